@@ -3,240 +3,169 @@
  */
 #include <VM.hpp>
 #include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <limits>
 
-VM::VM(const std::vector<uint8_t> &filedata)
-    : ip(0), fp(0)
+namespace
 {
-    loadFromBinary(filedata);
-
-    /* Code Added By Mokshith - Start*/
-    for (const auto &cls : classes)
+    double asDouble(uint64_t bits)
     {
-        objectFactory.registerClass(cls);
+        double value;
+        std::memcpy(&value, &bits, sizeof(double));
+        return value;
     }
-    /* Code Added By Mokshith - End*/
-
-    objectFactory.buildAllVTables();
-
-    fileData.resize(10, nullptr); // Support up to 10 open files
-    fileData[0] = stdin;
-    fileData[1] = stdout;
-    fileData[2] = stderr;
-
-    stack.reserve(STACK_SIZE);
-    locals.resize(LOCALS_SIZE, 0);
-}
 
-VM::~VM()
-{
-    for (void *obj_data : heap)
+    uint64_t bitsOf(double value)
     {
-        objectFactory.destroyObject(obj_data);
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(double));
+        return bits;
     }
-}
-
-void VM::loadFromBinary(const std::vector<uint8_t> &filedata)
-{
 
-    if (filedata.size() < 24)
+    float asFloat(uint32_t bits)
     {
-        throw std::runtime_error("File too small to be a valid VM executable\n Expected at least 24 bytes, got " + std::to_string(filedata.size()));
+        float value;
+        std::memcpy(&value, &bits, sizeof(float));
+        return value;
     }
 
-    // Check magic number "VM\x00\x01"
-    const uint8_t expected_magic[4] = {0x56, 0x4D, 0x00, 0x01};
-    if (!std::equal(filedata.begin(), filedata.begin() + 4, expected_magic))
+    // Saturating double to integer conversion; NaN converts to 0
+    template <typename T>
+    T truncateDouble(double value)
     {
-        throw std::runtime_error("Invalid VM file magic number");
+        if (std::isnan(value))
+            return 0;
+        if (value <= static_cast<double>(std::numeric_limits<T>::min()))
+            return std::numeric_limits<T>::min();
+        if (value >= static_cast<double>(std::numeric_limits<T>::max()))
+            return std::numeric_limits<T>::max();
+        return static_cast<T>(value);
     }
+}
 
-    size_t offset = 4;
+VM::VM(std::shared_ptr<const Program> program, const VMOptions &options)
+    : options(options), program(std::move(program)), code(this->program->code()), codeMarks(this->program->codeMarks()), classes(this->program->classes()),
+      stack(options.stackBytes, options.memory), locals(options.localsBytes, options.memory),
+      ip(0), fp(0), objectFactory(classes), gc(heap, objectFactory)
+{
+    setup();
+}
 
-    auto read_uint32 = [&](size_t &off) -> uint32_t
-    {
-        if (off + 4 > filedata.size())
-            throw std::runtime_error("Unexpected EOF");
-        uint32_t val = filedata[off] | (filedata[off + 1] << 8) | (filedata[off + 2] << 16) | (filedata[off + 3] << 24);
-        off += 4;
-        return val;
-    };
+VM::VM(const std::vector<uint8_t> &filedata, const VMOptions &options)
+    : VM(std::make_shared<const Program>(filedata, options.memory), options)
+{
+}
 
-    auto read_uint8 = [&](size_t &off) -> uint8_t
-    {
-        if (off + 1 > filedata.size())
-            throw std::runtime_error("Unexpected EOF");
-        return filedata[off++];
-    };
+VM::VM(MappedFile file, const VMOptions &options)
+    : VM(std::make_shared<const Program>(std::move(file), options.memory), options)
+{
+}
 
-    uint16_t version = read_uint32(offset);
-    if (version != 1)
+void VM::setup()
+{
+    objectFactory.setMemoryPolicy(options.memory);
+    for (const std::string &value : program->strings())
     {
-        throw std::runtime_error("Unsupported VM version");
+        void *chars = objectFactory.createArray(FieldType::CHAR, static_cast<uint32_t>(value.size()));
+        std::memcpy(chars, value.data(), value.size());
+        ObjectFactory::header(chars)->gcBits |= GC_CONSTANT;
+        gc.track(chars);
     }
+    loadedRefs = heap.size();
+    for (size_t i = 0; i < program->globals().size(); i++)
+        locals.at(i) = program->globals()[i];
+    ip = program->entryPoint();
 
-    uint32_t entryPoint = read_uint32(offset);
-    uint32_t constPoolOffset = read_uint32(offset);
-    uint32_t constPoolSize = read_uint32(offset);
-    uint32_t codeOffset = read_uint32(offset);
-    uint32_t codeSize = read_uint32(offset);
-    uint32_t globalsOffset = read_uint32(offset);
-    uint32_t globalsSize = read_uint32(offset);
-    uint32_t classMetadataOffset = read_uint32(offset);
-    uint32_t classMetadataSize = read_uint32(offset);
+    gc.configure(options.gc);
+    gcCountdown = gc.sliceInstructions();
+    quantumLeft = options.taskQuantum;
 
-    DBG("VM Version: " << version);
-    DBG("Entry Point: " << entryPoint);
-    DBG("Const Pool Offset: " << constPoolOffset << ", Size: " << constPoolSize);
-    DBG("Code Offset: " << codeOffset << ", Size: " << codeSize);
-    DBG("Globals Offset: " << globalsOffset << ", Size: " << globalsSize);
-    DBG("Class Metadata Offset: " << classMetadataOffset << ", Size: " << classMetadataSize);
+    fileData.resize(10, nullptr); // Support up to 10 open files
+    openFiles.resize(fileData.size());
+    checkpointsSeen = checkpointRequests.load(std::memory_order_relaxed);
+    fileData[0] = stdin;
+    fileData[1] = stdout;
+    fileData[2] = stderr;
+}
 
-    if (constPoolOffset + constPoolSize > filedata.size())
-    {
-        throw std::runtime_error("Constant pool section out of file bounds");
-    }
-    constantPool.clear();
-    // Assuming constant pool entries are 4-byte integers for simplicity:
-    if (constPoolSize % 4 != 0)
+VM::~VM()
+{
+    for (void *obj_data : heap)
     {
-        throw std::runtime_error("Constant pool size not multiple of 4");
+        objectFactory.destroyObject(obj_data);
     }
-    size_t numConsts = constPoolSize / 4;
-    constantPool.reserve(numConsts);
-
-    for (size_t i = 0; i < numConsts; i++)
+    // Files the program opened and left open; the standard streams belong
+    // to whoever set them
+    for (size_t fd = 3; fd < fileData.size(); fd++)
     {
-        size_t pos = constPoolOffset + i * 4;
-        int val = filedata[pos] | (filedata[pos + 1] << 8) | (filedata[pos + 2] << 16) | (filedata[pos + 3] << 24);
-        constantPool.push_back(val);
+        if (fileData[fd] != nullptr)
+            fclose(fileData[fd]);
     }
+}
 
-    locals.clear();
-    if (globalsOffset + globalsSize > filedata.size())
-    {
-        throw std::runtime_error("Globals section out of file bounds");
-    }
-    if (globalsSize % 4 != 0)
-    {
-        throw std::runtime_error("Globals section size not multiple of 4");
-    }
+void VM::setStandardStreams(FILE *in, FILE *out, FILE *err)
+{
+    fileData[0] = in;
+    fileData[1] = out;
+    fileData[2] = err;
+}
 
-    size_t numGlobals = globalsSize / 4;
-    locals.reserve(numGlobals);
+void VM::run()
+{
+    // From the entry point, also after invoke has moved ip
+    endTasks();
+    ip = program->entryPoint();
+    stack.clear();
+    fp = 0;
+    exited = false;
+    exitCode = 0;
+    executeGuarded();
+}
 
-    for (size_t i = 0; i < numGlobals; i++)
-    {
-        size_t pos = globalsOffset + i * 4;
-        int val = filedata[pos] | (filedata[pos + 1] << 8) | (filedata[pos + 2] << 16) | (filedata[pos + 3] << 24);
-        locals.push_back(val);
-    }
+void VM::resume()
+{
+    exited = false;
+    exitCode = 0;
+    executeGuarded();
+}
 
-    if (codeOffset + codeSize > filedata.size())
+void VM::executeGuarded()
+{
+#ifdef VM_GUARD_PAGES
+    // Stack overflow and underflow are caught by the guard pages around the
+    // operand stack instead of a compare on every push and pop
+    GuardTrap trap(&stack.guarded(), &locals.guarded());
+    if (sigsetjmp(trap.jump, 1) != 0)
     {
-        throw std::runtime_error("Code section out of file bounds");
+        if (stack.guarded().inLowerGuard(trap.faultAddress))
+            throw std::runtime_error("Stack Underflow");
+        if (stack.guarded().inUpperGuard(trap.faultAddress))
+            throw std::runtime_error("Stack Overflow");
+        throw std::runtime_error("Locals out of range");
     }
-
-    code.clear();
-    code.insert(code.end(), filedata.begin() + codeOffset, filedata.begin() + codeOffset + codeSize);
-
-#ifdef VM_CPP_DEBUG
-    DBG("Code bytes loaded: ");
-    for (auto b : code)
-        std::cerr << std::hex << (int)b << ' ';
-    std::cerr << std::endl;
 #endif
-
-    if (classMetadataOffset + classMetadataSize > filedata.size())
-    {
-        throw std::runtime_error("Class metadata section out of file bounds");
-    }
-
-    size_t classMetaEnd = classMetadataOffset + classMetadataSize;
-    size_t classOffset = classMetadataOffset;
-
-    if (classMetadataSize != 0)
-    {
-
-        classes.clear();
-
-        uint32_t classCount = read_uint32(classOffset);
-
-        for (uint32_t i = 0; i < classCount; i++)
-        {
-            ClassInfo cls;
-
-            uint8_t classNameLen = read_uint8(classOffset);
-            if (classOffset + classNameLen > classMetaEnd)
-                throw std::runtime_error("Class name exceeds metadata bounds");
-
-            cls.name.assign(reinterpret_cast<const char *>(&filedata[classOffset]), classNameLen);
-            classOffset += classNameLen;
-
-            cls.superClassIndex = static_cast<int32_t>(read_uint32(classOffset));
-
-            DBG("Class: " << cls.name << ", Superclass Index: " << cls.superClassIndex);
-
-            uint32_t fieldCount = read_uint32(classOffset);
-            for (uint32_t f = 0; f < fieldCount; f++)
-            {
-                FieldInfo field;
-
-                uint8_t fieldNameLen = read_uint8(classOffset);
-                if (classOffset + fieldNameLen + 1 > classMetaEnd)
-                    throw std::runtime_error("Field info exceeds metadata bounds\n Expected at least " + std::to_string(fieldNameLen + 1) + " bytes, but only " + std::to_string(classMetaEnd - classOffset) + " bytes remain");
-
-                field.name.assign(reinterpret_cast<const char *>(&filedata[classOffset]), fieldNameLen);
-                classOffset += fieldNameLen;
-
-                field.type = static_cast<FieldType>(read_uint8(classOffset));
-
-                cls.fields.push_back(field);
-                DBG("Field: " << field.name << " Type: " << static_cast<int>(field.type));
-            }
-
-            uint32_t methodCount = read_uint32(classOffset);
-            for (uint32_t m = 0; m < methodCount; m++)
-            {
-                MethodInfo method;
-
-                uint8_t methodNameLen = read_uint8(classOffset);
-
-                if (classOffset + methodNameLen + 4 > classMetaEnd)
-                    throw std::runtime_error("Method info exceeds metadata bounds \nExpected at least " + std::to_string(methodNameLen + 4) + " bytes, but only " + std::to_string(classMetaEnd - classOffset) + " bytes remain");
-
-                method.name.assign(reinterpret_cast<const char *>(&filedata[classOffset]), methodNameLen);
-                classOffset += methodNameLen;
-
-                method.bytecodeOffset = read_uint32(classOffset);
-
-                cls.methods.push_back(method);
-                DBG("Method: " << method.name << " Bytecode Offset: " << method.bytecodeOffset);
-            }
-
-            classes.push_back(std::move(cls));
-        }
-
-        if (classOffset != classMetaEnd)
-        {
-            throw std::runtime_error("Class metadata size mismatch after parsing");
-        }
-    }
-
-    if (entryPoint >= code.size())
+    execute();
+    // execute returns when the running task ends. The run ends with task 0
+    // or SYS_EXIT; any other task hands over to the next runnable one.
+    while (currentTask != 0 && !exited)
     {
-        throw std::runtime_error("Entry point out of code segment bounds");
+        finishTask();
+        execute();
     }
-    ip = entryPoint;
-    DBG("Entry point set to " + std::to_string(ip));
-
-    stack.clear();
+    endTasks();
 }
 
-void VM::run()
+void VM::execute()
 {
     while (ip < code.size())
     {
+        if (gc.collecting() && --gcCountdown == 0)
+        {
+            gcCountdown = gc.sliceInstructions();
+            gcStep();
+        }
+
         Opcode opcode = static_cast<Opcode>(fetch8());
 
         switch (opcode)
@@ -360,6 +289,20 @@ void VM::run()
             DBG("PUSH " + std::to_string(val) + ", Stack top = " + std::to_string(stack.back()));
             break;
         }
+        case Opcode::PUSH_I8:
+        {
+            int32_t val = static_cast<int8_t>(fetch8());
+            push(val);
+            DBG("PUSH_I8 " + std::to_string(val));
+            break;
+        }
+        case Opcode::PUSH_I16:
+        {
+            int32_t val = static_cast<int16_t>(fetch16());
+            push(val);
+            DBG("PUSH_I16 " + std::to_string(val));
+            break;
+        }
         case Opcode::POP:
         {
             pop();
@@ -379,6 +322,18 @@ void VM::run()
             break;
         }
 
+        case Opcode::LDC:
+        {
+            uint16_t idx = fetch16();
+            if (idx >= program->constantCount())
+            {
+                throw std::runtime_error("LDC error: Constant index " + std::to_string(idx) + " out of range.");
+            }
+            push(program->constant(idx));
+            DBG("LDC " << idx << ", Stack top = " << static_cast<int32_t>(stack.back()));
+            break;
+        }
+
         case Opcode::FPOP:
         {
             pop();
@@ -403,10 +358,36 @@ void VM::run()
         case Opcode::STORE:
         {
             uint32_t idx = fetch32();
-            locals.at(idx) = pop();
+            uint32_t value = pop();
+            gc.writeBarrier(value);
+            locals.at(idx) = value;
             DBG("STORE " + std::to_string((int)idx) + ", Value = " + std::to_string(locals.at(idx)));
             break;
         }
+        case Opcode::LOAD_0:
+        case Opcode::LOAD_1:
+        case Opcode::LOAD_2:
+        case Opcode::LOAD_3:
+        case Opcode::LOAD_V:
+        {
+            uint32_t idx = opcode == Opcode::LOAD_V ? fetchVarint() : static_cast<uint8_t>(opcode) - static_cast<uint8_t>(Opcode::LOAD_0);
+            push(locals.at(idx));
+            DBG("LOAD " + std::to_string(idx) + ", Value = " + std::to_string(stack.back()));
+            break;
+        }
+        case Opcode::STORE_0:
+        case Opcode::STORE_1:
+        case Opcode::STORE_2:
+        case Opcode::STORE_3:
+        case Opcode::STORE_V:
+        {
+            uint32_t idx = opcode == Opcode::STORE_V ? fetchVarint() : static_cast<uint8_t>(opcode) - static_cast<uint8_t>(Opcode::STORE_0);
+            uint32_t value = pop();
+            gc.writeBarrier(value);
+            locals.at(idx) = value;
+            DBG("STORE " + std::to_string(idx) + ", Value = " + std::to_string(value));
+            break;
+        }
 
         case Opcode::LOAD_ARG:
         {
@@ -422,6 +403,7 @@ void VM::run()
             uint16_t addr = fetch16();
             ip = addr;
             DBG("JMP to " + std::to_string(addr));
+            safePoint();
             break;
         }
         case Opcode::JZ:
@@ -430,6 +412,7 @@ void VM::run()
             if (pop() == 0)
                 ip = addr;
             DBG("JZ to " + std::to_string(addr));
+            safePoint();
             break;
         }
         case Opcode::JNZ:
@@ -438,10 +421,57 @@ void VM::run()
             if (pop() != 0)
                 ip = addr;
             DBG("JNZ to " + std::to_string(addr));
+            safePoint();
+            break;
+        }
+        case Opcode::TABLESWITCH:
+        case Opcode::LOOKUPSWITCH:
+        {
+            const char *name = opcode == Opcode::TABLESWITCH ? "TABLESWITCH" : "LOOKUPSWITCH";
+            size_t pc = ip - 1;
+            if (switchTableBytes(code.data(), pc, code.size()) < 0)
+            {
+                throw std::runtime_error(std::string(name) + " error: Malformed jump table at offset " + std::to_string(pc) + ".");
+            }
+            const uint8_t *operands = code.data() + ip;
+            int32_t key = pop();
+            uint32_t target = readWord(operands);
+            if (opcode == Opcode::TABLESWITCH)
+            {
+                int32_t low = static_cast<int32_t>(readWord(operands + 4));
+                int32_t high = static_cast<int32_t>(readWord(operands + 8));
+                if (key >= low && key <= high)
+                    target = readWord(operands + 12 + (static_cast<int64_t>(key) - low) * 4);
+            }
+            else
+            {
+                // Binary search of the sorted (key, target) pairs
+                const uint8_t *pairs = operands + 8;
+                uint32_t lo = 0, hi = readWord(operands + 4);
+                while (lo < hi)
+                {
+                    uint32_t mid = lo + (hi - lo) / 2;
+                    int32_t midKey = static_cast<int32_t>(readWord(pairs + mid * 8));
+                    if (midKey == key)
+                    {
+                        target = readWord(pairs + mid * 8 + 4);
+                        break;
+                    }
+                    if (midKey < key)
+                        lo = mid + 1;
+                    else
+                        hi = mid;
+                }
+            }
+            ip = target;
+            DBG(name << " on " << key << " to " << target);
+            safePoint();
             break;
         }
         case Opcode::RET:
+        case Opcode::WRET:
         {
+            bool wide = opcode == Opcode::WRET;
             if (fp == 0)
             {
                 DBG("RET at base frame, halting execution.");
@@ -461,16 +491,23 @@ void VM::run()
             uint32_t old_fp = stack[fp];
 
             uint32_t return_ip = stack[fp - 1];
+            // A frame the program rewrote must not send control into the
+            // middle of an instruction
+            if (return_ip < code.size() && !(codeMarks[return_ip] & CODE_RETURN_SITE))
+            {
+                throw std::runtime_error("RET error: Return address " + std::to_string(return_ip) + " does not follow a call.");
+            }
 
             uint32_t itemsToPop = static_cast<int>(stack.size()) - (fp - 1);
+            uint32_t returnHigh = wide ? pop() : 0;
             uint32_t returnValue = pop();
-            for (int i = 0; i < itemsToPop - 1; i++)
+            for (int i = 0; i < itemsToPop - (wide ? 2 : 1); i++)
             {
                 pop();
             }
 
             fp = old_fp;
-            ip = return_ip;
+            ip = return_ip; // RETURN_TO_HOST ends the loop
 
             for (uint8_t i = 0; i < args_to_pop; i++)
             {
@@ -479,13 +516,16 @@ void VM::run()
             args_to_pop = 0;
 
             push(returnValue);
+            if (wide)
+                push(returnHigh);
 
             DBG("RET to ip " << ip << ", restored FP = " << fp);
             break;
         }
         case Opcode::CALL:
+        case Opcode::CALL_V:
         {
-            uint32_t methodOffset = fetch32();
+            uint32_t methodOffset = opcode == Opcode::CALL_V ? fetchVarint() : fetch32();
             uint8_t argCount = fetch8();
 
             args_to_pop = argCount;
@@ -499,6 +539,133 @@ void VM::run()
             ip = methodOffset;
 
             DBG("CALL to offset " + std::to_string(methodOffset) + ", return IP = " + std::to_string(stack[fp - 1]) + ", FP = " + std::to_string(stack[fp]));
+            safePoint();
+            break;
+        }
+        case Opcode::SPAWN:
+        {
+            uint32_t methodOffset = fetch32();
+            uint8_t argCount = fetch8();
+            if (stack.size() < argCount)
+            {
+                throw std::runtime_error("SPAWN error: Not enough arguments on the stack.");
+            }
+            uint32_t id = spawnTask(methodOffset, argCount);
+            push(id);
+            DBG("SPAWN of offset " << methodOffset << " as task " << id);
+            break;
+        }
+        case Opcode::YIELD:
+        {
+            // Inside an arena tasks are not switched, so YIELD does nothing there
+            if (!runQueue.empty() && objectFactory.arenaDepth() == 0)
+            {
+                runQueue.push_back(currentTask);
+                switchTask();
+            }
+            DBG("YIELD to task " << currentTask);
+            break;
+        }
+        case Opcode::JOIN:
+        {
+            uint32_t id = peek();
+            if (id >= tasks.size() || tasks[id]->state == TaskState::FREE)
+            {
+                throw std::runtime_error("JOIN error: Invalid task id " + std::to_string(id) + ".");
+            }
+            if (id == currentTask)
+            {
+                throw std::runtime_error("JOIN error: A task cannot join itself.");
+            }
+            Task &task = *tasks[id];
+            if (task.state != TaskState::FINISHED)
+            {
+                task.joiners.push_back(currentTask);
+                blockTask("JOIN");
+                break;
+            }
+            // Joining hands out the result and the id
+            pop();
+            push(task.result);
+            task.state = TaskState::FREE;
+            freeTaskIds.push_back(id);
+            DBG("JOIN of task " << id << ", result " << stack.back());
+            break;
+        }
+        case Opcode::CHANNEW:
+        {
+            FieldType type = static_cast<FieldType>(fetch8());
+            int32_t capacity = static_cast<int32_t>(pop());
+            if (type != FieldType::INT && type != FieldType::FLOAT && type != FieldType::OBJECT)
+            {
+                throw std::runtime_error("CHANNEW error: Channels hold INT, FLOAT or OBJECT values.");
+            }
+            if (capacity < 1)
+            {
+                throw std::runtime_error("CHANNEW error: Capacity must be at least 1.");
+            }
+            void *channel = objectFactory.createChannel(type, static_cast<uint32_t>(capacity));
+            int32_t channelRef = gc.track(channel);
+            push(channelRef);
+            if (gc.allocationStepDue())
+                gcStep();
+            DBG("CHANNEW of capacity " << capacity << ", reference " << channelRef);
+            break;
+        }
+        case Opcode::SEND:
+        {
+            uint32_t value = pop();
+            int32_t channelRef = static_cast<int32_t>(peek());
+            void *channel = channelAt(channelRef, "SEND");
+            ChannelState &state = ObjectFactory::channel(channel);
+            uint32_t capacity = ObjectFactory::channelCapacity(channel);
+            if (state.count == capacity)
+            {
+                push(value);
+                channelWaiters[channelRef].senders.push_back(currentTask);
+                blockTask("SEND");
+                break;
+            }
+            pop();
+            ObjectFactory::channelSlots(channel)[(state.head + state.count) % capacity] = value;
+            state.count++;
+            if (ObjectFactory::header(channel)->elementType == FieldType::OBJECT)
+                gc.writeBarrier(value);
+            auto waiting = channelWaiters.find(channelRef);
+            if (waiting != channelWaiters.end() && !waiting->second.receivers.empty())
+            {
+                wakeTask(waiting->second.receivers.front());
+                waiting->second.receivers.pop_front();
+                if (waiting->second.senders.empty() && waiting->second.receivers.empty())
+                    channelWaiters.erase(waiting);
+            }
+            DBG("SEND " << value << " on channel " << channelRef);
+            break;
+        }
+        case Opcode::RECV:
+        {
+            int32_t channelRef = static_cast<int32_t>(peek());
+            void *channel = channelAt(channelRef, "RECV");
+            ChannelState &state = ObjectFactory::channel(channel);
+            if (state.count == 0)
+            {
+                channelWaiters[channelRef].receivers.push_back(currentTask);
+                blockTask("RECV");
+                break;
+            }
+            pop();
+            push(ObjectFactory::channelSlots(channel)[state.head]);
+            state.head = (state.head + 1) % ObjectFactory::channelCapacity(channel);
+            state.count--;
+            auto waiting = channelWaiters.find(channelRef);
+            if (waiting != channelWaiters.end() && !waiting->second.senders.empty())
+            {
+                wakeTask(waiting->second.senders.front());
+                waiting->second.senders.pop_front();
+                if (waiting->second.senders.empty() && waiting->second.receivers.empty())
+                    channelWaiters.erase(waiting);
+            }
+            DBG("RECV " << stack.back() << " from channel " << channelRef);
             break;
         }
 
@@ -618,16 +785,16 @@ void VM::run()
         {
 
             uint8_t classIndex = fetch8();
-            if (classIndex >= classes.size())
+            if (classIndex >= classes.classCount())
             {
                 throw std::runtime_error("NEW error: Invalid class index.");
             }
-            const ClassInfo &cls = classes.at(classIndex);
-            void *newObjectData = objectFactory.createObject(cls.name);
-            heap.push_back(newObjectData);
-            int32_t objRef = static_cast<int32_t>(heap.size() - 1);
+            void *newObjectData = objectFactory.createObject(static_cast<uint16_t>(classIndex));
+            int32_t objRef = gc.track(newObjectData);
             push(objRef);
-            DBG("NEW " << cls.name << ", ObjRef: " << objRef);
+            if (gc.allocationStepDue())
+                gcStep();
+            DBG("NEW " << classes.getClassInfo(classIndex)->name << ", ObjRef: " << objRef);
             break;
         }
         case Opcode::GETFIELD:
@@ -635,26 +802,35 @@ void VM::run()
 
             uint8_t fieldIndex = fetch8();
             int32_t objRef = pop();
-            if (objRef < 0 || static_cast<size_t>(objRef) >= heap.size())
+            if (objRef < 0 || static_cast<size_t>(objRef) >= heap.size() || heap[objRef] == nullptr)
             {
                 throw std::runtime_error("GETFIELD error: Invalid object reference.");
             }
             void *objectData = heap.at(objRef);
-            void *rawMemory = static_cast<char *>(objectData) - sizeof(void *);
-            const ClassInfo *cls = *static_cast<const ClassInfo **>(rawMemory);
+            const ClassInfo *cls = classes.getClassInfo(ObjectFactory::header(objectData)->classId);
+            if (cls == nullptr)
+            {
+                throw std::runtime_error("GETFIELD error: Reference is not an object.");
+            }
 
-            DBG("GETFIELD, requested index: " + std::to_string((int)fieldIndex) + ", fieldCount: " + std::to_string(cls->fields.size()));
-            // DBG("filedIndex" << fieldIndex << " " << cls->fields.size());
-            if (fieldIndex >= cls->fields.size())
+            DBG("GETFIELD, requested index: " + std::to_string((int)fieldIndex) + ", fieldCount: " + std::to_string(cls->fieldSlots.size()));
+            if (fieldIndex >= cls->fieldSlots.size())
             {
                 throw std::runtime_error("GETFIELD error: Invalid field index.");
             }
-            const FieldInfo &field = cls->fields.at(fieldIndex);
-            size_t offset = cls->fieldOffsets.at(field.name);
-            char *baseAddress = static_cast<char *>(objectData);
-            int32_t value = *reinterpret_cast<int32_t *>(baseAddress + offset);
+            const FieldSlot &slot = cls->fieldSlots[fieldIndex];
+            if (ObjectFactory::fieldSize(slot.type) == 8)
+            {
+                throw std::runtime_error("GETFIELD error: 64-bit fields need WGETFIELD.");
+            }
+            char *fieldAddress = static_cast<char *>(objectData) + slot.offset;
+            int32_t value;
+            if (slot.type == FieldType::CHAR)
+                value = *reinterpret_cast<char *>(fieldAddress);
+            else
+                value = *reinterpret_cast<int32_t *>(fieldAddress);
             push(value);
-            DBG("GETFIELD from ObjRef " + std::to_string(objRef) + " (" + cls->name + "." + field.name + "), Value = " + std::to_string(value));
+            DBG("GETFIELD from ObjRef " + std::to_string(objRef) + " (" + cls->name + " field " + std::to_string((int)fieldIndex) + "), Value = " + std::to_string(value));
             break;
         }
         case Opcode::PUTFIELD:
@@ -663,22 +839,33 @@ void VM::run()
             uint8_t fieldIndex = fetch8();
             int32_t value = pop();
             int32_t objRef = pop();
-            if (objRef < 0 || static_cast<size_t>(objRef) >= heap.size())
+            if (objRef < 0 || static_cast<size_t>(objRef) >= heap.size() || heap[objRef] == nullptr)
             {
                 throw std::runtime_error("PUTFIELD error: Invalid object reference.");
             }
             void *objectData = heap.at(objRef);
-            void *rawMemory = static_cast<char *>(objectData) - sizeof(void *);
-            const ClassInfo *cls = *static_cast<const ClassInfo **>(rawMemory);
-            if (fieldIndex >= cls->fields.size())
+            const ClassInfo *cls = classes.getClassInfo(ObjectFactory::header(objectData)->classId);
+            if (cls == nullptr)
+            {
+                throw std::runtime_error("PUTFIELD error: Reference is not an object.");
+            }
+            if (fieldIndex >= cls->fieldSlots.size())
             {
                 throw std::runtime_error("PUTFIELD error: Invalid field index.");
             }
-            const FieldInfo &field = cls->fields.at(fieldIndex);
-            size_t offset = cls->fieldOffsets.at(field.name);
-            char *baseAddress = static_cast<char *>(objectData);
-            *reinterpret_cast<int32_t *>(baseAddress + offset) = value;
-            DBG("PUTFIELD on ObjRef " + std::to_string(objRef) + " (" + cls->name + "." + field.name + "), Value = " + std::to_string(value));
+            const FieldSlot &slot = cls->fieldSlots[fieldIndex];
+            if (ObjectFactory::fieldSize(slot.type) == 8)
+            {
+                throw std::runtime_error("PUTFIELD error: 64-bit fields need WPUTFIELD.");
+            }
+            char *fieldAddress = static_cast<char *>(objectData) + slot.offset;
+            if (slot.type == FieldType::CHAR)
+                *reinterpret_cast<char *>(fieldAddress) = static_cast<char>(value);
+            else
+                *reinterpret_cast<int32_t *>(fieldAddress) = value;
+            if (slot.type == FieldType::OBJECT)
+                gc.writeBarrier(value);
+            DBG("PUTFIELD on ObjRef " + std::to_string(objRef) + " (" + cls->name + " field " + std::to_string((int)fieldIndex) + "), Value = " + std::to_string(value));
             break;
         }
         case Opcode::INVOKEVIRTUAL:
@@ -687,19 +874,23 @@ void VM::run()
             args_to_pop = fetch8();
             int32_t objRef = pop();
 
-            if (objRef < 0 || static_cast<size_t>(objRef) >= heap.size())
+            if (objRef < 0 || static_cast<size_t>(objRef) >= heap.size() || heap[objRef] == nullptr)
             {
                 throw std::runtime_error("INVOKEVIRTUAL error: Invalid object reference.");
             }
             void *objectData = heap.at(objRef);
-            void *rawMemory = static_cast<char *>(objectData) - sizeof(void *); // remove cls metadata header
-            const ClassInfo *cls = *static_cast<const ClassInfo **>(rawMemory);
+            const ClassInfo *cls = classes.getClassInfo(ObjectFactory::header(objectData)->classId);
+            if (cls == nullptr || methodOffset >= cls->vtable.size())
+            {
+                throw std::runtime_error("INVOKEVIRTUAL error: Invalid method index.");
+            }
 
             push(ip);
             push(fp);
             fp = static_cast<int>(stack.size()) - 1;
             ip = cls->vtable[methodOffset]->bytecodeOffset;
             DBG("INVOKEVIRTUAL to offset " + std::to_string(cls->vtable[methodOffset]->bytecodeOffset));
+            safePoint();
             break;
         }
         case Opcode::INVOKESPECIAL:
@@ -708,68 +899,71 @@ void VM::run()
             break;
         }
 
+        case Opcode::ARENA_BEGIN:
+        {
+            gc.beginArena();
+            DBG("ARENA_BEGIN, depth = " + std::to_string(objectFactory.arenaDepth()));
+            break;
+        }
+        case Opcode::ARENA_END:
+        {
+            if (options.arenaChecks)
+                gc.endArena(true, RootSpan{locals.data(), locals.used()}, arenaCheckRoots());
+            else
+                gc.endArena(false);
+            DBG("ARENA_END, depth = " + std::to_string(objectFactory.arenaDepth()));
+            break;
+        }
+
         case Opcode::NEWARRAY:
         {
             FieldType type = static_cast<FieldType>(fetch8());
             int size = pop(); // size of the array
             // int localidx = pop(); // local index to store array reference
-
-            int multiplier = 1;
-            switch (type)
-            {
-            case FieldType::INT:
-            {
-                multiplier = sizeof(int);
-                break;
-            }
-            case FieldType::FLOAT:
-            {
-                multiplier = sizeof(float);
-                break;
-            }
-            case FieldType::OBJECT:
-            {
-                multiplier = sizeof(void *);
-                break;
-            }
-            case FieldType::CHAR:
+            if (size < 0)
             {
-                multiplier = sizeof(char);
-                break;
-            }
-
-            default:
-                throw std::runtime_error("Unsupported array type");
+                throw std::runtime_error("NEWARRAY error: Negative array size.");
             }
 
-            void *rawarrayData = malloc(size * multiplier + multiplier + sizeof(void *));              // Allocate memory with header ;)
-            *static_cast<FieldType *>(rawarrayData) = type;                                            // Store array type at the start
-            void *arrayData = static_cast<void *>(static_cast<char *>(rawarrayData) + sizeof(void *)); // Pointer to actual array data
+            void *arrayData = objectFactory.createArray(type, static_cast<uint32_t>(size));
 
-            heap.push_back(arrayData);
+            int32_t arrayRef = gc.track(arrayData);
             // locals.at(localidx) = heap.size() - 1; // Store array reference in locals
-            push(heap.size() - 1);
+            push(arrayRef);
 
-            DBG("NEWARRAY of type " + std::to_string(static_cast<int>(type)) + ", size " + std::to_string(size) + ", stored with reference " + std::to_string(heap.size() - 1));
+            DBG("NEWARRAY of type " + std::to_string(static_cast<int>(type)) + ", size " + std::to_string(size) + ", stored with reference " + std::to_string(arrayRef));
+            if (gc.allocationStepDue())
+                gcStep();
 
             break;
         }
 
         case Opcode::ALOAD:
+        case Opcode::ALOAD_UNCHECKED:
         {
             int index = pop();    // array index
             int arrayRef = pop(); // local index where array reference is stored
             // int arrayRef = locals.at(arrIdx);
-            if (arrayRef < 0 || static_cast<size_t>(arrayRef) >= heap.size())
+            if (arrayRef < 0 || static_cast<size_t>(arrayRef) >= heap.size() || heap[arrayRef] == nullptr)
             {
                 throw std::runtime_error("ALOAD error: Invalid array reference.");
             }
             void *arrayData = heap.at(arrayRef);
-
-            FieldType arrayType = *reinterpret_cast<FieldType *>(static_cast<char *>(arrayData) - sizeof(void *));
+            const ObjectHeader *arrayHeader = ObjectFactory::header(arrayData);
+            if (arrayHeader->classId != ARRAY_CLASS_ID)
+            {
+                throw std::runtime_error("ALOAD error: Reference is not an array.");
+            }
+            if (opcode == Opcode::ALOAD && static_cast<uint32_t>(index) >= ObjectFactory::arrayLength(arrayData))
+            {
+                throw std::runtime_error("ALOAD error: Index " + std::to_string(index) + " out of bounds for length " + std::to_string(ObjectFactory::arrayLength(arrayData)) + ".");
+            }
+            FieldType arrayType = arrayHeader->elementType;
 
             switch (arrayType)
             {
+            default:
+                throw std::runtime_error("ALOAD error: 64-bit arrays need WALOAD.");
             case FieldType::INT:
             case FieldType::OBJECT:
             {
@@ -800,21 +994,38 @@ void VM::run()
         }
 
         case Opcode::ASTORE:
+        case Opcode::ASTORE_UNCHECKED:
         {
             int value = pop();    // value to store
             int index = pop();    // index in the array
             int arrayRef = pop(); // heap index of array
             // int arrayRef = locals.at(arrIdx);
-            if (arrayRef < 0 || static_cast<size_t>(arrayRef) >= heap.size())
+            if (arrayRef < 0 || static_cast<size_t>(arrayRef) >= heap.size() || heap[arrayRef] == nullptr)
             {
                 throw std::runtime_error("ASTORE error: Invalid array reference.");
             }
             void *arrayData = heap.at(arrayRef);
-
-            FieldType arrayType = *reinterpret_cast<FieldType *>(static_cast<char *>(arrayData) - sizeof(void *));
+            const ObjectHeader *arrayHeader = ObjectFactory::header(arrayData);
+            if (arrayHeader->classId != ARRAY_CLASS_ID)
+            {
+                throw std::runtime_error("ASTORE error: Reference is not an array.");
+            }
+            if (arrayHeader->gcBits & GC_CONSTANT)
+            {
+                throw std::runtime_error("ASTORE error: Array is a read-only constant.");
+            }
+            if (opcode == Opcode::ASTORE && static_cast<uint32_t>(index) >= ObjectFactory::arrayLength(arrayData))
+            {
+                throw std::runtime_error("ASTORE error: Index " + std::to_string(index) + " out of bounds for length " + std::to_string(ObjectFactory::arrayLength(arrayData)) + ".");
+            }
+            FieldType arrayType = arrayHeader->elementType;
             switch (arrayType)
             {
+            default:
+                throw std::runtime_error("ASTORE error: 64-bit arrays need WASTORE.");
             case FieldType::OBJECT:
+                gc.writeBarrier(value);
+                [[fallthrough]];
             case FieldType::INT:
             {
                 *reinterpret_cast<int *>(static_cast<char *>(arrayData) + index * sizeof(int)) = value;
@@ -843,27 +1054,795 @@ void VM::run()
             break;
         }
 
-        case Opcode::SYS_CALL:
+        case Opcode::ARRAYLENGTH:
         {
-            Syscall syscall = static_cast<Syscall>(fetch8());
-            switch (syscall)
+            int arrayRef = pop();
+            if (arrayRef < 0 || static_cast<size_t>(arrayRef) >= heap.size() || heap[arrayRef] == nullptr)
             {
-            case Syscall::READ:
+                throw std::runtime_error("ARRAYLENGTH error: Invalid array reference.");
+            }
+            void *arrayData = heap[arrayRef];
+            if (ObjectFactory::header(arrayData)->classId != ARRAY_CLASS_ID)
             {
-                int fd = pop();        // Stack: file descriptor
-                int size = pop();      // Stack: buffer size
-                int localsIdx = pop(); // Stack: local index to store buffer address
-                // void *rawbuffer = malloc(size + sizeof(void *));                                     // Allocate buffer
-                // void *buffer = static_cast<void *>(static_cast<char *>(rawbuffer) + sizeof(void *)); // following heap convention
-                // heap.push_back(buffer);
-                // locals.at(localsIdx) = heap.size() - 1; // Store buffer index in locals
-                // get buf from locals
-                int bufIdx = locals.at(localsIdx);
-                if (bufIdx < 0 || static_cast<size_t>(bufIdx) >= heap.size())
-                {
-                    throw std::runtime_error("SYS_READ error: Invalid buffer index " + std::to_string(bufIdx));
-                }
+                throw std::runtime_error("ARRAYLENGTH error: Reference is not an array.");
+            }
+            push(ObjectFactory::arrayLength(arrayData));
+            DBG("ARRAYLENGTH of array ref " + std::to_string(arrayRef) + ", Stack top = " + std::to_string(stack.back()));
+            break;
+        }
+
+        case Opcode::ARRAYCOPY:
+        {
+            int32_t count = pop();
+            int32_t dstPos = pop();
+            int32_t dstRef = pop();
+            int32_t srcPos = pop();
+            int32_t srcRef = pop();
+            FieldType srcType, dstType;
+            void *src = arrayRange(srcRef, srcPos, count, "ARRAYCOPY", srcType);
+            void *dst = arrayRange(dstRef, dstPos, count, "ARRAYCOPY", dstType);
+            checkWritable(dstRef, "ARRAYCOPY");
+            if (srcType != dstType)
+            {
+                throw std::runtime_error("ARRAYCOPY error: Array element types differ.");
+            }
+            arrayCopy(dst, src, count, dstType);
+            if (dstType == FieldType::OBJECT)
+                gc.writeBarrier(static_cast<const uint32_t *>(dst), count);
+            DBG("ARRAYCOPY " + std::to_string(count) + " elements from array ref " + std::to_string(srcRef) + " to array ref " + std::to_string(dstRef));
+            break;
+        }
+        case Opcode::ARRAYFILL:
+        {
+            uint32_t value = pop();
+            int32_t count = pop();
+            int32_t from = pop();
+            int32_t arrayRef = pop();
+            FieldType type;
+            void *dst = narrowRange(arrayRef, from, count, "ARRAYFILL", type);
+            checkWritable(arrayRef, "ARRAYFILL");
+            arrayFill(dst, count, type, value);
+            if (type == FieldType::OBJECT)
+                gc.writeBarrier(value);
+            DBG("ARRAYFILL " + std::to_string(count) + " elements of array ref " + std::to_string(arrayRef) + ", Value = " + std::to_string(value));
+            break;
+        }
+        case Opcode::ARRAYCMP:
+        {
+            int32_t count = pop();
+            int32_t bPos = pop();
+            int32_t bRef = pop();
+            int32_t aPos = pop();
+            int32_t aRef = pop();
+            FieldType aType, bType;
+            const void *a = narrowRange(aRef, aPos, count, "ARRAYCMP", aType);
+            const void *b = arrayRange(bRef, bPos, count, "ARRAYCMP", bType);
+            if (aType != bType)
+            {
+                throw std::runtime_error("ARRAYCMP error: Array element types differ.");
+            }
+            push(arrayCompare(a, b, count, aType));
+            DBG("ARRAYCMP array refs " + std::to_string(aRef) + " and " + std::to_string(bRef) + ", Stack top = " + std::to_string(static_cast<int32_t>(stack.back())));
+            break;
+        }
+        case Opcode::ARRAYFIND:
+        {
+            uint32_t value = pop();
+            int32_t count = pop();
+            int32_t from = pop();
+            int32_t arrayRef = pop();
+            FieldType type;
+            const void *data = narrowRange(arrayRef, from, count, "ARRAYFIND", type);
+            int64_t found = arrayFind(data, count, type, value);
+            push(found < 0 ? -1 : static_cast<int32_t>(from + found));
+            DBG("ARRAYFIND in array ref " + std::to_string(arrayRef) + ", Stack top = " + std::to_string(static_cast<int32_t>(stack.back())));
+            break;
+        }
+
+        case Opcode::ASORT:
+        {
+            int32_t count = pop();
+            int32_t from = pop();
+            int32_t arrayRef = pop();
+            FieldType type;
+            void *data = orderedRange(arrayRef, from, count, "ASORT", type);
+            checkWritable(arrayRef, "ASORT");
+            arraySort(data, count, type, options.sortThreads);
+            DBG("ASORT " + std::to_string(count) + " elements of array ref " + std::to_string(arrayRef));
+            break;
+        }
+        case Opcode::ASORT_STABLE:
+        {
+            int32_t count = pop();
+            int32_t from = pop();
+            int32_t valuesRef = pop();
+            int32_t keysRef = pop();
+            FieldType keyType, valueType = FieldType::INT;
+            void *keys = orderedRange(keysRef, from, count, "ASORT_STABLE", keyType);
+            void *values = valuesRef == -1 ? nullptr : narrowRange(valuesRef, from, count, "ASORT_STABLE", valueType);
+            checkWritable(keysRef, "ASORT_STABLE");
+            if (values != nullptr)
+                checkWritable(valuesRef, "ASORT_STABLE");
+            if (values == keys)
+            {
+                values = nullptr;
+            }
+            arraySortStable(keys, keyType, values, valueType, count, options.sortThreads);
+            // The collector may have scanned only part of the values array
+            if (values != nullptr && valueType == FieldType::OBJECT)
+                gc.writeBarrier(static_cast<const uint32_t *>(values), count);
+            DBG("ASORT_STABLE " + std::to_string(count) + " elements of array ref " + std::to_string(keysRef));
+            break;
+        }
+        case Opcode::ABSEARCH:
+        {
+            uint32_t key = pop();
+            int32_t count = pop();
+            int32_t from = pop();
+            int32_t arrayRef = pop();
+            FieldType type;
+            const void *data = orderedRange(arrayRef, from, count, "ABSEARCH", type);
+            int64_t found = arrayBinarySearch(data, count, type, key);
+            push(static_cast<int32_t>(found >= 0 ? from + found : found - from));
+            DBG("ABSEARCH in array ref " + std::to_string(arrayRef) + ", Stack top = " + std::to_string(static_cast<int32_t>(stack.back())));
+            break;
+        }
+        case Opcode::APARTITION:
+        {
+            uint32_t pivot = pop();
+            int32_t count = pop();
+            int32_t from = pop();
+            int32_t arrayRef = pop();
+            FieldType type;
+            void *data = orderedRange(arrayRef, from, count, "APARTITION", type);
+            checkWritable(arrayRef, "APARTITION");
+            push(static_cast<int32_t>(from + arrayPartition(data, count, type, pivot)));
+            DBG("APARTITION of array ref " + std::to_string(arrayRef) + ", Stack top = " + std::to_string(static_cast<int32_t>(stack.back())));
+            break;
+        }
+
+        case Opcode::VADD:
+        case Opcode::VSUB:
+        case Opcode::VMUL:
+        case Opcode::VDIV:
+        case Opcode::VFMA:
+        {
+            static const char *names[] = {"VADD", "VSUB", "VMUL", "VDIV", "VFMA"};
+            VectorOp op = static_cast<VectorOp>(static_cast<uint8_t>(opcode) - static_cast<uint8_t>(Opcode::VADD));
+            const char *name = names[static_cast<int>(op)];
+            int32_t count = pop();
+            int32_t offset = pop();
+            int32_t bRef = pop();
+            int32_t aRef = pop();
+            int32_t dstRef = pop();
+            FieldType dstType = FieldType::INT, aType = FieldType::INT, bType = FieldType::INT;
+            void *dst = vectorRange(dstRef, offset, count, name, dstType);
+            checkWritable(dstRef, name);
+            const void *a = vectorRange(aRef, offset, count, name, aType);
+            const void *b = vectorRange(bRef, offset, count, name, bType);
+            if (aType != dstType || bType != dstType)
+            {
+                throw std::runtime_error(std::string(name) + " error: Array element types differ.");
+            }
+            vectorMap(op, dstType, dst, a, b, count);
+            DBG(name << " " << count << " elements into array ref " << dstRef << " (" << vectorIsa() << ")");
+            break;
+        }
+        case Opcode::VDOT:
+        {
+            int32_t count = pop();
+            int32_t offset = pop();
+            int32_t bRef = pop();
+            int32_t aRef = pop();
+            FieldType aType = FieldType::INT, bType = FieldType::INT;
+            const void *a = vectorRange(aRef, offset, count, "VDOT", aType);
+            const void *b = vectorRange(bRef, offset, count, "VDOT", bType);
+            if (aType != bType)
+            {
+                throw std::runtime_error("VDOT error: Array element types differ.");
+            }
+            push(vectorDot(aType, a, b, count));
+            DBG("VDOT of " << count << " elements, Stack top = " << stack.back());
+            break;
+        }
+        case Opcode::VSUM:
+        case Opcode::VMIN:
+        case Opcode::VMAX:
+        {
+            static const char *names[] = {"VSUM", "VMIN", "VMAX"};
+            VectorReduce op = static_cast<VectorReduce>(static_cast<uint8_t>(opcode) - static_cast<uint8_t>(Opcode::VSUM));
+            const char *name = names[static_cast<int>(op)];
+            int32_t count = pop();
+            int32_t offset = pop();
+            int32_t arrayRef = pop();
+            FieldType type = FieldType::INT;
+            const void *a = vectorRange(arrayRef, offset, count, name, type);
+            if (count == 0 && op != VectorReduce::SUM)
+            {
+                throw std::runtime_error(std::string(name) + " error: Empty range.");
+            }
+            push(vectorReduce(op, type, a, count));
+            DBG(name << " of " << count << " elements, Stack top = " << stack.back());
+            break;
+        }
+
+        case Opcode::FSQRT:
+        case Opcode::FEXP:
+        case Opcode::FLOG:
+        case Opcode::FSIN:
+        case Opcode::FCOS:
+        case Opcode::FPOW:
+        {
+            [[maybe_unused]] static const char *names[] = {"FSQRT", "FEXP", "FLOG", "FSIN", "FCOS", "FPOW"};
+            MathFn fn = static_cast<MathFn>(static_cast<uint8_t>(opcode) - static_cast<uint8_t>(Opcode::FSQRT));
+            uint32_t b = fn == MathFn::POW ? pop() : 0, a = pop();
+            float bf, af;
+            std::memcpy(&bf, &b, sizeof(float));
+            std::memcpy(&af, &a, sizeof(float));
+            float cf = mathScalar(fn, af, bf);
+            std::memcpy(&a, &cf, sizeof(float));
+            push(a);
+            DBG(names[static_cast<int>(fn)] << ", Stack top = " << cf);
+            break;
+        }
+        case Opcode::VSQRT:
+        case Opcode::VEXP:
+        case Opcode::VLOG:
+        case Opcode::VSIN:
+        case Opcode::VCOS:
+        case Opcode::VPOW:
+        {
+            static const char *names[] = {"VSQRT", "VEXP", "VLOG", "VSIN", "VCOS", "VPOW"};
+            MathFn fn = static_cast<MathFn>(static_cast<uint8_t>(opcode) - static_cast<uint8_t>(Opcode::VSQRT));
+            const char *name = names[static_cast<int>(fn)];
+            int32_t count = pop();
+            int32_t offset = pop();
+            int32_t bRef = fn == MathFn::POW ? pop() : -1;
+            int32_t aRef = pop();
+            int32_t dstRef = pop();
+            FieldType dstType = FieldType::INT, aType = FieldType::INT, bType = FieldType::FLOAT;
+            void *dst = vectorRange(dstRef, offset, count, name, dstType);
+            checkWritable(dstRef, name);
+            const void *a = vectorRange(aRef, offset, count, name, aType);
+            const void *b = bRef == -1 ? nullptr : vectorRange(bRef, offset, count, name, bType);
+            if (dstType != FieldType::FLOAT || aType != FieldType::FLOAT || bType != FieldType::FLOAT)
+            {
+                throw std::runtime_error(std::string(name) + " error: Math operations need FLOAT arrays.");
+            }
+            mathMap(fn, static_cast<float *>(dst), static_cast<const float *>(a), static_cast<const float *>(b), count);
+            DBG(name << " " << count << " elements into array ref " << dstRef << " (" << mathIsa() << ")");
+            break;
+        }
+
+        case Opcode::MAPNEW:
+        {
+            MapKind kind = static_cast<MapKind>(fetch8());
+            if (kind != MapKind::INT_INT && kind != MapKind::INT_REF && kind != MapKind::STRING_REF)
+            {
+                throw std::runtime_error("MAPNEW error: Unknown map kind " + std::to_string(static_cast<int>(kind)) + ".");
+            }
+            int32_t mapRef = gc.track(objectFactory.createMap(kind));
+            push(mapRef);
+            DBG("MAPNEW of kind " + std::to_string(static_cast<int>(kind)) + ", stored with reference " + std::to_string(mapRef));
+            if (gc.allocationStepDue())
+                gcStep();
+            break;
+        }
+        case Opcode::MAPGET:
+        case Opcode::MAPHAS:
+        {
+            const char *name = opcode == Opcode::MAPGET ? "MAPGET" : "MAPHAS";
+            uint32_t fallback = opcode == Opcode::MAPGET ? pop() : 0;
+            uint32_t key = pop();
+            int32_t mapRef = pop();
+            HashMap &map = mapAt(mapRef, name);
+            int64_t found = map.find(mapKeyHash(map, key, name), [&](uint32_t stored)
+                                     { return mapKeysEqual(map, stored, key); });
+            if (opcode == Opcode::MAPGET)
+                push(found >= 0 ? map.slot(found).value : fallback);
+            else
+                push(found >= 0 ? 1 : 0);
+            DBG(name << " on map ref " << mapRef << ", Stack top = " << static_cast<int32_t>(stack.back()));
+            break;
+        }
+        case Opcode::MAPPUT:
+        {
+            uint32_t value = pop();
+            uint32_t key = pop();
+            int32_t mapRef = pop();
+            HashMap &map = mapAt(mapRef, "MAPPUT");
+            size_t tableBytes = map.tableBytes();
+            uint32_t generation = map.generation();
+            bool inserted;
+            size_t idx = map.insert(mapKeyHash(map, key, "MAPPUT"), key, [&](uint32_t stored)
+                                    { return mapKeysEqual(map, stored, key); }, inserted);
+            map.slot(idx).value = value;
+            if (map.keysAreRefs())
+                gc.writeBarrier(key);
+            if (map.valuesAreRefs())
+                gc.writeBarrier(value);
+            if (map.generation() != generation)
+            {
+                gc.mapResized(map, map.tableBytes() - tableBytes);
+                if (gc.allocationStepDue())
+                    gcStep();
+            }
+            DBG("MAPPUT on map ref " << mapRef << (inserted ? ", new key" : ", replaced") << ", size " << map.size());
+            break;
+        }
+        case Opcode::MAPDEL:
+        {
+            uint32_t key = pop();
+            int32_t mapRef = pop();
+            HashMap &map = mapAt(mapRef, "MAPDEL");
+            int64_t found = map.find(mapKeyHash(map, key, "MAPDEL"), [&](uint32_t stored)
+                                     { return mapKeysEqual(map, stored, key); });
+            if (found >= 0)
+                map.erase(found);
+            push(found >= 0 ? 1 : 0);
+            DBG("MAPDEL on map ref " << mapRef << ", Stack top = " << stack.back());
+            break;
+        }
+        case Opcode::MAPSIZE:
+        {
+            int32_t mapRef = pop();
+            push(static_cast<uint32_t>(mapAt(mapRef, "MAPSIZE").size()));
+            DBG("MAPSIZE of map ref " << mapRef << ", Stack top = " << stack.back());
+            break;
+        }
+        case Opcode::MAPNEXT:
+        {
+            int32_t cursor = pop();
+            int32_t mapRef = pop();
+            HashMap &map = mapAt(mapRef, "MAPNEXT");
+            if (cursor < 0)
+            {
+                throw std::runtime_error("MAPNEXT error: Negative cursor.");
+            }
+            push(static_cast<int32_t>(map.next(cursor)));
+            DBG("MAPNEXT on map ref " << mapRef << ", Stack top = " << static_cast<int32_t>(stack.back()));
+            break;
+        }
+        case Opcode::MAPKEY:
+        case Opcode::MAPVAL:
+        {
+            const char *name = opcode == Opcode::MAPKEY ? "MAPKEY" : "MAPVAL";
+            int32_t idx = pop();
+            int32_t mapRef = pop();
+            HashMap &map = mapAt(mapRef, name);
+            if (idx < 0 || !map.occupied(idx))
+            {
+                throw std::runtime_error(std::string(name) + " error: Slot " + std::to_string(idx) + " holds no entry.");
+            }
+            push(opcode == Opcode::MAPKEY ? map.slot(idx).key : map.slot(idx).value);
+            DBG(name << " of slot " << idx << " in map ref " << mapRef << ", Stack top = " << static_cast<int32_t>(stack.back()));
+            break;
+        }
+
+        case Opcode::CONCAT:
+        {
+            int32_t bRef = pop();
+            int32_t aRef = pop();
+            uint32_t aLength, bLength;
+            const uint8_t *a = stringAt(aRef, "CONCAT", aLength);
+            const uint8_t *b = stringAt(bRef, "CONCAT", bLength);
+            if (static_cast<uint64_t>(aLength) + bLength > INT32_MAX)
+            {
+                throw std::runtime_error("CONCAT error: Result too long.");
+            }
+            char *result = static_cast<char *>(objectFactory.createString(aLength + bLength));
+            std::memcpy(result, a, aLength);
+            std::memcpy(result + aLength, b, bLength);
+            pushString(result);
+            DBG("CONCAT of string refs " << aRef << " and " << bRef << ", length " << aLength + bLength);
+            break;
+        }
+        case Opcode::EQUALS:
+        case Opcode::COMPARE:
+        {
+            const char *name = opcode == Opcode::EQUALS ? "EQUALS" : "COMPARE";
+            int32_t bRef = pop();
+            int32_t aRef = pop();
+            uint32_t aLength, bLength;
+            const uint8_t *a = stringAt(aRef, name, aLength);
+            const uint8_t *b = stringAt(bRef, name, bLength);
+            if (opcode == Opcode::EQUALS)
+            {
+                // Cached hashes rule out most unequal pairs without reading the bytes
+                uint32_t aHash = ObjectFactory::stringHash(heap[aRef]);
+                uint32_t bHash = ObjectFactory::stringHash(heap[bRef]);
+                bool equal = a == b || (aLength == bLength && (aHash == 0 || bHash == 0 || aHash == bHash) && std::memcmp(a, b, aLength) == 0);
+                push(equal ? 1 : 0);
+            }
+            else
+            {
+                push(static_cast<int32_t>(stringCompare(a, aLength, b, bLength)));
+            }
+            DBG(name << " of string refs " << aRef << " and " << bRef << ", Stack top = " << static_cast<int32_t>(stack.back()));
+            break;
+        }
+        case Opcode::SUBSTRING:
+        {
+            int32_t end = pop();
+            int32_t begin = pop();
+            int32_t stringRef = pop();
+            uint32_t length;
+            const uint8_t *bytes = stringAt(stringRef, "SUBSTRING", length);
+            if (begin < 0 || end < begin || static_cast<uint32_t>(end) > length)
+            {
+                throw std::runtime_error("SUBSTRING error: Range [" + std::to_string(begin) + ", " + std::to_string(end) + ") out of bounds for length " + std::to_string(length) + ".");
+            }
+            if (begin == 0 && static_cast<uint32_t>(end) == length)
+            {
+                push(stringRef); // strings are immutable, so the whole string can be shared
+                break;
+            }
+            char *result = static_cast<char *>(objectFactory.createString(end - begin));
+            std::memcpy(result, bytes + begin, end - begin);
+            pushString(result);
+            DBG("SUBSTRING [" << begin << ", " << end << ") of string ref " << stringRef);
+            break;
+        }
+        case Opcode::INDEXOF:
+        {
+            int32_t from = pop();
+            int32_t needleRef = pop();
+            int32_t stringRef = pop();
+            uint32_t length, needleLength;
+            const uint8_t *bytes = stringAt(stringRef, "INDEXOF", length);
+            const uint8_t *needle = stringAt(needleRef, "INDEXOF", needleLength);
+            if (from < 0 || static_cast<uint32_t>(from) > length)
+            {
+                throw std::runtime_error("INDEXOF error: Start " + std::to_string(from) + " out of bounds for length " + std::to_string(length) + ".");
+            }
+            int64_t found = stringFind(bytes + from, length - from, needle, needleLength);
+            push(found < 0 ? -1 : static_cast<int32_t>(from + found));
+            DBG("INDEXOF in string ref " << stringRef << ", Stack top = " << static_cast<int32_t>(stack.back()));
+            break;
+        }
+        case Opcode::HASH:
+        {
+            int32_t stringRef = pop();
+            uint32_t length;
+            stringAt(stringRef, "HASH", length);
+            push(stringHashOf(heap[stringRef]));
+            DBG("HASH of string ref " << stringRef << ", Stack top = " << stack.back());
+            break;
+        }
+        case Opcode::INTERN:
+        {
+            int32_t stringRef = pop();
+            uint32_t length;
+            const uint8_t *bytes = stringAt(stringRef, "INTERN", length);
+            bool inserted;
+            size_t idx = internTable.insert(stringHashOf(heap[stringRef]), stringRef, [&](uint32_t stored)
+                                            { return ObjectFactory::stringLength(heap[stored]) == length && std::memcmp(heap[stored], bytes, length) == 0; }, inserted);
+            if (inserted)
+            {
+                void *string = heap[stringRef];
+                if (ObjectFactory::header(string)->gcBits & GC_ARENA)
+                {
+                    // An arena string dies with its region, so the table keeps a copy
+                    void *copy = objectFactory.createString(length, true);
+                    std::memcpy(copy, bytes, length);
+                    ObjectFactory::stringHash(copy) = ObjectFactory::stringHash(string);
+                    internTable.slot(idx).key = static_cast<uint32_t>(gc.track(copy));
+                    string = copy;
+                }
+                ObjectFactory::header(string)->gcBits |= GC_CONSTANT;
+            }
+            push(internTable.slot(idx).key);
+            DBG("INTERN of string ref " << stringRef << ", Stack top = " << stack.back());
+            break;
+        }
+        case Opcode::STRLEN:
+        {
+            int32_t stringRef = pop();
+            uint32_t length;
+            stringAt(stringRef, "STRLEN", length);
+            push(length);
+            DBG("STRLEN of string ref " << stringRef << ", Stack top = " << stack.back());
+            break;
+        }
+        case Opcode::CHARAT:
+        {
+            int32_t index = pop();
+            int32_t stringRef = pop();
+            uint32_t length;
+            const uint8_t *bytes = stringAt(stringRef, "CHARAT", length);
+            if (static_cast<uint32_t>(index) >= length)
+            {
+                throw std::runtime_error("CHARAT error: Index " + std::to_string(index) + " out of bounds for length " + std::to_string(length) + ".");
+            }
+            push(bytes[index]);
+            DBG("CHARAT " << index << " of string ref " << stringRef << ", Stack top = " << stack.back());
+            break;
+        }
+        case Opcode::NEWSTRING:
+        {
+            int32_t count = pop();
+            int32_t from = pop();
+            int32_t arrayRef = pop();
+            FieldType type;
+            const void *chars = arrayRange(arrayRef, from, count, "NEWSTRING", type);
+            if (type != FieldType::CHAR)
+            {
+                throw std::runtime_error("NEWSTRING error: Array is not a CHAR array.");
+            }
+            void *result = objectFactory.createString(count);
+            std::memcpy(result, chars, count);
+            pushString(result);
+            DBG("NEWSTRING of " << count << " chars from array ref " << arrayRef);
+            break;
+        }
+        case Opcode::STRCHARS:
+        {
+            int32_t stringRef = pop();
+            uint32_t length;
+            const uint8_t *bytes = stringAt(stringRef, "STRCHARS", length);
+            void *chars = objectFactory.createArray(FieldType::CHAR, length);
+            std::memcpy(chars, bytes, length);
+            int32_t arrayRef = gc.track(chars);
+            push(arrayRef);
+            DBG("STRCHARS of string ref " << stringRef << ", stored with reference " << arrayRef);
+            if (gc.allocationStepDue())
+                gcStep();
+            break;
+        }
+
+        case Opcode::LPUSH:
+        {
+            push64(fetch64());
+            DBG("LPUSH " << static_cast<int64_t>((static_cast<uint64_t>(stack.back()) << 32) | stack[stack.size() - 2]));
+            break;
+        }
+        case Opcode::LADD:
+        case Opcode::LSUB:
+        case Opcode::LMUL:
+        {
+            uint64_t b = pop64(), a = pop64();
+            // Unsigned arithmetic wraps like the 32-bit opcodes without signed overflow
+            push64(opcode == Opcode::LADD ? a + b : opcode == Opcode::LSUB ? a - b : a * b);
+            DBG(opcodeInfo(static_cast<uint8_t>(opcode))->name << ", Stack top = " << static_cast<int64_t>((static_cast<uint64_t>(stack.back()) << 32) | stack[stack.size() - 2]));
+            break;
+        }
+        case Opcode::LDIV:
+        case Opcode::LREM:
+        {
+            int64_t b = static_cast<int64_t>(pop64()), a = static_cast<int64_t>(pop64());
+            if (b == 0)
+                throw std::runtime_error("Division by zero");
+            int64_t result;
+            if (b == -1)
+                result = opcode == Opcode::LDIV ? static_cast<int64_t>(0 - static_cast<uint64_t>(a)) : 0; // INT64_MIN / -1 wraps
+            else
+                result = opcode == Opcode::LDIV ? a / b : a % b;
+            push64(static_cast<uint64_t>(result));
+            DBG(opcodeInfo(static_cast<uint8_t>(opcode))->name << ", Stack top = " << result);
+            break;
+        }
+        case Opcode::LNEG:
+        {
+            push64(0 - pop64());
+            DBG("LNEG");
+            break;
+        }
+        case Opcode::LCMP:
+        {
+            int64_t b = static_cast<int64_t>(pop64()), a = static_cast<int64_t>(pop64());
+            push(static_cast<uint32_t>((a > b) - (a < b)));
+            DBG("LCMP, Stack top = " << static_cast<int32_t>(stack.back()));
+            break;
+        }
+        case Opcode::DPUSH:
+        {
+            push64(fetch64());
+            DBG("DPUSH");
+            break;
+        }
+        case Opcode::DADD:
+        case Opcode::DSUB:
+        case Opcode::DMUL:
+        case Opcode::DDIV:
+        {
+            double b = asDouble(pop64()), a = asDouble(pop64());
+            double result = opcode == Opcode::DADD   ? a + b
+                            : opcode == Opcode::DSUB ? a - b
+                            : opcode == Opcode::DMUL ? a * b
+                                                     : a / b;
+            push64(bitsOf(result));
+            DBG(opcodeInfo(static_cast<uint8_t>(opcode))->name << ", Stack top = " << result);
+            break;
+        }
+        case Opcode::DNEG:
+        {
+            push64(bitsOf(-asDouble(pop64())));
+            DBG("DNEG");
+            break;
+        }
+        case Opcode::DCMP:
+        {
+            double b = asDouble(pop64()), a = asDouble(pop64());
+            // Unordered compares as greater, so `DCMP; PUSH 0; ICMP_LT` is false for NaN
+            push(static_cast<uint32_t>(a < b ? -1 : (a == b ? 0 : 1)));
+            DBG("DCMP, Stack top = " << static_cast<int32_t>(stack.back()));
+            break;
+        }
+        case Opcode::I2L:
+        {
+            push64(static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(pop()))));
+            DBG("I2L");
+            break;
+        }
+        case Opcode::L2I:
+        {
+            push(static_cast<uint32_t>(pop64()));
+            DBG("L2I, Stack top = " << static_cast<int32_t>(stack.back()));
+            break;
+        }
+        case Opcode::L2D:
+        {
+            push64(bitsOf(static_cast<double>(static_cast<int64_t>(pop64()))));
+            DBG("L2D");
+            break;
+        }
+        case Opcode::D2L:
+        {
+            push64(static_cast<uint64_t>(truncateDouble<int64_t>(asDouble(pop64()))));
+            DBG("D2L");
+            break;
+        }
+        case Opcode::I2D:
+        {
+            push64(bitsOf(static_cast<double>(static_cast<int32_t>(pop()))));
+            DBG("I2D");
+            break;
+        }
+        case Opcode::D2I:
+        {
+            push(static_cast<uint32_t>(truncateDouble<int32_t>(asDouble(pop64()))));
+            DBG("D2I, Stack top = " << static_cast<int32_t>(stack.back()));
+            break;
+        }
+        case Opcode::F2D:
+        {
+            push64(bitsOf(static_cast<double>(asFloat(pop()))));
+            DBG("F2D");
+            break;
+        }
+        case Opcode::D2F:
+        {
+            float value = static_cast<float>(asDouble(pop64()));
+            uint32_t raw;
+            std::memcpy(&raw, &value, sizeof(uint32_t));
+            push(raw);
+            DBG("D2F, Stack top = " << value);
+            break;
+        }
+        case Opcode::WLOAD:
+        {
+            uint32_t idx = fetch32();
+            push(locals.at(idx));
+            push(locals.at(idx + 1));
+            DBG("WLOAD " << idx);
+            break;
+        }
+        case Opcode::WSTORE:
+        {
+            uint32_t idx = fetch32();
+            locals.at(idx + 1) = pop();
+            locals.at(idx) = pop();
+            DBG("WSTORE " << idx);
+            break;
+        }
+        case Opcode::DUP2:
+        {
+            uint32_t high = pop(), low = peek();
+            push(high);
+            push(low);
+            push(high);
+            DBG("DUP2");
+            break;
+        }
+        case Opcode::POP2:
+        {
+            pop();
+            pop();
+            DBG("POP2");
+            break;
+        }
+        case Opcode::WALOAD:
+        case Opcode::WASTORE:
+        {
+            const char *name = opcode == Opcode::WALOAD ? "WALOAD" : "WASTORE";
+            uint64_t value = opcode == Opcode::WASTORE ? pop64() : 0;
+            int32_t index = pop();
+            int32_t arrayRef = pop();
+            FieldType type;
+            void *element = arrayRange(arrayRef, index, 1, name, type);
+            if (ObjectFactory::fieldSize(type) != 8)
+            {
+                throw std::runtime_error(std::string(name) + " error: Array is not a LONG or DOUBLE array.");
+            }
+            // Array data is 8-byte aligned; memcpy moves the element without
+            // reading the untyped heap block through a 64-bit type
+            if (opcode == Opcode::WALOAD)
+            {
+                std::memcpy(&value, element, sizeof(value));
+                push64(value);
+            }
+            else
+            {
+                std::memcpy(element, &value, sizeof(value));
+            }
+            DBG(name << " at index " << index << " of array ref " << arrayRef);
+            break;
+        }
+        case Opcode::WGETFIELD:
+        case Opcode::WPUTFIELD:
+        {
+            const char *name = opcode == Opcode::WGETFIELD ? "WGETFIELD" : "WPUTFIELD";
+            uint8_t fieldIndex = fetch8();
+            uint64_t value = opcode == Opcode::WPUTFIELD ? pop64() : 0;
+            int32_t objRef = pop();
+            if (objRef < 0 || static_cast<size_t>(objRef) >= heap.size() || heap[objRef] == nullptr)
+            {
+                throw std::runtime_error(std::string(name) + " error: Invalid object reference.");
+            }
+            void *objectData = heap[objRef];
+            const ClassInfo *cls = classes.getClassInfo(ObjectFactory::header(objectData)->classId);
+            if (cls == nullptr)
+            {
+                throw std::runtime_error(std::string(name) + " error: Reference is not an object.");
+            }
+            if (fieldIndex >= cls->fieldSlots.size() || ObjectFactory::fieldSize(cls->fieldSlots[fieldIndex].type) != 8)
+            {
+                throw std::runtime_error(std::string(name) + " error: Field " + std::to_string(fieldIndex) + " is not a LONG or DOUBLE field.");
+            }
+            char *fieldAddress = static_cast<char *>(objectData) + cls->fieldSlots[fieldIndex].offset;
+            if (opcode == Opcode::WGETFIELD)
+            {
+                std::memcpy(&value, fieldAddress, sizeof(value));
+                push64(value);
+            }
+            else
+            {
+                std::memcpy(fieldAddress, &value, sizeof(value));
+            }
+            DBG(name << " on ObjRef " << objRef << " (" << cls->name << " field " << static_cast<int>(fieldIndex) << ")");
+            break;
+        }
+
+        case Opcode::SYS_CALL:
+        {
+            Syscall syscall = static_cast<Syscall>(fetch8());
+            switch (syscall)
+            {
+            case Syscall::READ:
+            {
+                int fd = pop();        // Stack: file descriptor
+                int size = pop();      // Stack: buffer size
+                int localsIdx = pop(); // Stack: local index to store buffer address
+                // void *rawbuffer = malloc(size + sizeof(void *));                                     // Allocate buffer
+                // void *buffer = static_cast<void *>(static_cast<char *>(rawbuffer) + sizeof(void *)); // following heap convention
+                // heap.push_back(buffer);
+                // locals.at(localsIdx) = heap.size() - 1; // Store buffer index in locals
+                // get buf from locals
+                int bufIdx = locals.at(localsIdx);
+                if (bufIdx < 0 || static_cast<size_t>(bufIdx) >= heap.size() || heap[bufIdx] == nullptr)
+                {
+                    throw std::runtime_error("SYS_READ error: Invalid buffer index " + std::to_string(bufIdx));
+                }
                 void *buffer = heap.at(bufIdx);
+                if (ObjectFactory::header(buffer)->classId == STRING_CLASS_ID)
+                {
+                    throw std::runtime_error("SYS_READ error: Buffer is an immutable string.");
+                }
+                if (ObjectFactory::header(buffer)->gcBits & GC_CONSTANT)
+                {
+                    throw std::runtime_error("SYS_READ error: Buffer is a read-only constant.");
+                }
+                checkBufferSize(buffer, size, "SYS_READ");
                 if (fileData.at(fd) == nullptr)
                 {
                     throw std::runtime_error("SYS_READ error: Invalid file descriptor " + std::to_string(fd));
@@ -884,11 +1863,12 @@ void VM::run()
                 // int bufIdx = locals.at(locIdx); // Get buffer index from locals
                 int bufIdx = pop(); // Stack: buffer index
 
-                if (bufIdx < 0 || static_cast<size_t>(bufIdx) >= heap.size())
+                if (bufIdx < 0 || static_cast<size_t>(bufIdx) >= heap.size() || heap[bufIdx] == nullptr)
                 {
                     throw std::runtime_error("SYS_WRITE error: Invalid buffer index " + std::to_string(bufIdx));
                 }
                 void *buffer = heap.at(bufIdx);
+                checkBufferSize(buffer, size, "SYS_WRITE");
                 if (fileData.at(fd) == nullptr)
                 {
                     throw std::runtime_error("SYS_WRITE error: Invalid file descriptor " + std::to_string(fd));
@@ -909,7 +1889,7 @@ void VM::run()
             {
                 char mode = pop();
                 int32_t filenameIdx = pop();
-                if (filenameIdx < 0 || static_cast<size_t>(filenameIdx) >= heap.size())
+                if (filenameIdx < 0 || static_cast<size_t>(filenameIdx) >= heap.size() || heap[filenameIdx] == nullptr)
                 {
                     throw std::runtime_error("SYS_OPEN error: Invalid filename index " + std::to_string(filenameIdx));
                 }
@@ -927,6 +1907,7 @@ void VM::run()
                             throw std::runtime_error("SYS_OPEN error: Failed to open file " + std::string(filename));
                         }
                         fileData.at(i) = f;
+                        openFiles.at(i) = OpenFile{filename, mode};
                         fd = i;
                         break;
                     }
@@ -952,14 +1933,73 @@ void VM::run()
                 }
                 fclose(fileData.at(fd));
                 fileData.at(fd) = nullptr;
+                if (static_cast<size_t>(fd) < openFiles.size())
+                    openFiles.at(fd) = OpenFile();
                 DBG("SYS_CLOSE on FD " + std::to_string(fd));
                 break;
             }
+            case Syscall::READLINE:
+            {
+                int fd = pop();
+                if (fd < 0 || static_cast<size_t>(fd) >= fileData.size() || fileData.at(fd) == nullptr)
+                {
+                    throw std::runtime_error("SYS_READLINE error: Invalid file descriptor " + std::to_string(fd));
+                }
+                std::string line;
+                char chunk[256];
+                bool any = false;
+                while (std::fgets(chunk, sizeof(chunk), fileData.at(fd)) != nullptr)
+                {
+                    any = true;
+                    line += chunk;
+                    if (!line.empty() && line.back() == '\n')
+                        break;
+                }
+                if (!any)
+                {
+                    push(static_cast<uint32_t>(-1)); // end of file
+                    DBG("SYS_READLINE from FD " + std::to_string(fd) + " at end of file");
+                    break;
+                }
+                if (!line.empty() && line.back() == '\n')
+                    line.pop_back();
+                void *string = objectFactory.createString(static_cast<uint32_t>(line.size()));
+                std::memcpy(string, line.data(), line.size());
+                pushString(string);
+                DBG("SYS_READLINE from FD " + std::to_string(fd) + ", Length = " + std::to_string(line.size()));
+                break;
+            }
+            case Syscall::WRITESTR:
+            {
+                int fd = pop();
+                int32_t stringRef = pop();
+                uint32_t length;
+                const uint8_t *bytes = stringAt(stringRef, "SYS_WRITESTR", length);
+                if (fd < 0 || static_cast<size_t>(fd) >= fileData.size() || fileData.at(fd) == nullptr)
+                {
+                    throw std::runtime_error("SYS_WRITESTR error: Invalid file descriptor " + std::to_string(fd));
+                }
+                push(static_cast<uint32_t>(fwrite(bytes, 1, length, fileData.at(fd))));
+                DBG("SYS_WRITESTR to FD " + std::to_string(fd) + ", Bytes Written = " + std::to_string(stack.back()));
+                break;
+            }
+            case Syscall::CHECKPOINT:
+            {
+                std::string path = textAt(pop(), "SYS_CHECKPOINT");
+                // A run resumed from the checkpoint sees 1, this one goes on with 0
+                push(1);
+                checkpoint(path);
+                pop();
+                push(0);
+                DBG("SYS_CHECKPOINT to " + path);
+                break;
+            }
             case Syscall::EXIT:
             {
-                int exitCode = pop();
+                exitCode = static_cast<int32_t>(pop());
+                exited = true;
                 DBG("SYS_EXIT with code " + std::to_string(exitCode) + ", halting execution.");
-                exit(exitCode);
+                return;
             }
             default:
                 throw std::runtime_error("Unsupported syscall: " + std::to_string((int)syscall));
@@ -975,25 +2015,300 @@ void VM::run()
 
 uint32_t VM::top() const { return peek(); }
 
-void VM::push(uint32_t v)
+void *VM::arrayRange(int32_t arrayRef, int32_t pos, int32_t count, const char *opName, FieldType &type)
 {
-    if (stack.size() >= STACK_SIZE)
-        throw std::runtime_error("Stack Overflow");
-    stack.push_back(v);
+    if (arrayRef < 0 || static_cast<size_t>(arrayRef) >= heap.size() || heap[arrayRef] == nullptr)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Invalid array reference.");
+    }
+    void *arrayData = heap[arrayRef];
+    const ObjectHeader *arrayHeader = ObjectFactory::header(arrayData);
+    if (arrayHeader->classId != ARRAY_CLASS_ID)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Reference is not an array.");
+    }
+    uint32_t length = ObjectFactory::arrayLength(arrayData);
+    if (pos < 0 || count < 0 || static_cast<int64_t>(pos) + count > length)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Range [" + std::to_string(pos) + ", " + std::to_string(static_cast<int64_t>(pos) + count) + ") out of bounds for length " + std::to_string(length) + ".");
+    }
+    type = arrayHeader->elementType;
+    return static_cast<char *>(arrayData) + pos * ObjectFactory::fieldSize(type);
 }
-uint32_t VM::pop()
+
+void *VM::vectorRange(int32_t arrayRef, int32_t offset, int32_t count, const char *opName, FieldType &type)
 {
-    if (stack.empty())
-        throw std::runtime_error("Stack Underflow");
-    uint32_t v = stack.back();
-    stack.pop_back();
-    return v;
+    void *data = arrayRange(arrayRef, offset, count, opName, type);
+    if (type != FieldType::INT && type != FieldType::FLOAT)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Vector operations need INT or FLOAT arrays.");
+    }
+    return data;
 }
-uint32_t VM::peek() const
+
+void *VM::narrowRange(int32_t arrayRef, int32_t pos, int32_t count, const char *opName, FieldType &type)
 {
-    if (stack.empty())
-        throw std::runtime_error("Empty stack");
-    return stack.back();
+    void *data = arrayRange(arrayRef, pos, count, opName, type);
+    if (ObjectFactory::fieldSize(type) == 8)
+    {
+        throw std::runtime_error(std::string(opName) + " error: LONG and DOUBLE arrays are not supported.");
+    }
+    return data;
+}
+
+void *VM::orderedRange(int32_t arrayRef, int32_t from, int32_t count, const char *opName, FieldType &type)
+{
+    void *data = narrowRange(arrayRef, from, count, opName, type);
+    if (type == FieldType::OBJECT)
+    {
+        throw std::runtime_error(std::string(opName) + " error: OBJECT arrays have no order.");
+    }
+    return data;
+}
+
+const uint8_t *VM::stringAt(int32_t stringRef, const char *opName, uint32_t &length)
+{
+    if (stringRef < 0 || static_cast<size_t>(stringRef) >= heap.size() || heap[stringRef] == nullptr)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Invalid string reference.");
+    }
+    if (ObjectFactory::header(heap[stringRef])->classId != STRING_CLASS_ID)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Reference is not a string.");
+    }
+    length = ObjectFactory::stringLength(heap[stringRef]);
+    return static_cast<const uint8_t *>(heap[stringRef]);
+}
+
+std::string VM::textAt(int32_t ref, const char *opName)
+{
+    if (ref >= 0 && static_cast<size_t>(ref) < heap.size() && heap[ref] != nullptr)
+    {
+        // String constants are CHAR arrays
+        const ObjectHeader *hdr = ObjectFactory::header(heap[ref]);
+        if (hdr->classId == ARRAY_CLASS_ID && hdr->elementType == FieldType::CHAR)
+            return std::string(static_cast<const char *>(heap[ref]), ObjectFactory::arrayLength(heap[ref]));
+    }
+    uint32_t length;
+    const uint8_t *bytes = stringAt(ref, opName, length);
+    return std::string(reinterpret_cast<const char *>(bytes), length);
+}
+
+uint32_t VM::stringHashOf(void *string)
+{
+    uint32_t &hash = ObjectFactory::stringHash(string);
+    if (hash == 0)
+        hash = hashBytes(string, ObjectFactory::stringLength(string));
+    return hash;
+}
+
+void VM::pushString(void *string)
+{
+    push(gc.track(string));
+    if (gc.allocationStepDue())
+        gcStep();
+}
+
+void VM::checkWritable(int32_t arrayRef, const char *opName) const
+{
+    if (ObjectFactory::header(heap[arrayRef])->gcBits & GC_CONSTANT)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Array is a read-only constant.");
+    }
+}
+
+void VM::checkBufferSize(const void *buffer, int32_t size, const char *opName) const
+{
+    // Arrays hold length elements and strings length bytes; other objects
+    // are no byte buffers
+    const ObjectHeader *hdr = ObjectFactory::header(buffer);
+    size_t bytes = 0;
+    if (hdr->classId == ARRAY_CLASS_ID)
+        bytes = static_cast<size_t>(ObjectFactory::arrayLength(buffer)) * ObjectFactory::fieldSize(hdr->elementType);
+    else if (hdr->classId == STRING_CLASS_ID)
+        bytes = ObjectFactory::stringLength(buffer);
+    if (size < 0 || static_cast<size_t>(size) > bytes)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Size " + std::to_string(size) + " out of bounds for a buffer of " + std::to_string(bytes) + " bytes.");
+    }
+}
+
+void *VM::channelAt(int32_t channelRef, const char *opName)
+{
+    if (channelRef < 0 || static_cast<size_t>(channelRef) >= heap.size() || heap[channelRef] == nullptr)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Invalid channel reference.");
+    }
+    if (ObjectFactory::header(heap[channelRef])->classId != CHANNEL_CLASS_ID)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Reference is not a channel.");
+    }
+    return heap[channelRef];
+}
+
+HashMap &VM::mapAt(int32_t mapRef, const char *opName)
+{
+    if (mapRef < 0 || static_cast<size_t>(mapRef) >= heap.size() || heap[mapRef] == nullptr)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Invalid map reference.");
+    }
+    if (ObjectFactory::header(heap[mapRef])->classId != MAP_CLASS_ID)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Reference is not a map.");
+    }
+    return ObjectFactory::map(heap[mapRef]);
+}
+
+uint32_t VM::mapKeyHash(const HashMap &map, uint32_t key, const char *opName)
+{
+    if (!map.keysAreRefs())
+        return hashInt(key);
+    FieldType type;
+    int32_t keyRef = static_cast<int32_t>(key);
+    if (keyRef >= 0 && static_cast<size_t>(keyRef) < heap.size() && heap[keyRef] != nullptr)
+    {
+        // Strings and CHAR arrays with the same bytes are the same key
+        if (ObjectFactory::header(heap[keyRef])->classId == STRING_CLASS_ID)
+            return stringHashOf(heap[keyRef]);
+        const void *chars = arrayRange(keyRef, 0, 0, opName, type);
+        if (type == FieldType::CHAR)
+            return hashBytes(chars, ObjectFactory::arrayLength(chars));
+    }
+    throw std::runtime_error(std::string(opName) + " error: Key is not a string or CHAR array.");
+}
+
+bool VM::mapKeysEqual(const HashMap &map, uint32_t a, uint32_t b) const
+{
+    // Strings keep their length where arrays do, so both kinds compare alike
+    if (a == b || !map.keysAreRefs())
+        return a == b;
+    const void *x = heap[a];
+    const void *y = heap[b];
+    uint32_t length = ObjectFactory::arrayLength(x);
+    return length == ObjectFactory::arrayLength(y) && std::memcmp(x, y, length) == 0;
+}
+
+void VM::gcStep()
+{
+    if (tasks.empty())
+    {
+        gc.step(RootSpan{stack.data(), stack.size(), &stack}, RootSpan{locals.data(), locals.used()});
+        return;
+    }
+    // Parked stacks change whenever their task runs, so the spans are
+    // taken again for every slice, one for each task id
+    taskRoots.clear();
+    for (size_t id = 0; id < tasks.size(); id++)
+    {
+        Task &task = *tasks[id];
+        if (task.state == TaskState::FINISHED)
+            taskRoots.push_back(RootSpan{&task.result, 1});
+        else if (task.state != TaskState::FREE && id != currentTask)
+            taskRoots.push_back(RootSpan{task.stack.data(), task.stack.size(), &task.stack});
+        else
+            taskRoots.push_back(RootSpan{nullptr, 0});
+    }
+    gc.step(RootSpan{stack.data(), stack.size(), &stack}, RootSpan{locals.data(), locals.used()}, taskRoots);
+}
+
+std::vector<RootSpan> VM::arenaCheckRoots() const
+{
+    std::vector<RootSpan> spans;
+    auto addStack = [&spans](const uint32_t *words, size_t size, uint32_t frame)
+    {
+        // Frames link down through their saved fp; the base frame has none
+        size_t end = size;
+        while (frame > 0 && frame < end)
+        {
+            spans.push_back(RootSpan{words + frame + 1, end - frame - 1});
+            end = frame - 1;
+            frame = words[frame];
+        }
+        spans.push_back(RootSpan{words, end});
+    };
+    addStack(stack.data(), stack.size(), fp);
+    for (size_t id = 0; id < tasks.size(); id++)
+    {
+        const Task &task = *tasks[id];
+        if (task.state == TaskState::FINISHED)
+            spans.push_back(RootSpan{&task.result, 1});
+        else if (task.state != TaskState::FREE && id != currentTask)
+            addStack(task.stack.data(), task.stack.size(), task.fp);
+    }
+    return spans;
+}
+
+void VM::dumpGCStats(std::ostream &out) const
+{
+    gc.dumpStats(out);
+}
+
+void VM::dumpMemoryStats(std::ostream &out) const
+{
+    dumpPageStats(out);
+}
+
+void VM::dumpHeapStats(std::ostream &out) const
+{
+    struct Usage
+    {
+        size_t count = 0;
+        size_t bytes = 0;
+    };
+    std::vector<Usage> perClass(classes.classCount());
+    Usage perArrayType[7];
+    Usage maps;
+    Usage strings;
+    Usage channels;
+    size_t totalBytes = 0;
+    size_t liveObjects = 0;
+
+    for (void *object : heap)
+    {
+        if (object == nullptr)
+            continue;
+        const ObjectHeader *hdr = ObjectFactory::header(object);
+        size_t bytes = objectFactory.allocationSize(object);
+        Usage &usage = hdr->classId == ARRAY_CLASS_ID ? perArrayType[static_cast<int>(hdr->elementType)]
+                       : hdr->classId == MAP_CLASS_ID    ? maps
+                       : hdr->classId == STRING_CLASS_ID  ? strings
+                       : hdr->classId == CHANNEL_CLASS_ID ? channels
+                                                          : perClass.at(hdr->classId);
+        usage.count++;
+        usage.bytes += bytes;
+        totalBytes += bytes;
+        liveObjects++;
+    }
+
+    out << "Heap stats: " << liveObjects << " objects, " << totalBytes << " bytes" << std::endl;
+    for (size_t i = 0; i < perClass.size(); i++)
+    {
+        if (perClass[i].count == 0)
+            continue;
+        const ClassInfo *cls = classes.getClassInfo(static_cast<uint16_t>(i));
+        out << "  class " << cls->name << ": " << perClass[i].count << " objects, "
+            << perClass[i].bytes << " bytes, " << (sizeof(ObjectHeader) + cls->objectSize) << " bytes/object" << std::endl;
+    }
+    const char *arrayTypeNames[7] = {"?", "INT", "OBJECT", "FLOAT", "CHAR", "LONG", "DOUBLE"};
+    for (int t = 1; t < 7; t++)
+    {
+        if (perArrayType[t].count == 0)
+            continue;
+        out << "  array " << arrayTypeNames[t] << "[]: " << perArrayType[t].count << " arrays, "
+            << perArrayType[t].bytes << " bytes, " << perArrayType[t].bytes / perArrayType[t].count << " bytes/array avg" << std::endl;
+    }
+    if (strings.count != 0)
+    {
+        out << "  string: " << strings.count << " strings, " << strings.bytes << " bytes, " << strings.bytes / strings.count << " bytes/string avg" << std::endl;
+    }
+    if (maps.count != 0)
+    {
+        out << "  map: " << maps.count << " maps, " << maps.bytes << " bytes, " << maps.bytes / maps.count << " bytes/map avg" << std::endl;
+    }
+    if (channels.count != 0)
+    {
+        out << "  channel: " << channels.count << " channels, " << channels.bytes << " bytes, " << channels.bytes / channels.count << " bytes/channel avg" << std::endl;
+    }
 }
 
 uint8_t VM::fetch8() { return code.at(ip++); }
@@ -1011,3 +2326,18 @@ int32_t VM::fetch32()
     int32_t b4 = fetch8();
     return (b4 << 24) | (b3 << 16) | (b2 << 8) | b1;
 }
+uint32_t VM::fetchVarint()
+{
+    uint32_t value;
+    size_t length = readVarint(code.data() + ip, code.end(), value);
+    if (length == 0)
+        throw std::out_of_range("Malformed varint at code offset " + std::to_string(ip));
+    ip += length;
+    return value;
+}
+uint64_t VM::fetch64()
+{
+    uint64_t low = static_cast<uint32_t>(fetch32());
+    uint64_t high = static_cast<uint32_t>(fetch32());
+    return (high << 32) | low;
+}
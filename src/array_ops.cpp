@@ -0,0 +1,99 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <array_ops.hpp>
+#include <sort_ops.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // Elements checked with one memcmp before searching for the deciding pair
+    constexpr size_t COMPARE_BLOCK = 256;
+}
+
+void arrayCopy(void *dst, const void *src, size_t count, FieldType type)
+{
+    std::memmove(dst, src, count * ObjectFactory::fieldSize(type));
+}
+
+void arrayFill(void *dst, size_t count, FieldType type, uint32_t value)
+{
+    if (type == FieldType::CHAR)
+    {
+        std::memset(dst, static_cast<uint8_t>(value), count);
+        return;
+    }
+    uint32_t *words = static_cast<uint32_t *>(dst);
+    std::fill(words, words + count, value);
+}
+
+int arrayCompare(const void *a, const void *b, size_t count, FieldType type)
+{
+    switch (type)
+    {
+    case FieldType::CHAR:
+    {
+        int result = std::memcmp(a, b, count);
+        return (result > 0) - (result < 0);
+    }
+    case FieldType::FLOAT:
+    {
+        // The order ASORT sorts by, so that swapping the operands negates
+        // the result even with NaNs
+        const float *x = static_cast<const float *>(a);
+        const float *y = static_cast<const float *>(b);
+        FloatLess less;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (less(x[i], y[i]))
+                return -1;
+            if (less(y[i], x[i]))
+                return 1;
+        }
+        return 0;
+    }
+    default:
+    {
+        // memcmp skips equal blocks quickly but orders by bytes, so the first
+        // unequal pair is then compared as integers
+        const int32_t *x = static_cast<const int32_t *>(a);
+        const int32_t *y = static_cast<const int32_t *>(b);
+        for (size_t i = 0; i < count; i += COMPARE_BLOCK)
+        {
+            size_t n = std::min(COMPARE_BLOCK, count - i);
+            if (std::memcmp(x + i, y + i, n * sizeof(int32_t)) == 0)
+                continue;
+            auto diff = std::mismatch(x + i, x + i + n, y + i);
+            return *diff.first < *diff.second ? -1 : 1;
+        }
+        return 0;
+    }
+    }
+}
+
+int64_t arrayFind(const void *data, size_t count, FieldType type, uint32_t value)
+{
+    switch (type)
+    {
+    case FieldType::CHAR:
+    {
+        const void *hit = std::memchr(data, static_cast<uint8_t>(value), count);
+        return hit ? static_cast<const char *>(hit) - static_cast<const char *>(data) : -1;
+    }
+    case FieldType::FLOAT:
+    {
+        float key;
+        std::memcpy(&key, &value, sizeof(float));
+        const float *elements = static_cast<const float *>(data);
+        const float *hit = std::find(elements, elements + count, key);
+        return hit != elements + count ? hit - elements : -1;
+    }
+    default:
+    {
+        const uint32_t *elements = static_cast<const uint32_t *>(data);
+        const uint32_t *hit = std::find(elements, elements + count, value);
+        return hit != elements + count ? hit - elements : -1;
+    }
+    }
+}
@@ -0,0 +1,85 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <batch.hpp>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+
+#ifdef VM_THREADS
+#include <thread>
+#endif
+
+namespace
+{
+    // Inputs claimed per visit to the shared cursor
+    constexpr size_t BATCH_CHUNK = 16;
+}
+
+std::vector<BatchResult> runBatch(const std::shared_ptr<const Program> &program, const MethodHandle &method,
+                                  const std::vector<std::vector<VMValue>> &inputs, FieldType resultType,
+                                  unsigned threads, const VMOptions &options)
+{
+    std::vector<BatchResult> results(inputs.size());
+    if (inputs.empty())
+        return results;
+    std::atomic<size_t> cursor{0};
+    std::exception_ptr failure; // of a worker that could not set up its VM
+    std::mutex failureLock;
+    VMOptions workerOptions = options;
+    if (workerOptions.sortThreads == 0)
+        workerOptions.sortThreads = 1;
+
+    auto worker = [&]()
+    {
+        std::unique_ptr<VM> vm;
+        try
+        {
+            vm = std::make_unique<VM>(program, workerOptions);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(failureLock);
+            failure = std::current_exception();
+            return;
+        }
+        for (size_t begin; (begin = cursor.fetch_add(BATCH_CHUNK)) < inputs.size();)
+        {
+            size_t end = std::min(inputs.size(), begin + BATCH_CHUNK);
+            for (size_t i = begin; i < end; i++)
+            {
+                try
+                {
+                    results[i].value = vm->invoke(method, inputs[i], resultType);
+                }
+                catch (const std::exception &ex)
+                {
+                    results[i].error = ex.what();
+                }
+                vm->resetHeap();
+            }
+        }
+    };
+
+#ifdef VM_THREADS
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>(threads, (inputs.size() + BATCH_CHUNK - 1) / BATCH_CHUNK));
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++)
+        workers.emplace_back(worker);
+    worker();
+    for (std::thread &thread : workers)
+        thread.join();
+#else
+    (void)threads;
+    worker();
+#endif
+    // Inputs a failed worker would have taken went to the others, unless
+    // every worker failed
+    if (failure && cursor.load() < inputs.size())
+        std::rethrow_exception(failure);
+    DBG("Batch of " << inputs.size() << " inputs done");
+    return results;
+}
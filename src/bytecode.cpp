@@ -0,0 +1,644 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <bytecode.hpp>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    struct OpcodeTable
+    {
+        OpcodeInfo entries[256] = {};
+
+        void set(Opcode op, const char *name, uint8_t operandBytes, int8_t pops, int8_t pushes, uint8_t flags = 0)
+        {
+            entries[static_cast<uint8_t>(op)] = OpcodeInfo{name, operandBytes, pops, pushes, flags};
+        }
+
+        OpcodeTable()
+        {
+            set(Opcode::IADD, "IADD", 0, 2, 1);
+            set(Opcode::ISUB, "ISUB", 0, 2, 1);
+            set(Opcode::IMUL, "IMUL", 0, 2, 1);
+            set(Opcode::IDIV, "IDIV", 0, 2, 1);
+            set(Opcode::INEG, "INEG", 0, 1, 1);
+            set(Opcode::FADD, "FADD", 0, 2, 1);
+            set(Opcode::FSUB, "FSUB", 0, 2, 1);
+            set(Opcode::FMUL, "FMUL", 0, 2, 1);
+            set(Opcode::FDIV, "FDIV", 0, 2, 1);
+            set(Opcode::FNEG, "FNEG", 0, 1, 1);
+            set(Opcode::IMOD, "IMOD", 0, 2, 1);
+            set(Opcode::PUSH, "PUSH", 4, 0, 1);
+            set(Opcode::POP, "POP", 0, 1, 0);
+            set(Opcode::DUP, "DUP", 0, 1, 2);
+            set(Opcode::FPOP, "FPOP", 0, 1, 0);
+            set(Opcode::FPUSH, "FPUSH", 4, 0, 1);
+            set(Opcode::LDC, "LDC", 2, 0, 1);
+            set(Opcode::PUSH_I8, "PUSH_I8", 1, 0, 1);
+            set(Opcode::PUSH_I16, "PUSH_I16", 2, 0, 1);
+            set(Opcode::LOAD, "LOAD", 4, 0, 1);
+            set(Opcode::STORE, "STORE", 4, 1, 0);
+            set(Opcode::LOAD_ARG, "LOAD_ARG", 1, 0, 1);
+            set(Opcode::LOAD_0, "LOAD_0", 0, 0, 1);
+            set(Opcode::LOAD_1, "LOAD_1", 0, 0, 1);
+            set(Opcode::LOAD_2, "LOAD_2", 0, 0, 1);
+            set(Opcode::LOAD_3, "LOAD_3", 0, 0, 1);
+            set(Opcode::STORE_0, "STORE_0", 0, 1, 0);
+            set(Opcode::STORE_1, "STORE_1", 0, 1, 0);
+            set(Opcode::STORE_2, "STORE_2", 0, 1, 0);
+            set(Opcode::STORE_3, "STORE_3", 0, 1, 0);
+            set(Opcode::LOAD_V, "LOAD_V", 0, 0, 1, OP_VARINT);
+            set(Opcode::STORE_V, "STORE_V", 0, 1, 0, OP_VARINT);
+            set(Opcode::JMP, "JMP", 2, 0, 0, OP_BRANCH | OP_NO_FALL);
+            set(Opcode::JZ, "JZ", 2, 1, 0, OP_BRANCH);
+            set(Opcode::JNZ, "JNZ", 2, 1, 0, OP_BRANCH);
+            set(Opcode::CALL, "CALL", 5, -1, -1, OP_CALLS);
+            set(Opcode::RET, "RET", 0, -1, -1, OP_NO_FALL);
+            set(Opcode::TABLESWITCH, "TABLESWITCH", 12, 1, 0, OP_NO_FALL | OP_SWITCH);
+            set(Opcode::LOOKUPSWITCH, "LOOKUPSWITCH", 8, 1, 0, OP_NO_FALL | OP_SWITCH);
+            set(Opcode::CALL_V, "CALL_V", 1, -1, -1, OP_CALLS | OP_VARINT);
+            set(Opcode::SPAWN, "SPAWN", 5, -1, 1);
+            set(Opcode::YIELD, "YIELD", 0, 0, 0, OP_CALLS);
+            set(Opcode::JOIN, "JOIN", 0, 1, 1, OP_CALLS);
+            set(Opcode::CHANNEW, "CHANNEW", 1, 1, 1);
+            set(Opcode::SEND, "SEND", 0, 2, 0, OP_CALLS);
+            set(Opcode::RECV, "RECV", 0, 1, 1, OP_CALLS);
+            set(Opcode::ICMP_EQ, "ICMP_EQ", 0, 2, 1);
+            set(Opcode::ICMP_LT, "ICMP_LT", 0, 2, 1);
+            set(Opcode::ICMP_GT, "ICMP_GT", 0, 2, 1);
+            set(Opcode::FCMP_EQ, "FCMP_EQ", 0, 2, 1);
+            set(Opcode::FCMP_LT, "FCMP_LT", 0, 2, 1);
+            set(Opcode::FCMP_GT, "FCMP_GT", 0, 2, 1);
+            set(Opcode::ICMP_GEQ, "ICMP_GEQ", 0, 2, 1);
+            set(Opcode::ICMP_NEQ, "ICMP_NEQ", 0, 2, 1);
+            set(Opcode::ICMP_LEQ, "ICMP_LEQ", 0, 2, 1);
+            set(Opcode::FCMP_GEQ, "FCMP_GEQ", 0, 2, 1);
+            set(Opcode::FCMP_NEQ, "FCMP_NEQ", 0, 2, 1);
+            set(Opcode::FCMP_LEQ, "FCMP_LEQ", 0, 2, 1);
+            set(Opcode::NEW, "NEW", 1, 0, 1);
+            set(Opcode::GETFIELD, "GETFIELD", 1, 1, 1);
+            set(Opcode::PUTFIELD, "PUTFIELD", 1, 2, 0);
+            set(Opcode::INVOKEVIRTUAL, "INVOKEVIRTUAL", 5, -1, -1, OP_CALLS);
+            set(Opcode::INVOKESPECIAL, "INVOKESPECIAL", 0, 0, 0);
+            set(Opcode::ARENA_BEGIN, "ARENA_BEGIN", 0, 0, 0);
+            set(Opcode::ARENA_END, "ARENA_END", 0, 0, 0);
+            set(Opcode::SYS_CALL, "SYS_CALL", 1, -1, -1);
+            set(Opcode::NEWARRAY, "NEWARRAY", 1, 1, 1);
+            set(Opcode::ALOAD, "ALOAD", 0, 2, 1);
+            set(Opcode::ASTORE, "ASTORE", 0, 3, 0);
+            set(Opcode::ARRAYLENGTH, "ARRAYLENGTH", 0, 1, 1);
+            set(Opcode::ARRAYCOPY, "ARRAYCOPY", 0, 5, 0);
+            set(Opcode::ARRAYFILL, "ARRAYFILL", 0, 4, 0);
+            set(Opcode::ARRAYCMP, "ARRAYCMP", 0, 5, 1);
+            set(Opcode::ARRAYFIND, "ARRAYFIND", 0, 4, 1);
+            set(Opcode::ASORT, "ASORT", 0, 3, 0);
+            set(Opcode::ASORT_STABLE, "ASORT_STABLE", 0, 4, 0);
+            set(Opcode::ABSEARCH, "ABSEARCH", 0, 4, 1);
+            set(Opcode::APARTITION, "APARTITION", 0, 4, 1);
+            set(Opcode::VADD, "VADD", 0, 5, 0);
+            set(Opcode::VSUB, "VSUB", 0, 5, 0);
+            set(Opcode::VMUL, "VMUL", 0, 5, 0);
+            set(Opcode::VDIV, "VDIV", 0, 5, 0);
+            set(Opcode::VFMA, "VFMA", 0, 5, 0);
+            set(Opcode::VDOT, "VDOT", 0, 4, 1);
+            set(Opcode::VSUM, "VSUM", 0, 3, 1);
+            set(Opcode::VMIN, "VMIN", 0, 3, 1);
+            set(Opcode::VMAX, "VMAX", 0, 3, 1);
+            set(Opcode::MAPNEW, "MAPNEW", 1, 0, 1);
+            set(Opcode::MAPGET, "MAPGET", 0, 3, 1);
+            set(Opcode::MAPPUT, "MAPPUT", 0, 3, 0);
+            set(Opcode::MAPDEL, "MAPDEL", 0, 2, 1);
+            set(Opcode::MAPSIZE, "MAPSIZE", 0, 1, 1);
+            set(Opcode::MAPHAS, "MAPHAS", 0, 2, 1);
+            set(Opcode::MAPNEXT, "MAPNEXT", 0, 2, 1);
+            set(Opcode::MAPKEY, "MAPKEY", 0, 2, 1);
+            set(Opcode::MAPVAL, "MAPVAL", 0, 2, 1);
+            set(Opcode::CONCAT, "CONCAT", 0, 2, 1);
+            set(Opcode::EQUALS, "EQUALS", 0, 2, 1);
+            set(Opcode::COMPARE, "COMPARE", 0, 2, 1);
+            set(Opcode::SUBSTRING, "SUBSTRING", 0, 3, 1);
+            set(Opcode::INDEXOF, "INDEXOF", 0, 3, 1);
+            set(Opcode::HASH, "HASH", 0, 1, 1);
+            set(Opcode::INTERN, "INTERN", 0, 1, 1);
+            set(Opcode::STRLEN, "STRLEN", 0, 1, 1);
+            set(Opcode::CHARAT, "CHARAT", 0, 2, 1);
+            set(Opcode::NEWSTRING, "NEWSTRING", 0, 3, 1);
+            set(Opcode::STRCHARS, "STRCHARS", 0, 1, 1);
+            set(Opcode::LPUSH, "LPUSH", 8, 0, 2);
+            set(Opcode::LADD, "LADD", 0, 4, 2);
+            set(Opcode::LSUB, "LSUB", 0, 4, 2);
+            set(Opcode::LMUL, "LMUL", 0, 4, 2);
+            set(Opcode::LDIV, "LDIV", 0, 4, 2);
+            set(Opcode::LREM, "LREM", 0, 4, 2);
+            set(Opcode::LNEG, "LNEG", 0, 2, 2);
+            set(Opcode::LCMP, "LCMP", 0, 4, 1);
+            set(Opcode::DPUSH, "DPUSH", 8, 0, 2);
+            set(Opcode::DADD, "DADD", 0, 4, 2);
+            set(Opcode::DSUB, "DSUB", 0, 4, 2);
+            set(Opcode::DMUL, "DMUL", 0, 4, 2);
+            set(Opcode::DDIV, "DDIV", 0, 4, 2);
+            set(Opcode::DNEG, "DNEG", 0, 2, 2);
+            set(Opcode::DCMP, "DCMP", 0, 4, 1);
+            set(Opcode::WRET, "WRET", 0, -1, -1, OP_NO_FALL);
+            set(Opcode::I2L, "I2L", 0, 1, 2);
+            set(Opcode::L2I, "L2I", 0, 2, 1);
+            set(Opcode::L2D, "L2D", 0, 2, 2);
+            set(Opcode::D2L, "D2L", 0, 2, 2);
+            set(Opcode::I2D, "I2D", 0, 1, 2);
+            set(Opcode::D2I, "D2I", 0, 2, 1);
+            set(Opcode::F2D, "F2D", 0, 1, 2);
+            set(Opcode::D2F, "D2F", 0, 2, 1);
+            set(Opcode::WLOAD, "WLOAD", 4, 0, 2);
+            set(Opcode::WSTORE, "WSTORE", 4, 2, 0);
+            set(Opcode::DUP2, "DUP2", 0, 2, 4);
+            set(Opcode::POP2, "POP2", 0, 2, 0);
+            set(Opcode::WALOAD, "WALOAD", 0, 2, 2);
+            set(Opcode::WASTORE, "WASTORE", 0, 4, 0);
+            set(Opcode::WGETFIELD, "WGETFIELD", 1, 1, 2);
+            set(Opcode::WPUTFIELD, "WPUTFIELD", 1, 3, 0);
+            set(Opcode::FSQRT, "FSQRT", 0, 1, 1);
+            set(Opcode::FEXP, "FEXP", 0, 1, 1);
+            set(Opcode::FLOG, "FLOG", 0, 1, 1);
+            set(Opcode::FSIN, "FSIN", 0, 1, 1);
+            set(Opcode::FCOS, "FCOS", 0, 1, 1);
+            set(Opcode::FPOW, "FPOW", 0, 2, 1);
+            set(Opcode::VSQRT, "VSQRT", 0, 4, 0);
+            set(Opcode::VEXP, "VEXP", 0, 4, 0);
+            set(Opcode::VLOG, "VLOG", 0, 4, 0);
+            set(Opcode::VSIN, "VSIN", 0, 4, 0);
+            set(Opcode::VCOS, "VCOS", 0, 4, 0);
+            set(Opcode::VPOW, "VPOW", 0, 5, 0);
+            set(Opcode::ALOAD_UNCHECKED, "ALOAD_UNCHECKED", 0, 2, 1, OP_INTERNAL);
+            set(Opcode::ASTORE_UNCHECKED, "ASTORE_UNCHECKED", 0, 3, 0, OP_INTERNAL);
+        }
+    };
+
+    const OpcodeTable opcodeTable;
+
+    uint32_t read16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+    struct Transfer
+    {
+        uint32_t from;
+        uint32_t to;
+    };
+
+    // An ALOAD/ASTORE together with the locals its array and index operands
+    // were loaded from, or -1 when they come from anything else
+    struct Access
+    {
+        uint32_t pc;
+        int64_t arrayLocal;
+        int64_t indexLocal;
+    };
+}
+
+const OpcodeInfo *opcodeInfo(uint8_t opcode)
+{
+    const OpcodeInfo &info = opcodeTable.entries[opcode];
+    return info.name != nullptr ? &info : nullptr;
+}
+
+size_t readVarint(const uint8_t *p, const uint8_t *end, uint32_t &value)
+{
+    value = 0;
+    for (size_t i = 0; i < 5 && p + i < end; i++)
+    {
+        value |= static_cast<uint32_t>(p[i] & 0x7F) << (7 * i);
+        if (!(p[i] & 0x80))
+            return i + 1;
+    }
+    return 0;
+}
+
+size_t varintLength(uint32_t value)
+{
+    size_t length = 1;
+    for (; value >= 0x80; value >>= 7)
+        length++;
+    return length;
+}
+
+void writeVarint(std::vector<uint8_t> &out, uint32_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+bool loadOperand(const uint8_t *code, size_t pc, size_t size, uint32_t &local)
+{
+    Opcode op = static_cast<Opcode>(code[pc]);
+    if (op >= Opcode::LOAD_0 && op <= Opcode::LOAD_3)
+        local = code[pc] - static_cast<uint8_t>(Opcode::LOAD_0);
+    else if (op == Opcode::LOAD && pc + 5 <= size)
+        local = readWord(code + pc + 1);
+    else if (op != Opcode::LOAD_V || readVarint(code + pc + 1, code + size, local) == 0)
+        return false;
+    return true;
+}
+
+bool storeOperand(const uint8_t *code, size_t pc, size_t size, uint32_t &local)
+{
+    Opcode op = static_cast<Opcode>(code[pc]);
+    if (op >= Opcode::STORE_0 && op <= Opcode::STORE_3)
+        local = code[pc] - static_cast<uint8_t>(Opcode::STORE_0);
+    else if (op == Opcode::STORE && pc + 5 <= size)
+        local = readWord(code + pc + 1);
+    else if (op != Opcode::STORE_V || readVarint(code + pc + 1, code + size, local) == 0)
+        return false;
+    return true;
+}
+
+bool pushOperand(const uint8_t *code, size_t pc, size_t size, int32_t &value)
+{
+    Opcode op = static_cast<Opcode>(code[pc]);
+    if (op == Opcode::PUSH_I8 && pc + 2 <= size)
+        value = static_cast<int8_t>(code[pc + 1]);
+    else if (op == Opcode::PUSH_I16 && pc + 3 <= size)
+        value = static_cast<int16_t>(read16(code + pc + 1));
+    else if (op == Opcode::PUSH && pc + 5 <= size)
+        value = static_cast<int32_t>(readWord(code + pc + 1));
+    else
+        return false;
+    return true;
+}
+
+int64_t switchTableBytes(const uint8_t *code, size_t pc, size_t size)
+{
+    const OpcodeInfo *info = opcodeInfo(code[pc]);
+    if (pc + 1 + info->operandBytes > size)
+        return -1;
+    int64_t bytes;
+    if (code[pc] == static_cast<uint8_t>(Opcode::TABLESWITCH))
+    {
+        int64_t low = static_cast<int32_t>(readWord(code + pc + 5));
+        int64_t high = static_cast<int32_t>(readWord(code + pc + 9));
+        if (high < low)
+            return -1;
+        bytes = (high - low + 1) * 4;
+    }
+    else
+    {
+        bytes = static_cast<int64_t>(readWord(code + pc + 5)) * 8;
+    }
+    return pc + 1 + info->operandBytes + bytes <= size ? bytes : -1;
+}
+
+size_t instructionLength(const uint8_t *code, size_t pc, size_t size)
+{
+    const OpcodeInfo *info = opcodeInfo(code[pc]);
+    if (info == nullptr || pc + 1 + info->operandBytes > size)
+        return 0;
+    if (info->flags & OP_VARINT)
+    {
+        uint32_t value;
+        size_t varint = readVarint(code + pc + 1, code + size, value);
+        if (varint == 0 || pc + 1 + varint + info->operandBytes > size)
+            return 0;
+        return 1 + varint + info->operandBytes;
+    }
+    if (!(info->flags & OP_SWITCH))
+        return 1 + info->operandBytes;
+    int64_t table = switchTableBytes(code, pc, size);
+    return table < 0 ? 0 : 1 + info->operandBytes + static_cast<size_t>(table);
+}
+
+void disassemble(std::ostream &out, const uint8_t *code, size_t size)
+{
+    for (size_t pc = 0; pc < size;)
+    {
+        size_t length = instructionLength(code, pc, size);
+        if (length == 0)
+        {
+            out << std::setw(6) << pc << "  <" << static_cast<int>(code[pc]) << ": does not decode>\n";
+            return;
+        }
+        const OpcodeInfo *info = opcodeInfo(code[pc]);
+        const uint8_t *operands = code + pc + 1;
+        Opcode op = static_cast<Opcode>(code[pc]);
+        std::ostringstream line;
+        line << std::setw(6) << pc << "  " << info->name;
+        if (op == Opcode::TABLESWITCH)
+        {
+            int32_t low = static_cast<int32_t>(readWord(operands + 4));
+            int32_t high = static_cast<int32_t>(readWord(operands + 8));
+            line << " " << low << ".." << high << " default " << readWord(operands);
+            for (int64_t key = low; key <= high; key++)
+                line << "\n          " << key << ": " << readWord(operands + 12 + (key - low) * 4);
+        }
+        else if (op == Opcode::LOOKUPSWITCH)
+        {
+            uint32_t pairs = readWord(operands + 4);
+            line << " " << pairs << " keys default " << readWord(operands);
+            for (uint32_t i = 0; i < pairs; i++)
+                line << "\n          " << static_cast<int32_t>(readWord(operands + 8 + i * 8)) << ": " << readWord(operands + 12 + i * 8);
+        }
+        else if (op == Opcode::FPUSH)
+        {
+            float value;
+            std::memcpy(&value, operands, sizeof(value));
+            line << " " << std::setprecision(9) << value;
+        }
+        else if (op == Opcode::DPUSH)
+        {
+            double value;
+            std::memcpy(&value, operands, sizeof(value));
+            line << " " << std::setprecision(17) << value;
+        }
+        else if (op == Opcode::LPUSH)
+        {
+            line << " " << static_cast<int64_t>(readWord(operands) | (static_cast<uint64_t>(readWord(operands + 4)) << 32));
+        }
+        else if (info->flags & OP_VARINT) // LOAD_V, STORE_V local and CALL_V target, argc
+        {
+            uint32_t value;
+            size_t varint = readVarint(operands, code + size, value);
+            line << " " << value;
+            if (info->operandBytes == 1)
+                line << " " << static_cast<int>(operands[varint]);
+        }
+        else if (op == Opcode::PUSH_I8)
+        {
+            line << " " << static_cast<int>(static_cast<int8_t>(operands[0]));
+        }
+        else if (op == Opcode::PUSH_I16)
+        {
+            line << " " << static_cast<int16_t>(read16(operands));
+        }
+        else if (info->operandBytes == 1)
+        {
+            line << " " << static_cast<int>(operands[0]);
+        }
+        else if (info->operandBytes == 2)
+        {
+            line << " " << read16(operands);
+        }
+        else if (info->operandBytes == 4)
+        {
+            line << " " << static_cast<int32_t>(readWord(operands));
+        }
+        else if (info->operandBytes == 5) // CALL and SPAWN target, argc and INVOKEVIRTUAL class, method
+        {
+            line << " " << readWord(operands) << " " << static_cast<int>(operands[4]);
+        }
+        out << line.str() << "\n";
+        pc += length;
+    }
+}
+
+namespace
+{
+    // Decodes code linearly into its instruction starts and the targets of
+    // its branches, calls, spawns and switches, checking the switch tables.
+    // Returns the offset of the first byte that does not start a complete
+    // instruction, or size when all of it decodes.
+    size_t decode(const uint8_t *code, size_t size, std::vector<uint32_t> &starts, std::vector<Transfer> &transfers)
+    {
+        for (size_t pc = 0; pc < size;)
+        {
+            const OpcodeInfo *info = opcodeInfo(code[pc]);
+            size_t length = instructionLength(code, pc, size);
+            if (length == 0)
+                return pc;
+            if (info->flags & OP_INTERNAL)
+                throw std::runtime_error("Reserved opcode " + std::to_string(code[pc]) + " at offset " + std::to_string(pc));
+            starts.push_back(static_cast<uint32_t>(pc));
+            Opcode op = static_cast<Opcode>(code[pc]);
+            if (info->flags & OP_BRANCH)
+                transfers.push_back(Transfer{static_cast<uint32_t>(pc), read16(code + pc + 1)});
+            else if (op == Opcode::CALL || op == Opcode::SPAWN)
+                transfers.push_back(Transfer{static_cast<uint32_t>(pc), readWord(code + pc + 1)});
+            else if (op == Opcode::CALL_V)
+            {
+                uint32_t target;
+                readVarint(code + pc + 1, code + size, target);
+                transfers.push_back(Transfer{static_cast<uint32_t>(pc), target});
+            }
+            else if (op == Opcode::TABLESWITCH)
+            {
+                transfers.push_back(Transfer{static_cast<uint32_t>(pc), readWord(code + pc + 1)});
+                for (size_t at = pc + 13; at < pc + length; at += 4)
+                    transfers.push_back(Transfer{static_cast<uint32_t>(pc), readWord(code + at)});
+            }
+            else if (op == Opcode::LOOKUPSWITCH)
+            {
+                transfers.push_back(Transfer{static_cast<uint32_t>(pc), readWord(code + pc + 1)});
+                for (size_t at = pc + 9; at < pc + length; at += 8)
+                {
+                    if (at > pc + 9 && static_cast<int32_t>(readWord(code + at)) <= static_cast<int32_t>(readWord(code + at - 8)))
+                        throw std::runtime_error("LOOKUPSWITCH keys out of order at offset " + std::to_string(pc));
+                    transfers.push_back(Transfer{static_cast<uint32_t>(pc), readWord(code + at + 4)});
+                }
+            }
+            pc += length;
+        }
+        return size;
+    }
+}
+
+std::vector<uint8_t> verifyCode(const uint8_t *code, size_t size, const std::vector<uint32_t> &entries)
+{
+    std::vector<uint32_t> starts;
+    std::vector<Transfer> transfers;
+    size_t decoded = decode(code, size, starts, transfers);
+    if (decoded != size)
+        throw std::runtime_error("Code does not decode at offset " + std::to_string(decoded));
+
+    std::vector<uint8_t> marks(size + 1, 0);
+    for (uint32_t pc : starts)
+    {
+        marks[pc] |= CODE_START;
+        Opcode op = static_cast<Opcode>(code[pc]);
+        if (op == Opcode::CALL || op == Opcode::CALL_V || op == Opcode::INVOKEVIRTUAL)
+            marks[pc + instructionLength(code, pc, size)] |= CODE_RETURN_SITE;
+    }
+    // Running off the end of the code ends the run
+    marks[size] |= CODE_START;
+    for (const Transfer &t : transfers)
+    {
+        if (t.to > size || !(marks[t.to] & CODE_START))
+            throw std::runtime_error("Target " + std::to_string(t.to) + " of the instruction at offset " + std::to_string(t.from) +
+                                     " is not the start of an instruction");
+    }
+    for (uint32_t entry : entries)
+    {
+        if (entry >= size || !(marks[entry] & CODE_START))
+            throw std::runtime_error("Method offset " + std::to_string(entry) + " is not the start of an instruction");
+    }
+    return marks;
+}
+
+size_t eliminateBoundsChecks(uint8_t *code, size_t size, const std::vector<uint32_t> &entries)
+{
+    // verifyCode has accepted the code, so it decodes and every target and
+    // entry is the start of an instruction
+    std::vector<uint32_t> starts;
+    std::vector<Transfer> transfers;
+    decode(code, size, starts, transfers);
+    bool spawns = std::any_of(starts.begin(), starts.end(), [&](uint32_t pc)
+                              { return code[pc] == static_cast<uint8_t>(Opcode::SPAWN); });
+    if (spawns)
+        return 0;
+
+    std::vector<uint8_t> isTarget(size + 1, 0);
+    for (const Transfer &t : transfers)
+        isTarget[t.to] = 1;
+    for (uint32_t entry : entries)
+        isTarget[entry] = 1;
+
+    // Track where each operand stack value came from within a basic block
+    std::vector<Access> accesses;
+    std::vector<int64_t> origin;
+    for (uint32_t pc : starts)
+    {
+        if (isTarget[pc])
+            origin.clear();
+        const OpcodeInfo *info = opcodeInfo(code[pc]);
+        auto from = [&](size_t depth) -> int64_t
+        { return depth < origin.size() ? origin[origin.size() - 1 - depth] : -1; };
+
+        Opcode op = static_cast<Opcode>(code[pc]);
+        uint32_t local;
+        if (loadOperand(code, pc, size, local))
+        {
+            origin.push_back(local);
+            continue;
+        }
+        if (op == Opcode::DUP)
+        {
+            origin.push_back(from(0));
+            continue;
+        }
+        if (op == Opcode::ALOAD)
+            accesses.push_back(Access{pc, from(1), from(0)});
+        else if (op == Opcode::ASTORE)
+            accesses.push_back(Access{pc, from(2), from(1)});
+
+        if (info->pops < 0 || info->pushes < 0 || (info->flags & (OP_NO_FALL | OP_CALLS)))
+        {
+            origin.clear();
+            continue;
+        }
+        origin.resize(origin.size() - std::min<size_t>(origin.size(), info->pops));
+        origin.insert(origin.end(), info->pushes, -1);
+    }
+
+    // Instructions are matched by position in starts, so every encoding of
+    // LOAD, STORE and PUSH fits the pattern
+    auto is = [&](size_t at, Opcode op)
+    { return code[starts[at]] == static_cast<uint8_t>(op); };
+    auto loads = [&](size_t at, uint32_t &local)
+    { return loadOperand(code, starts[at], size, local); };
+    auto stores = [&](size_t at, uint32_t local)
+    { uint32_t stored; return storeOperand(code, starts[at], size, stored) && stored == local; };
+    auto pushes = [&](size_t at, int32_t &value)
+    { return pushOperand(code, starts[at], size, value); };
+    auto targeted = [&](size_t at)
+    { return isTarget[starts[at]] != 0; };
+
+    size_t rewritten = 0;
+    for (const Transfer &back : transfers)
+    {
+        if (code[back.from] != static_cast<uint8_t>(Opcode::JMP) || back.to >= back.from)
+            continue;
+        const size_t h = std::lower_bound(starts.begin(), starts.end(), back.to) - starts.begin();
+        const size_t b = std::lower_bound(starts.begin(), starts.end(), back.from) - starts.begin();
+        const uint32_t head = back.to;
+        const uint32_t exit = back.from + 3;
+
+        // LOAD i; LOAD a; ARRAYLENGTH; ICMP_LT; JZ exit
+        uint32_t index, array;
+        if (b < h + 5 + 4 || !loads(h, index) || !loads(h + 1, array) || !is(h + 2, Opcode::ARRAYLENGTH) ||
+            !is(h + 3, Opcode::ICMP_LT) || !is(h + 4, Opcode::JZ) || read16(code + starts[h + 4] + 1) != exit)
+            continue;
+        if (index == array || targeted(h + 1) || targeted(h + 2) || targeted(h + 3) || targeted(h + 4))
+            continue;
+        const uint32_t bodyStart = starts[h + 4];
+
+        // PUSH k; STORE i in front of the header, with k >= 0
+        int32_t initial;
+        if (h < 2 || !pushes(h - 2, initial) || initial < 0 || !stores(h - 1, index) || targeted(h - 1))
+            continue;
+
+        // LOAD i; PUSH 1; IADD; STORE i right before the back edge
+        uint32_t incremented;
+        int32_t step;
+        if (!loads(b - 4, incremented) || incremented != index || !pushes(b - 3, step) || step != 1 ||
+            !is(b - 2, Opcode::IADD) || !stores(b - 1, index) || targeted(b - 3) || targeted(b - 2) || targeted(b - 1))
+            continue;
+        const uint32_t increment = starts[b - 4];
+
+        // The loop is entered only through its initialisation
+        bool enteredFromOutside = std::any_of(transfers.begin(), transfers.end(), [&](const Transfer &t)
+                                              { return (t.from < head || t.from >= exit) && t.to >= head && t.to <= back.from; }) ||
+                                  std::any_of(entries.begin(), entries.end(), [&](uint32_t e)
+                                              { return e >= head && e <= back.from; });
+        if (enteredFromOutside)
+            continue;
+
+        // The body must leave i and a alone. Locals are shared by every
+        // frame, so it must not call out either, and ARENA_END could free
+        // the array while the loop still holds its reference.
+        bool bodySafe = true;
+        for (size_t at = h + 5; at < b - 4; at++)
+        {
+            uint32_t pc = starts[at];
+            const OpcodeInfo *info = opcodeInfo(code[pc]);
+            // WSTORE writes its local and the one after it
+            bool wide = code[pc] == static_cast<uint8_t>(Opcode::WSTORE);
+            uint32_t stored = wide ? readWord(code + pc + 1) : 0;
+            bool store = wide || storeOperand(code, pc, size, stored);
+            auto writes = [&](uint32_t local)
+            { return stored == local || (wide && stored + 1 == local); };
+            if ((info->flags & OP_CALLS) || code[pc] == static_cast<uint8_t>(Opcode::ARENA_END) ||
+                (store && (writes(index) || writes(array))))
+            {
+                bodySafe = false;
+                break;
+            }
+        }
+        if (!bodySafe)
+            continue;
+
+        for (const Access &access : accesses)
+        {
+            if (access.pc <= bodyStart || access.pc >= increment)
+                continue;
+            if (access.arrayLocal != array || access.indexLocal != index)
+                continue;
+            uint8_t &op = code[access.pc];
+            if (op == static_cast<uint8_t>(Opcode::ALOAD))
+                op = static_cast<uint8_t>(Opcode::ALOAD_UNCHECKED);
+            else if (op == static_cast<uint8_t>(Opcode::ASTORE))
+                op = static_cast<uint8_t>(Opcode::ASTORE_UNCHECKED);
+            else
+                continue;
+            rewritten++;
+        }
+    }
+    return rewritten;
+}
+
+std::vector<uint8_t> withBoundsChecks(const uint8_t *code, size_t size)
+{
+    std::vector<uint8_t> checked(code, code + size);
+    for (size_t pc = 0; pc < size;)
+    {
+        size_t length = instructionLength(code, pc, size);
+        if (length == 0)
+            break; // left for verifyCode to report
+        if (code[pc] == static_cast<uint8_t>(Opcode::ALOAD_UNCHECKED))
+            checked[pc] = static_cast<uint8_t>(Opcode::ALOAD);
+        else if (code[pc] == static_cast<uint8_t>(Opcode::ASTORE_UNCHECKED))
+            checked[pc] = static_cast<uint8_t>(Opcode::ASTORE);
+        pc += length;
+    }
+    return checked;
+}
@@ -0,0 +1,455 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <VM.hpp>
+#include <bytecode.hpp>
+#include <checkpoint.hpp>
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+std::atomic<uint32_t> VM::checkpointRequests{0};
+
+namespace
+{
+    void putBytes(std::vector<uint8_t> &out, const void *data, size_t size)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        out.insert(out.end(), bytes, bytes + size);
+        out.resize((out.size() + 3) & ~size_t(3), 0);
+    }
+
+    struct CheckpointReader
+    {
+        const uint8_t *bytes;
+        size_t size;
+        size_t pos;
+
+        uint32_t word()
+        {
+            return readWord(take(4));
+        }
+
+        // Whole words, as putBytes pads them
+        const uint8_t *take(size_t count)
+        {
+            size_t padded = (count + 3) & ~size_t(3);
+            if (padded < count || padded > size - pos)
+                throw std::runtime_error("Checkpoint error: Unexpected end of file");
+            const uint8_t *start = bytes + pos;
+            pos += padded;
+            return start;
+        }
+    };
+
+    // Start of a section, checked against the file
+    CheckpointReader section(const MappedFile &file, size_t headerPos, uint32_t &count)
+    {
+        size_t offset = readWord(file.data() + headerPos);
+        count = readWord(file.data() + headerPos + 4);
+        if (offset > file.size())
+            throw std::runtime_error("Checkpoint error: Section out of file bounds");
+        return CheckpointReader{file.data(), file.size(), offset};
+    }
+
+    // FNV-1a over what a checkpoint refers to: code offsets, constants and
+    // the numbering of classes and string constants
+    uint32_t programFingerprint(const Program &program)
+    {
+        uint32_t hash = 2166136261u;
+        auto mix = [&](uint32_t value)
+        {
+            for (int shift = 0; shift < 32; shift += 8)
+                hash = (hash ^ ((value >> shift) & 0xFF)) * 16777619u;
+        };
+        for (uint8_t byte : program.code())
+            hash = (hash ^ byte) * 16777619u;
+        for (size_t i = 0; i < program.constantCount(); i++)
+            mix(program.constant(i));
+        mix(static_cast<uint32_t>(program.classes().classCount()));
+        mix(static_cast<uint32_t>(program.strings().size()));
+        return hash;
+    }
+
+    // Reopening a file must not truncate what the program wrote before
+    const char *reopenMode(char mode)
+    {
+        switch (mode)
+        {
+        case 'r':
+            return "r";
+        case 'w':
+            return "r+";
+        case 'a':
+            return "a";
+        default:
+            throw std::runtime_error(std::string("Checkpoint error: Unsupported file mode ") + mode);
+        }
+    }
+}
+
+void VM::checkpointOnSignal(int signal)
+{
+    // Only an atomic counter is touched from the handler
+    std::signal(signal, [](int)
+                { checkpointRequests.fetch_add(1, std::memory_order_relaxed); });
+}
+
+void VM::checkpointOnRequest()
+{
+    // Arena objects cannot be restored one by one: wait until the region ends
+    if (objectFactory.arenaDepth() > 0)
+        return;
+    checkpointsSeen = checkpointRequests.load(std::memory_order_relaxed);
+    if (options.checkpointPath.empty())
+        return;
+    try
+    {
+        checkpoint(options.checkpointPath);
+        std::cerr << "Checkpoint written to " << options.checkpointPath << std::endl;
+    }
+    catch (const std::exception &ex)
+    {
+        // The run is worth more than the checkpoint
+        std::cerr << "VM error: " << ex.what() << std::endl;
+    }
+}
+
+void VM::checkpoint(const std::string &path)
+{
+    if (objectFactory.arenaDepth() > 0)
+        throw std::runtime_error("Checkpoint error: Inside an arena region");
+    // Only the running task's state is saved
+    if (tasksRunning())
+        throw std::runtime_error("Checkpoint error: Spawned tasks are still running");
+    // A cycle in progress keeps state in gcBits and the gray stack; finish it
+    if (gc.collecting())
+        gc.collect(RootSpan{stack.data(), stack.size(), &stack}, RootSpan{locals.data(), locals.used()});
+
+    std::vector<uint8_t> out(CHECKPOINT_HEADER_SIZE, 0);
+    std::copy(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + 4, out.begin());
+    patchWord(out, 4, CHECKPOINT_VERSION);
+    patchWord(out, 8, programFingerprint(*program));
+    patchWord(out, 12, ip);
+    patchWord(out, 16, fp);
+    patchWord(out, 20, args_to_pop);
+    patchWord(out, 24, heap.size());
+    patchWord(out, 28, loadedRefs);
+
+    beginSection(out, 32, stack.size());
+    for (size_t i = 0; i < stack.size(); i++)
+        putWord(out, stack[i]);
+
+    beginSection(out, 40, locals.used());
+    for (size_t i = 0; i < locals.used(); i++)
+        putWord(out, locals.data()[i]);
+
+    std::vector<bool> instantiated(classes.classCount());
+    for (size_t ref = loadedRefs; ref < heap.size(); ref++)
+    {
+        if (heap[ref] != nullptr && ObjectFactory::header(heap[ref])->classId < instantiated.size())
+            instantiated[ObjectFactory::header(heap[ref])->classId] = true;
+    }
+    beginSection(out, 48, std::count(instantiated.begin(), instantiated.end(), true));
+    for (size_t id = 0; id < instantiated.size(); id++)
+    {
+        if (!instantiated[id])
+            continue;
+        const std::string &name = classes.getClassInfo(static_cast<uint16_t>(id))->name;
+        putWord(out, static_cast<uint32_t>(id));
+        putWord(out, static_cast<uint32_t>(name.size()));
+        putBytes(out, name.data(), name.size());
+    }
+
+    size_t objectsPos = out.size();
+    size_t objectCount = 0;
+    for (size_t ref = loadedRefs; ref < heap.size(); ref++)
+    {
+        void *object = heap[ref];
+        if (object == nullptr)
+            continue;
+        const ObjectHeader *hdr = ObjectFactory::header(object);
+        if (hdr->gcBits & GC_ARENA)
+            throw std::runtime_error("Checkpoint error: Arena object outside an arena region");
+        objectCount++;
+        putWord(out, static_cast<uint32_t>(ref));
+        putWord(out, hdr->classId | (static_cast<uint32_t>(hdr->gcBits & ~GC_COLOR_MASK) << 16) |
+                         (static_cast<uint32_t>(hdr->elementType) << 24));
+        if (hdr->classId == ARRAY_CLASS_ID)
+        {
+            uint32_t length = ObjectFactory::arrayLength(object);
+            putWord(out, length);
+            putWord(out, 0);
+            putBytes(out, object, static_cast<size_t>(length) * ObjectFactory::fieldSize(hdr->elementType));
+        }
+        else if (hdr->classId == STRING_CLASS_ID)
+        {
+            uint32_t length = ObjectFactory::stringLength(object);
+            putWord(out, length);
+            putWord(out, ObjectFactory::stringHash(object));
+            putBytes(out, object, length);
+        }
+        else if (hdr->classId == CHANNEL_CLASS_ID)
+        {
+            uint32_t capacity = ObjectFactory::channelCapacity(object);
+            putWord(out, capacity);
+            putWord(out, 0);
+            putBytes(out, object, sizeof(ChannelState) + static_cast<size_t>(capacity) * sizeof(uint32_t));
+        }
+        else if (hdr->classId == MAP_CLASS_ID)
+        {
+            // The table holds pointers; its entries are what gets restored
+            const HashMap &map = ObjectFactory::map(object);
+            putWord(out, static_cast<uint32_t>(map.size()));
+            putWord(out, static_cast<uint32_t>(map.kind()));
+            for (int64_t idx = map.next(0); idx >= 0; idx = map.next(static_cast<size_t>(idx) + 1))
+            {
+                const MapSlot &slot = map.slot(static_cast<size_t>(idx));
+                putWord(out, slot.key);
+                putWord(out, slot.value);
+                putWord(out, slot.hash);
+            }
+        }
+        else
+        {
+            size_t size = classes.getClassInfo(hdr->classId)->objectSize;
+            putWord(out, static_cast<uint32_t>(size));
+            putWord(out, 0);
+            putBytes(out, object, size);
+        }
+    }
+    patchWord(out, 56, objectsPos);
+    patchWord(out, 60, objectCount);
+
+    beginSection(out, 64, gc.freeReferences().size());
+    for (int32_t ref : gc.freeReferences())
+        putWord(out, static_cast<uint32_t>(ref));
+
+    beginSection(out, 72, internTable.size());
+    for (int64_t idx = internTable.next(0); idx >= 0; idx = internTable.next(static_cast<size_t>(idx) + 1))
+    {
+        const MapSlot &slot = internTable.slot(static_cast<size_t>(idx));
+        putWord(out, slot.key);
+        putWord(out, slot.value);
+        putWord(out, slot.hash);
+    }
+
+    // Positions are only meaningful once buffered writes reach the files
+    size_t filesPos = out.size();
+    size_t fileCount = 0;
+    for (size_t fd = 0; fd < fileData.size(); fd++)
+    {
+        if (fileData[fd] != nullptr)
+            fflush(fileData[fd]);
+        if (fd < 3 || fileData[fd] == nullptr)
+            continue;
+        long position = ftell(fileData[fd]);
+        if (position < 0)
+            throw std::runtime_error("Checkpoint error: File descriptor " + std::to_string(fd) + " has no position");
+        fileCount++;
+        const OpenFile &file = openFiles.at(fd);
+        putWord(out, static_cast<uint32_t>(fd));
+        putWord(out, static_cast<uint8_t>(file.mode));
+        putWord(out, static_cast<uint32_t>(static_cast<uint64_t>(position)));
+        putWord(out, static_cast<uint32_t>(static_cast<uint64_t>(position) >> 32));
+        putWord(out, static_cast<uint32_t>(file.path.size()));
+        putBytes(out, file.path.data(), file.path.size());
+    }
+    patchWord(out, 80, filesPos);
+    patchWord(out, 84, fileCount);
+
+    // Replace an earlier checkpoint only once this one is complete
+    std::string partial = path + ".partial";
+    FILE *file = fopen(partial.c_str(), "wb");
+    if (file == nullptr)
+        throw std::runtime_error("Checkpoint error: Cannot create " + partial);
+    bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+    written = fclose(file) == 0 && written;
+    if (!written || std::rename(partial.c_str(), path.c_str()) != 0)
+    {
+        std::remove(partial.c_str());
+        throw std::runtime_error("Checkpoint error: Cannot write " + path);
+    }
+    DBG("Checkpoint of " << objectCount << " objects, " << out.size() << " bytes, to " << path);
+}
+
+void VM::restore(const std::string &path)
+{
+    MappedFile file(path);
+    if (file.size() < CHECKPOINT_HEADER_SIZE || !std::equal(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + 4, file.data()))
+        throw std::runtime_error("Checkpoint error: " + path + " is not a checkpoint");
+    const uint8_t *header = file.data();
+    if ((readWord(header + 4) & 0xFFFF) != CHECKPOINT_VERSION)
+        throw std::runtime_error("Checkpoint error: Unsupported checkpoint version");
+    if (readWord(header + 8) != programFingerprint(*program))
+        throw std::runtime_error("Checkpoint error: Checkpoint was taken from a different program");
+    if (readWord(header + 28) != loadedRefs)
+        throw std::runtime_error("Checkpoint error: String constant count mismatch");
+    size_t heapSize = readWord(header + 24);
+    if (heapSize < loadedRefs)
+        throw std::runtime_error("Checkpoint error: Heap smaller than its string constants");
+
+    endTasks();
+    gc.reset(loadedRefs);
+    for (int64_t idx = internTable.next(0); idx >= 0; idx = internTable.next(static_cast<size_t>(idx) + 1))
+        internTable.erase(static_cast<size_t>(idx));
+    for (size_t fd = 3; fd < fileData.size(); fd++)
+    {
+        if (fileData[fd] != nullptr)
+            fclose(fileData[fd]);
+        fileData[fd] = nullptr;
+        openFiles[fd] = OpenFile();
+    }
+
+    uint32_t count;
+    CheckpointReader reader = section(file, 32, count);
+    stack.clear();
+    for (uint32_t i = 0; i < count; i++)
+        push(reader.word());
+
+    reader = section(file, 40, count);
+    locals.clear();
+    for (uint32_t i = 0; i < count; i++)
+        locals.at(i) = reader.word();
+
+    reader = section(file, 48, count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t classId = reader.word();
+        uint32_t length = reader.word();
+        std::string name(reinterpret_cast<const char *>(reader.take(length)), length);
+        if (classId >= classes.classCount() || classes.resolveClass(static_cast<uint16_t>(classId)).name != name)
+            throw std::runtime_error("Checkpoint error: Class " + name + " is not class " + std::to_string(classId) + " of the program");
+    }
+
+    heap.resize(heapSize, nullptr);
+    // Every object goes into heap[ref] as soon as it is created, before its
+    // record is read, so a malformed record cannot leak it
+    reader = section(file, 56, count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t ref = reader.word();
+        uint32_t headerWord = reader.word();
+        uint32_t length = reader.word();
+        uint32_t extra = reader.word();
+        if (ref < loadedRefs || ref >= heapSize || heap[ref] != nullptr)
+            throw std::runtime_error("Checkpoint error: Object reference " + std::to_string(ref) + " out of place");
+        uint16_t classId = static_cast<uint16_t>(headerWord);
+        FieldType elementType = static_cast<FieldType>(headerWord >> 24);
+        void *object;
+        if (classId == ARRAY_CLASS_ID)
+        {
+            size_t elementSize = ObjectFactory::fieldSize(elementType);
+            if (elementSize == 0 || length > (reader.size - reader.pos) / elementSize)
+                throw std::runtime_error("Checkpoint error: Malformed array record");
+            object = objectFactory.createArray(elementType, length);
+            heap[ref] = object;
+            std::memcpy(object, reader.take(static_cast<size_t>(length) * elementSize), static_cast<size_t>(length) * elementSize);
+        }
+        else if (classId == STRING_CLASS_ID)
+        {
+            if (length > reader.size - reader.pos)
+                throw std::runtime_error("Checkpoint error: Malformed string record");
+            object = objectFactory.createString(length);
+            heap[ref] = object;
+            std::memcpy(object, reader.take(length), length);
+            ObjectFactory::stringHash(object) = extra;
+        }
+        else if (classId == CHANNEL_CLASS_ID)
+        {
+            if (ObjectFactory::fieldSize(elementType) != sizeof(uint32_t) || length == 0 ||
+                length > (reader.size - reader.pos) / sizeof(uint32_t))
+                throw std::runtime_error("Checkpoint error: Malformed channel record");
+            object = objectFactory.createChannel(elementType, length);
+            heap[ref] = object;
+            std::memcpy(object, reader.take(sizeof(ChannelState) + static_cast<size_t>(length) * sizeof(uint32_t)),
+                        sizeof(ChannelState) + static_cast<size_t>(length) * sizeof(uint32_t));
+            const ChannelState &state = ObjectFactory::channel(object);
+            if (state.head >= length || state.count > length)
+                throw std::runtime_error("Checkpoint error: Malformed channel record");
+        }
+        else if (classId == MAP_CLASS_ID)
+        {
+            MapKind kind = static_cast<MapKind>(extra);
+            if (kind != MapKind::INT_INT && kind != MapKind::INT_REF && kind != MapKind::STRING_REF)
+                throw std::runtime_error("Checkpoint error: Malformed map record");
+            object = objectFactory.createMap(kind);
+            heap[ref] = object;
+            HashMap &map = ObjectFactory::map(object);
+            for (uint32_t entry = 0; entry < length; entry++)
+            {
+                uint32_t key = reader.word(), value = reader.word(), hash = reader.word();
+                bool inserted;
+                // Keys were distinct when written
+                size_t idx = map.insert(hash, key, [](uint32_t)
+                                        { return false; }, inserted);
+                map.slot(idx).value = value;
+            }
+        }
+        else
+        {
+            if (classId >= classes.classCount())
+                throw std::runtime_error("Checkpoint error: Unknown class id " + std::to_string(classId));
+            object = objectFactory.createObject(classId);
+            heap[ref] = object;
+            size_t size = classes.getClassInfo(classId)->objectSize;
+            if (length != size)
+                throw std::runtime_error("Checkpoint error: Object size of class " + std::to_string(classId) + " changed");
+            std::memcpy(object, reader.take(size), size);
+        }
+        ObjectFactory::header(object)->gcBits = static_cast<uint8_t>(headerWord >> 16) & GC_CONSTANT;
+    }
+
+    reader = section(file, 64, count);
+    std::vector<int32_t> freeList;
+    freeList.reserve(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t ref = reader.word();
+        if (ref >= heapSize || heap[ref] != nullptr)
+            throw std::runtime_error("Checkpoint error: Free reference " + std::to_string(ref) + " is in use");
+        freeList.push_back(static_cast<int32_t>(ref));
+    }
+    gc.restoreState(std::move(freeList));
+
+    reader = section(file, 72, count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t key = reader.word(), value = reader.word(), hash = reader.word();
+        bool inserted;
+        size_t idx = internTable.insert(hash, key, [](uint32_t)
+                                        { return false; }, inserted);
+        internTable.slot(idx).value = value;
+    }
+
+    reader = section(file, 80, count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t fd = reader.word();
+        char mode = static_cast<char>(reader.word());
+        uint64_t position = reader.word();
+        position |= static_cast<uint64_t>(reader.word()) << 32;
+        uint32_t length = reader.word();
+        std::string name(reinterpret_cast<const char *>(reader.take(length)), length);
+        if (fd < 3 || fd >= fileData.size() || fileData[fd] != nullptr)
+            throw std::runtime_error("Checkpoint error: File descriptor " + std::to_string(fd) + " out of range");
+        FILE *f = fopen(name.c_str(), reopenMode(mode));
+        if (f == nullptr)
+            throw std::runtime_error("Checkpoint error: Cannot reopen " + name);
+        fileData[fd] = f;
+        openFiles[fd] = OpenFile{name, mode};
+        if (fseek(f, static_cast<long>(position), SEEK_SET) != 0)
+            throw std::runtime_error("Checkpoint error: Cannot seek " + name);
+    }
+
+    ip = readWord(header + 12);
+    if (ip > code.size() || !(codeMarks[ip] & CODE_START))
+        throw std::runtime_error("Checkpoint error: Saved ip " + std::to_string(ip) + " is not the start of an instruction");
+    fp = readWord(header + 16);
+    args_to_pop = static_cast<uint16_t>(readWord(header + 20));
+    gcCountdown = gc.sliceInstructions();
+    exited = false;
+    exitCode = 0;
+    DBG("Restored " << path << " at ip " << ip);
+}
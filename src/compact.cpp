@@ -0,0 +1,331 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <compact.hpp>
+#include <bytecode.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    enum class Form : uint8_t
+    {
+        COPY,   // unchanged apart from its targets
+        PUSH,   // PUSH_I8, PUSH_I16 or PUSH
+        LOAD,   // LOAD_n, LOAD_V or LOAD
+        STORE,  // STORE_n, STORE_V or STORE
+        CALL,   // CALL_V
+    };
+
+    struct Instruction
+    {
+        uint32_t pc;     // offset in the input
+        uint32_t length; // length in the input
+        Form form;
+        uint32_t operand; // value, local or call target
+        uint32_t newLength = 0;
+    };
+
+    uint32_t shortLength(const Instruction &insn)
+    {
+        int32_t value = static_cast<int32_t>(insn.operand);
+        switch (insn.form)
+        {
+        case Form::PUSH:
+            return value >= -128 && value <= 127 ? 2 : value >= -32768 && value <= 32767 ? 3 : 5;
+        case Form::LOAD:
+        case Form::STORE:
+            return insn.operand < 4 ? 1 : static_cast<uint32_t>(std::min<size_t>(1 + varintLength(insn.operand), 5));
+        default:
+            return insn.length;
+        }
+    }
+}
+
+std::vector<uint8_t> compactBinary(const uint8_t *binary, size_t size, CompactStats *stats)
+{
+    if (size < 44)
+        throw std::runtime_error("File too small to be a valid VM executable");
+    const uint8_t magic[4] = {0x56, 0x4D, 0x00, 0x01};
+    if (!std::equal(binary, binary + 4, magic))
+        throw std::runtime_error("Invalid VM file magic number");
+
+    uint32_t versionWord = readWord(binary + 4);
+    uint16_t version = versionWord & 0xFFFF;
+    if (version != FORMAT_VERSION && version != FORMAT_VERSION_COMPACT)
+        throw std::runtime_error("Unsupported VM version");
+    uint32_t entryPoint = readWord(binary + 8);
+    uint32_t sections[4][2];
+    const char *sectionNames[4] = {"Constant pool", "Code", "Globals", "Class metadata"};
+    for (int i = 0; i < 4; i++)
+    {
+        sections[i][0] = readWord(binary + 12 + i * 8);
+        sections[i][1] = readWord(binary + 16 + i * 8);
+        if (static_cast<uint64_t>(sections[i][0]) + sections[i][1] > size)
+            throw std::runtime_error(std::string(sectionNames[i]) + " section out of file bounds");
+    }
+    const uint8_t *code = binary + sections[1][0];
+    const size_t codeSize = sections[1][1];
+
+    // Decode every instruction; offsets that start none stay at -1
+    std::vector<Instruction> instructions;
+    std::vector<int64_t> indexAt(codeSize + 1, -1);
+    for (size_t pc = 0; pc < codeSize;)
+    {
+        size_t length = instructionLength(code, pc, codeSize);
+        if (length == 0)
+            throw std::runtime_error("Code does not decode at offset " + std::to_string(pc));
+        const OpcodeInfo *info = opcodeInfo(code[pc]);
+        if (info->flags & OP_INTERNAL)
+            throw std::runtime_error("Reserved opcode " + std::to_string(code[pc]) + " at offset " + std::to_string(pc));
+
+        Instruction insn{static_cast<uint32_t>(pc), static_cast<uint32_t>(length), Form::COPY, 0};
+        int32_t value;
+        if (pushOperand(code, pc, codeSize, value))
+        {
+            insn.form = Form::PUSH;
+            insn.operand = static_cast<uint32_t>(value);
+        }
+        else if (loadOperand(code, pc, codeSize, insn.operand))
+            insn.form = Form::LOAD;
+        else if (storeOperand(code, pc, codeSize, insn.operand))
+            insn.form = Form::STORE;
+        else if (code[pc] == static_cast<uint8_t>(Opcode::CALL))
+        {
+            insn.form = Form::CALL;
+            insn.operand = readWord(code + pc + 1);
+        }
+        else if (code[pc] == static_cast<uint8_t>(Opcode::CALL_V))
+        {
+            insn.form = Form::CALL;
+            readVarint(code + pc + 1, code + codeSize, insn.operand);
+        }
+        insn.newLength = shortLength(insn);
+        indexAt[pc] = static_cast<int64_t>(instructions.size());
+        instructions.push_back(insn);
+        pc += length;
+    }
+    indexAt[codeSize] = static_cast<int64_t>(instructions.size());
+
+    auto checkTarget = [&](uint32_t target, uint32_t from)
+    {
+        if (target > codeSize || indexAt[target] < 0)
+            throw std::runtime_error("Target " + std::to_string(target) + " of the instruction at offset " + std::to_string(from) + " is not an instruction");
+    };
+    for (const Instruction &insn : instructions)
+    {
+        if (insn.form == Form::CALL)
+            checkTarget(insn.operand, insn.pc);
+    }
+
+    // Lay out, then grow every call whose target moved out of its varint's
+    // reach. Lengths only grow, so this settles.
+    std::vector<uint32_t> newOffset(instructions.size() + 1);
+    auto layout = [&]()
+    {
+        uint32_t offset = 0;
+        for (size_t i = 0; i < instructions.size(); i++)
+        {
+            newOffset[i] = offset;
+            offset += instructions[i].newLength;
+        }
+        newOffset[instructions.size()] = offset;
+    };
+    auto moved = [&](uint32_t target)
+    { return newOffset[indexAt[target]]; };
+    for (Instruction &insn : instructions)
+    {
+        if (insn.form == Form::CALL)
+            insn.newLength = static_cast<uint32_t>(2 + varintLength(0));
+    }
+    for (bool grown = true; grown;)
+    {
+        layout();
+        grown = false;
+        for (Instruction &insn : instructions)
+        {
+            if (insn.form != Form::CALL)
+                continue;
+            uint32_t length = static_cast<uint32_t>(2 + varintLength(moved(insn.operand)));
+            if (length > insn.newLength)
+            {
+                insn.newLength = length;
+                grown = true;
+            }
+        }
+    }
+
+    std::vector<uint8_t> newCode;
+    newCode.reserve(newOffset.back());
+    for (const Instruction &insn : instructions)
+    {
+        const uint8_t *source = code + insn.pc;
+        Opcode op = static_cast<Opcode>(source[0]);
+        int32_t value = static_cast<int32_t>(insn.operand);
+        switch (insn.form)
+        {
+        case Form::PUSH:
+            if (insn.newLength == 2)
+            {
+                newCode.push_back(static_cast<uint8_t>(Opcode::PUSH_I8));
+                newCode.push_back(static_cast<uint8_t>(value));
+            }
+            else if (insn.newLength == 3)
+            {
+                newCode.push_back(static_cast<uint8_t>(Opcode::PUSH_I16));
+                newCode.push_back(static_cast<uint8_t>(value));
+                newCode.push_back(static_cast<uint8_t>(value >> 8));
+            }
+            else
+            {
+                newCode.push_back(static_cast<uint8_t>(Opcode::PUSH));
+                putWord(newCode, insn.operand);
+            }
+            break;
+        case Form::LOAD:
+        case Form::STORE:
+        {
+            bool load = insn.form == Form::LOAD;
+            if (insn.newLength == 1)
+            {
+                newCode.push_back(static_cast<uint8_t>(load ? Opcode::LOAD_0 : Opcode::STORE_0) + insn.operand);
+            }
+            else if (insn.newLength < 5)
+            {
+                newCode.push_back(static_cast<uint8_t>(load ? Opcode::LOAD_V : Opcode::STORE_V));
+                writeVarint(newCode, insn.operand);
+            }
+            else
+            {
+                newCode.push_back(static_cast<uint8_t>(load ? Opcode::LOAD : Opcode::STORE));
+                putWord(newCode, insn.operand);
+            }
+            break;
+        }
+        case Form::CALL:
+        {
+            // A call may keep a longer varint than its target needs, so the
+            // padding is written as continuation bytes
+            uint32_t target = moved(insn.operand);
+            size_t varint = insn.newLength - 2;
+            newCode.push_back(static_cast<uint8_t>(Opcode::CALL_V));
+            for (size_t i = 0; i < varint; i++)
+            {
+                uint8_t bits = static_cast<uint8_t>((target >> (7 * i)) & 0x7F);
+                newCode.push_back(i + 1 < varint ? bits | 0x80 : bits);
+            }
+            newCode.push_back(source[insn.length - 1]);
+            break;
+        }
+        case Form::COPY:
+        {
+            size_t at = newCode.size();
+            newCode.insert(newCode.end(), source, source + insn.length);
+            const OpcodeInfo *info = opcodeInfo(source[0]);
+            if (info->flags & OP_BRANCH)
+            {
+                uint32_t target = source[1] | (source[2] << 8);
+                checkTarget(target, insn.pc);
+                newCode[at + 1] = static_cast<uint8_t>(moved(target));
+                newCode[at + 2] = static_cast<uint8_t>(moved(target) >> 8);
+            }
+            else if (op == Opcode::SPAWN)
+            {
+                uint32_t target = readWord(source + 1);
+                checkTarget(target, insn.pc);
+                patchWord(newCode, at + 1, moved(target));
+            }
+            else if (op == Opcode::TABLESWITCH || op == Opcode::LOOKUPSWITCH)
+            {
+                // The default, then every target of the table; both kinds
+                // have their first target 13 bytes in
+                size_t stride = op == Opcode::TABLESWITCH ? 4 : 8;
+                std::vector<size_t> targets{1};
+                for (size_t t = 13; t < insn.length; t += stride)
+                    targets.push_back(t);
+                for (size_t t : targets)
+                {
+                    uint32_t target = readWord(source + t);
+                    checkTarget(target, insn.pc);
+                    patchWord(newCode, at + t, moved(target));
+                }
+            }
+            break;
+        }
+        }
+    }
+
+    // Method offsets are the only code offsets outside the code
+    std::vector<uint8_t> classes(binary + sections[3][0], binary + sections[3][0] + sections[3][1]);
+    if (!classes.empty())
+    {
+        size_t at = 0;
+        auto need = [&](size_t bytes)
+        {
+            if (bytes > classes.size() - at)
+                throw std::runtime_error("Class metadata exceeds its section");
+        };
+        need(4);
+        uint32_t classCount = readWord(&classes[at]);
+        at += 4;
+        for (uint32_t c = 0; c < classCount; c++)
+        {
+            need(1);
+            at += 1 + classes[at];
+            need(8);
+            uint32_t fieldCount = readWord(&classes[at + 4]);
+            at += 8;
+            for (uint32_t f = 0; f < fieldCount; f++)
+            {
+                need(1);
+                at += 1 + classes[at];
+                need(1);
+                at += 1;
+            }
+            need(4);
+            uint32_t methodCount = readWord(&classes[at]);
+            at += 4;
+            for (uint32_t m = 0; m < methodCount; m++)
+            {
+                need(1);
+                at += 1 + classes[at];
+                need(4);
+                uint32_t offset = readWord(&classes[at]);
+                checkTarget(offset, offset);
+                patchWord(classes, at, moved(offset));
+                at += 4;
+            }
+        }
+    }
+    checkTarget(entryPoint, entryPoint);
+
+    std::vector<uint8_t> out(binary, binary + 4);
+    putWord(out, FORMAT_VERSION_COMPACT | (versionWord & 0xFFFF0000));
+    putWord(out, moved(entryPoint));
+    const std::vector<uint8_t> contents[4] = {
+        std::vector<uint8_t>(binary + sections[0][0], binary + sections[0][0] + sections[0][1]),
+        newCode,
+        std::vector<uint8_t>(binary + sections[2][0], binary + sections[2][0] + sections[2][1]),
+        classes,
+    };
+    uint32_t offset = 44;
+    for (const std::vector<uint8_t> &section : contents)
+    {
+        putWord(out, offset);
+        putWord(out, static_cast<uint32_t>(section.size()));
+        offset += static_cast<uint32_t>(section.size());
+    }
+    for (const std::vector<uint8_t> &section : contents)
+        out.insert(out.end(), section.begin(), section.end());
+
+    if (stats != nullptr)
+    {
+        stats->codeBefore = codeSize;
+        stats->codeAfter = newCode.size();
+        stats->instructions = instructions.size();
+        stats->shortened = std::count_if(instructions.begin(), instructions.end(), [](const Instruction &insn)
+                                         { return insn.newLength < insn.length; });
+    }
+    return out;
+}
@@ -0,0 +1,108 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <VM.hpp>
+#include <cstring>
+
+VMValue VM::invoke(const MethodHandle &method, const std::vector<VMValue> &args, FieldType resultType)
+{
+    if (method.offset >= code.size())
+    {
+        throw std::runtime_error("Invoke error: Method offset " + std::to_string(method.offset) + " out of code segment bounds");
+    }
+
+    // The frame CALL would build: arguments pushed last first, so that
+    // LOAD_ARG 0 is the first one, wide ones low word first as LPUSH leaves
+    // them, then the return address and the old FP
+    endTasks();
+    stack.clear();
+    size_t slots = 0;
+    for (auto arg = args.rbegin(); arg != args.rend(); ++arg)
+    {
+        if (arg->wide())
+        {
+            uint64_t bits = static_cast<uint64_t>(arg->longValue);
+            push(static_cast<uint32_t>(bits));
+            push(static_cast<uint32_t>(bits >> 32));
+            slots += 2;
+        }
+        else
+        {
+            push(static_cast<uint32_t>(arg->intValue));
+            slots++;
+        }
+    }
+    if (slots > 0xFF)
+    {
+        throw std::runtime_error("Invoke error: More than 255 argument slots");
+    }
+    args_to_pop = static_cast<uint16_t>(slots);
+    push(RETURN_TO_HOST);
+    push(0);
+    fp = static_cast<uint32_t>(stack.size()) - 1;
+    ip = method.offset;
+    exited = false;
+    exitCode = 0;
+
+    executeGuarded();
+
+    if (exited)
+    {
+        throw std::runtime_error("Invoke error: Program exited with status " + std::to_string(exitCode));
+    }
+    if (ip != RETURN_TO_HOST)
+    {
+        throw std::runtime_error("Invoke error: Method ran off the end of the code");
+    }
+
+    VMValue result;
+    result.type = resultType;
+    if (result.wide())
+    {
+        if (stack.size() < 2)
+            throw std::runtime_error("Invoke error: Method returned no wide value");
+        uint64_t high = pop();
+        result.longValue = static_cast<int64_t>((high << 32) | pop());
+    }
+    else
+    {
+        if (stack.empty())
+            throw std::runtime_error("Invoke error: Method returned no value");
+        result.intValue = static_cast<int32_t>(pop());
+    }
+    // Arguments of a frame that made calls of its own are left behind by RET
+    stack.clear();
+    fp = 0;
+    DBG("Invoke of offset " << method.offset << " returned " << result.longValue);
+    return result;
+}
+
+void VM::resetHeap()
+{
+    endTasks();
+    gc.reset(loadedRefs);
+    for (int64_t idx = internTable.next(0); idx >= 0; idx = internTable.next(static_cast<size_t>(idx) + 1))
+    {
+        if (internTable.slot(static_cast<size_t>(idx)).key >= loadedRefs)
+            internTable.erase(static_cast<size_t>(idx));
+    }
+
+    locals.clear();
+    for (size_t i = 0; i < program->globals().size(); i++)
+        locals.at(i) = program->globals()[i];
+    stack.clear();
+    fp = 0;
+    DBG("Heap reset to " << loadedRefs << " constants");
+}
+
+int32_t VM::newString(const std::string &value)
+{
+    void *string = objectFactory.createString(static_cast<uint32_t>(value.size()));
+    std::memcpy(string, value.data(), value.size());
+    return gc.track(string);
+}
+
+std::string VM::stringValue(int32_t stringRef)
+{
+    return textAt(stringRef, "Invoke");
+}
@@ -0,0 +1,508 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <gc.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using Clock = std::chrono::steady_clock;
+
+GarbageCollector::GarbageCollector(std::vector<void *> &heap, ObjectFactory &factory)
+    : heap(heap), factory(factory)
+{
+}
+
+int32_t GarbageCollector::track(void *object)
+{
+    int32_t ref;
+    if (!freeRefs.empty())
+    {
+        ref = freeRefs.back();
+        freeRefs.pop_back();
+        heap[ref] = object;
+    }
+    else
+    {
+        heap.push_back(object);
+        ref = static_cast<int32_t>(heap.size() - 1);
+        // Marking can gray every object and sweeping can free every slot.
+        // Both lists grow with the heap, here, so that neither is copied
+        // inside a slice.
+        if (freeRefs.capacity() < heap.capacity())
+        {
+            freeRefs.reserve(heap.capacity());
+            grayStack.reserve(heap.capacity());
+        }
+    }
+
+    // Objects created during a cycle must survive it: marking never revisits
+    // them and the sweeper has not yet reached slots past its cursor
+    uint8_t color = GC_WHITE;
+    if (phase == Phase::MARK || (phase == Phase::SWEEP && static_cast<size_t>(ref) >= sweepCursor))
+        color = GC_BLACK;
+    ObjectHeader *hdr = ObjectFactory::header(object);
+    hdr->gcBits = (hdr->gcBits & ~GC_COLOR_MASK) | color;
+
+    if (hdr->gcBits & GC_ARENA)
+    {
+        arenaRefs.back().push_back(ref);
+        return ref;
+    }
+
+    size_t bytes = factory.allocationSize(object);
+    bytesSinceCycle += bytes;
+    if (phase != Phase::IDLE)
+        allocationDebt += bytes;
+    return ref;
+}
+
+void GarbageCollector::step(RootSpan stack, RootSpan locals, const std::vector<RootSpan> &tasks)
+{
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::microseconds(options.maxPauseMicros);
+
+    if (phase == Phase::IDLE)
+        beginCycle();
+
+    if (phase == Phase::MARK && markSlice(stack, locals, tasks, deadline))
+    {
+        phase = Phase::SWEEP;
+        sweepCursor = 0;
+    }
+
+    if (phase == Phase::SWEEP && Clock::now() < deadline && sweepSlice(deadline))
+    {
+        phase = Phase::IDLE;
+        bytesSinceCycle = 0;
+        cycles++;
+    }
+
+    allocationDebt = 0;
+    recordPause(Clock::now() - start);
+}
+
+void GarbageCollector::collect(RootSpan stack, RootSpan locals, const std::vector<RootSpan> &tasks)
+{
+    do
+    {
+        step(stack, locals, tasks);
+    } while (phase != Phase::IDLE);
+}
+
+void GarbageCollector::reset(size_t keptRefs)
+{
+    for (size_t ref = keptRefs; ref < heap.size(); ref++)
+    {
+        factory.destroyObject(heap[ref]); // arena objects go with their arena
+    }
+    heap.resize(std::min(keptRefs, heap.size()));
+    for (void *object : heap)
+    {
+        if (object != nullptr)
+            ObjectFactory::header(object)->gcBits &= ~GC_COLOR_MASK;
+    }
+    while (!arenaRefs.empty())
+    {
+        arenaRefs.pop_back();
+        factory.popArena();
+    }
+
+    phase = Phase::IDLE;
+    grayStack.clear();
+    freeRefs.clear();
+    sweepCursor = 0;
+    bytesSinceCycle = 0;
+    allocationDebt = 0;
+}
+
+void GarbageCollector::restoreState(std::vector<int32_t> freeList)
+{
+    phase = Phase::IDLE;
+    grayStack.clear();
+    freeRefs = std::move(freeList);
+    freeRefs.reserve(heap.capacity());
+    grayStack.reserve(heap.capacity());
+    sweepCursor = 0;
+    bytesSinceCycle = 0;
+    allocationDebt = 0;
+}
+
+void GarbageCollector::beginCycle()
+{
+    phase = Phase::MARK;
+    grayStack.clear();
+    rootsScanned = false;
+    localsCursor = 0;
+    resultsCursor = 0;
+    arenaCursor = 0;
+    arenaRefCursor = 0;
+    stackCursors.clear();
+}
+
+void GarbageCollector::beginArena()
+{
+    factory.pushArena();
+    arenaRefs.emplace_back();
+}
+
+void GarbageCollector::endArena(bool checkEscapes, RootSpan locals, const std::vector<RootSpan> &stacks)
+{
+    if (arenaRefs.empty())
+        throw std::runtime_error("ARENA_END error: No active arena.");
+
+    std::vector<int32_t> &region = arenaRefs.back();
+    if (checkEscapes)
+        checkArenaEscapes(region, locals, stacks);
+
+    for (int32_t ref : region)
+    {
+        heap[ref] = nullptr;
+        if (!checkEscapes)
+            freeRefs.push_back(ref);
+    }
+    arenaRefs.pop_back();
+    factory.popArena();
+}
+
+void GarbageCollector::checkArenaEscapes(const std::vector<int32_t> &region, RootSpan locals, const std::vector<RootSpan> &stacks) const
+{
+    std::vector<bool> inRegion(heap.size(), false);
+    for (int32_t ref : region)
+    {
+        inRegion[ref] = true;
+    }
+
+    auto check = [&](size_t holder, uint32_t value)
+    {
+        if (value < heap.size() && inRegion[value])
+            throw std::runtime_error("ARENA_END error: Object " + std::to_string(value) + " escapes its arena through object " + std::to_string(holder) + ".");
+    };
+
+    // Roots are untyped, so these checks are as conservative as marking
+    for (size_t i = 0; i < locals.size; i++)
+    {
+        uint32_t value = locals.data[i];
+        if (value < heap.size() && inRegion[value])
+            throw std::runtime_error("ARENA_END error: Object " + std::to_string(value) + " escapes its arena through local " + std::to_string(i) + ".");
+    }
+    for (RootSpan roots : stacks)
+    {
+        for (size_t i = 0; i < roots.size; i++)
+        {
+            uint32_t value = roots.data[i];
+            if (value < heap.size() && inRegion[value])
+                throw std::runtime_error("ARENA_END error: Object " + std::to_string(value) + " escapes its arena through the operand stack.");
+        }
+    }
+
+    for (size_t i = 0; i < heap.size(); i++)
+    {
+        void *object = heap[i];
+        if (object == nullptr || inRegion[i])
+            continue;
+        const ObjectHeader *hdr = ObjectFactory::header(object);
+        if (hdr->classId == ARRAY_CLASS_ID)
+        {
+            if (hdr->elementType != FieldType::OBJECT)
+                continue;
+            const uint32_t *elements = static_cast<const uint32_t *>(object);
+            uint32_t length = ObjectFactory::arrayLength(object);
+            for (uint32_t e = 0; e < length; e++)
+            {
+                check(i, elements[e]);
+            }
+        }
+        else if (hdr->classId == STRING_CLASS_ID)
+        {
+            continue;
+        }
+        else if (hdr->classId == CHANNEL_CLASS_ID)
+        {
+            if (hdr->elementType != FieldType::OBJECT)
+                continue;
+            const ChannelState &channel = ObjectFactory::channel(object);
+            uint32_t capacity = ObjectFactory::channelCapacity(object);
+            for (uint32_t n = 0; n < channel.count; n++)
+            {
+                check(i, ObjectFactory::channelSlots(object)[(channel.head + n) % capacity]);
+            }
+        }
+        else if (hdr->classId == MAP_CLASS_ID)
+        {
+            const HashMap &map = ObjectFactory::map(object);
+            for (int64_t s = map.next(0); s >= 0; s = map.next(s + 1))
+            {
+                if (map.keysAreRefs())
+                    check(i, map.slot(s).key);
+                if (map.valuesAreRefs())
+                    check(i, map.slot(s).value);
+            }
+        }
+        else
+        {
+            for (const FieldSlot &slot : factory.classTable().getClassInfo(hdr->classId)->fieldSlots)
+            {
+                if (slot.type == FieldType::OBJECT)
+                    check(i, *reinterpret_cast<const uint32_t *>(static_cast<const char *>(object) + slot.offset));
+            }
+        }
+    }
+}
+
+void GarbageCollector::mapResized(const HashMap &map, size_t grownBytes)
+{
+    bytesSinceCycle += grownBytes;
+    if (phase != Phase::IDLE)
+        allocationDebt += grownBytes;
+    if (phase != Phase::MARK || !(map.keysAreRefs() || map.valuesAreRefs()))
+        return;
+    for (int64_t s = map.next(0); s >= 0; s = map.next(s + 1))
+    {
+        if (map.keysAreRefs())
+            shade(map.slot(s).key);
+        if (map.valuesAreRefs())
+            shade(map.slot(s).value);
+    }
+}
+
+bool GarbageCollector::scanRoots(RootSpan roots, size_t &cursor, Clock::time_point deadline)
+{
+    while (cursor < roots.size)
+    {
+        size_t end = std::min(roots.size, cursor + ROOT_SCAN_CHUNK);
+        for (; cursor < end; cursor++)
+        {
+            shade(roots.data[cursor]);
+        }
+        if (Clock::now() >= deadline)
+            return cursor >= roots.size;
+    }
+    return true;
+}
+
+bool GarbageCollector::scanOtherRoots(RootSpan locals, const std::vector<RootSpan> &tasks, Clock::time_point deadline)
+{
+    if (!scanRoots(locals, localsCursor, deadline))
+        return false;
+
+    // Task ids index the spans, so the cursor stays valid as tasks come and go
+    while (resultsCursor < tasks.size())
+    {
+        size_t end = std::min(tasks.size(), resultsCursor + ROOT_SCAN_CHUNK);
+        for (; resultsCursor < end; resultsCursor++)
+        {
+            RootSpan roots = tasks[resultsCursor];
+            for (size_t i = 0; roots.stack == nullptr && i < roots.size; i++)
+                shade(roots.data[i]);
+        }
+        if (Clock::now() >= deadline && resultsCursor < tasks.size())
+            return false;
+    }
+
+    // A region that ends is gone from the heap, and the objects of one that
+    // opens in its place are black
+    for (; arenaCursor < arenaRefs.size(); arenaCursor++, arenaRefCursor = 0)
+    {
+        const std::vector<int32_t> &region = arenaRefs[arenaCursor];
+        if (!scanRoots(RootSpan{reinterpret_cast<const uint32_t *>(region.data()), region.size()}, arenaRefCursor, deadline))
+            return false;
+    }
+    return true;
+}
+
+bool GarbageCollector::scanStack(RootSpan stack, Clock::time_point deadline)
+{
+    // Nothing below the low-water mark changed since the last scan
+    size_t &cursor = stackCursors[stack.data];
+    cursor = std::min(cursor, stack.stack->lowWaterMark());
+    bool done = scanRoots(stack, cursor, deadline);
+    stack.stack->markLowWater();
+    return done;
+}
+
+void GarbageCollector::shade(uint32_t value)
+{
+    if (value >= heap.size() || heap[value] == nullptr)
+        return;
+    ObjectHeader *hdr = ObjectFactory::header(heap[value]);
+    if ((hdr->gcBits & GC_COLOR_MASK) != GC_WHITE)
+        return;
+    hdr->gcBits = (hdr->gcBits & ~GC_COLOR_MASK) | GC_GRAY;
+    grayStack.push_back(GrayEntry{static_cast<int32_t>(value), 0});
+}
+
+void GarbageCollector::scanObject(const GrayEntry &entry)
+{
+    void *object = heap[entry.ref];
+    if (object == nullptr)
+        return; // released by ARENA_END while gray
+    ObjectHeader *hdr = ObjectFactory::header(object);
+
+    if (hdr->classId == ARRAY_CLASS_ID)
+    {
+        if (hdr->elementType == FieldType::OBJECT)
+        {
+            // Large arrays are scanned in chunks so one array cannot blow the pause budget
+            uint32_t length = ObjectFactory::arrayLength(object);
+            uint32_t end = std::min(length, entry.from + ARRAY_SCAN_CHUNK);
+            if (end < length)
+                grayStack.push_back(GrayEntry{entry.ref, end});
+            const uint32_t *elements = static_cast<const uint32_t *>(object);
+            for (uint32_t i = entry.from; i < end; i++)
+            {
+                shade(elements[i]);
+            }
+            if (end < length)
+                return;
+        }
+    }
+    else if (hdr->classId == STRING_CLASS_ID)
+    {
+        // Strings hold no references
+    }
+    else if (hdr->classId == CHANNEL_CLASS_ID)
+    {
+        // Only the buffered values; the other slots may hold stale words
+        if (hdr->elementType == FieldType::OBJECT)
+        {
+            const ChannelState &channel = ObjectFactory::channel(object);
+            uint32_t capacity = ObjectFactory::channelCapacity(object);
+            for (uint32_t n = 0; n < channel.count; n++)
+            {
+                shade(ObjectFactory::channelSlots(object)[(channel.head + n) % capacity]);
+            }
+        }
+    }
+    else if (hdr->classId == MAP_CLASS_ID)
+    {
+        const HashMap &map = ObjectFactory::map(object);
+        if (map.keysAreRefs() || map.valuesAreRefs())
+        {
+            // Scanned in chunks of slots like large arrays; mapResized covers
+            // entries that a resize moves behind the cursor
+            size_t capacity = map.capacity();
+            size_t end = std::min<size_t>(capacity, entry.from + ARRAY_SCAN_CHUNK);
+            if (end < capacity)
+                grayStack.push_back(GrayEntry{entry.ref, static_cast<uint32_t>(end)});
+            for (size_t i = entry.from; i < end; i++)
+            {
+                if (!map.occupied(i))
+                    continue;
+                if (map.keysAreRefs())
+                    shade(map.slot(i).key);
+                if (map.valuesAreRefs())
+                    shade(map.slot(i).value);
+            }
+            if (end < capacity)
+                return;
+        }
+    }
+    else
+    {
+        const ClassInfo *cls = factory.classTable().getClassInfo(hdr->classId);
+        for (const FieldSlot &slot : cls->fieldSlots)
+        {
+            if (slot.type == FieldType::OBJECT)
+                shade(*reinterpret_cast<const uint32_t *>(static_cast<const char *>(object) + slot.offset));
+        }
+    }
+
+    hdr->gcBits = (hdr->gcBits & ~GC_COLOR_MASK) | GC_BLACK;
+}
+
+bool GarbageCollector::markSlice(RootSpan stack, RootSpan locals, const std::vector<RootSpan> &tasks, Clock::time_point deadline)
+{
+    if (!rootsScanned)
+    {
+        if (!scanOtherRoots(locals, tasks, deadline))
+            return false;
+        rootsScanned = true;
+    }
+
+    uint32_t work = 0;
+    while (true)
+    {
+        while (!grayStack.empty())
+        {
+            GrayEntry entry = grayStack.back();
+            grayStack.pop_back();
+            scanObject(entry);
+            if ((++work & 7) == 0 && Clock::now() >= deadline)
+                return false;
+        }
+
+        // Operand stacks have no write barrier, so what changed in them is
+        // scanned once the gray set drains; marking is done when every stack
+        // is scanned to its top in this slice and that finds nothing new
+        if (!scanStack(stack, deadline))
+            return false;
+        for (RootSpan roots : tasks)
+        {
+            if (roots.stack != nullptr && !scanStack(roots, deadline))
+                return false;
+        }
+        if (grayStack.empty())
+            return true;
+    }
+}
+
+bool GarbageCollector::sweepSlice(Clock::time_point deadline)
+{
+    while (sweepCursor < heap.size())
+    {
+        size_t end = std::min(heap.size(), sweepCursor + SWEEP_CHUNK);
+        for (; sweepCursor < end; sweepCursor++)
+        {
+            void *object = heap[sweepCursor];
+            if (object == nullptr)
+                continue;
+            ObjectHeader *hdr = ObjectFactory::header(object);
+            if ((hdr->gcBits & (GC_COLOR_MASK | GC_ARENA | GC_CONSTANT)) == GC_WHITE)
+            {
+                bytesFreed += factory.allocationSize(object);
+                objectsFreed++;
+                factory.destroyObject(object);
+                heap[sweepCursor] = nullptr;
+                freeRefs.push_back(static_cast<int32_t>(sweepCursor));
+            }
+            else
+            {
+                hdr->gcBits &= ~GC_COLOR_MASK;
+            }
+        }
+        if (Clock::now() >= deadline)
+            return sweepCursor >= heap.size();
+    }
+    return true;
+}
+
+void GarbageCollector::recordPause(Clock::duration pause)
+{
+    uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(pause).count();
+    maxPauseNanos = std::max(maxPauseNanos, nanos);
+    slices++;
+
+    // Bucket b holds pauses below 2^b microseconds
+    uint64_t micros = nanos / 1000;
+    int bucket = 0;
+    while (bucket < PAUSE_BUCKETS - 1 && micros >= (1ull << bucket))
+        bucket++;
+    pauseHistogram[bucket]++;
+}
+
+void GarbageCollector::dumpStats(std::ostream &out) const
+{
+    out << "GC stats: " << cycles << " cycles, " << slices << " slices, freed " << objectsFreed
+        << " objects (" << bytesFreed << " bytes), max pause " << maxPauseNanos / 1000.0
+        << " us (target " << options.maxPauseMicros << " us)" << std::endl;
+    for (int b = 0; b < PAUSE_BUCKETS; b++)
+    {
+        if (pauseHistogram[b] == 0)
+            continue;
+        if (b == PAUSE_BUCKETS - 1)
+            out << "  pause >= " << (1ull << (b - 1)) << " us: " << pauseHistogram[b] << std::endl;
+        else
+            out << "  pause < " << (1ull << b) << " us: " << pauseHistogram[b] << std::endl;
+    }
+}
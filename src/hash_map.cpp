@@ -0,0 +1,116 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <hash_map.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+uint32_t hashInt(uint32_t key)
+{
+    // Murmur3 finalizer: every input bit affects the 7 control bits
+    key ^= key >> 16;
+    key *= 0x85EBCA6Bu;
+    key ^= key >> 13;
+    key *= 0xC2B2AE35u;
+    key ^= key >> 16;
+    return key;
+}
+
+uint32_t hashBytes(const void *data, size_t length)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ length;
+    while (length >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+        bytes += 8;
+        length -= 8;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes, length);
+    hash = (hash ^ tail) * 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 29;
+    return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+HashMap::~HashMap()
+{
+    std::free(ctrl);
+}
+
+int64_t HashMap::next(size_t from) const
+{
+    for (size_t idx = from; idx < capacity(); idx++)
+    {
+        if (ctrl[idx] >= 0)
+            return static_cast<int64_t>(idx);
+    }
+    return -1;
+}
+
+void HashMap::erase(size_t idx)
+{
+    // A slot in a group that still has an empty slot never made a probe move
+    // on, so it can go straight back to EMPTY instead of becoming a tombstone
+    size_t group = idx / GROUP_SIZE;
+    if (matchByte(ctrl + group * GROUP_SIZE, EMPTY) != 0)
+    {
+        ctrl[idx] = EMPTY;
+    }
+    else
+    {
+        ctrl[idx] = DELETED;
+        tombstones++;
+    }
+    count--;
+}
+
+size_t HashMap::freeSlot(uint32_t hash) const
+{
+    const size_t mask = groups - 1;
+    size_t group = (hash >> 7) & mask;
+    for (size_t step = 1;; step++)
+    {
+        uint32_t bits = matchFree(ctrl + group * GROUP_SIZE);
+        if (bits != 0)
+            return group * GROUP_SIZE + __builtin_ctz(bits);
+        group = (group + step) & mask;
+    }
+}
+
+void HashMap::rehash()
+{
+    // Double when live entries fill half the table, otherwise rebuild in
+    // place to drop tombstones
+    size_t newGroups = groups == 0 ? 1 : (count * 2 >= capacity() ? groups * 2 : groups);
+    size_t newCapacity = newGroups * GROUP_SIZE;
+
+    int8_t *newCtrl = static_cast<int8_t *>(std::malloc(newCapacity * (1 + sizeof(MapSlot))));
+    if (!newCtrl)
+        throw std::bad_alloc();
+    std::memset(newCtrl, EMPTY, newCapacity);
+    MapSlot *newSlots = reinterpret_cast<MapSlot *>(newCtrl + newCapacity);
+
+    int8_t *oldCtrl = ctrl;
+    MapSlot *oldSlots = slots;
+    size_t oldCapacity = capacity();
+    ctrl = newCtrl;
+    slots = newSlots;
+    groups = newGroups;
+    tombstones = 0;
+    rehashes++;
+
+    for (size_t idx = 0; idx < oldCapacity; idx++)
+    {
+        if (oldCtrl[idx] < 0)
+            continue;
+        size_t to = freeSlot(oldSlots[idx].hash);
+        ctrl[to] = oldCtrl[idx];
+        slots[to] = oldSlots[idx];
+    }
+    std::free(oldCtrl);
+}
@@ -9,7 +9,19 @@
 #include <cstdint>
 #include <stdexcept>
 #include <unordered_map>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <object_factory.hpp>
+#include <gc.hpp>
+#include <memory.hpp>
+#include <bytecode.hpp>
+#include <array_ops.hpp>
+#include <vector_ops.hpp>
+#include <sort_ops.hpp>
+#include <string_ops.hpp>
+#include <math_ops.hpp>
+#include <program.hpp>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -25,55 +37,6 @@
 #define DBG(msg) // nothing
 #endif
 
-enum class Opcode : uint8_t
-{
-    IADD = 0x01,
-    ISUB = 0x02,
-    IMUL = 0x03,
-    IDIV = 0x04,
-    INEG = 0x05,
-    FADD = 0x06,
-    FSUB = 0x07,
-    FMUL = 0x08,
-    FDIV = 0x09,
-    FNEG = 0x0A,
-    IMOD = 0x0B,
-    PUSH = 0x10,
-    POP = 0x11,
-    DUP = 0x12,
-    FPOP = 0x13,
-    FPUSH = 0x14,
-    LOAD = 0x20,
-    STORE = 0x21,
-    LOAD_ARG = 0x22,
-    JMP = 0x30,
-    JZ = 0x31,
-    JNZ = 0x32,
-    CALL = 0x33,
-    RET = 0x34,
-    ICMP_EQ = 0x40,
-    ICMP_LT = 0x41,
-    ICMP_GT = 0x42,
-    FCMP_EQ = 0x43,
-    FCMP_LT = 0x44,
-    FCMP_GT = 0x45,
-    ICMP_GEQ = 0x46,
-    ICMP_NEQ = 0x47,
-    ICMP_LEQ = 0x48,
-    FCMP_GEQ = 0x49,
-    FCMP_NEQ = 0x4A,
-    FCMP_LEQ = 0x4B,
-    NEW = 0x50,
-    GETFIELD = 0x51,
-    PUTFIELD = 0x52,
-    INVOKEVIRTUAL = 0x53,
-    INVOKESPECIAL = 0x54,
-    SYS_CALL = 0x60,
-    NEWARRAY = 0x70,
-    ALOAD = 0x71,
-    ASTORE = 0x72,
-};
-
 enum class Syscall : uint8_t
 {
     OPEN = 0x01,
@@ -94,6 +57,9 @@ enum class Syscall : uint8_t
     UNLINK = 0x11,
     MKDIR = 0x12,
     ISATTY = 0x13,
+    READLINE = 0x14,
+    WRITESTR = 0x15,
+    CHECKPOINT = 0x16,
 };
 
 union Value
@@ -105,44 +71,300 @@ union Value
     Value(float v) : floatValue(v) {}
 };
 
+// Argument or result of VM::invoke. LONG and DOUBLE take two slots, laid
+// out as LPUSH leaves them: the high word on top, so a wide first argument
+// is LOAD_ARG 0 (high) and LOAD_ARG 1 (low). OBJECT is a heap reference.
+struct VMValue
+{
+    FieldType type = FieldType::INT;
+    union
+    {
+        int32_t intValue;
+        float floatValue;
+        int64_t longValue;
+        double doubleValue;
+    };
+
+    VMValue() : longValue(0) {}
+    static VMValue ofInt(int32_t v)
+    {
+        VMValue value;
+        value.intValue = v;
+        return value;
+    }
+    static VMValue ofFloat(float v)
+    {
+        VMValue value;
+        value.type = FieldType::FLOAT;
+        value.floatValue = v;
+        return value;
+    }
+    static VMValue ofLong(int64_t v)
+    {
+        VMValue value;
+        value.type = FieldType::LONG;
+        value.longValue = v;
+        return value;
+    }
+    static VMValue ofDouble(double v)
+    {
+        VMValue value;
+        value.type = FieldType::DOUBLE;
+        value.doubleValue = v;
+        return value;
+    }
+    static VMValue ofObject(int32_t ref)
+    {
+        VMValue value;
+        value.type = FieldType::OBJECT;
+        value.intValue = ref;
+        return value;
+    }
+    bool wide() const { return type == FieldType::LONG || type == FieldType::DOUBLE; }
+};
+
+struct VMOptions
+{
+    bool heapStats = false; // print per-class heap usage when the program ends
+    bool gcStats = false;   // print collector pauses when the program ends
+    bool arenaChecks = false; // fail ARENA_END when a heap object still references the arena
+    size_t stackBytes = 64 * 1024 * 1024;  // virtual range reserved for the operand stack
+    size_t localsBytes = 16 * 1024 * 1024; // virtual range reserved for locals
+    MemoryPolicy memory;                   // huge page / NUMA placement of heap, code and stacks
+    bool memoryStats = false;              // print resident and huge page usage when the program ends
+    unsigned sortThreads = 0;              // threads for large ASORT/ASORT_STABLE, 0 for all cores
+    GCOptions gc;
+    std::string checkpointPath; // written when the signal given to checkpointOnSignal arrives
+    size_t taskStackBytes = 1024 * 1024; // virtual range reserved for the stack of each SPAWNed task
+    uint32_t taskQuantum = 1000;         // jumps and calls a task runs before it is preempted
+};
+
+/*
+ * One execution context of a Program: the stack, locals, heap and open
+ * files of a run. Contexts share their Program, so a context costs its
+ * string constants and the pages it touches, and any number of them can run
+ * on separate threads. A single context is not thread-safe.
+ */
 class VM
 {
 public:
-    VM(const std::vector<uint8_t> &filedata);
+    VM(std::shared_ptr<const Program> program, const VMOptions &options = VMOptions());
+    // Loads a Program of its own
+    VM(const std::vector<uint8_t> &filedata, const VMOptions &options = VMOptions());
+    VM(MappedFile file, const VMOptions &options = VMOptions());
     ~VM(); // Added by Mokshith
-    void loadFromBinary(const std::vector<uint8_t> &filedata);
 
+    // Runs the program from its entry point, on the heap and globals as they are
     void run();
+    // Status passed to SYS_EXIT, which halts the VM instead of the process;
+    // 0 when the program returned
+    int exitStatus() const { return exitCode; }
     uint32_t top() const;
+    // Streams behind file descriptors 0 to 2, stdin, stdout and stderr by
+    // default. The VM does not close them, but SYS_CLOSE on them does.
+    void setStandardStreams(FILE *in, FILE *out, FILE *err);
+
+    // Embedding API: load once, then invoke methods any number of times.
+    // Finds a method of the class or of its nearest superclass declaring it
+    MethodHandle findMethod(const std::string &className, const std::string &methodName) const
+    {
+        return program->findMethod(className, methodName);
+    }
+    // Calls a method with the given arguments and returns once it returns.
+    // The bytecode does not declare result types, so the caller names one;
+    // LONG and DOUBLE methods return with WRET. Fails if the method reaches
+    // SYS_EXIT. Object references handed out are not collector roots: use
+    // them before the next invoke, or pass them to it as arguments.
+    VMValue invoke(const MethodHandle &method, const std::vector<VMValue> &args = {}, FieldType resultType = FieldType::INT);
+    // Frees every object but the string constants and puts the globals back
+    // to their loaded values. Needed after an invoke that failed.
+    void resetHeap();
+    // String object for invoke arguments, and the contents of one
+    int32_t newString(const std::string &value);
+    std::string stringValue(int32_t stringRef);
+
+    // Writes the running state to a checkpoint file, which restore loads
+    // into a fresh VM of the same program; resume then carries on. Call it
+    // between instructions, and outside ARENA_BEGIN / ARENA_END.
+    void checkpoint(const std::string &path);
+    void restore(const std::string &path);
+    // Continues from ip, where run starts over from the entry point
+    void resume();
+    // Makes the signal write a checkpoint of every VM with a checkpointPath,
+    // at its next call or jump
+    static void checkpointOnSignal(int signal);
+
+    void dumpHeapStats(std::ostream &out) const;
+    void dumpGCStats(std::ostream &out) const;
+    void dumpMemoryStats(std::ostream &out) const;
 
 private:
-    static constexpr int STACK_SIZE = 2048;
-    static constexpr int LOCALS_SIZE = 2048;
     static constexpr int CONST_POOL_SIZE = 256;
 
-    std::vector<uint32_t> stack;
-    std::vector<uint32_t> locals;
-    std::vector<uint32_t> constantPool;
-    std::vector<ClassInfo> classes;
-    std::vector<uint8_t> code;
+    VMOptions options;
+    std::shared_ptr<const Program> program;
+    const PageBuffer &code;                // of program
+    const std::vector<uint8_t> &codeMarks; // of program
+    ClassTable &classes;                   // of program
+
+    GuardedStack stack;
+    LocalStore locals;
     std::vector<FILE *> fileData;
+    // How each fd from 3 on was opened, for checkpoints
+    struct OpenFile
+    {
+        std::string path;
+        char mode = 0;
+    };
+    std::vector<OpenFile> openFiles;
     // std::vector<void *> read_data;
     uint32_t ip;
-    uint32_t sp;
     uint32_t fp;
 
     uint16_t args_to_pop;
+    bool exited = false; // set by SYS_EXIT
+    int exitCode = 0;
+
+    // Return address of a frame pushed by invoke; returning to it leaves execute
+    static constexpr uint32_t RETURN_TO_HOST = 0xFFFFFFFF;
+    // What resetHeap keeps: the string constants take the first references
+    size_t loadedRefs = 0;
 
     ObjectFactory objectFactory; // Added by Mokshith
     std::vector<void *> heap;    // Added by Mokshith
+    GarbageCollector gc;
+    uint32_t gcCountdown;
+    HashMap internTable{MapKind::STRING_REF}; // pinned strings by content
+
+    // Checkpoints requested by signal so far, and the number this VM has handled
+    static std::atomic<uint32_t> checkpointRequests;
+    uint32_t checkpointsSeen = 0;
+    // Safe point at calls and jumps: checkpoints and preemption happen here
+    void safePoint()
+    {
+        if (checkpointRequests.load(std::memory_order_relaxed) != checkpointsSeen)
+            checkpointOnRequest();
+        if (--quantumLeft == 0)
+            preempt();
+    }
+    void checkpointOnRequest();
+
+    /*
+     * Green threads. Task 0 is the context that run or invoke started, the
+     * others come from SPAWN; all of them share the heap and the globals and
+     * run on the calling thread. The running task's stack is always `stack`,
+     * and a task that is not running keeps its stack, ip, fp and argument
+     * count in its record, so a switch is two stack swaps.
+     */
+    enum class TaskState : uint8_t
+    {
+        FREE, // id can be reused
+        RUNNABLE,
+        BLOCKED,  // in JOIN, or in SEND or RECV on a full or empty channel
+        FINISHED, // returned; its result waits for JOIN
+    };
+    struct Task
+    {
+        GuardedStack stack; // empty while the task runs
+        uint32_t ip = 0;
+        uint32_t fp = 0;
+        uint16_t argsToPop = 0;
+        TaskState state = TaskState::FREE;
+        uint32_t result = 0;
+        std::vector<uint32_t> joiners; // tasks blocked in JOIN on this one
+    };
+    // Tasks blocked on a channel, woken one per value sent or received
+    struct ChannelWaiters
+    {
+        std::deque<uint32_t> senders;
+        std::deque<uint32_t> receivers;
+    };
+    // Return address of a task's base frame; returning to it ends the task
+    static constexpr uint32_t TASK_EXIT = 0xFFFFFFFE;
+    std::vector<std::unique_ptr<Task>> tasks; // by id; empty until the first SPAWN
+    std::vector<uint32_t> freeTaskIds;
+    std::deque<uint32_t> runQueue; // runnable tasks but the current one
+    uint32_t currentTask = 0;
+    uint32_t quantumLeft = 0;
+    std::unordered_map<int32_t, ChannelWaiters> channelWaiters; // by channel reference
+    std::vector<std::unique_ptr<GuardedStack>> spareStacks;     // of finished tasks
+    std::vector<RootSpan> taskRoots;                            // rebuilt for each collector slice
+
+    uint32_t spawnTask(uint32_t methodOffset, uint8_t argCount);
+    // Parks the current task, which is already queued again, blocked or
+    // finished, and runs the next runnable one
+    void switchTask();
+    void preempt();
+    // Blocks the current task at the instruction it is executing, which runs
+    // again once the task is woken
+    void blockTask(const char *opName);
+    void wakeTask(uint32_t id);
+    void finishTask();
+    // Drops every task but task 0 and makes it current again
+    void endTasks();
+    bool tasksRunning() const;
+
+    // Creates the string constants and the globals of the program
+    void setup();
+    void gcStep();
+    // The words of every task stack that --arena-check treats as roots: all
+    // of them but the saved ip and fp of each frame, which are offsets and
+    // indexes rather than references
+    std::vector<RootSpan> arenaCheckRoots() const;
+
+    // Checks an array reference and the element range [pos, pos + count)
+    // for the named opcode, and returns the address of element pos
+    void *arrayRange(int32_t arrayRef, int32_t pos, int32_t count, const char *opName, FieldType &type);
+    // Same, for vector operands, which must be INT or FLOAT arrays of one type
+    void *vectorRange(int32_t arrayRef, int32_t offset, int32_t count, const char *opName, FieldType &type);
+    // Same, for opcodes that work on 4-byte or CHAR elements only
+    void *narrowRange(int32_t arrayRef, int32_t pos, int32_t count, const char *opName, FieldType &type);
+    // Same, for arrays that are ordered, which rules out OBJECT arrays
+    void *orderedRange(int32_t arrayRef, int32_t from, int32_t count, const char *opName, FieldType &type);
+    // Fails when a checked array is a string constant, which every LDC of it shares
+    void checkWritable(int32_t arrayRef, const char *opName) const;
+    // Fails unless size bytes of a SYS_READ or SYS_WRITE buffer lie inside it
+    void checkBufferSize(const void *buffer, int32_t size, const char *opName) const;
+    // Checks a string reference for the named opcode and returns its bytes
+    const uint8_t *stringAt(int32_t stringRef, const char *opName, uint32_t &length);
+    // Contents of a string or of a CHAR array such as a string constant
+    std::string textAt(int32_t ref, const char *opName);
+    // Hash of a string object, computed on first use
+    static uint32_t stringHashOf(void *string);
+    // Tracks a string made by createString and pushes its reference
+    void pushString(void *string);
+    // Checks a channel reference for the named opcode
+    void *channelAt(int32_t channelRef, const char *opName);
+    // Checks a map reference for the named opcode
+    HashMap &mapAt(int32_t mapRef, const char *opName);
+    // Hash of a key of the map; CHAR array keys hash their contents
+    uint32_t mapKeyHash(const HashMap &map, uint32_t key, const char *opName);
+    bool mapKeysEqual(const HashMap &map, uint32_t a, uint32_t b) const;
+
+    // Runs execute with guard page faults turned into stack errors
+    void executeGuarded();
+    void execute();
 
-    void push(uint32_t v);
-    uint32_t pop();
-    uint32_t peek() const;
+    void push(uint32_t v) { stack.push(v); }
+    uint32_t pop() { return stack.pop(); }
+    uint32_t peek() const { return stack.back(); }
+    // 64-bit values take two slots, low word first
+    void push64(uint64_t v)
+    {
+        push(static_cast<uint32_t>(v));
+        push(static_cast<uint32_t>(v >> 32));
+    }
+    uint64_t pop64()
+    {
+        uint64_t high = pop();
+        return (high << 32) | pop();
+    }
 
     uint8_t fetch8();
     uint16_t fetch16();
     int32_t fetch32();
+    uint64_t fetch64();
+    uint32_t fetchVarint();
 };
 
 #endif // VM_HPP
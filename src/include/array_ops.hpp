@@ -0,0 +1,24 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_ARRAY_OPS_HPP
+#define VM_ARRAY_OPS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <object_factory.hpp>
+
+// Bulk kernels behind ARRAYCOPY, ARRAYFILL, ARRAYCMP and ARRAYFIND. They work
+// on raw element data of the given type; the caller checks the ranges.
+
+// Overlapping ranges are copied as if through a temporary buffer
+void arrayCopy(void *dst, const void *src, size_t count, FieldType type);
+// value holds the element bits as they sit on the operand stack
+void arrayFill(void *dst, size_t count, FieldType type, uint32_t value);
+// -1, 0 or 1 by the first unequal pair; CHAR compares as unsigned bytes and
+// FLOAT by FloatLess, NaNs last
+int arrayCompare(const void *a, const void *b, size_t count, FieldType type);
+// Index of the first element equal to value, or -1
+int64_t arrayFind(const void *data, size_t count, FieldType type, uint32_t value);
+
+#endif // VM_ARRAY_OPS_HPP
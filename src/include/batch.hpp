@@ -0,0 +1,30 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_BATCH_HPP
+#define VM_BATCH_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <VM.hpp>
+
+struct BatchResult
+{
+    VMValue value;
+    std::string error; // empty when the invocation returned
+};
+
+/*
+ * Invokes method once per input on a pool of threads sharing one Program.
+ * Every thread runs its own VM and resets its heap after each input, so
+ * inputs see the program as loaded and do not see each other. Inputs are
+ * taken in small chunks from a shared cursor, which keeps threads busy when
+ * inputs differ in cost. threads of 0 uses every core; VMs that leave
+ * sortThreads at 0 sort on their own thread, since every core is taken.
+ */
+std::vector<BatchResult> runBatch(const std::shared_ptr<const Program> &program, const MethodHandle &method,
+                                  const std::vector<std::vector<VMValue>> &inputs, FieldType resultType,
+                                  unsigned threads = 0, const VMOptions &options = VMOptions());
+
+#endif // VM_BATCH_HPP
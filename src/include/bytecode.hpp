@@ -0,0 +1,319 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_BYTECODE_HPP
+#define VM_BYTECODE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+
+enum class Opcode : uint8_t
+{
+    IADD = 0x01,
+    ISUB = 0x02,
+    IMUL = 0x03,
+    IDIV = 0x04,
+    INEG = 0x05,
+    FADD = 0x06,
+    FSUB = 0x07,
+    FMUL = 0x08,
+    FDIV = 0x09,
+    FNEG = 0x0A,
+    IMOD = 0x0B,
+    PUSH = 0x10,
+    POP = 0x11,
+    DUP = 0x12,
+    FPOP = 0x13,
+    FPUSH = 0x14,
+    LDC = 0x15,
+    PUSH_I8 = 0x16,
+    PUSH_I16 = 0x17,
+    LOAD = 0x20,
+    STORE = 0x21,
+    LOAD_ARG = 0x22,
+    LOAD_0 = 0x23,
+    LOAD_1 = 0x24,
+    LOAD_2 = 0x25,
+    LOAD_3 = 0x26,
+    STORE_0 = 0x27,
+    STORE_1 = 0x28,
+    STORE_2 = 0x29,
+    STORE_3 = 0x2A,
+    LOAD_V = 0x2B,
+    STORE_V = 0x2C,
+    JMP = 0x30,
+    JZ = 0x31,
+    JNZ = 0x32,
+    CALL = 0x33,
+    RET = 0x34,
+    TABLESWITCH = 0x35,
+    LOOKUPSWITCH = 0x36,
+    CALL_V = 0x37,
+    SPAWN = 0x38,
+    YIELD = 0x39,
+    JOIN = 0x3A,
+    CHANNEW = 0x3B,
+    SEND = 0x3C,
+    RECV = 0x3D,
+    ICMP_EQ = 0x40,
+    ICMP_LT = 0x41,
+    ICMP_GT = 0x42,
+    FCMP_EQ = 0x43,
+    FCMP_LT = 0x44,
+    FCMP_GT = 0x45,
+    ICMP_GEQ = 0x46,
+    ICMP_NEQ = 0x47,
+    ICMP_LEQ = 0x48,
+    FCMP_GEQ = 0x49,
+    FCMP_NEQ = 0x4A,
+    FCMP_LEQ = 0x4B,
+    NEW = 0x50,
+    GETFIELD = 0x51,
+    PUTFIELD = 0x52,
+    INVOKEVIRTUAL = 0x53,
+    INVOKESPECIAL = 0x54,
+    ARENA_BEGIN = 0x55,
+    ARENA_END = 0x56,
+    SYS_CALL = 0x60,
+    NEWARRAY = 0x70,
+    ALOAD = 0x71,
+    ASTORE = 0x72,
+    ARRAYLENGTH = 0x73,
+    ARRAYCOPY = 0x74,
+    ARRAYFILL = 0x75,
+    ARRAYCMP = 0x76,
+    ARRAYFIND = 0x77,
+    ASORT = 0x78,
+    ASORT_STABLE = 0x79,
+    ABSEARCH = 0x7A,
+    APARTITION = 0x7B,
+    VADD = 0x80,
+    VSUB = 0x81,
+    VMUL = 0x82,
+    VDIV = 0x83,
+    VFMA = 0x84,
+    VDOT = 0x85,
+    VSUM = 0x86,
+    VMIN = 0x87,
+    VMAX = 0x88,
+    MAPNEW = 0x90,
+    MAPGET = 0x91,
+    MAPPUT = 0x92,
+    MAPDEL = 0x93,
+    MAPSIZE = 0x94,
+    MAPHAS = 0x95,
+    MAPNEXT = 0x96,
+    MAPKEY = 0x97,
+    MAPVAL = 0x98,
+    CONCAT = 0xA0,
+    EQUALS = 0xA1,
+    COMPARE = 0xA2,
+    SUBSTRING = 0xA3,
+    INDEXOF = 0xA4,
+    HASH = 0xA5,
+    INTERN = 0xA6,
+    STRLEN = 0xA7,
+    CHARAT = 0xA8,
+    NEWSTRING = 0xA9,
+    STRCHARS = 0xAA,
+    LPUSH = 0xB0,
+    LADD = 0xB1,
+    LSUB = 0xB2,
+    LMUL = 0xB3,
+    LDIV = 0xB4,
+    LREM = 0xB5,
+    LNEG = 0xB6,
+    LCMP = 0xB7,
+    DPUSH = 0xB8,
+    DADD = 0xB9,
+    DSUB = 0xBA,
+    DMUL = 0xBB,
+    DDIV = 0xBC,
+    DNEG = 0xBD,
+    DCMP = 0xBE,
+    WRET = 0xBF,
+    I2L = 0xC0,
+    L2I = 0xC1,
+    L2D = 0xC2,
+    D2L = 0xC3,
+    I2D = 0xC4,
+    D2I = 0xC5,
+    F2D = 0xC6,
+    D2F = 0xC7,
+    WLOAD = 0xC8,
+    WSTORE = 0xC9,
+    DUP2 = 0xCA,
+    POP2 = 0xCB,
+    WALOAD = 0xCC,
+    WASTORE = 0xCD,
+    WGETFIELD = 0xCE,
+    WPUTFIELD = 0xCF,
+    FSQRT = 0xD0,
+    FEXP = 0xD1,
+    FLOG = 0xD2,
+    FSIN = 0xD3,
+    FCOS = 0xD4,
+    FPOW = 0xD5,
+    VSQRT = 0xD8,
+    VEXP = 0xD9,
+    VLOG = 0xDA,
+    VSIN = 0xDB,
+    VCOS = 0xDC,
+    VPOW = 0xDD,
+
+    // Internal forms written by the loader, never accepted from a file
+    ALOAD_UNCHECKED = 0xF0,
+    ASTORE_UNCHECKED = 0xF1,
+};
+
+enum OpcodeFlags : uint8_t
+{
+    OP_BRANCH = 0x1,   // 16-bit jump target operand
+    OP_NO_FALL = 0x2,  // never continues with the next instruction
+    OP_CALLS = 0x4,    // runs other code before continuing, including other tasks
+    OP_INTERNAL = 0x8, // only produced by the loader
+    OP_SWITCH = 0x10,  // followed by a jump table; operandBytes covers its fixed part
+    OP_VARINT = 0x20,  // operands start with a varint; operandBytes covers what follows it
+};
+
+// Low 16 bits of the header version word. Version 2 binaries may use the
+// compact encodings (PUSH_I8, PUSH_I16, LOAD_0 .. STORE_V, CALL_V); older
+// VMs refuse them by version instead of failing on the first such opcode.
+static constexpr uint16_t FORMAT_VERSION = 1;
+static constexpr uint16_t FORMAT_VERSION_COMPACT = 2;
+
+// Format flags, kept in the upper 16 bits of the header version word
+enum FormatFlags : uint16_t
+{
+    FORMAT_TYPED_CONSTANTS = 0x1, // constant pool holds tagged entries instead of bare 4-byte integers
+};
+
+// Tag byte in front of every entry of a typed constant pool
+enum class ConstantTag : uint8_t
+{
+    INT = 1,    // 4-byte integer
+    FLOAT = 2,  // 4-byte IEEE float
+    STRING = 3, // u32 byte length, then that many bytes of UTF-8
+    CLASS = 4,  // u32 index into the class metadata
+};
+
+// Static description of an opcode. pops/pushes of -1 mean the stack effect
+// depends on the operands or on the callee.
+struct OpcodeInfo
+{
+    const char *name;
+    uint8_t operandBytes;
+    int8_t pops;
+    int8_t pushes;
+    uint8_t flags;
+};
+
+// nullptr for bytes that are not an opcode
+const OpcodeInfo *opcodeInfo(uint8_t opcode);
+
+// Varint operands are unsigned LEB128: 7 bits per byte, low bits first, the
+// top bit set on every byte but the last, at most 5 bytes.
+// Returns the bytes taken by the varint at p, or 0 when it does not end
+// before end or within 5 bytes
+size_t readVarint(const uint8_t *p, const uint8_t *end, uint32_t &value);
+size_t varintLength(uint32_t value);
+void writeVarint(std::vector<uint8_t> &out, uint32_t value);
+
+// Decoders that see through the encodings of one operation. Each returns
+// false when the instruction at pc is not that operation.
+bool loadOperand(const uint8_t *code, size_t pc, size_t size, uint32_t &local);  // LOAD, LOAD_0 .. LOAD_3, LOAD_V
+bool storeOperand(const uint8_t *code, size_t pc, size_t size, uint32_t &local); // STORE, STORE_0 .. STORE_3, STORE_V
+bool pushOperand(const uint8_t *code, size_t pc, size_t size, int32_t &value);   // PUSH, PUSH_I8, PUSH_I16
+
+/*
+ * Switch operands, all little-endian 32-bit words with absolute targets:
+ *
+ *   TABLESWITCH  default, low, high, then high - low + 1 targets
+ *   LOOKUPSWITCH default, npairs, then npairs (key, target) pairs with
+ *                strictly increasing keys
+ */
+// Size in bytes of the switch's jump table after the fixed operands, or -1
+// when the table does not fit in size bytes
+int64_t switchTableBytes(const uint8_t *code, size_t pc, size_t size);
+
+// Bytes taken by the instruction at pc with its operands, or 0 when pc does
+// not start an instruction that fits in size bytes or has a malformed varint
+size_t instructionLength(const uint8_t *code, size_t pc, size_t size);
+
+// Writes one line per instruction, and one per switch case, using the
+// opcode table. Stops at the first byte that does not decode.
+void disassemble(std::ostream &out, const uint8_t *code, size_t size);
+
+// What verifyCode found at each byte of the code
+enum CodeMark : uint8_t
+{
+    CODE_START = 0x1,       // an instruction starts here
+    CODE_RETURN_SITE = 0x2, // and follows a CALL, CALL_V or INVOKEVIRTUAL
+};
+
+/*
+ * Checks code before it runs: it must decode from its first byte to its
+ * last, hold no reserved opcode, and every branch, call, spawn and switch
+ * target and every entry (entry point and method offsets) must be the start
+ * of an instruction. Throws on the first violation. Returns the CodeMarks of
+ * every offset up to and including size, where running off the code ends
+ * the run. With these checks and RET returning only to return sites,
+ * control never reaches a byte inside an instruction.
+ */
+std::vector<uint8_t> verifyCode(const uint8_t *code, size_t size, const std::vector<uint32_t> &entries);
+
+/*
+ * Load-time range analysis. Finds counted loops of the form
+ *
+ *     PUSH k; STORE i                            (k >= 0)
+ *   H:LOAD i; LOAD a; ARRAYLENGTH; ICMP_LT; JZ X
+ *     ... body ...
+ *     LOAD i; PUSH 1; IADD; STORE i; JMP H
+ *   X:
+ *
+ * with LOAD, STORE and PUSH in any of their encodings, where the body cannot
+ * change i or a, and rewrites every ALOAD/ASTORE in the body whose operands
+ * are `LOAD a; LOAD i` to its unchecked form. entries are
+ * the offsets control can reach from outside the code (entry point and method
+ * offsets). Code that SPAWNs tasks keeps every check, since a task can be
+ * preempted inside the loop and another one store to i or a. The code must
+ * have passed verifyCode. Returns the number of accesses rewritten.
+ */
+size_t eliminateBoundsChecks(uint8_t *code, size_t size, const std::vector<uint32_t> &entries);
+
+// A copy of code with every unchecked access eliminateBoundsChecks wrote
+// turned back into ALOAD/ASTORE, as code loaded from a snapshot needs
+// before it can be verified
+std::vector<uint8_t> withBoundsChecks(const uint8_t *code, size_t size);
+
+// Little-endian words, as the program, snapshot, checkpoint and serve
+// formats store them
+inline uint32_t readWord(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline void putWord(std::vector<uint8_t> &out, uint32_t value)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+        out.push_back(static_cast<uint8_t>(value >> shift));
+}
+
+inline void patchWord(std::vector<uint8_t> &out, size_t pos, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out[pos + i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+// Starts a section at a word boundary and records its offset and count in
+// the header words at headerPos
+inline void beginSection(std::vector<uint8_t> &out, size_t headerPos, size_t count)
+{
+    out.resize((out.size() + 3) & ~size_t(3), 0);
+    patchWord(out, headerPos, static_cast<uint32_t>(out.size()));
+    patchWord(out, headerPos + 4, static_cast<uint32_t>(count));
+}
+
+#endif // VM_BYTECODE_HPP
@@ -0,0 +1,52 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_CHECKPOINT_HPP
+#define VM_CHECKPOINT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * A checkpoint is the state of a running VM between two instructions: ip,
+ * fp, the operand stack, the locals, every heap object past the string
+ * constants, the collector's free list, the interned strings and the files
+ * the program has open. It is restored into a fresh VM of the same program,
+ * which the header's fingerprint checks. Spawned tasks are not saved, so a
+ * checkpoint is only taken while task 0 runs alone. Integers are
+ * little-endian 32-bit words and records are word aligned; object payloads
+ * are their bytes in memory, so restoring one is an allocation and a copy.
+ *
+ *   0  magic "VMC" 0x01
+ *   4  version word: CHECKPOINT_VERSION, high 16 bits reserved
+ *   8  program fingerprint
+ *  12  ip
+ *  16  fp
+ *  20  argument slots the next RET pops
+ *  24  heap size in references
+ *  28  string constant count
+ *  32  stack offset, word count
+ *  40  locals offset, word count
+ *  48  classes offset, class count
+ *  56  objects offset, object count
+ *  64  free list offset, reference count
+ *  72  interned strings offset, entry count
+ *  80  files offset, file count
+ *
+ * Class record: class id, name length, name; one per class with instances.
+ * Object record: reference, header word (class id, gcBits << 16, element
+ * type << 24), length, extra, payload. Arrays have their element count and
+ * no extra, strings their byte length and cached hash, objects their size
+ * and no extra, maps their entry count and MapKind, channels their capacity
+ * and no extra. A map's payload is its entries as (key, value, hash) words,
+ * a channel's its head, count and every slot of its ring buffer.
+ * Interned string entry: key, value, hash.
+ * File record: file descriptor, mode character, position low and high
+ * words, path length, path.
+ */
+
+static constexpr uint8_t CHECKPOINT_MAGIC[4] = {0x56, 0x4D, 0x43, 0x01};
+static constexpr uint16_t CHECKPOINT_VERSION = 2; // 2: 8-byte fields at offsets 4 mod 8
+static constexpr size_t CHECKPOINT_HEADER_SIZE = 88;
+
+#endif // VM_CHECKPOINT_HPP
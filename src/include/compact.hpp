@@ -0,0 +1,30 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_COMPACT_HPP
+#define VM_COMPACT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct CompactStats
+{
+    size_t codeBefore = 0;
+    size_t codeAfter = 0;
+    size_t instructions = 0;
+    size_t shortened = 0; // instructions given a shorter encoding
+};
+
+/*
+ * Rewrites a binary as format version 2. PUSH, LOAD, STORE and CALL get
+ * their shortest encoding and every code offset in the file (branch, call
+ * and switch targets, method offsets, the entry point) is moved to match.
+ * CALL_V targets are varints whose length depends on where their target
+ * lands, so the layout is repeated until no call grows. Throws
+ * std::runtime_error for a file the VM would not load or code that does not
+ * decode from start to end.
+ */
+std::vector<uint8_t> compactBinary(const uint8_t *binary, size_t size, CompactStats *stats = nullptr);
+
+#endif // VM_COMPACT_HPP
@@ -0,0 +1,176 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_GC_HPP
+#define VM_GC_HPP
+
+#include <vector>
+#include <cstdint>
+#include <chrono>
+#include <iostream>
+#include <object_factory.hpp>
+#include <memory.hpp>
+#include <unordered_map>
+
+// Tri-color state kept in ObjectHeader::gcBits
+static constexpr uint8_t GC_WHITE = 0x0;
+static constexpr uint8_t GC_GRAY = 0x1;
+static constexpr uint8_t GC_BLACK = 0x2;
+static constexpr uint8_t GC_COLOR_MASK = 0x3;
+
+struct GCOptions
+{
+    size_t triggerBytes = 4 * 1024 * 1024; // allocation volume that starts a cycle
+    size_t sliceBytes = 64 * 1024;         // allocation volume that forces a slice during a cycle
+    uint32_t sliceInstructions = 10000;    // instructions between slices during a cycle
+    uint32_t maxPauseMicros = 500;         // upper bound for a single slice
+};
+
+// A window of untyped VM words scanned conservatively as roots. An operand
+// stack also names its storage, whose low-water mark shows what changed.
+struct RootSpan
+{
+    const uint32_t *data;
+    size_t size;
+    GuardedStack *stack = nullptr;
+};
+
+/*
+ * Incremental mark and lazy sweep collector for VM::heap.
+ *
+ * The operand stack and locals are untyped, so any word in them that names a
+ * live heap slot is treated as a reference. Objects are traced precisely
+ * through OBJECT fields, OBJECT arrays and the references held by maps.
+ * Every part of a cycle runs in slices bounded by maxPauseMicros, root
+ * scanning included, so a slice is never longer than the target by more
+ * than one chunk of work. Locals, task results and arena regions are
+ * scanned once behind a cursor; stores of references during marking go
+ * through writeBarrier. Operand stacks have no barrier: each is scanned from
+ * its low-water mark up, again whenever the program popped below what was
+ * scanned, and marking ends in a slice that finds every stack scanned to
+ * its top and nothing left gray.
+ */
+class GarbageCollector
+{
+public:
+    GarbageCollector(std::vector<void *> &heap, ObjectFactory &factory);
+
+    void configure(const GCOptions &options) { this->options = options; }
+
+    // Places a freshly created object in a heap slot and returns its reference
+    int32_t track(void *object);
+
+    bool collecting() const { return phase != Phase::IDLE; }
+    bool allocationStepDue() const
+    {
+        return phase == Phase::IDLE ? bytesSinceCycle >= options.triggerBytes : allocationDebt >= options.sliceBytes;
+    }
+    uint32_t sliceInstructions() const { return options.sliceInstructions; }
+
+    // Runs one bounded slice of collection work, starting a cycle if needed.
+    // tasks are further roots, one span per task id so that they keep their
+    // place between slices: the stacks of parked green threads, treated
+    // like the stack, and the results nobody has joined yet, which are
+    // stored through writeBarrier.
+    void step(RootSpan stack, RootSpan locals, const std::vector<RootSpan> &tasks = {});
+    // Runs a whole cycle to completion
+    void collect(RootSpan stack, RootSpan locals, const std::vector<RootSpan> &tasks = {});
+
+    // Frees every object from reference keptRefs on, abandoning a running
+    // cycle and any open arenas; the objects below keptRefs survive
+    void reset(size_t keptRefs);
+
+    // References that track hands out again, last first; checkpoints keep
+    // them so that a restored run allocates like the original
+    const std::vector<int32_t> &freeReferences() const { return freeRefs; }
+    // Takes the free list of a heap refilled from a checkpoint, with no
+    // cycle running and no arena open
+    void restoreState(std::vector<int32_t> freeList);
+
+    // Region scopes for ARENA_BEGIN / ARENA_END. Arena objects act as roots
+    // while their region is open and are dropped together when it ends.
+    // With checkEscapes, endArena first fails when a heap object, a local or
+    // a stack word still names an object of the region, and the references
+    // of the dropped objects are retired rather than handed out again, so a
+    // stale one fails on use instead of aliasing a later object.
+    void beginArena();
+    void endArena(bool checkEscapes, RootSpan locals = RootSpan{nullptr, 0}, const std::vector<RootSpan> &stacks = {});
+
+    void writeBarrier(uint32_t value)
+    {
+        if (phase == Phase::MARK)
+            shade(value);
+    }
+    void writeBarrier(const uint32_t *values, size_t count)
+    {
+        if (phase == Phase::MARK)
+            for (size_t i = 0; i < count; i++)
+                shade(values[i]);
+    }
+    // Counts the growth of a map table as allocation. A resize moves entries
+    // across the scan cursor of a partly scanned map, so during marking every
+    // reference the map holds is shaded.
+    void mapResized(const HashMap &map, size_t grownBytes);
+
+    void dumpStats(std::ostream &out) const;
+
+private:
+    enum class Phase
+    {
+        IDLE,
+        MARK,
+        SWEEP,
+    };
+
+    struct GrayEntry
+    {
+        int32_t ref;
+        uint32_t from; // first unscanned element of a large array
+    };
+
+    static constexpr uint32_t ARRAY_SCAN_CHUNK = 256;
+    static constexpr uint32_t ROOT_SCAN_CHUNK = 256;
+    static constexpr uint32_t SWEEP_CHUNK = 32;
+    static constexpr int PAUSE_BUCKETS = 20;
+
+    std::vector<void *> &heap;
+    ObjectFactory &factory;
+    GCOptions options;
+
+    Phase phase = Phase::IDLE;
+    std::vector<GrayEntry> grayStack;
+    std::vector<int32_t> freeRefs;
+    std::vector<std::vector<int32_t>> arenaRefs;
+    size_t sweepCursor = 0;
+
+    // Root scanning cursors of the running cycle
+    bool rootsScanned = false;
+    size_t localsCursor = 0;
+    size_t resultsCursor = 0; // task id
+    size_t arenaCursor = 0;   // region
+    size_t arenaRefCursor = 0;
+    std::unordered_map<const uint32_t *, size_t> stackCursors; // words scanned, by storage
+    size_t bytesSinceCycle = 0;
+    size_t allocationDebt = 0;
+
+    // Statistics
+    uint64_t cycles = 0;
+    uint64_t slices = 0;
+    uint64_t objectsFreed = 0;
+    uint64_t bytesFreed = 0;
+    uint64_t maxPauseNanos = 0;
+    uint64_t pauseHistogram[PAUSE_BUCKETS] = {};
+
+    void beginCycle();
+    bool scanRoots(RootSpan roots, size_t &cursor, std::chrono::steady_clock::time_point deadline);
+    bool scanOtherRoots(RootSpan locals, const std::vector<RootSpan> &tasks, std::chrono::steady_clock::time_point deadline);
+    bool scanStack(RootSpan stack, std::chrono::steady_clock::time_point deadline);
+    void shade(uint32_t value);
+    bool markSlice(RootSpan stack, RootSpan locals, const std::vector<RootSpan> &tasks, std::chrono::steady_clock::time_point deadline);
+    void scanObject(const GrayEntry &entry);
+    bool sweepSlice(std::chrono::steady_clock::time_point deadline);
+    void checkArenaEscapes(const std::vector<int32_t> &region, RootSpan locals, const std::vector<RootSpan> &stacks) const;
+    void recordPause(std::chrono::steady_clock::duration pause);
+};
+
+#endif // VM_GC_HPP
@@ -0,0 +1,154 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_HASH_MAP_HPP
+#define VM_HASH_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum class MapKind : uint8_t
+{
+    INT_INT = 1,    // INT keys, INT values
+    INT_REF = 2,    // INT keys, OBJECT values
+    STRING_REF = 3, // CHAR array keys compared by content, OBJECT values
+};
+
+struct MapSlot
+{
+    uint32_t key;
+    uint32_t value;
+    uint32_t hash;
+};
+
+uint32_t hashInt(uint32_t key);
+uint32_t hashBytes(const void *data, size_t length);
+
+/*
+ * Open addressing hash map in the style of a Swiss table. Every slot has a
+ * control byte holding 7 bits of its hash, or EMPTY / DELETED. Lookups load a
+ * group of 16 control bytes and compare them against the hash in one SSE2
+ * instruction, so most probes touch a single slot. Key equality is supplied
+ * by the caller, which lets CHAR array keys be compared by content.
+ */
+class HashMap
+{
+public:
+    static constexpr size_t GROUP_SIZE = 16;
+
+    explicit HashMap(MapKind kind) : mapKind(kind) {}
+    HashMap(const HashMap &) = delete;
+    HashMap &operator=(const HashMap &) = delete;
+    ~HashMap();
+
+    MapKind kind() const { return mapKind; }
+    bool keysAreRefs() const { return mapKind == MapKind::STRING_REF; }
+    bool valuesAreRefs() const { return mapKind != MapKind::INT_INT; }
+    size_t size() const { return count; }
+    size_t capacity() const { return groups * GROUP_SIZE; }
+    size_t tableBytes() const { return capacity() * (1 + sizeof(MapSlot)); }
+    // Changes whenever entries move to other slots
+    uint32_t generation() const { return rehashes; }
+
+    bool occupied(size_t idx) const { return idx < capacity() && ctrl[idx] >= 0; }
+    MapSlot &slot(size_t idx) { return slots[idx]; }
+    const MapSlot &slot(size_t idx) const { return slots[idx]; }
+    // First occupied slot at or after from, or -1
+    int64_t next(size_t from) const;
+
+    // Slot holding a key equal to one with this hash, or -1
+    template <typename Equal>
+    int64_t find(uint32_t hash, Equal &&equal) const
+    {
+        if (count == 0)
+            return -1;
+        const int8_t tag = static_cast<int8_t>(hash & 0x7F);
+        const size_t mask = groups - 1;
+        size_t group = (hash >> 7) & mask;
+        for (size_t step = 1;; step++)
+        {
+            const int8_t *control = ctrl + group * GROUP_SIZE;
+            for (uint32_t bits = matchByte(control, tag); bits != 0; bits &= bits - 1)
+            {
+                size_t idx = group * GROUP_SIZE + __builtin_ctz(bits);
+                if (slots[idx].hash == hash && equal(slots[idx].key))
+                    return static_cast<int64_t>(idx);
+            }
+            if (matchByte(control, EMPTY) != 0)
+                return -1;
+            group = (group + step) & mask; // triangular probing visits every group
+        }
+    }
+
+    // Slot for the key, adding it with a zero value when absent
+    template <typename Equal>
+    size_t insert(uint32_t hash, uint32_t key, Equal &&equal, bool &inserted)
+    {
+        int64_t found = find(hash, equal);
+        if (found >= 0)
+        {
+            inserted = false;
+            return static_cast<size_t>(found);
+        }
+        if ((count + tombstones + 1) * 8 > capacity() * 7)
+            rehash();
+        size_t idx = freeSlot(hash);
+        if (ctrl[idx] == DELETED)
+            tombstones--;
+        ctrl[idx] = static_cast<int8_t>(hash & 0x7F);
+        slots[idx] = MapSlot{key, 0, hash};
+        count++;
+        inserted = true;
+        return idx;
+    }
+
+    void erase(size_t idx);
+
+private:
+    static constexpr int8_t EMPTY = -128;
+    static constexpr int8_t DELETED = -2;
+
+    MapKind mapKind;
+    int8_t *ctrl = nullptr;
+    MapSlot *slots = nullptr;
+    size_t groups = 0;
+    size_t count = 0;
+    size_t tombstones = 0;
+    uint32_t rehashes = 0;
+
+    // Bit i is set when control byte i of the group equals value
+    static uint32_t matchByte(const int8_t *control, int8_t value)
+    {
+#if defined(__SSE2__)
+        __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(control));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value))));
+#else
+        uint32_t bits = 0;
+        for (size_t i = 0; i < GROUP_SIZE; i++)
+            bits |= static_cast<uint32_t>(control[i] == value) << i;
+        return bits;
+#endif
+    }
+
+    // Bit i is set when slot i of the group is EMPTY or DELETED
+    static uint32_t matchFree(const int8_t *control)
+    {
+#if defined(__SSE2__)
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(control))));
+#else
+        uint32_t bits = 0;
+        for (size_t i = 0; i < GROUP_SIZE; i++)
+            bits |= static_cast<uint32_t>(control[i] < 0) << i;
+        return bits;
+#endif
+    }
+
+    size_t freeSlot(uint32_t hash) const;
+    void rehash();
+};
+
+#endif // VM_HASH_MAP_HPP
@@ -0,0 +1,37 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_MATH_OPS_HPP
+#define VM_MATH_OPS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Functions behind FSQRT .. FPOW and VSQRT .. VPOW, in opcode order
+enum class MathFn : uint8_t
+{
+    SQRT,
+    EXP,
+    LOG,
+    SIN,
+    COS,
+    POW, // a to the power b
+};
+
+// Single value, computed by libm
+float mathScalar(MathFn fn, float a, float b);
+
+/*
+ * dst[i] = fn(a[i]) (or pow(a[i], b[i])) for FLOAT data. dst may be a but
+ * must not overlap it otherwise. With AVX2 and FMA the first call picks
+ * 8-lane polynomial kernels that stay within 2 ulp of libm; lanes whose
+ * argument falls outside the kernel's range (NaN, infinities, subnormal
+ * results, |x| > 65536 for SIN/COS) are recomputed with libm, so special
+ * values match the scalar opcodes. POW always uses libm.
+ */
+void mathMap(MathFn fn, float *dst, const float *a, const float *b, size_t count);
+
+// Name of the kernel set in use: "avx2" or "scalar"
+const char *mathIsa();
+
+#endif // VM_MATH_OPS_HPP
@@ -0,0 +1,290 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_MEMORY_HPP
+#define VM_MEMORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <iostream>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VM_GUARD_PAGES
+#include <csetjmp>
+#endif
+
+enum class MemoryKind : uint8_t
+{
+    HEAP,
+    CODE,
+    STACK,
+};
+
+// Placement requested for the memory behind the heap, code and stacks
+struct MemoryPolicy
+{
+    bool hugePages = false; // MAP_HUGETLB, falling back to madvise(MADV_HUGEPAGE)
+    bool numaLocal = false; // prefer the NUMA node of the allocating thread
+};
+
+// Page-granular allocations that honor a MemoryPolicy. Every range is
+// recorded so that dumpPageStats can report how much of it is resident and
+// how much of that ended up on huge pages.
+void *allocatePages(size_t bytes, const MemoryPolicy &policy, MemoryKind kind);
+void freePages(void *pages);
+void dumpPageStats(std::ostream &out);
+
+// Page-backed copy of a byte range (used for the decoded code), or a view
+// of bytes owned by someone else, such as a MappedFile
+class PageBuffer
+{
+public:
+    PageBuffer() = default;
+    PageBuffer(const PageBuffer &) = delete;
+    PageBuffer &operator=(const PageBuffer &) = delete;
+    ~PageBuffer() { clear(); }
+
+    void assign(const uint8_t *source, size_t length, const MemoryPolicy &policy, MemoryKind kind);
+    // Uses source in place; it must outlive the buffer
+    void borrow(uint8_t *source, size_t length);
+    void clear();
+
+    uint8_t *data() { return bytes; }
+    const uint8_t *data() const { return bytes; }
+    size_t size() const { return length; }
+    const uint8_t *begin() const { return bytes; }
+    const uint8_t *end() const { return bytes + length; }
+    uint8_t at(size_t idx) const
+    {
+        if (idx >= length)
+            throw std::out_of_range("Code offset " + std::to_string(idx) + " out of range");
+        return bytes[idx];
+    }
+
+private:
+    uint8_t *bytes = nullptr;
+    size_t length = 0;
+    bool owned = false;
+};
+
+/*
+ * A whole file in memory. On hosted builds it is mapped MAP_PRIVATE, so
+ * processes running the same binary share its page-cache pages; only a page
+ * written before seal() becomes a private copy. Targets without mmap read
+ * the file into an allocation.
+ */
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string &path);
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    uint8_t *data() { return bytes; }
+    const uint8_t *data() const { return bytes; }
+    size_t size() const { return length; }
+
+    // Makes the contents read-only
+    void seal();
+
+private:
+    uint8_t *bytes = nullptr;
+    size_t length = 0;
+};
+
+/*
+ * A large virtual range reserved up front and committed by the kernel only
+ * when a page is first touched. On hosted builds it is fenced by PROT_NONE
+ * guard pages on both ends, so running off either end faults instead of
+ * corrupting memory. Targets without mmap get a plain zeroed allocation.
+ */
+class GuardedRegion
+{
+public:
+    // An empty region, which reserves nothing until it is swapped with one
+    GuardedRegion() = default;
+    explicit GuardedRegion(size_t bytes, const MemoryPolicy &policy = MemoryPolicy());
+    GuardedRegion(const GuardedRegion &) = delete;
+    GuardedRegion &operator=(const GuardedRegion &) = delete;
+    ~GuardedRegion();
+
+    char *begin() const { return usable; }
+    char *end() const { return usable + usableSize; }
+    size_t size() const { return usableSize; }
+
+    bool inLowerGuard(const void *address) const;
+    bool inUpperGuard(const void *address) const;
+
+    // Hands the committed pages back to the kernel, leaving the range zeroed
+    void decommit();
+
+    void swap(GuardedRegion &other) noexcept
+    {
+        std::swap(mapping, other.mapping);
+        std::swap(mappingSize, other.mappingSize);
+        std::swap(usable, other.usable);
+        std::swap(usableSize, other.usableSize);
+        std::swap(guardSize, other.guardSize);
+    }
+
+private:
+    char *mapping = nullptr;
+    size_t mappingSize = 0;
+    char *usable = nullptr;
+    size_t usableSize = 0;
+    size_t guardSize = 0;
+};
+
+// Operand stack of 32-bit words. push has no limit check on hosted builds:
+// overflow runs into the upper guard page and underflow into the lower one.
+// pop keeps a low-water mark, the lowest size since markLowWater, below
+// which no word has changed; the collector uses it to rescan only the rest.
+class GuardedStack
+{
+public:
+    // A stack with no storage, to swap a real one into
+    GuardedStack() = default;
+    explicit GuardedStack(size_t bytes, const MemoryPolicy &policy = MemoryPolicy())
+        : region(bytes, policy), base(reinterpret_cast<uint32_t *>(region.begin())), top(base), lowWater(base)
+#ifndef VM_GUARD_PAGES
+          ,
+          limit(reinterpret_cast<uint32_t *>(region.end()))
+#endif
+    {
+    }
+
+    void push(uint32_t v)
+    {
+#ifndef VM_GUARD_PAGES
+        if (top == limit)
+            throw std::runtime_error("Stack Overflow");
+#endif
+        *top++ = v;
+    }
+    uint32_t pop()
+    {
+#ifndef VM_GUARD_PAGES
+        if (top == base)
+            throw std::runtime_error("Stack Underflow");
+#endif
+        if (--top < lowWater)
+            lowWater = top;
+        return *top;
+    }
+    uint32_t back() const
+    {
+#ifndef VM_GUARD_PAGES
+        if (top == base)
+            throw std::runtime_error("Empty stack");
+#endif
+        return top[-1];
+    }
+
+    size_t size() const { return static_cast<size_t>(top - base); }
+    bool empty() const { return top == base; }
+    uint32_t *data() const { return base; }
+    uint32_t &operator[](size_t idx) { return base[idx]; }
+    uint32_t operator[](size_t idx) const { return base[idx]; }
+    uint32_t at(size_t idx) const
+    {
+        if (idx >= size())
+            throw std::out_of_range("Stack index " + std::to_string(idx) + " out of range");
+        return base[idx];
+    }
+    void clear() { top = lowWater = base; }
+
+    size_t lowWaterMark() const { return static_cast<size_t>(lowWater - base); }
+    void markLowWater() { lowWater = top; }
+
+    // Exchanges the storage and contents of two stacks, which is how green
+    // threads switch stacks under a running interpreter
+    void swap(GuardedStack &other) noexcept
+    {
+        region.swap(other.region);
+        std::swap(base, other.base);
+        std::swap(top, other.top);
+        std::swap(lowWater, other.lowWater);
+#ifndef VM_GUARD_PAGES
+        std::swap(limit, other.limit);
+#endif
+    }
+
+    const GuardedRegion &guarded() const { return region; }
+
+private:
+    GuardedRegion region;
+    uint32_t *base = nullptr;
+    uint32_t *top = nullptr;
+    uint32_t *lowWater = nullptr;
+#ifndef VM_GUARD_PAGES
+    uint32_t *limit = nullptr;
+#endif
+};
+
+// Local variable store of 32-bit words. Indices come straight from bytecode
+// operands, so they are range checked; used() is the high-water mark and
+// bounds what the collector has to scan.
+class LocalStore
+{
+public:
+    explicit LocalStore(size_t bytes, const MemoryPolicy &policy = MemoryPolicy())
+        : region(bytes, policy), words(reinterpret_cast<uint32_t *>(region.begin())), capacity(region.size() / sizeof(uint32_t))
+    {
+    }
+
+    uint32_t &at(size_t idx)
+    {
+        if (idx >= highWater)
+        {
+            if (idx >= capacity)
+                throw std::out_of_range("Local index " + std::to_string(idx) + " out of range");
+            highWater = idx + 1;
+        }
+        return words[idx];
+    }
+
+    uint32_t *data() const { return words; }
+    size_t used() const { return highWater; }
+    void clear()
+    {
+        region.decommit();
+        highWater = 0;
+    }
+
+    const GuardedRegion &guarded() const { return region; }
+
+private:
+    GuardedRegion region;
+    uint32_t *words;
+    size_t capacity;
+    size_t highWater = 0;
+};
+
+#ifdef VM_GUARD_PAGES
+/*
+ * While alive, turns a fault in the guard pages of the given regions on the
+ * calling thread into a siglongjmp to `jump`. The owner must call sigsetjmp
+ * on `jump` in its own frame.
+ */
+struct GuardTrap
+{
+    sigjmp_buf jump;
+    const GuardedRegion *regions[2];
+    const void *volatile faultAddress = nullptr;
+    GuardTrap *previous;
+
+    GuardTrap(const GuardedRegion *first, const GuardedRegion *second);
+    GuardTrap(const GuardTrap &) = delete;
+    GuardTrap &operator=(const GuardTrap &) = delete;
+    ~GuardTrap();
+};
+#endif
+
+#endif // VM_MEMORY_HPP
@@ -7,7 +7,15 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <map>
+#include <atomic>
+#include <mutex>
 #include <cstdint>
+#include <memory.hpp>
+#include <hash_map.hpp>
 
 enum class FieldType : uint8_t
 {
@@ -15,6 +23,8 @@ enum class FieldType : uint8_t
     OBJECT = 2,
     FLOAT = 3,
     CHAR = 4,
+    LONG = 5,   // 64-bit integer, two stack slots
+    DOUBLE = 6, // 64-bit IEEE double, two stack slots
 };
 
 struct FieldInfo
@@ -23,6 +33,15 @@ struct FieldInfo
     FieldType type;
 };
 
+// Resolved position of a field inside an object. Indexed by field index,
+// with the inherited fields first so that a superclass field keeps the same
+// index and offset in every subclass.
+struct FieldSlot
+{
+    uint32_t offset;
+    FieldType type;
+};
+
 struct MethodInfo
 {
     std::string name;
@@ -37,26 +56,259 @@ struct ClassInfo
     std::vector<FieldInfo> fields;
     std::vector<MethodInfo> methods;
     std::vector<MethodInfo *> vtable; // pointers to methods for virtual dispatch
-    std::unordered_map<std::string, size_t> fieldOffsets;
-    size_t objectSize;
+    std::vector<FieldSlot> fieldSlots; // filled by computeLayout
+    size_t objectSize = 0;
+    uint16_t classId = 0;
+    bool laidOut = false;
 };
 
-class ObjectFactory
+// Position-independent form of a vtable slot: method methodIndex of class
+// classIndex, which is the class itself or one of its superclasses
+struct MethodRef
+{
+    uint32_t classIndex;
+    uint32_t methodIndex;
+};
+
+static constexpr uint16_t ARRAY_CLASS_ID = 0xFFFF;
+static constexpr uint16_t MAP_CLASS_ID = 0xFFFE;
+static constexpr uint16_t STRING_CLASS_ID = 0xFFFD;
+static constexpr uint16_t CHANNEL_CLASS_ID = 0xFFFC;
+
+// Header stored immediately before the data of every heap object.
+// Arrays additionally keep their element count in the 4 bytes in front of it;
+// maps keep 4 bytes of padding there so that their HashMap is 8-byte aligned.
+// Strings keep their byte length there, like arrays, and their cached hash in
+// the 4 bytes before the length. Channels keep their capacity there. Objects
+// keep nothing there; computeLayout puts their 8-byte fields at offsets that
+// are 4 mod 8 instead, which makes those fields 8-byte aligned.
+struct ObjectHeader
+{
+    uint16_t classId;      // class index, ARRAY_CLASS_ID, MAP_CLASS_ID, STRING_CLASS_ID or CHANNEL_CLASS_ID
+    uint8_t gcBits;        // reserved for the collector
+    FieldType elementType; // element type of arrays, unused for objects
+};
+
+static_assert(sizeof(ObjectHeader) == 4, "ObjectHeader must stay 4 bytes");
+
+// Start of a channel's data: a ring buffer of capacity 4-byte values
+// follows it, of the channel's element type
+struct ChannelState
+{
+    uint32_t head;  // slot of the oldest buffered value
+    uint32_t count; // values buffered
+};
+
+// gcBits flag of objects allocated inside an arena; they are released with
+// the arena and never swept or freed one by one
+static constexpr uint8_t GC_ARENA = 0x4;
+// gcBits flag of string constants and interned strings: one object is shared
+// by every user, so it is never swept and never written
+static constexpr uint8_t GC_CONSTANT = 0x8;
+
+// Blocks too large for a chunk, each on pages of its own that follow the
+// MemoryPolicy. Released blocks are kept for reuse up to SPARE_BYTES, since
+// fresh pages cost a fault each the first time they are written.
+class LargeBlocks
 {
 public:
+    LargeBlocks() = default;
+    LargeBlocks(const LargeBlocks &) = delete;
+    LargeBlocks &operator=(const LargeBlocks &) = delete;
+    ~LargeBlocks();
+
+    void *allocate(size_t size, const MemoryPolicy &policy);
+    void release(void *block, size_t size, const MemoryPolicy &policy);
+
+private:
+    static constexpr size_t SPARE_BYTES = 64 * 1024 * 1024;
+    std::multimap<size_t, void *> spare; // by rounded size
+    size_t spareBytes = 0;
+
+    static MemoryPolicy placement(size_t size, const MemoryPolicy &policy);
+    static size_t roundedSize(size_t size, const MemoryPolicy &policy);
+};
+
+// Bump allocator for objects that all die together. reset() releases every
+// allocation at once and keeps the chunks for the next use.
+class Arena
+{
+public:
+    Arena(const MemoryPolicy &policy, LargeBlocks &large) : policy(policy), large(large) {}
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    ~Arena();
+
+    void *allocate(size_t size);
+    void reset();
+
+private:
+    MemoryPolicy policy;
+    LargeBlocks &large; // shared with the collected heap
+    std::vector<void *> chunks;
+    std::vector<std::pair<void *, size_t>> largeBlocks;
+    size_t nextChunk = 0;
+    char *cursor = nullptr;
+    char *end = nullptr;
+};
+
+/*
+ * The classes of a program. Class records are parsed, laid out and given
+ * their vtables the first time they are resolved; that may happen on any
+ * thread running the program, so resolution is serialized and a class is
+ * only published once it is complete. Reading a resolved class takes no lock.
+ */
+class ClassTable
+{
+public:
+    ClassTable() = default;
+    ClassTable(const ClassTable &) = delete;
+    ClassTable &operator=(const ClassTable &) = delete;
+
+    // A class that arrives laid out, as one restored from a snapshot does,
+    // keeps its fieldSlots, objectSize and vtable
     void registerClass(const ClassInfo &cls);
+    // Reserves the next count class ids. The loader parses a class the first
+    // time it is resolved, which is when it is first instantiated.
+    using ClassLoader = std::function<ClassInfo(uint16_t classId)>;
+    void declareClasses(size_t count, ClassLoader loader);
+    // Parses, lays out and builds the vtable of a class and its superclasses
+    // if that has not happened yet
+    ClassInfo &resolveClass(uint16_t classId);
+    void resolveAllClasses();
+    size_t classCount() const { return classById.size(); }
+    const ClassInfo *getClassInfo(const std::string &className);
+    // nullptr for a class that has not been resolved; every class with an
+    // instance has been
+    const ClassInfo *getClassInfo(uint16_t classId) const
+    {
+        if (classId >= classById.size())
+            return nullptr;
+        return classById[classId].load(std::memory_order_acquire);
+    }
+    std::vector<MethodRef> vtableRefs(uint16_t classId) const;
+    void setVTable(uint16_t classId, const std::vector<MethodRef> &refs);
+
+private:
+    std::deque<std::atomic<ClassInfo *>> classById; // nullptr until resolved
+    std::vector<ClassInfo *> parsed;                 // nullptr until parsed
+    std::deque<ClassInfo> classStore;
+    ClassLoader classLoader;
+    std::mutex resolving;
+
+    ClassInfo &resolveLocked(uint16_t classId);
+    void computeLayout(ClassInfo &cls);
+    void buildVTable(ClassInfo &cls);
+};
+
+class ObjectFactory
+{
+public:
+    explicit ObjectFactory(ClassTable &classes) : classes(classes) {}
+    ObjectFactory(const ObjectFactory &) = delete;
+    ObjectFactory &operator=(const ObjectFactory &) = delete;
+    ~ObjectFactory();
+
+    // Must be set before the first allocation
+    void setMemoryPolicy(const MemoryPolicy &policy) { memoryPolicy = policy; }
+    static void *allocateChunk(const MemoryPolicy &policy, size_t size);
+    static void freeChunk(void *chunk);
+    static size_t chunkSize(const MemoryPolicy &policy);
+
+    ClassTable &classTable() const { return classes; }
     void *createObject(const std::string &className);
+    void *createObject(uint16_t classId);
+    void *createArray(FieldType type, uint32_t length);
+    // Maps are never placed in an arena: their table lives outside the heap
+    // block and is only released when the map itself is destroyed
+    void *createMap(MapKind kind);
+    // Bytes are left for the caller to fill; the byte after them is zeroed.
+    // Pinned strings always come from the collected heap, even inside an arena.
+    void *createString(uint32_t length, bool pinned = false);
+    // Channels are never placed in an arena either, since a task blocked on
+    // one would outlive the region
+    void *createChannel(FieldType type, uint32_t capacity);
     void destroyObject(void *object);
-    const ClassInfo *getClassInfo(const std::string &className) const;
-    void buildVTable(int classIndex);
-    void buildAllVTables();
+
+    // Objects created between pushArena and popArena come from that arena
+    void pushArena();
+    void popArena();
+    size_t arenaDepth() const { return activeArenas; }
+
+    size_t allocationSize(const void *object) const;
+
+    static size_t fieldSize(FieldType type);
+
+    static ObjectHeader *header(void *object)
+    {
+        return reinterpret_cast<ObjectHeader *>(static_cast<char *>(object) - sizeof(ObjectHeader));
+    }
+    static const ObjectHeader *header(const void *object)
+    {
+        return reinterpret_cast<const ObjectHeader *>(static_cast<const char *>(object) - sizeof(ObjectHeader));
+    }
+    static HashMap &map(void *object)
+    {
+        return *static_cast<HashMap *>(object);
+    }
+    static const HashMap &map(const void *object)
+    {
+        return *static_cast<const HashMap *>(object);
+    }
+    static uint32_t arrayLength(const void *array)
+    {
+        return *reinterpret_cast<const uint32_t *>(static_cast<const char *>(array) - sizeof(ObjectHeader) - sizeof(uint32_t));
+    }
+    // Strings share the array length slot
+    static uint32_t stringLength(const void *string) { return arrayLength(string); }
+    static ChannelState &channel(void *object)
+    {
+        return *static_cast<ChannelState *>(object);
+    }
+    static const ChannelState &channel(const void *object)
+    {
+        return *static_cast<const ChannelState *>(object);
+    }
+    static uint32_t *channelSlots(void *object)
+    {
+        return reinterpret_cast<uint32_t *>(static_cast<char *>(object) + sizeof(ChannelState));
+    }
+    static const uint32_t *channelSlots(const void *object)
+    {
+        return reinterpret_cast<const uint32_t *>(static_cast<const char *>(object) + sizeof(ChannelState));
+    }
+    // Channels share the array length slot too
+    static uint32_t channelCapacity(const void *channel) { return arrayLength(channel); }
+    // 0 until the hash has been computed
+    static uint32_t &stringHash(void *string)
+    {
+        return *reinterpret_cast<uint32_t *>(static_cast<char *>(string) - sizeof(ObjectHeader) - 2 * sizeof(uint32_t));
+    }
 
 private:
-    std::unordered_map<int, std::string> class_offset_to_name;
-    std::unordered_map<std::string, ClassInfo> classes;
-    void computeLayout(ClassInfo &cls);
-    void *heapAllocate(size_t size); // TODO: use a better allocator
-    void heapFree(void *ptr);
+    // Blocks up to a quarter chunk are recycled through per-size-class free
+    // lists carved out of chunks, so freeing one never reaches into malloc.
+    // Classes step by 8 bytes up to 256 bytes, then by a quarter of each
+    // power of two, up to the 512 KiB quarter of a huge page chunk. Larger
+    // blocks get pages of their own, placed by the same MemoryPolicy.
+    static constexpr size_t SIZE_CLASS_GRANULE = 8;
+    static constexpr size_t SMALL_CLASS_COUNT = 32; // blocks up to 256 bytes
+    static constexpr size_t SIZE_CLASS_COUNT = SMALL_CLASS_COUNT + 4 * 11;
+    ClassTable &classes;
+    void *freeLists[SIZE_CLASS_COUNT] = {};
+    std::vector<void *> chunks;
+    char *chunkCursor = nullptr;
+    char *chunkEnd = nullptr;
+    MemoryPolicy memoryPolicy;
+    LargeBlocks largeBlocks;
+    std::vector<std::unique_ptr<Arena>> arenas;
+    size_t activeArenas = 0;
+
+    void *heapAllocate(size_t size);
+    void *blockAllocate(size_t size);
+    void heapFree(void *ptr, size_t size);
+    // Free list index of a block of size bytes, and the size it rounds to
+    static size_t sizeClass(size_t size, size_t &blockSize);
 };
 
-#endif // VM_OBJECT_FACTORY_HPP
\ No newline at end of file
+#endif // VM_OBJECT_FACTORY_HPP
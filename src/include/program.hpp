@@ -0,0 +1,93 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_PROGRAM_HPP
+#define VM_PROGRAM_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <bytecode.hpp>
+#include <object_factory.hpp>
+#include <memory.hpp>
+
+// A method found by Program::findMethod
+struct MethodHandle
+{
+    uint16_t classId;
+    uint32_t offset; // bytecode offset of the method
+};
+
+/*
+ * The loaded, immutable part of a program: the code as the loader rewrote
+ * it, the constant pool, the string constants, the initial globals and the
+ * classes. Any number of VMs, on any threads, can run one Program at the
+ * same time; each keeps its own stack, locals and heap. Classes are still
+ * resolved on first use, which ClassTable makes safe across threads.
+ *
+ * String constants are not heap objects here. Every VM creates them first
+ * thing, in order, so string i gets heap reference i, which is what the
+ * constant pool holds.
+ */
+class Program
+{
+public:
+    explicit Program(const std::vector<uint8_t> &filedata, const MemoryPolicy &memory = MemoryPolicy());
+    // Code and an untyped constant pool are used in place in the mapping
+    explicit Program(MappedFile file, const MemoryPolicy &memory = MemoryPolicy());
+    Program(const Program &) = delete;
+    Program &operator=(const Program &) = delete;
+
+    const PageBuffer &code() const { return codePages; }
+    // The CodeMarks verifyCode returned for the code
+    const std::vector<uint8_t> &codeMarks() const { return marks; }
+    uint32_t entryPoint() const { return entry; }
+    size_t constantCount() const { return numConstants; }
+    uint32_t constant(size_t idx) const
+    {
+        if (mappedConstants == nullptr)
+            return constantPool[idx];
+        return readWord(mappedConstants + idx * 4);
+    }
+    const std::vector<std::string> &strings() const { return stringConstants; }
+    const std::vector<uint32_t> &globals() const { return initialGlobals; }
+    // Resolving a class is logically const: it only fills in what the class
+    // records already determine
+    ClassTable &classes() const { return classTable; }
+
+    // Finds a method of the class or of its nearest superclass declaring it
+    MethodHandle findMethod(const std::string &className, const std::string &methodName) const;
+    // Lists the entry point, the methods and the loaded code
+    void disassemble(std::ostream &out) const;
+    // Writes the program as a snapshot that later runs load instead of the
+    // binary. Every class is resolved first.
+    void saveSnapshot(const std::string &path) const;
+
+private:
+    MemoryPolicy memory;
+    MappedFile image; // the binary, when the program was given a mapping
+
+    PageBuffer codePages;
+    std::vector<uint8_t> marks;
+    uint32_t entry = 0;
+    std::vector<uint32_t> constantPool;
+    const uint8_t *mappedConstants = nullptr; // untyped pool read from image instead of constantPool
+    size_t numConstants = 0;
+    std::vector<std::string> stringConstants;
+    std::vector<uint32_t> initialGlobals;
+    // Class records stay unparsed until the class table resolves them
+    const uint8_t *classMetadata = nullptr; // in image, or in ownedClassMetadata
+    std::vector<uint8_t> ownedClassMetadata;
+    std::vector<uint32_t> classRecords; // offset of each record in classMetadata
+    mutable ClassTable classTable;
+
+    void setup(const uint8_t *binary, size_t binarySize);
+    void loadFromBinary(const uint8_t *binary, size_t binarySize);
+    // Restores what loadFromBinary and the class setup leave behind
+    void loadSnapshot(const uint8_t *snapshot, size_t snapshotSize);
+    // Builds the ClassInfo of a class record; the loader has checked its bounds
+    ClassInfo parseClass(uint16_t classId) const;
+};
+
+#endif // VM_PROGRAM_HPP
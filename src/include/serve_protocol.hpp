@@ -0,0 +1,88 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_SERVE_PROTOCOL_HPP
+#define VM_SERVE_PROTOCOL_HPP
+
+#include <bytecode.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Job protocol of vm --serve, over a Unix stream socket. Every integer is a
+ * little-endian 32-bit word, and a connection carries any number of jobs,
+ * one after the other.
+ *
+ * Request: the length of the rest, then
+ *   program  length, path as the server opens it
+ *   method   length, Class.method, or nothing to run from the entry point
+ *   args     count, then that many INT arguments of the method
+ *   stdin    length, bytes the job reads from fd 0
+ *
+ * Response: frames of a type byte, a payload length and the payload, up to
+ * and including the EXIT frame. A STARTUP frame, when sent, comes first.
+ */
+enum class Frame : uint8_t
+{
+    STDOUT = 'O',  // bytes the job wrote to fd 1, as they are flushed
+    STDERR = 'E',  // bytes written to fd 2, and the message of a failed job
+    RESULT = 'R',  // INT result of a method job, one word
+    EXIT = 'X',    // SYS_EXIT status, 0, or 1 when the job failed; one word
+    STARTUP = 'S', // nanoseconds from fork to first instruction, of forked jobs; one word
+};
+
+// Largest request the server reads
+constexpr uint32_t MAX_REQUEST_BYTES = 64 * 1024 * 1024;
+
+inline bool readFully(int fd, void *data, size_t size)
+{
+    uint8_t *p = static_cast<uint8_t *>(data);
+    while (size > 0)
+    {
+        ssize_t got = read(fd, p, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        p += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+// MSG_NOSIGNAL: a client that went away is an error, not SIGPIPE
+inline bool writeFully(int fd, const void *data, size_t size)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        p += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+inline bool writeFrame(int fd, Frame type, const void *data, uint32_t size)
+{
+    std::vector<uint8_t> head{static_cast<uint8_t>(type)};
+    putWord(head, size);
+    return writeFully(fd, head.data(), head.size()) && writeFully(fd, data, size);
+}
+
+inline bool writeFrame(int fd, Frame type, int32_t value)
+{
+    std::vector<uint8_t> word;
+    putWord(word, static_cast<uint32_t>(value));
+    return writeFrame(fd, type, word.data(), 4);
+}
+
+#endif // VM_SERVE_PROTOCOL_HPP
@@ -0,0 +1,33 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_SERVER_HPP
+#define VM_SERVER_HPP
+
+#include <string>
+#include <vector>
+#include <VM.hpp>
+
+/*
+ * Serves jobs over a Unix socket at socketPath until the process is killed;
+ * the protocol is in serve_protocol.hpp. Programs are loaded on their first
+ * job, or up front when listed in preload, and stay loaded. Every job runs
+ * in a fresh VM on the Program, with its stdin read from the request and
+ * its stdout and stderr streamed back, so jobs share no state. Each
+ * connection is served by a thread of its own.
+ */
+int serve(const std::string &socketPath, const std::vector<std::string> &preload, const VMOptions &options);
+
+/*
+ * Serves jobs of one program with a process per job. The program is loaded,
+ * its classes are resolved and initMethod, if given, is invoked once; its
+ * heap and globals are what every job starts from. Each connection gets a
+ * process forked from the server, which forks again for each of its jobs,
+ * so a job's pages are the server's, copied only when written. Jobs name
+ * programPath or no program. Every job sends a STARTUP frame with the time
+ * from its fork to its first instruction.
+ */
+int serveForked(const std::string &socketPath, const std::string &programPath, const std::string &initMethod,
+                const VMOptions &options);
+
+#endif // VM_SERVER_HPP
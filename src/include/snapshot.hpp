@@ -0,0 +1,47 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_SNAPSHOT_HPP
+#define VM_SNAPSHOT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * A snapshot is the state of a VM right after loading: the code as the
+ * loader rewrote it, the resolved constant pool, the string constants, the
+ * initial globals and the laid-out classes with their vtables. Every
+ * reference inside it is a file offset or an index and every integer is a
+ * little-endian 32-bit word, so the file can be mapped anywhere and used in
+ * place.
+ *
+ *   0  magic "VMS" 0x01
+ *   4  version word: SNAPSHOT_VERSION, high 16 bits reserved
+ *   8  entry point
+ *  12  code offset, code size in bytes
+ *  20  constants offset, constant count (one word each)
+ *  28  strings offset, string count
+ *  36  globals offset, global count (one word each)
+ *  44  classes offset, class count
+ *
+ * String record: heap reference, byte length, bytes.
+ * Class record: name length, name, superclass index, object size, own
+ * field count, per field (name length, name, type), field slot count
+ * including inherited ones, per slot (offset, type), method count, per
+ * method (name length, name, bytecode offset, virtual flag), vtable size,
+ * per slot (class index, method index).
+ *
+ * Sections start on a word boundary.
+ */
+
+static constexpr uint8_t SNAPSHOT_MAGIC[4] = {0x56, 0x4D, 0x53, 0x01};
+static constexpr uint16_t SNAPSHOT_VERSION = 1;
+static constexpr size_t SNAPSHOT_HEADER_SIZE = 52;
+
+inline bool isSnapshot(const uint8_t *bytes, size_t size)
+{
+    return size >= 4 && bytes[0] == SNAPSHOT_MAGIC[0] && bytes[1] == SNAPSHOT_MAGIC[1] &&
+           bytes[2] == SNAPSHOT_MAGIC[2] && bytes[3] == SNAPSHOT_MAGIC[3];
+}
+
+#endif // VM_SNAPSHOT_HPP
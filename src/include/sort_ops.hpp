@@ -0,0 +1,38 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_SORT_OPS_HPP
+#define VM_SORT_OPS_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <object_factory.hpp>
+
+// Ranges at least this long are sorted by several threads
+static constexpr size_t PARALLEL_SORT_MIN = 1 << 16;
+
+// Total order of FLOAT elements: NaNs after every number and equal to each other
+struct FloatLess
+{
+    bool operator()(float a, float b) const
+    {
+        return a < b || (std::isnan(b) && !std::isnan(a));
+    }
+};
+
+/*
+ * Kernels behind ASORT, ASORT_STABLE, ABSEARCH and APARTITION for INT, FLOAT
+ * and CHAR data. FLOAT NaNs order after every number and CHAR orders as
+ * unsigned bytes, like ARRAYCMP. `threads` of 0 uses every hardware thread.
+ */
+void arraySort(void *data, size_t count, FieldType type, unsigned threads);
+// Stable sort of keys; values, when not null, is permuted alongside and may
+// have any element type
+void arraySortStable(void *keys, FieldType keyType, void *values, FieldType valueType, size_t count, unsigned threads);
+// Index of an element equal to key in sorted data, or -(insertion point) - 1
+int64_t arrayBinarySearch(const void *data, size_t count, FieldType type, uint32_t key);
+// Moves the elements less than pivot to the front and returns their count
+size_t arrayPartition(void *data, size_t count, FieldType type, uint32_t pivot);
+
+#endif // VM_SORT_OPS_HPP
@@ -0,0 +1,17 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_STRING_OPS_HPP
+#define VM_STRING_OPS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernels behind the string opcodes. Strings are compared as unsigned bytes.
+
+// -1, 0 or 1; a proper prefix orders first
+int stringCompare(const uint8_t *a, size_t aLength, const uint8_t *b, size_t bLength);
+// Index of the first occurrence of needle in text, or -1. An empty needle is found at 0.
+int64_t stringFind(const uint8_t *text, size_t textLength, const uint8_t *needle, size_t needleLength);
+
+#endif // VM_STRING_OPS_HPP
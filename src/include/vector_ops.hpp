@@ -0,0 +1,41 @@
+/**
+ * Author: Shivadharshan S
+ */
+#ifndef VM_VECTOR_OPS_HPP
+#define VM_VECTOR_OPS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <object_factory.hpp>
+
+// Element-wise operations of VADD .. VFMA. FMA accumulates: dst += a * b.
+enum class VectorOp : uint8_t
+{
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    FMA,
+};
+
+enum class VectorReduce : uint8_t
+{
+    SUM,
+    MIN,
+    MAX,
+};
+
+/*
+ * Kernels behind the vector opcodes for INT and FLOAT data. The first call
+ * picks AVX2, SSE4.1 or portable code for the running CPU. INT arithmetic
+ * wraps like IADD/IMUL; FLOAT sums may be added in a different order than a
+ * sequential loop would. Results are returned as the raw 32-bit word.
+ */
+void vectorMap(VectorOp op, FieldType type, void *dst, const void *a, const void *b, size_t count);
+uint32_t vectorDot(FieldType type, const void *a, const void *b, size_t count);
+uint32_t vectorReduce(VectorReduce op, FieldType type, const void *a, size_t count);
+
+// Name of the kernel set in use: "avx2", "sse4.1" or "scalar"
+const char *vectorIsa();
+
+#endif // VM_VECTOR_OPS_HPP
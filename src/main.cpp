@@ -5,50 +5,239 @@
 #include <fstream>
 #include <vector>
 #include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <csignal>
 #include <VM.hpp>
+#include <batch.hpp>
+
+#ifdef VM_SERVER
+#include <server.hpp>
+#endif
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2)
+    VMOptions options;
+    const char *filename = nullptr;
+    bool disasm = false;
+    const char *snapshotPath = nullptr;
+    const char *batchMethod = nullptr;
+    const char *resumePath = nullptr;
+    unsigned batchThreads = 0;
+    const char *socketPath = nullptr;
+    bool forkJobs = false; // --serve with a process per job
+    const char *initMethod = nullptr;
+    std::vector<std::string> preload; // further binaries, for --serve
+
+    for (int i = 1; i < argc; i++)
     {
-        std::cerr << "Usage: " << argv[0] << " <vm_binary_file>" << std::endl;
-        return 1;
+        if (std::strcmp(argv[i], "--heap-stats") == 0)
+        {
+            options.heapStats = true;
+        }
+        else if (std::strcmp(argv[i], "--gc-stats") == 0)
+        {
+            options.gcStats = true;
+        }
+        else if (std::strcmp(argv[i], "--arena-check") == 0)
+        {
+            options.arenaChecks = true;
+        }
+        else if (std::strcmp(argv[i], "--huge-pages") == 0)
+        {
+            options.memory.hugePages = true;
+        }
+        else if (std::strcmp(argv[i], "--numa-local") == 0)
+        {
+            options.memory.numaLocal = true;
+        }
+        else if (std::strcmp(argv[i], "--memory-stats") == 0)
+        {
+            options.memoryStats = true;
+        }
+        else if (std::strcmp(argv[i], "--disasm") == 0)
+        {
+            disasm = true;
+        }
+        else if (std::strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc)
+        {
+            snapshotPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+        {
+            options.checkpointPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--resume") == 0 && i + 1 < argc)
+        {
+            resumePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            batchMethod = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            batchThreads = std::stoul(argv[++i]);
+        }
+#ifdef VM_SERVER
+        else if (std::strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+        {
+            socketPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--fork") == 0)
+        {
+            forkJobs = true;
+        }
+        else if (std::strcmp(argv[i], "--init") == 0 && i + 1 < argc)
+        {
+            initMethod = argv[++i];
+        }
+#endif
+        else if (std::strcmp(argv[i], "--stack-mb") == 0 && i + 1 < argc)
+        {
+            options.stackBytes = std::stoul(argv[++i]) * 1024 * 1024;
+        }
+        else if (std::strcmp(argv[i], "--task-stack-kb") == 0 && i + 1 < argc)
+        {
+            options.taskStackBytes = std::stoul(argv[++i]) * 1024;
+        }
+        else if (std::strcmp(argv[i], "--task-quantum") == 0 && i + 1 < argc)
+        {
+            options.taskQuantum = std::max(1ul, std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--sort-threads") == 0 && i + 1 < argc)
+        {
+            options.sortThreads = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--gc-pause-us") == 0 && i + 1 < argc)
+        {
+            options.gc.maxPauseMicros = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--gc-trigger-kb") == 0 && i + 1 < argc)
+        {
+            options.gc.triggerBytes = std::stoul(argv[++i]) * 1024;
+        }
+        else if (filename == nullptr)
+        {
+            filename = argv[i];
+        }
+        else
+        {
+            preload.push_back(argv[i]);
+        }
     }
 
-    const char *filename = argv[1];
+#ifdef VM_SERVER
+    if (socketPath != nullptr)
+    {
+        try
+        {
+            if (forkJobs)
+            {
+                if (filename == nullptr || !preload.empty())
+                    throw std::runtime_error("--fork serves exactly one binary");
+                return serveForked(socketPath, filename, initMethod != nullptr ? initMethod : "", options);
+            }
+            if (filename != nullptr)
+                preload.insert(preload.begin(), filename);
+            return serve(socketPath, preload, options);
+        }
+        catch (const std::exception &ex)
+        {
+            std::cerr << "Error: " << ex.what() << std::endl;
+            return 1;
+        }
+    }
+#endif
 
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
-    if (!file)
+    if (filename == nullptr)
     {
-        std::cerr << "Error: Cannot open file " << filename << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--heap-stats] [--gc-stats] [--arena-check] [--stack-mb <n>] [--task-stack-kb <n>] [--task-quantum <n>] [--huge-pages] [--numa-local] [--memory-stats] [--gc-pause-us <n>] [--gc-trigger-kb <n>] [--sort-threads <n>] [--disasm] [--snapshot <file>] [--checkpoint <file>] [--resume <checkpoint>] [--batch <Class.method> [--threads <n>]] <vm_binary_file>\n       " << argv[0] << " --serve <socket> [vm_binary_file...]\n       " << argv[0] << " --serve <socket> --fork [--init <Class.method>] <vm_binary_file>" << std::endl;
         return 1;
     }
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
 
-    if (size <= 0)
+    MappedFile image;
+    try
     {
-        std::cerr << "Error: File is empty or invalid size" << std::endl;
+        image = MappedFile(filename);
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << "Error: " << ex.what() << std::endl;
         return 1;
     }
 
-    std::vector<uint8_t> filedata(size);
-    if (!file.read(reinterpret_cast<char *>(filedata.data()), size))
+    int status = 0;
+    try
+    {
+        auto program = std::make_shared<const Program>(std::move(image), options.memory);
+        if (disasm)
+        {
+            program->disassemble(std::cout);
+            return 0;
+        }
+        if (snapshotPath != nullptr)
+        {
+            program->saveSnapshot(snapshotPath);
+            return 0;
+        }
+        if (batchMethod != nullptr)
+        {
+            // One input per line of stdin, as INT arguments; one INT result
+            // or error per line of stdout, in input order
+            const char *dot = std::strrchr(batchMethod, '.');
+            if (dot == nullptr)
+                throw std::runtime_error("--batch expects Class.method");
+            MethodHandle method = program->findMethod(std::string(batchMethod, dot), dot + 1);
+            std::vector<std::vector<VMValue>> inputs;
+            for (std::string line; std::getline(std::cin, line);)
+            {
+                std::istringstream fields(line);
+                inputs.emplace_back();
+                for (int32_t arg; fields >> arg;)
+                    inputs.back().push_back(VMValue::ofInt(arg));
+            }
+            for (const BatchResult &result : runBatch(program, method, inputs, FieldType::INT, batchThreads, options))
+            {
+                if (result.error.empty())
+                    std::cout << result.value.intValue << '\n';
+                else
+                    std::cout << "error: " << result.error << '\n';
+            }
+            return 0;
+        }
+        if (!options.checkpointPath.empty())
+            VM::checkpointOnSignal(SIGUSR1);
+        VM vm(program, options);
+        if (resumePath != nullptr)
+        {
+            vm.restore(resumePath);
+            vm.resume();
+        }
+        else
+        {
+            vm.run();
+        }
+        status = vm.exitStatus();
+        if (options.heapStats)
+        {
+            vm.dumpHeapStats(std::cerr);
+        }
+        if (options.gcStats)
+        {
+            vm.dumpGCStats(std::cerr);
+        }
+        if (options.memoryStats)
+        {
+            vm.dumpMemoryStats(std::cerr);
+        }
+    }
+    catch (const std::exception &ex)
     {
-        std::cerr << "Error: Failed to read file " << filename << std::endl;
+        std::cerr << "VM error: " << ex.what() << std::endl;
         return 1;
     }
 
-    // try
-    // {
-    VM vm(filedata);
-    vm.run();
-    // }
-    // catch (const std::exception &ex)
-    // {
-    // std::cerr << "VM error: " << ex.what() << std::endl;
-    // return 1;
-    // }
-
-    return 0;
+    return status;
 }
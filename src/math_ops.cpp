@@ -0,0 +1,253 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <math_ops.hpp>
+#include <cmath>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define VM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    float libmFn(MathFn fn, float a, float b)
+    {
+        switch (fn)
+        {
+        case MathFn::SQRT:
+            return std::sqrt(a);
+        case MathFn::EXP:
+            return std::exp(a);
+        case MathFn::LOG:
+            return std::log(a);
+        case MathFn::SIN:
+            return std::sin(a);
+        case MathFn::COS:
+            return std::cos(a);
+        case MathFn::POW:
+            return std::pow(a, b);
+        }
+        return 0.0f;
+    }
+
+    // Portable kernel. It starts at element i so the SIMD kernel can hand it
+    // the tail that does not fill a whole register.
+    void mapScalar(MathFn fn, float *dst, const float *a, const float *b, size_t i, size_t n)
+    {
+        for (; i < n; i++)
+            dst[i] = libmFn(fn, a[i], b != nullptr ? b[i] : 0.0f);
+    }
+
+    void mapPortable(MathFn fn, float *dst, const float *a, size_t n)
+    {
+        mapScalar(fn, dst, a, nullptr, 0, n);
+    }
+
+#ifdef VM_X86_KERNELS
+
+    // AVX2 with FMA: 8 lanes. The polynomials are the single precision
+    // minimax fits from Cephes. Each kernel also returns the lanes it is
+    // accurate for; the caller hands the others to libm.
+
+    __attribute__((target("avx2,fma"))) inline __m256 splat(float value)
+    {
+        return _mm256_set1_ps(value);
+    }
+
+    __attribute__((target("avx2,fma"))) __m256 expAvx2(__m256 x, __m256 &valid)
+    {
+        // Keeps 2^n and the result normal
+        valid = _mm256_and_ps(_mm256_cmp_ps(x, splat(-87.0f), _CMP_GE_OQ), _mm256_cmp_ps(x, splat(88.0f), _CMP_LE_OQ));
+        x = _mm256_and_ps(x, valid);
+
+        // x = n * ln 2 + r with |r| <= ln 2 / 2; ln 2 is split in two so
+        // n * C1 is exact
+        __m256 n = _mm256_round_ps(_mm256_mul_ps(x, splat(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_fnmadd_ps(n, splat(0.693359375f), x);
+        r = _mm256_fnmadd_ps(n, splat(-2.12194440e-4f), r);
+
+        __m256 p = splat(1.9875691500e-4f);
+        p = _mm256_fmadd_ps(p, r, splat(1.3981999507e-3f));
+        p = _mm256_fmadd_ps(p, r, splat(8.3334519073e-3f));
+        p = _mm256_fmadd_ps(p, r, splat(4.1665795894e-2f));
+        p = _mm256_fmadd_ps(p, r, splat(1.6666665459e-1f));
+        p = _mm256_fmadd_ps(p, r, splat(5.0000001201e-1f));
+        __m256 y = _mm256_add_ps(_mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r), splat(1.0f));
+
+        __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(y, _mm256_castsi256_ps(exponent));
+    }
+
+    __attribute__((target("avx2,fma"))) __m256 logAvx2(__m256 x, __m256 &valid)
+    {
+        // Positive, normal and finite
+        valid = _mm256_and_ps(_mm256_cmp_ps(x, splat(1.17549435e-38f), _CMP_GE_OQ), _mm256_cmp_ps(x, splat(3.40282347e38f), _CMP_LE_OQ));
+        x = _mm256_blendv_ps(splat(1.0f), x, valid);
+
+        // x = m * 2^e with m in [sqrt(1/2), sqrt(2)), then log(x) = log(m) + e * ln 2
+        __m256i bits = _mm256_castps_si256(x);
+        __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+        __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F000000)));
+        __m256 small = _mm256_cmp_ps(m, splat(0.707106781186547524f), _CMP_LT_OQ);
+        e = _mm256_sub_ps(e, _mm256_and_ps(splat(1.0f), small));
+        m = _mm256_add_ps(_mm256_sub_ps(m, splat(1.0f)), _mm256_and_ps(m, small));
+
+        __m256 z = _mm256_mul_ps(m, m);
+        __m256 p = splat(7.0376836292e-2f);
+        p = _mm256_fmadd_ps(p, m, splat(-1.1514610310e-1f));
+        p = _mm256_fmadd_ps(p, m, splat(1.1676998740e-1f));
+        p = _mm256_fmadd_ps(p, m, splat(-1.2420140846e-1f));
+        p = _mm256_fmadd_ps(p, m, splat(1.4249322787e-1f));
+        p = _mm256_fmadd_ps(p, m, splat(-1.6668057665e-1f));
+        p = _mm256_fmadd_ps(p, m, splat(2.0000714765e-1f));
+        p = _mm256_fmadd_ps(p, m, splat(-2.4999993993e-1f));
+        p = _mm256_fmadd_ps(p, m, splat(3.3333331174e-1f));
+        __m256 y = _mm256_mul_ps(_mm256_mul_ps(p, m), z);
+        y = _mm256_fmadd_ps(e, splat(-2.12194440e-4f), y);
+        y = _mm256_fnmadd_ps(z, splat(0.5f), y);
+        return _mm256_fmadd_ps(e, splat(0.693359375f), _mm256_add_ps(m, y));
+    }
+
+    // |x| - j * pi/4 for 4 lanes; pi/4 is split in two doubles
+    __attribute__((target("avx2,fma"))) __m128 reduceAvx2(__m128 ax, __m128i j)
+    {
+        __m256d y = _mm256_cvtepi32_pd(j);
+        __m256d r = _mm256_fnmadd_pd(y, _mm256_set1_pd(7.8539816339744828e-1), _mm256_cvtps_pd(ax));
+        r = _mm256_fnmadd_pd(y, _mm256_set1_pd(3.0616169978683830e-17), r);
+        return _mm256_cvtpd_ps(r);
+    }
+
+    __attribute__((target("avx2,fma"))) __m256 sinCosAvx2(__m256 x, bool cosine, __m256 &valid)
+    {
+        const __m256 signBit = splat(-0.0f);
+        __m256 ax = _mm256_andnot_ps(signBit, x);
+        valid = _mm256_cmp_ps(ax, splat(65536.0f), _CMP_LE_OQ);
+        ax = _mm256_and_ps(ax, valid);
+
+        // Octant j, rounded up to even, so |x| - j * pi/4 lies in [-pi/4, pi/4]
+        __m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(ax, splat(1.27323954473516f)));
+        j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+
+        // r = |x| - j * pi/4 in double precision: near a zero of the result
+        // most of the bits of |x| cancel
+        __m256 r = _mm256_set_m128(reduceAvx2(_mm256_extractf128_ps(ax, 1), _mm256_extracti128_si256(j, 1)),
+                                   reduceAvx2(_mm256_castps256_ps128(ax), _mm256_castsi256_si128(j)));
+
+        // cos(x) = sin(x + pi/2): two octants on
+        __m256i sign;
+        if (cosine)
+        {
+            j = _mm256_sub_epi32(j, _mm256_set1_epi32(2));
+            sign = _mm256_slli_epi32(_mm256_andnot_si256(j, _mm256_set1_epi32(4)), 29);
+        }
+        else
+        {
+            sign = _mm256_xor_si256(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29),
+                                    _mm256_castps_si256(_mm256_and_ps(x, signBit)));
+        }
+        __m256 useSin = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_setzero_si256()));
+        __m256 z = _mm256_mul_ps(r, r);
+
+        __m256 c = splat(2.443315711809948e-5f);
+        c = _mm256_fmadd_ps(c, z, splat(-1.388731625493765e-3f));
+        c = _mm256_fmadd_ps(c, z, splat(4.166664568298827e-2f));
+        c = _mm256_fmadd_ps(c, _mm256_mul_ps(z, z), _mm256_fnmadd_ps(z, splat(0.5f), splat(1.0f)));
+
+        __m256 s = splat(-1.9515295891e-4f);
+        s = _mm256_fmadd_ps(s, z, splat(8.3321608736e-3f));
+        s = _mm256_fmadd_ps(s, z, splat(-1.6666654611e-1f));
+        s = _mm256_fmadd_ps(s, _mm256_mul_ps(z, r), r);
+
+        return _mm256_xor_ps(_mm256_blendv_ps(c, s, useSin), _mm256_castsi256_ps(sign));
+    }
+
+    __attribute__((target("avx2,fma"))) void mapAvx2(MathFn fn, float *dst, const float *a, size_t n)
+    {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 x = _mm256_loadu_ps(a + i);
+            __m256 valid = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            __m256 result;
+            switch (fn)
+            {
+            case MathFn::SQRT:
+                result = _mm256_sqrt_ps(x);
+                break;
+            case MathFn::EXP:
+                result = expAvx2(x, valid);
+                break;
+            case MathFn::LOG:
+                result = logAvx2(x, valid);
+                break;
+            case MathFn::SIN:
+            case MathFn::COS:
+                result = sinCosAvx2(x, fn == MathFn::COS, valid);
+                break;
+            default:
+                mapScalar(fn, dst, a, nullptr, i, n);
+                return;
+            }
+            // Read the arguments of rejected lanes before dst, which may be a, is written
+            int rejected = ~_mm256_movemask_ps(valid) & 0xFF;
+            if (rejected != 0)
+            {
+                float lanes[8];
+                _mm256_storeu_ps(lanes, result);
+                for (; rejected != 0; rejected &= rejected - 1)
+                {
+                    int lane = __builtin_ctz(rejected);
+                    lanes[lane] = libmFn(fn, a[i + lane], 0.0f);
+                }
+                result = _mm256_loadu_ps(lanes);
+            }
+            _mm256_storeu_ps(dst + i, result);
+        }
+        mapScalar(fn, dst, a, nullptr, i, n);
+    }
+
+#endif // VM_X86_KERNELS
+
+    struct MathKernels
+    {
+        const char *name;
+        void (*map)(MathFn, float *, const float *, size_t);
+    };
+
+    MathKernels selectKernels()
+    {
+#ifdef VM_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return MathKernels{"avx2", mapAvx2};
+#endif
+        return MathKernels{"scalar", mapPortable};
+    }
+
+    const MathKernels &kernels()
+    {
+        static const MathKernels selected = selectKernels();
+        return selected;
+    }
+}
+
+float mathScalar(MathFn fn, float a, float b)
+{
+    return libmFn(fn, a, b);
+}
+
+void mathMap(MathFn fn, float *dst, const float *a, const float *b, size_t count)
+{
+    // exp(b * log(a)) in single precision is off by up to ~100 ulp for large
+    // results, so POW has no vector kernel
+    if (fn == MathFn::POW)
+        mapScalar(fn, dst, a, b, 0, count);
+    else
+        kernels().map(fn, dst, a, count);
+}
+
+const char *mathIsa()
+{
+    return kernels().name;
+}
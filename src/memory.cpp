@@ -0,0 +1,455 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <memory.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#ifdef VM_GUARD_PAGES
+#include <fstream>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace
+{
+    constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    struct PageRange
+    {
+        char *start;
+        size_t length;
+        MemoryKind kind;
+        bool hugetlb; // backed by the hugetlbfs pool rather than transparent huge pages
+    };
+
+    std::mutex rangesMutex;
+    std::map<char *, PageRange> ranges;
+
+    void recordRange(void *start, size_t length, MemoryKind kind, bool hugetlb)
+    {
+        std::lock_guard<std::mutex> lock(rangesMutex);
+        ranges[static_cast<char *>(start)] = PageRange{static_cast<char *>(start), length, kind, hugetlb};
+    }
+
+    bool forgetRange(void *start, PageRange &range)
+    {
+        std::lock_guard<std::mutex> lock(rangesMutex);
+        auto it = ranges.find(static_cast<char *>(start));
+        if (it == ranges.end())
+            return false;
+        range = it->second;
+        ranges.erase(it);
+        return true;
+    }
+
+    size_t roundUp(size_t value, size_t to)
+    {
+        return (value + to - 1) / to * to;
+    }
+
+    // Prefers the NUMA node of the calling thread for pages not yet touched
+    void bindToLocalNode(void *start, size_t length)
+    {
+#ifdef __linux__
+        constexpr int MPOL_PREFERRED = 1;
+        unsigned cpu = 0, node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0 || node >= 8 * sizeof(unsigned long))
+            return;
+        unsigned long nodemask = 1ul << node;
+        syscall(SYS_mbind, start, length, MPOL_PREFERRED, &nodemask, 8 * sizeof(nodemask), 0);
+#else
+        (void)start;
+        (void)length;
+#endif
+    }
+
+    void applyPolicy(void *start, size_t length, const MemoryPolicy &policy)
+    {
+#if defined(VM_GUARD_PAGES) && defined(MADV_HUGEPAGE)
+        if (policy.hugePages)
+            madvise(start, length, MADV_HUGEPAGE);
+#endif
+        if (policy.numaLocal)
+            bindToLocalNode(start, length);
+    }
+}
+
+void *allocatePages(size_t bytes, const MemoryPolicy &policy, MemoryKind kind)
+{
+#ifdef VM_GUARD_PAGES
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#ifdef MAP_HUGETLB
+    if (policy.hugePages)
+    {
+        size_t length = roundUp(bytes, HUGE_PAGE_SIZE);
+        void *pages = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (pages != MAP_FAILED)
+        {
+            if (policy.numaLocal)
+                bindToLocalNode(pages, length);
+            recordRange(pages, length, kind, true);
+            return pages;
+        }
+
+        // No reserved huge pages: over-reserve so the range can start on a
+        // huge page boundary and let transparent huge pages back it
+        void *raw = mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (raw == MAP_FAILED)
+            throw std::bad_alloc();
+        char *aligned = reinterpret_cast<char *>(roundUp(reinterpret_cast<uintptr_t>(raw), HUGE_PAGE_SIZE));
+        size_t head = aligned - static_cast<char *>(raw);
+        if (head != 0)
+            munmap(raw, head);
+        munmap(aligned + length, HUGE_PAGE_SIZE - head);
+        applyPolicy(aligned, length, policy);
+        recordRange(aligned, length, kind, false);
+        return aligned;
+    }
+#endif
+    size_t length = roundUp(bytes, pageSize);
+    void *pages = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED)
+        throw std::bad_alloc();
+    applyPolicy(pages, length, policy);
+    recordRange(pages, length, kind, false);
+    return pages;
+#else
+    (void)policy;
+    void *pages = std::calloc(1, bytes);
+    if (!pages)
+        throw std::bad_alloc();
+    recordRange(pages, bytes, kind, false);
+    return pages;
+#endif
+}
+
+void freePages(void *pages)
+{
+    PageRange range;
+    if (pages == nullptr || !forgetRange(pages, range))
+        return;
+#ifdef VM_GUARD_PAGES
+    munmap(range.start, range.length);
+#else
+    std::free(range.start);
+#endif
+}
+
+void dumpPageStats(std::ostream &out)
+{
+    const char *kindNames[3] = {"heap", "code", "stack"};
+    size_t resident[3] = {0, 0, 0};
+    size_t huge[3] = {0, 0, 0};
+
+    std::vector<PageRange> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(rangesMutex);
+        for (const auto &entry : ranges)
+            snapshot.push_back(entry.second);
+    }
+
+#ifdef VM_GUARD_PAGES
+    // The kernel may merge neighbouring ranges into one mapping, so each
+    // mapping's counters are shared out in proportion to the overlap
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    uintptr_t mapStart = 0, mapEnd = 0;
+    while (std::getline(smaps, line))
+    {
+        // Mapping headers start with "start-end"; counter lines with "Key:"
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || line.find(' ') < colon)
+        {
+            char *rest = nullptr;
+            mapStart = std::strtoull(line.c_str(), &rest, 16);
+            mapEnd = (rest && *rest == '-') ? std::strtoull(rest + 1, nullptr, 16) : mapStart;
+            continue;
+        }
+
+        std::string key = line.substr(0, colon);
+        bool isRss = key == "Rss";
+        bool isThp = key == "AnonHugePages";
+        bool isHugetlb = key == "Private_Hugetlb" || key == "Shared_Hugetlb";
+        if (!isRss && !isThp && !isHugetlb)
+            continue;
+        size_t kb = std::strtoull(line.c_str() + colon + 1, nullptr, 10);
+        if (kb == 0 || mapEnd <= mapStart)
+            continue;
+
+        for (const PageRange &range : snapshot)
+        {
+            uintptr_t lo = std::max(mapStart, reinterpret_cast<uintptr_t>(range.start));
+            uintptr_t hi = std::min(mapEnd, reinterpret_cast<uintptr_t>(range.start) + range.length);
+            if (lo >= hi)
+                continue;
+            size_t share = static_cast<size_t>(kb * 1024.0 * (hi - lo) / (mapEnd - mapStart));
+            int k = static_cast<int>(range.kind);
+            if (isRss || isHugetlb)
+                resident[k] += share;
+            if (isThp || isHugetlb)
+                huge[k] += share;
+        }
+    }
+#endif
+
+    size_t totalResident = 0, totalHuge = 0;
+    out << "Pages:";
+    for (int k = 0; k < 3; k++)
+    {
+        out << (k ? ", " : " ") << kindNames[k] << " " << resident[k] / 1024 << " KiB (" << huge[k] / 1024 << " KiB huge)";
+        totalResident += resident[k];
+        totalHuge += huge[k];
+    }
+    out << "; " << totalHuge / 1024 << " of " << totalResident / 1024 << " KiB on huge pages" << std::endl;
+}
+
+void PageBuffer::assign(const uint8_t *source, size_t count, const MemoryPolicy &policy, MemoryKind kind)
+{
+    clear();
+    if (count == 0)
+        return;
+    bytes = static_cast<uint8_t *>(allocatePages(count, policy, kind));
+    std::memcpy(bytes, source, count);
+    length = count;
+    owned = true;
+}
+
+void PageBuffer::borrow(uint8_t *source, size_t count)
+{
+    clear();
+    bytes = source;
+    length = count;
+}
+
+void PageBuffer::clear()
+{
+    if (owned)
+        freePages(bytes);
+    bytes = nullptr;
+    length = 0;
+    owned = false;
+}
+
+MappedFile::MappedFile(const std::string &path)
+{
+#ifdef VM_GUARD_PAGES
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open file " + path);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0)
+    {
+        close(fd);
+        throw std::runtime_error("File is empty or invalid size");
+    }
+    length = static_cast<size_t>(info.st_size);
+    // Writable so the loader can patch code in place; those pages alone are copied
+    void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("Cannot map file " + path);
+    bytes = static_cast<uint8_t *>(mapped);
+#else
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        throw std::runtime_error("Cannot open file " + path);
+    long size = -1;
+    if (std::fseek(file, 0, SEEK_END) == 0)
+        size = std::ftell(file);
+    if (size <= 0)
+    {
+        std::fclose(file);
+        throw std::runtime_error("File is empty or invalid size");
+    }
+    length = static_cast<size_t>(size);
+    bytes = static_cast<uint8_t *>(std::malloc(length));
+    std::rewind(file);
+    bool complete = bytes != nullptr && std::fread(bytes, 1, length, file) == length;
+    std::fclose(file);
+    if (!complete)
+    {
+        std::free(bytes);
+        bytes = nullptr;
+        throw std::runtime_error("Failed to read file " + path);
+    }
+#endif
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept : bytes(other.bytes), length(other.length)
+{
+    other.bytes = nullptr;
+    other.length = 0;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    std::swap(bytes, other.bytes);
+    std::swap(length, other.length);
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    if (bytes == nullptr)
+        return;
+#ifdef VM_GUARD_PAGES
+    munmap(bytes, length);
+#else
+    std::free(bytes);
+#endif
+}
+
+void MappedFile::seal()
+{
+#ifdef VM_GUARD_PAGES
+    if (bytes != nullptr)
+        mprotect(bytes, length, PROT_READ);
+#endif
+}
+
+GuardedRegion::GuardedRegion(size_t bytes, const MemoryPolicy &policy)
+{
+#ifdef VM_GUARD_PAGES
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    guardSize = pageSize;
+    usableSize = (bytes + pageSize - 1) & ~(pageSize - 1);
+    mappingSize = usableSize + 2 * guardSize;
+
+    // Reserve the whole range inaccessible, then open up everything between
+    // the guards; pages are only backed by memory once they are touched
+    void *reserved = mmap(nullptr, mappingSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED)
+        throw std::bad_alloc();
+    mapping = static_cast<char *>(reserved);
+    usable = mapping + guardSize;
+    if (mprotect(usable, usableSize, PROT_READ | PROT_WRITE) != 0)
+    {
+        munmap(mapping, mappingSize);
+        throw std::bad_alloc();
+    }
+    // Guard pages need small-page protections, so huge pages here can only
+    // come from the transparent huge page path, never from MAP_HUGETLB
+    applyPolicy(usable, usableSize, policy);
+    recordRange(usable, usableSize, MemoryKind::STACK, false);
+#else
+    (void)policy;
+    usableSize = bytes;
+    mappingSize = bytes;
+    mapping = static_cast<char *>(std::calloc(1, bytes));
+    if (!mapping)
+        throw std::bad_alloc();
+    usable = mapping;
+#endif
+}
+
+GuardedRegion::~GuardedRegion()
+{
+#ifdef VM_GUARD_PAGES
+    if (mapping == nullptr)
+        return;
+    PageRange range;
+    forgetRange(usable, range);
+    munmap(mapping, mappingSize);
+#else
+    std::free(mapping);
+#endif
+}
+
+bool GuardedRegion::inLowerGuard(const void *address) const
+{
+    const char *p = static_cast<const char *>(address);
+    return guardSize != 0 && p >= mapping && p < usable;
+}
+
+bool GuardedRegion::inUpperGuard(const void *address) const
+{
+    const char *p = static_cast<const char *>(address);
+    return guardSize != 0 && p >= usable + usableSize && p < mapping + mappingSize;
+}
+
+void GuardedRegion::decommit()
+{
+#ifdef VM_GUARD_PAGES
+    madvise(usable, usableSize, MADV_DONTNEED);
+#else
+    std::memset(usable, 0, usableSize);
+#endif
+}
+
+#ifdef VM_GUARD_PAGES
+
+static thread_local GuardTrap *activeTrap = nullptr;
+static struct sigaction previousAction;
+
+static void guardFaultHandler(int sig, siginfo_t *info, void *context)
+{
+    GuardTrap *trap = activeTrap;
+    if (trap != nullptr)
+    {
+        for (const GuardedRegion *region : trap->regions)
+        {
+            if (region != nullptr && (region->inLowerGuard(info->si_addr) || region->inUpperGuard(info->si_addr)))
+            {
+                trap->faultAddress = info->si_addr;
+                siglongjmp(trap->jump, 1);
+            }
+        }
+    }
+
+    // Not a guard page: the fault belongs to whoever handled SIGSEGV before
+    // us. Their handler is called in place, so this one stays installed for
+    // every later VM even when theirs recovers.
+    if (previousAction.sa_flags & SA_SIGINFO)
+    {
+        previousAction.sa_sigaction(sig, info, context);
+        return;
+    }
+    if (previousAction.sa_handler != SIG_DFL && previousAction.sa_handler != SIG_IGN)
+    {
+        previousAction.sa_handler(sig);
+        return;
+    }
+    // No handler before us: the process dies as it would have without one.
+    // A real fault happens again once this returns; a sent signal is raised.
+    signal(SIGSEGV, SIG_DFL);
+    if (info->si_code <= 0)
+        raise(SIGSEGV);
+}
+
+static void installGuardHandler()
+{
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guardFaultHandler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previousAction);
+}
+
+GuardTrap::GuardTrap(const GuardedRegion *first, const GuardedRegion *second)
+    : regions{first, second}, previous(activeTrap)
+{
+    static std::once_flag installed;
+    std::call_once(installed, installGuardHandler);
+    activeTrap = this;
+}
+
+GuardTrap::~GuardTrap()
+{
+    activeTrap = previous;
+}
+
+#endif
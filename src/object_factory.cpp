@@ -2,99 +2,348 @@
  * Author: Shivadharshan S
  */
 #include <object_factory.hpp>
+#include <algorithm>
+#include <numeric>
 #include <cstring>
-#include <cstdlib>
 #include <stdexcept>
+#include <new>
 
-void ObjectFactory::registerClass(const ClassInfo &cls)
+ObjectFactory::~ObjectFactory()
 {
-    ClassInfo copy = cls;
-    computeLayout(copy);
-    classes[copy.name] = std::move(copy);
-    class_offset_to_name[classes.size() - 1] = cls.name;
+    arenas.clear(); // before the large blocks they return theirs to
+    for (void *chunk : chunks)
+    {
+        freeChunk(chunk);
+    }
 }
 
-void ObjectFactory::computeLayout(ClassInfo &cls)
+size_t ObjectFactory::chunkSize(const MemoryPolicy &policy)
 {
-    size_t offset = 0;
-    for (const auto &field : cls.fields)
+    // A whole huge page per chunk when huge pages are requested
+    return policy.hugePages ? 2 * 1024 * 1024 : 64 * 1024;
+}
+
+void *ObjectFactory::allocateChunk(const MemoryPolicy &policy, size_t size)
+{
+    return allocatePages(size, policy, MemoryKind::HEAP);
+}
+
+void ObjectFactory::freeChunk(void *chunk)
+{
+    freePages(chunk);
+}
+
+void ClassTable::registerClass(const ClassInfo &cls)
+{
+    if (classById.size() >= CHANNEL_CLASS_ID)
+        throw std::runtime_error("Too many classes registered");
+
+    classStore.push_back(cls);
+    ClassInfo &stored = classStore.back();
+    stored.classId = static_cast<uint16_t>(classById.size());
+    if (!stored.laidOut)
+        stored.vtable.clear();
+    parsed.push_back(&stored);
+    classById.emplace_back(stored.laidOut ? &stored : nullptr);
+}
+
+void ClassTable::declareClasses(size_t count, ClassLoader loader)
+{
+    if (classById.size() + count > CHANNEL_CLASS_ID)
+        throw std::runtime_error("Too many classes registered");
+    parsed.resize(parsed.size() + count, nullptr);
+    for (size_t i = 0; i < count; i++)
+        classById.emplace_back(nullptr);
+    classLoader = std::move(loader);
+}
+
+ClassInfo &ClassTable::resolveClass(uint16_t classId)
+{
+    if (classId >= classById.size())
+        throw std::runtime_error("Class id not registered: " + std::to_string(classId));
+    ClassInfo *cls = classById[classId].load(std::memory_order_acquire);
+    if (cls != nullptr)
+        return *cls;
+    std::lock_guard<std::mutex> lock(resolving);
+    return resolveLocked(classId);
+}
+
+ClassInfo &ClassTable::resolveLocked(uint16_t classId)
+{
+    ClassInfo *cls = classById[classId].load(std::memory_order_relaxed);
+    if (cls != nullptr)
+        return *cls; // resolved by another thread, or as a superclass
+
+    if (parsed[classId] == nullptr)
+    {
+        classStore.push_back(classLoader(classId));
+        classStore.back().classId = classId;
+        parsed[classId] = &classStore.back();
+    }
+    cls = parsed[classId];
+    if (!cls->laidOut)
     {
-        cls.fieldOffsets[field.name] = offset;
-        switch (field.type)
+        // Inherited fields and vtable slots come from the superclass, so it
+        // is resolved first
+        if (cls->superClassIndex >= 0)
         {
-        case FieldType::INT:
-            offset += sizeof(int);
-            break;
-        case FieldType::OBJECT:       // other class objects
-            offset += sizeof(void *); // pointer size
-            break;
-        case FieldType::FLOAT:
-            offset += sizeof(float);
-            break;
-        case FieldType::CHAR:
-            offset += sizeof(char);
-            break;
-        // TODO: add more types
-        default:
-            throw std::runtime_error("Unknown field type in computeLayout");
+            if (static_cast<size_t>(cls->superClassIndex) >= classById.size())
+                throw std::runtime_error("Invalid superclass index for class " + cls->name);
+            resolveLocked(static_cast<uint16_t>(cls->superClassIndex));
         }
+        computeLayout(*cls);
+        buildVTable(*cls);
+    }
+    classById[classId].store(cls, std::memory_order_release);
+    return *cls;
+}
+
+void ClassTable::resolveAllClasses()
+{
+    for (size_t i = 0; i < classById.size(); i++)
+    {
+        resolveClass(static_cast<uint16_t>(i));
+    }
+}
+
+void ClassTable::computeLayout(ClassInfo &cls)
+{
+    size_t offset = 0;
+    cls.fieldSlots.clear();
+
+    // Inherited fields come first and keep the superclass offsets, so code
+    // compiled against the superclass works on subclass instances
+    if (cls.superClassIndex >= 0)
+    {
+        const ClassInfo &superCls = *classById[cls.superClassIndex].load(std::memory_order_relaxed);
+        cls.fieldSlots = superCls.fieldSlots;
+        offset = superCls.objectSize;
+    }
+
+    // Own fields are placed largest first, which keeps every field naturally
+    // aligned with at most one padding gap after the inherited part. Fields
+    // are aligned relative to the header, which starts an 8-byte aligned
+    // heap block, so LONG and DOUBLE fields sit at offsets that are 4 mod 8.
+    // A 4-byte field goes first when it fills the gap in front of them.
+    std::vector<size_t> order(cls.fields.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return ObjectFactory::fieldSize(cls.fields[a].type) > ObjectFactory::fieldSize(cls.fields[b].type); });
+    size_t pos = sizeof(ObjectHeader) + offset;
+    if (!order.empty() && ObjectFactory::fieldSize(cls.fields[order[0]].type) == 8 && pos % 8 == 4)
+    {
+        auto filler = std::find_if(order.begin(), order.end(), [&](size_t idx)
+                                   { return ObjectFactory::fieldSize(cls.fields[idx].type) == 4; });
+        if (filler != order.end())
+            std::rotate(order.begin(), filler, filler + 1);
+    }
+
+    size_t base = cls.fieldSlots.size();
+    cls.fieldSlots.resize(base + cls.fields.size());
+    for (size_t idx : order)
+    {
+        const FieldInfo &field = cls.fields[idx];
+        size_t size = ObjectFactory::fieldSize(field.type);
+        pos = (pos + size - 1) & ~(size - 1);
+        cls.fieldSlots[base + idx] = FieldSlot{static_cast<uint32_t>(pos - sizeof(ObjectHeader)), field.type};
+        pos += size;
+    }
+    cls.objectSize = pos - sizeof(ObjectHeader);
+    cls.laidOut = true;
+}
+
+size_t ObjectFactory::fieldSize(FieldType type)
+{
+    switch (type)
+    {
+    case FieldType::INT:
+        return sizeof(int32_t);
+    case FieldType::OBJECT: // heap reference
+        return sizeof(int32_t);
+    case FieldType::FLOAT:
+        return sizeof(float);
+    case FieldType::CHAR:
+        return sizeof(char);
+    case FieldType::LONG:
+        return sizeof(int64_t);
+    case FieldType::DOUBLE:
+        return sizeof(double);
+    default:
+        throw std::runtime_error("Unknown field type " + std::to_string(static_cast<int>(type)));
     }
-    cls.objectSize = offset;
 }
 
 void *ObjectFactory::createObject(const std::string &className)
 {
-    auto it = classes.find(className);
-    if (it == classes.end())
+    const ClassInfo *cls = classes.getClassInfo(className);
+    if (cls == nullptr)
         throw std::runtime_error("Class not registered: " + className);
 
-    const ClassInfo &cls = it->second;
-    size_t totalSize = cls.objectSize + sizeof(void *); // simple header size for metadata pointer
+    return createObject(cls->classId);
+}
+
+void *ObjectFactory::createObject(uint16_t classId)
+{
+    ClassInfo &cls = classes.resolveClass(classId);
 
-    void *rawMemory = heapAllocate(totalSize);
+    void *rawMemory = heapAllocate(sizeof(ObjectHeader) + cls.objectSize);
     if (!rawMemory)
         throw std::bad_alloc();
 
-    // Store pointer to ClassInfo as object header
-    *static_cast<const ClassInfo **>(rawMemory) = &cls;
+    ObjectHeader *hdr = static_cast<ObjectHeader *>(rawMemory);
+    hdr->classId = classId;
+    hdr->gcBits = activeArenas > 0 ? GC_ARENA : 0;
+    hdr->elementType = static_cast<FieldType>(0);
 
     // Zero initialize object fields (after header)
-    void *objectData = static_cast<void *>(static_cast<char *>(rawMemory) + sizeof(void *));
+    void *objectData = static_cast<char *>(rawMemory) + sizeof(ObjectHeader);
     std::memset(objectData, 0, cls.objectSize);
 
     return objectData;
 }
 
+void *ObjectFactory::createArray(FieldType type, uint32_t length)
+{
+    size_t elementSize = fieldSize(type);
+    // One spare zeroed element keeps CHAR arrays NUL terminated for the syscall layer
+    size_t dataSize = (static_cast<size_t>(length) + 1) * elementSize;
+
+    void *rawMemory = heapAllocate(sizeof(uint32_t) + sizeof(ObjectHeader) + dataSize);
+    if (!rawMemory)
+        throw std::bad_alloc();
+
+    *static_cast<uint32_t *>(rawMemory) = length;
+    ObjectHeader *hdr = reinterpret_cast<ObjectHeader *>(static_cast<char *>(rawMemory) + sizeof(uint32_t));
+    hdr->classId = ARRAY_CLASS_ID;
+    hdr->gcBits = activeArenas > 0 ? GC_ARENA : 0;
+    hdr->elementType = type;
+
+    void *arrayData = reinterpret_cast<char *>(hdr) + sizeof(ObjectHeader);
+    std::memset(arrayData, 0, dataSize);
+
+    return arrayData;
+}
+
+void *ObjectFactory::createMap(MapKind kind)
+{
+    void *rawMemory = blockAllocate(sizeof(uint32_t) + sizeof(ObjectHeader) + sizeof(HashMap));
+    if (!rawMemory)
+        throw std::bad_alloc();
+
+    ObjectHeader *hdr = reinterpret_cast<ObjectHeader *>(static_cast<char *>(rawMemory) + sizeof(uint32_t));
+    hdr->classId = MAP_CLASS_ID;
+    hdr->gcBits = 0;
+    hdr->elementType = static_cast<FieldType>(0);
+
+    void *mapData = reinterpret_cast<char *>(hdr) + sizeof(ObjectHeader);
+    new (mapData) HashMap(kind);
+    return mapData;
+}
+
+void *ObjectFactory::createString(uint32_t length, bool pinned)
+{
+    size_t size = 2 * sizeof(uint32_t) + sizeof(ObjectHeader) + static_cast<size_t>(length) + 1;
+    bool inArena = activeArenas > 0 && !pinned;
+    void *rawMemory = inArena ? heapAllocate(size) : blockAllocate(size);
+    if (!rawMemory)
+        throw std::bad_alloc();
+
+    uint32_t *words = static_cast<uint32_t *>(rawMemory);
+    words[0] = 0; // hash, computed on first use
+    words[1] = length;
+    ObjectHeader *hdr = reinterpret_cast<ObjectHeader *>(words + 2);
+    hdr->classId = STRING_CLASS_ID;
+    hdr->gcBits = inArena ? GC_ARENA : 0;
+    hdr->elementType = FieldType::CHAR;
+
+    char *bytes = reinterpret_cast<char *>(hdr) + sizeof(ObjectHeader);
+    bytes[length] = '\0'; // keeps strings usable as C strings for the syscall layer
+    return bytes;
+}
+
+void *ObjectFactory::createChannel(FieldType type, uint32_t capacity)
+{
+    size_t size = sizeof(uint32_t) + sizeof(ObjectHeader) + sizeof(ChannelState) + static_cast<size_t>(capacity) * sizeof(uint32_t);
+    void *rawMemory = blockAllocate(size);
+    if (!rawMemory)
+        throw std::bad_alloc();
+
+    *static_cast<uint32_t *>(rawMemory) = capacity;
+    ObjectHeader *hdr = reinterpret_cast<ObjectHeader *>(static_cast<char *>(rawMemory) + sizeof(uint32_t));
+    hdr->classId = CHANNEL_CLASS_ID;
+    hdr->gcBits = 0;
+    hdr->elementType = type;
+
+    void *channelData = reinterpret_cast<char *>(hdr) + sizeof(ObjectHeader);
+    std::memset(channelData, 0, size - sizeof(uint32_t) - sizeof(ObjectHeader));
+    return channelData;
+}
+
+size_t ObjectFactory::allocationSize(const void *object) const
+{
+    const ObjectHeader *hdr = header(object);
+    if (hdr->classId == ARRAY_CLASS_ID)
+    {
+        return sizeof(uint32_t) + sizeof(ObjectHeader) + (static_cast<size_t>(arrayLength(object)) + 1) * fieldSize(hdr->elementType);
+    }
+    if (hdr->classId == MAP_CLASS_ID)
+    {
+        return sizeof(uint32_t) + sizeof(ObjectHeader) + sizeof(HashMap) + map(object).tableBytes();
+    }
+    if (hdr->classId == STRING_CLASS_ID)
+    {
+        return 2 * sizeof(uint32_t) + sizeof(ObjectHeader) + static_cast<size_t>(stringLength(object)) + 1;
+    }
+    if (hdr->classId == CHANNEL_CLASS_ID)
+    {
+        return sizeof(uint32_t) + sizeof(ObjectHeader) + sizeof(ChannelState) + static_cast<size_t>(channelCapacity(object)) * sizeof(uint32_t);
+    }
+    return sizeof(ObjectHeader) + classes.getClassInfo(hdr->classId)->objectSize;
+}
+
 void ObjectFactory::destroyObject(void *object)
 {
     if (!object)
         return;
+    if (header(object)->gcBits & GC_ARENA)
+        return; // released together with its arena
 
     // Move pointer back to header start to free
-    void *rawMemory = static_cast<void *>(static_cast<char *>(object) - sizeof(void *));
-    heapFree(rawMemory);
+    char *rawMemory = reinterpret_cast<char *>(header(object));
+    if (header(object)->classId == MAP_CLASS_ID)
+    {
+        map(object).~HashMap();
+        heapFree(rawMemory - sizeof(uint32_t), sizeof(uint32_t) + sizeof(ObjectHeader) + sizeof(HashMap));
+        return;
+    }
+    size_t size = allocationSize(object);
+    if (header(object)->classId == ARRAY_CLASS_ID || header(object)->classId == CHANNEL_CLASS_ID)
+        rawMemory -= sizeof(uint32_t);
+    else if (header(object)->classId == STRING_CLASS_ID)
+        rawMemory -= 2 * sizeof(uint32_t);
+    heapFree(rawMemory, size);
 }
 
-const ClassInfo *ObjectFactory::getClassInfo(const std::string &className) const
+const ClassInfo *ClassTable::getClassInfo(const std::string &className)
 {
-    auto it = classes.find(className);
-    if (it == classes.end())
-        return nullptr;
-    return &it->second;
+    // Names are only known once a class is parsed; nothing on a hot path
+    // looks a class up by name
+    resolveAllClasses();
+    for (const std::atomic<ClassInfo *> &slot : classById)
+    {
+        ClassInfo *cls = slot.load(std::memory_order_acquire);
+        if (cls->name == className)
+            return cls;
+    }
+    return nullptr;
 }
 
-void ObjectFactory::buildVTable(int classIndex)
+void ClassTable::buildVTable(ClassInfo &cls)
 {
-    ClassInfo &cls = classes[class_offset_to_name[classIndex]];
-
+    cls.vtable.clear();
     if (cls.superClassIndex >= 0)
     {
-        ClassInfo &superCls = classes[class_offset_to_name[cls.superClassIndex]];
-        if (superCls.vtable.empty())
-        {
-            buildVTable(cls.superClassIndex);
-        }
-        cls.vtable = superCls.vtable; // inherit superclass vtable
+        cls.vtable = classById[cls.superClassIndex].load(std::memory_order_relaxed)->vtable; // inherit superclass vtable
     }
 
     for (MethodInfo &method : cls.methods)
@@ -121,23 +370,214 @@ void ObjectFactory::buildVTable(int classIndex)
     }
 }
 
-void ObjectFactory::buildAllVTables()
+std::vector<MethodRef> ClassTable::vtableRefs(uint16_t classId) const
 {
-    for (size_t i = 0; i < classes.size(); i++)
+    const ClassInfo &cls = *getClassInfo(classId);
+    std::vector<MethodRef> refs;
+    refs.reserve(cls.vtable.size());
+    for (const MethodInfo *method : cls.vtable)
     {
-        if (classes[class_offset_to_name[i]].vtable.empty())
+        // The slot was inherited or overridden somewhere up the chain
+        const ClassInfo *owner = &cls;
+        while (owner != nullptr &&
+               !(method >= owner->methods.data() && method < owner->methods.data() + owner->methods.size()))
         {
-            buildVTable(i);
+            owner = owner->superClassIndex >= 0 ? getClassInfo(static_cast<uint16_t>(owner->superClassIndex)) : nullptr;
         }
+        if (owner == nullptr)
+            throw std::runtime_error("VTable of class " + cls.name + " points outside its class chain");
+        refs.push_back(MethodRef{owner->classId, static_cast<uint32_t>(method - owner->methods.data())});
     }
+    return refs;
+}
+
+void ClassTable::setVTable(uint16_t classId, const std::vector<MethodRef> &refs)
+{
+    ClassInfo &cls = *parsed.at(classId);
+    cls.vtable.clear();
+    cls.vtable.reserve(refs.size());
+    for (const MethodRef &ref : refs)
+    {
+        if (ref.classIndex >= parsed.size() || ref.methodIndex >= parsed[ref.classIndex]->methods.size())
+            throw std::runtime_error("VTable slot of class " + cls.name + " names an unknown method");
+        cls.vtable.push_back(&parsed[ref.classIndex]->methods[ref.methodIndex]);
+    }
+}
+
+void ObjectFactory::pushArena()
+{
+    if (activeArenas == arenas.size())
+        arenas.push_back(std::make_unique<Arena>(memoryPolicy, largeBlocks));
+    activeArenas++;
+}
+
+void ObjectFactory::popArena()
+{
+    if (activeArenas == 0)
+        throw std::runtime_error("No active arena");
+    arenas[--activeArenas]->reset();
 }
 
 void *ObjectFactory::heapAllocate(size_t size)
 {
-    return std::malloc(size);
+    if (activeArenas > 0)
+        return arenas[activeArenas - 1]->allocate(size);
+    return blockAllocate(size);
 }
 
-void ObjectFactory::heapFree(void *ptr)
+size_t ObjectFactory::sizeClass(size_t size, size_t &blockSize)
 {
-    std::free(ptr);
+    if (size <= SMALL_CLASS_COUNT * SIZE_CLASS_GRANULE)
+    {
+        size_t granules = std::max<size_t>(1, (size + SIZE_CLASS_GRANULE - 1) / SIZE_CLASS_GRANULE);
+        blockSize = granules * SIZE_CLASS_GRANULE;
+        return granules - 1;
+    }
+    // 2^k < size <= 2^(k+1), rounded up to 5, 6, 7 or 8 quarters of 2^k
+    int k = 63 - __builtin_clzll(static_cast<unsigned long long>(size - 1));
+    size_t quarter = static_cast<size_t>(1) << (k - 2);
+    blockSize = (size + quarter - 1) / quarter * quarter;
+    return SMALL_CLASS_COUNT + 4 * static_cast<size_t>(k - 8) + blockSize / quarter - 5;
+}
+
+void *ObjectFactory::blockAllocate(size_t size)
+{
+    size_t blockSize;
+    size_t index = sizeClass(size, blockSize);
+    size_t chunkBytes = chunkSize(memoryPolicy);
+    if (blockSize > chunkBytes / 4)
+        return largeBlocks.allocate(size, memoryPolicy);
+
+    void *&freeList = freeLists[index];
+    if (freeList != nullptr)
+    {
+        void *block = freeList;
+        freeList = *static_cast<void **>(block);
+        return block;
+    }
+
+    if (chunkCursor == nullptr || static_cast<size_t>(chunkEnd - chunkCursor) < blockSize)
+    {
+        void *chunk = allocateChunk(memoryPolicy, chunkBytes);
+        if (!chunk)
+            return nullptr;
+        chunks.push_back(chunk);
+        chunkCursor = static_cast<char *>(chunk);
+        chunkEnd = chunkCursor + chunkBytes;
+    }
+    void *block = chunkCursor;
+    chunkCursor += blockSize;
+    return block;
+}
+
+void ObjectFactory::heapFree(void *ptr, size_t size)
+{
+    size_t blockSize;
+    size_t index = sizeClass(size, blockSize);
+    if (blockSize > chunkSize(memoryPolicy) / 4)
+    {
+        largeBlocks.release(ptr, size, memoryPolicy);
+        return;
+    }
+    *static_cast<void **>(ptr) = freeLists[index];
+    freeLists[index] = ptr;
+}
+
+LargeBlocks::~LargeBlocks()
+{
+    for (const auto &entry : spare)
+    {
+        freePages(entry.second);
+    }
+}
+
+MemoryPolicy LargeBlocks::placement(size_t size, const MemoryPolicy &policy)
+{
+    // Huge pages would round a block below 2 MiB up to a whole one, so such
+    // blocks only take the NUMA placement
+    MemoryPolicy placed = policy;
+    if (size < ObjectFactory::chunkSize(policy))
+        placed.hugePages = false;
+    return placed;
+}
+
+size_t LargeBlocks::roundedSize(size_t size, const MemoryPolicy &policy)
+{
+    size_t granule = ObjectFactory::chunkSize(placement(size, policy));
+    return (size + granule - 1) / granule * granule;
+}
+
+void *LargeBlocks::allocate(size_t size, const MemoryPolicy &policy)
+{
+    size_t rounded = roundedSize(size, policy);
+    auto it = spare.find(rounded);
+    if (it != spare.end())
+    {
+        void *block = it->second;
+        spare.erase(it);
+        spareBytes -= rounded;
+        return block;
+    }
+    return allocatePages(rounded, placement(size, policy), MemoryKind::HEAP);
+}
+
+void LargeBlocks::release(void *block, size_t size, const MemoryPolicy &policy)
+{
+    size_t rounded = roundedSize(size, policy);
+    if (spareBytes + rounded > SPARE_BYTES)
+    {
+        freePages(block);
+        return;
+    }
+    spare.emplace(rounded, block);
+    spareBytes += rounded;
+}
+
+Arena::~Arena()
+{
+    reset();
+    for (void *chunk : chunks)
+    {
+        ObjectFactory::freeChunk(chunk);
+    }
+}
+
+void *Arena::allocate(size_t size)
+{
+    size_t chunkSize = ObjectFactory::chunkSize(policy);
+    size = (size + 7) & ~static_cast<size_t>(7);
+    if (size > chunkSize / 4)
+    {
+        void *block = large.allocate(size, policy);
+        largeBlocks.emplace_back(block, size);
+        return block;
+    }
+
+    if (cursor == nullptr || static_cast<size_t>(end - cursor) < size)
+    {
+        if (nextChunk == chunks.size())
+        {
+            void *chunk = ObjectFactory::allocateChunk(policy, chunkSize);
+            if (!chunk)
+                return nullptr;
+            chunks.push_back(chunk);
+        }
+        cursor = static_cast<char *>(chunks[nextChunk++]);
+        end = cursor + chunkSize;
+    }
+    void *block = cursor;
+    cursor += size;
+    return block;
+}
+
+void Arena::reset()
+{
+    for (const auto &block : largeBlocks)
+    {
+        large.release(block.first, block.second, policy);
+    }
+    largeBlocks.clear();
+    nextChunk = 0;
+    cursor = nullptr;
+    end = nullptr;
 }
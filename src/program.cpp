@@ -0,0 +1,435 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <program.hpp>
+#include <VM.hpp>
+#include <snapshot.hpp>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+    bool validUtf8(const uint8_t *bytes, size_t length)
+    {
+        size_t i = 0;
+        while (i < length)
+        {
+            uint8_t lead = bytes[i];
+            size_t extra;
+            uint32_t codePoint;
+            if (lead < 0x80)
+            {
+                i++;
+                continue;
+            }
+            if ((lead & 0xE0) == 0xC0)
+                extra = 1, codePoint = lead & 0x1F;
+            else if ((lead & 0xF0) == 0xE0)
+                extra = 2, codePoint = lead & 0x0F;
+            else if ((lead & 0xF8) == 0xF0)
+                extra = 3, codePoint = lead & 0x07;
+            else
+                return false;
+            if (extra >= length - i)
+                return false;
+            for (size_t k = 1; k <= extra; k++)
+            {
+                if ((bytes[i + k] & 0xC0) != 0x80)
+                    return false;
+                codePoint = (codePoint << 6) | (bytes[i + k] & 0x3F);
+            }
+            // Overlong forms, surrogates and values past U+10FFFF
+            static const uint32_t minimum[4] = {0, 0x80, 0x800, 0x10000};
+            if (codePoint < minimum[extra] || (codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF)
+                return false;
+            i += extra + 1;
+        }
+        return true;
+    }
+}
+
+Program::Program(const std::vector<uint8_t> &filedata, const MemoryPolicy &memory)
+    : memory(memory)
+{
+    setup(filedata.data(), filedata.size());
+}
+
+Program::Program(MappedFile file, const MemoryPolicy &memory)
+    : memory(memory), image(std::move(file))
+{
+    setup(image.data(), image.size());
+    // Loading is the last writer of the code; what it left untouched stays
+    // shared, which for a snapshot is all of it
+    image.seal();
+}
+
+void Program::setup(const uint8_t *binary, size_t binarySize)
+{
+    if (isSnapshot(binary, binarySize))
+    {
+        loadSnapshot(binary, binarySize);
+    }
+    else
+    {
+        loadFromBinary(binary, binarySize);
+        classTable.declareClasses(classRecords.size(), [this](uint16_t classId)
+                                  { return parseClass(classId); });
+    }
+}
+
+void Program::loadFromBinary(const uint8_t *binary, size_t binarySize)
+{
+    if (binarySize < 24)
+    {
+        throw std::runtime_error("File too small to be a valid VM executable\n Expected at least 24 bytes, got " + std::to_string(binarySize));
+    }
+
+    // Check magic number "VM\x00\x01"
+    const uint8_t expected_magic[4] = {0x56, 0x4D, 0x00, 0x01};
+    if (!std::equal(binary, binary + 4, expected_magic))
+    {
+        throw std::runtime_error("Invalid VM file magic number");
+    }
+
+    size_t offset = 4;
+
+    auto read_uint32 = [&](size_t &off) -> uint32_t
+    {
+        if (off + 4 > binarySize)
+            throw std::runtime_error("Unexpected EOF");
+        uint32_t val = binary[off] | (binary[off + 1] << 8) | (binary[off + 2] << 16) | (binary[off + 3] << 24);
+        off += 4;
+        return val;
+    };
+
+    auto read_uint8 = [&](size_t &off) -> uint8_t
+    {
+        if (off + 1 > binarySize)
+            throw std::runtime_error("Unexpected EOF");
+        return binary[off++];
+    };
+
+    uint32_t versionWord = read_uint32(offset);
+    uint16_t version = versionWord & 0xFFFF;
+    uint16_t formatFlags = versionWord >> 16;
+    if (version != FORMAT_VERSION && version != FORMAT_VERSION_COMPACT)
+    {
+        throw std::runtime_error("Unsupported VM version");
+    }
+    if (formatFlags & ~FORMAT_TYPED_CONSTANTS)
+    {
+        throw std::runtime_error("Unsupported format flags " + std::to_string(formatFlags));
+    }
+
+    uint32_t entryPoint = read_uint32(offset);
+    uint32_t constPoolOffset = read_uint32(offset);
+    uint32_t constPoolSize = read_uint32(offset);
+    uint32_t codeOffset = read_uint32(offset);
+    uint32_t codeSize = read_uint32(offset);
+    uint32_t globalsOffset = read_uint32(offset);
+    uint32_t globalsSize = read_uint32(offset);
+    uint32_t classMetadataOffset = read_uint32(offset);
+    uint32_t classMetadataSize = read_uint32(offset);
+
+    DBG("VM Version: " << version << ", Format Flags: " << formatFlags);
+    DBG("Entry Point: " << entryPoint);
+    DBG("Const Pool Offset: " << constPoolOffset << ", Size: " << constPoolSize);
+    DBG("Code Offset: " << codeOffset << ", Size: " << codeSize);
+    DBG("Globals Offset: " << globalsOffset << ", Size: " << globalsSize);
+    DBG("Class Metadata Offset: " << classMetadataOffset << ", Size: " << classMetadataSize);
+
+    if (constPoolOffset + constPoolSize > binarySize)
+    {
+        throw std::runtime_error("Constant pool section out of file bounds");
+    }
+    constantPool.clear();
+    mappedConstants = nullptr;
+    std::vector<size_t> classConstants;
+    if (formatFlags & FORMAT_TYPED_CONSTANTS)
+    {
+        // Equal strings share one array, so LDC of either pushes the same reference
+        std::unordered_map<std::string, int32_t> strings;
+        size_t constOffset = constPoolOffset;
+        size_t constEnd = constPoolOffset + constPoolSize;
+        while (constOffset < constEnd)
+        {
+            ConstantTag tag = static_cast<ConstantTag>(read_uint8(constOffset));
+            if (constOffset + 4 > constEnd)
+                throw std::runtime_error("Constant pool entry " + std::to_string(constantPool.size()) + " exceeds section bounds");
+            uint32_t value = read_uint32(constOffset);
+            switch (tag)
+            {
+            case ConstantTag::INT:
+            case ConstantTag::FLOAT:
+                break;
+            case ConstantTag::CLASS:
+                classConstants.push_back(constantPool.size());
+                break;
+            case ConstantTag::STRING:
+            {
+                if (value > constEnd - constOffset)
+                    throw std::runtime_error("Constant pool entry " + std::to_string(constantPool.size()) + " exceeds section bounds");
+                const uint8_t *bytes = binary + constOffset;
+                if (!validUtf8(bytes, value))
+                    throw std::runtime_error("Constant pool entry " + std::to_string(constantPool.size()) + " is not valid UTF-8");
+                auto [it, added] = strings.try_emplace(std::string(reinterpret_cast<const char *>(bytes), value), static_cast<int32_t>(stringConstants.size()));
+                if (added)
+                {
+                    stringConstants.push_back(it->first);
+                }
+                constOffset += value;
+                value = static_cast<uint32_t>(it->second);
+                break;
+            }
+            default:
+                throw std::runtime_error("Constant pool entry " + std::to_string(constantPool.size()) + " has unknown tag " + std::to_string(static_cast<int>(tag)));
+            }
+            constantPool.push_back(value);
+        }
+    }
+    else
+    {
+        // Untagged pools are a plain list of 4-byte integers
+        if (constPoolSize % 4 != 0)
+        {
+            throw std::runtime_error("Constant pool size not multiple of 4");
+        }
+        size_t numConsts = constPoolSize / 4;
+        if (binary == image.data())
+        {
+            // LDC reads a mapped pool in place
+            mappedConstants = binary + constPoolOffset;
+        }
+        else
+        {
+            constantPool.reserve(numConsts);
+            for (size_t i = 0; i < numConsts; i++)
+            {
+                constantPool.push_back(readWord(binary + constPoolOffset + i * 4));
+            }
+        }
+        numConstants = numConsts;
+    }
+    if (formatFlags & FORMAT_TYPED_CONSTANTS)
+    {
+        numConstants = constantPool.size();
+    }
+    if (numConstants > 0x10000)
+    {
+        throw std::runtime_error("Constant pool has more than 65536 entries");
+    }
+    DBG("Constants loaded: " << numConstants);
+
+    if (globalsOffset + globalsSize > binarySize)
+    {
+        throw std::runtime_error("Globals section out of file bounds");
+    }
+    if (globalsSize % 4 != 0)
+    {
+        throw std::runtime_error("Globals section size not multiple of 4");
+    }
+
+    size_t numGlobals = globalsSize / 4;
+
+    for (size_t i = 0; i < numGlobals; i++)
+    {
+        size_t pos = globalsOffset + i * 4;
+        int val = binary[pos] | (binary[pos + 1] << 8) | (binary[pos + 2] << 16) | (binary[pos + 3] << 24);
+        initialGlobals.push_back(static_cast<uint32_t>(val));
+    }
+
+    if (codeOffset + codeSize > binarySize)
+    {
+        throw std::runtime_error("Code section out of file bounds");
+    }
+
+    if (binary == image.data() && !memory.hugePages && !memory.numaLocal)
+    {
+        // Run from the mapping; a placement policy needs a copy in pages of its own
+        codePages.borrow(image.data() + codeOffset, codeSize);
+    }
+    else
+    {
+        codePages.assign(binary + codeOffset, codeSize, memory, MemoryKind::CODE);
+    }
+
+#ifdef VM_CPP_DEBUG
+    DBG("Code bytes loaded: ");
+    for (auto b : codePages)
+        std::cerr << std::hex << (int)b << ' ';
+    std::cerr << std::endl;
+#endif
+
+    if (classMetadataOffset + classMetadataSize > binarySize)
+    {
+        throw std::runtime_error("Class metadata section out of file bounds");
+    }
+
+    size_t classMetaEnd = classMetadataOffset + classMetadataSize;
+    size_t classOffset = classMetadataOffset;
+
+    // Only the start of every class record is kept here, together with the
+    // method entry points the code analysis needs. Names are turned into
+    // strings when a class is first used.
+    classRecords.clear();
+    std::vector<uint32_t> entries{entryPoint};
+    if (classMetadataSize != 0)
+    {
+        uint32_t classCount = read_uint32(classOffset);
+
+        for (uint32_t i = 0; i < classCount; i++)
+        {
+            classRecords.push_back(static_cast<uint32_t>(classOffset - classMetadataOffset));
+
+            uint8_t classNameLen = read_uint8(classOffset);
+            if (classOffset + classNameLen > classMetaEnd)
+                throw std::runtime_error("Class name exceeds metadata bounds");
+            size_t classNameOffset = classOffset;
+            classOffset += classNameLen;
+
+            int32_t superClassIndex = static_cast<int32_t>(read_uint32(classOffset));
+            if (superClassIndex >= static_cast<int32_t>(classCount))
+                throw std::runtime_error("Invalid superclass index for class " + std::string(reinterpret_cast<const char *>(&binary[classNameOffset]), classNameLen));
+
+            uint32_t fieldCount = read_uint32(classOffset);
+            for (uint32_t f = 0; f < fieldCount; f++)
+            {
+                uint8_t fieldNameLen = read_uint8(classOffset);
+                if (classOffset + fieldNameLen + 1 > classMetaEnd)
+                    throw std::runtime_error("Field info exceeds metadata bounds\n Expected at least " + std::to_string(fieldNameLen + 1) + " bytes, but only " + std::to_string(classMetaEnd - classOffset) + " bytes remain");
+                classOffset += fieldNameLen + 1;
+            }
+
+            uint32_t methodCount = read_uint32(classOffset);
+            for (uint32_t m = 0; m < methodCount; m++)
+            {
+                uint8_t methodNameLen = read_uint8(classOffset);
+
+                if (classOffset + methodNameLen + 4 > classMetaEnd)
+                    throw std::runtime_error("Method info exceeds metadata bounds \nExpected at least " + std::to_string(methodNameLen + 4) + " bytes, but only " + std::to_string(classMetaEnd - classOffset) + " bytes remain");
+                classOffset += methodNameLen;
+
+                entries.push_back(read_uint32(classOffset));
+            }
+        }
+
+        if (classOffset != classMetaEnd)
+        {
+            throw std::runtime_error("Class metadata size mismatch after parsing");
+        }
+    }
+    DBG("Classes indexed: " << classRecords.size());
+
+    if (binary == image.data())
+    {
+        classMetadata = binary + classMetadataOffset;
+    }
+    else
+    {
+        ownedClassMetadata.assign(binary + classMetadataOffset, binary + classMetaEnd);
+        classMetadata = ownedClassMetadata.data();
+    }
+
+    for (size_t idx : classConstants)
+    {
+        if (constantPool[idx] >= classRecords.size())
+            throw std::runtime_error("Constant pool entry " + std::to_string(idx) + " names unknown class " + std::to_string(constantPool[idx]));
+    }
+
+    if (entryPoint >= codePages.size())
+    {
+        throw std::runtime_error("Entry point out of code segment bounds");
+    }
+    entry = entryPoint;
+    DBG("Entry point set to " + std::to_string(entry));
+
+    marks = verifyCode(codePages.data(), codePages.size(), entries);
+    size_t unchecked = eliminateBoundsChecks(codePages.data(), codePages.size(), entries);
+    DBG("Bounds checks removed from " << unchecked << " array accesses");
+    (void)unchecked;
+}
+
+ClassInfo Program::parseClass(uint16_t classId) const
+{
+    const uint8_t *p = classMetadata + classRecords.at(classId);
+    auto read_uint32 = [&]() -> uint32_t
+    {
+        uint32_t val = readWord(p);
+        p += 4;
+        return val;
+    };
+    auto read_name = [&](std::string &name)
+    {
+        uint8_t length = *p++;
+        name.assign(reinterpret_cast<const char *>(p), length);
+        p += length;
+    };
+
+    ClassInfo cls;
+    read_name(cls.name);
+    cls.superClassIndex = static_cast<int32_t>(read_uint32());
+    DBG("Class: " << cls.name << ", Superclass Index: " << cls.superClassIndex);
+
+    cls.fields.resize(read_uint32());
+    for (FieldInfo &field : cls.fields)
+    {
+        read_name(field.name);
+        field.type = static_cast<FieldType>(*p++);
+        DBG("Field: " << field.name << " Type: " << static_cast<int>(field.type));
+    }
+
+    cls.methods.resize(read_uint32());
+    for (MethodInfo &method : cls.methods)
+    {
+        read_name(method.name);
+        method.bytecodeOffset = read_uint32();
+        DBG("Method: " << method.name << " Bytecode Offset: " << method.bytecodeOffset);
+    }
+    return cls;
+}
+
+void Program::disassemble(std::ostream &out) const
+{
+    out << "entry point " << entry << "\n";
+    for (size_t i = 0; i < classTable.classCount(); i++)
+    {
+        // Listing the code does not resolve classes
+        const ClassInfo *resolved = classTable.getClassInfo(static_cast<uint16_t>(i));
+        ClassInfo cls = resolved != nullptr ? *resolved : parseClass(static_cast<uint16_t>(i));
+        for (const auto &method : cls.methods)
+            out << "method " << cls.name << "." << method.name << " at " << method.bytecodeOffset << "\n";
+    }
+    ::disassemble(out, codePages.data(), codePages.size());
+}
+
+MethodHandle Program::findMethod(const std::string &className, const std::string &methodName) const
+{
+    // Unresolved classes are matched on the name at the start of their
+    // record, so a lookup resolves nothing but the class it finds
+    for (size_t id = 0; id < classTable.classCount(); id++)
+    {
+        const ClassInfo *resolved = classTable.getClassInfo(static_cast<uint16_t>(id));
+        if (resolved != nullptr ? resolved->name != className
+                                : classMetadata[classRecords[id]] != className.size() ||
+                                      std::memcmp(classMetadata + classRecords[id] + 1, className.data(), className.size()) != 0)
+        {
+            continue;
+        }
+
+        const ClassInfo *cls = &classTable.resolveClass(static_cast<uint16_t>(id));
+        while (true)
+        {
+            for (const MethodInfo &method : cls->methods)
+            {
+                if (method.name == methodName)
+                    return MethodHandle{static_cast<uint16_t>(id), method.bytecodeOffset};
+            }
+            if (cls->superClassIndex < 0)
+                break;
+            cls = classTable.getClassInfo(static_cast<uint16_t>(cls->superClassIndex));
+        }
+        throw std::runtime_error("Invoke error: Class " + className + " has no method " + methodName);
+    }
+    throw std::runtime_error("Invoke error: Unknown class " + className);
+}
@@ -0,0 +1,425 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <server.hpp>
+#include <serve_protocol.hpp>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+namespace
+{
+    // Loaded programs by path
+    class ProgramCache
+    {
+    public:
+        ProgramCache(const MemoryPolicy &memory) : memory(memory) {}
+
+        std::shared_ptr<const Program> get(const std::string &path)
+        {
+            std::lock_guard<std::mutex> lock(loading);
+            auto found = programs.find(path);
+            if (found != programs.end())
+                return found->second;
+            auto program = std::make_shared<const Program>(MappedFile(path.c_str()), memory);
+            programs.emplace(path, program);
+            DBG("Server loaded " << path);
+            return program;
+        }
+
+    private:
+        MemoryPolicy memory;
+        std::mutex loading;
+        std::unordered_map<std::string, std::shared_ptr<const Program>> programs;
+    };
+
+    struct Job
+    {
+        std::string program;
+        std::string method;
+        std::vector<VMValue> args;
+        std::string input;
+    };
+
+    // Parses a request body; false when it is malformed
+    bool parseJob(const std::vector<uint8_t> &body, Job &job)
+    {
+        size_t at = 0;
+        auto word = [&](uint32_t &value)
+        {
+            if (body.size() - at < 4)
+                return false;
+            value = readWord(&body[at]);
+            at += 4;
+            return true;
+        };
+        auto bytes = [&](std::string &value)
+        {
+            uint32_t length;
+            if (!word(length) || body.size() - at < length)
+                return false;
+            value.assign(reinterpret_cast<const char *>(&body[at]), length);
+            at += length;
+            return true;
+        };
+        uint32_t argc;
+        if (!bytes(job.program) || !bytes(job.method) || !word(argc) || argc > (body.size() - at) / 4)
+            return false;
+        for (uint32_t i = 0; i < argc; i++)
+        {
+            uint32_t arg = 0;
+            word(arg);
+            job.args.push_back(VMValue::ofInt(static_cast<int32_t>(arg)));
+        }
+        return bytes(job.input) && at == body.size();
+    }
+
+    // fd 1 and 2 of a job: every flush of the stream is one frame
+    struct OutputStream
+    {
+        int socket;
+        Frame type;
+        bool closed = false; // by SYS_CLOSE, or by the server
+    };
+
+    ssize_t writeOutput(void *cookie, const char *data, size_t size)
+    {
+        OutputStream *stream = static_cast<OutputStream *>(cookie);
+        if (!writeFrame(stream->socket, stream->type, data, static_cast<uint32_t>(size)))
+            return -1;
+        return static_cast<ssize_t>(size);
+    }
+
+    int closeOutput(void *cookie)
+    {
+        static_cast<OutputStream *>(cookie)->closed = true;
+        return 0;
+    }
+
+    // fd 0 of a job, over the request's stdin bytes
+    struct InputStream
+    {
+        const std::string &data;
+        size_t at = 0;
+        bool closed = false;
+    };
+
+    ssize_t readInput(void *cookie, char *data, size_t size)
+    {
+        InputStream *stream = static_cast<InputStream *>(cookie);
+        size_t count = std::min(size, stream->data.size() - stream->at);
+        std::memcpy(data, stream->data.data() + stream->at, count);
+        stream->at += count;
+        return static_cast<ssize_t>(count);
+    }
+
+    int closeInput(void *cookie)
+    {
+        static_cast<InputStream *>(cookie)->closed = true;
+        return 0;
+    }
+
+    // The streams of a job, and what the job left in them
+    class JobStreams
+    {
+    public:
+        JobStreams(int client, const std::string &input)
+            : outState{client, Frame::STDOUT}, errState{client, Frame::STDERR}, inState{input}
+        {
+            out = fopencookie(&outState, "w", {nullptr, writeOutput, nullptr, closeOutput});
+            err = fopencookie(&errState, "w", {nullptr, writeOutput, nullptr, closeOutput});
+            in = fopencookie(&inState, "r", {readInput, nullptr, nullptr, closeInput});
+            if (out == nullptr || err == nullptr || in == nullptr)
+                throw std::runtime_error("Server error: Could not open job streams");
+            // Like the process streams: stderr unbuffered, stdout in blocks
+            setvbuf(err, nullptr, _IONBF, 0);
+        }
+        JobStreams(const JobStreams &) = delete;
+        JobStreams &operator=(const JobStreams &) = delete;
+        ~JobStreams() { close(); }
+
+        FILE *in = nullptr, *out = nullptr, *err = nullptr;
+        int client() const { return outState.socket; }
+
+        void fail(const std::exception &ex)
+        {
+            if (!errState.closed)
+                fprintf(err, "VM error: %s\n", ex.what());
+        }
+        // Flushes what the job left buffered
+        void close()
+        {
+            if (in != nullptr && !inState.closed)
+                fclose(in);
+            if (out != nullptr && !outState.closed)
+                fclose(out);
+            if (err != nullptr && !errState.closed)
+                fclose(err);
+            inState.closed = outState.closed = errState.closed = true;
+        }
+
+    private:
+        OutputStream outState;
+        OutputStream errState;
+        InputStream inState;
+    };
+
+    struct Outcome
+    {
+        int32_t status = 0;
+        bool returned = false; // by a method job, with result
+        int32_t result = 0;
+    };
+
+    // Runs job on vm with the job's streams. forkedAt, when given, is when
+    // the job's process was forked; the time to the first instruction is
+    // sent as a STARTUP frame.
+    Outcome runOn(VM &vm, const Program &program, const Job &job, JobStreams &streams,
+                  const std::chrono::steady_clock::time_point *forkedAt = nullptr)
+    {
+        Outcome outcome;
+        vm.setStandardStreams(streams.in, streams.out, streams.err);
+        MethodHandle method{};
+        if (!job.method.empty())
+        {
+            size_t dot = job.method.rfind('.');
+            if (dot == std::string::npos)
+                throw std::runtime_error("Server error: Method must be given as Class.method");
+            method = program.findMethod(job.method.substr(0, dot), job.method.substr(dot + 1));
+        }
+        if (forkedAt != nullptr)
+        {
+            auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - *forkedAt);
+            writeFrame(streams.client(), Frame::STARTUP, static_cast<int32_t>(std::min<int64_t>(nanos.count(), INT32_MAX)));
+        }
+        if (job.method.empty())
+        {
+            vm.run();
+            outcome.status = vm.exitStatus();
+        }
+        else
+        {
+            outcome.result = vm.invoke(method, job.args).intValue;
+            outcome.returned = true;
+        }
+        return outcome;
+    }
+
+    // Sends the frames that follow the job's output
+    bool sendOutcome(int client, const Outcome &outcome)
+    {
+        if (outcome.returned && !writeFrame(client, Frame::RESULT, outcome.result))
+            return false;
+        return writeFrame(client, Frame::EXIT, outcome.status);
+    }
+
+    // Reads the next request of a connection; false at its end or when the
+    // request is malformed
+    bool readJob(int client, Job &job)
+    {
+        uint8_t head[4];
+        if (!readFully(client, head, 4))
+            return false;
+        uint32_t length = readWord(head);
+        if (length > MAX_REQUEST_BYTES)
+            return false;
+        std::vector<uint8_t> body(length);
+        if (!readFully(client, body.data(), length) || !parseJob(body, job))
+            return false;
+        DBG("Server job " << job.program << " " << job.method);
+        return true;
+    }
+
+    // Runs one job in a new VM and sends its frames; false when the client
+    // is gone
+    bool runJob(int client, const Job &job, ProgramCache &cache, const VMOptions &options)
+    {
+        JobStreams streams(client, job.input);
+        Outcome outcome;
+        try
+        {
+            std::shared_ptr<const Program> program = cache.get(job.program);
+            VM vm(program, options);
+            outcome = runOn(vm, *program, job, streams);
+        }
+        catch (const std::exception &ex)
+        {
+            streams.fail(ex);
+            outcome.status = 1;
+        }
+        streams.close();
+        return sendOutcome(client, outcome);
+    }
+
+    void serveConnection(int client, ProgramCache &cache, const VMOptions &options)
+    {
+        try
+        {
+            for (Job job; readJob(client, job); job = Job())
+            {
+                if (!runJob(client, job, cache, options))
+                    break;
+            }
+        }
+        catch (const std::exception &ex)
+        {
+            std::cerr << "Server error: " << ex.what() << std::endl;
+        }
+        close(client);
+    }
+
+    int listenOn(const std::string &socketPath)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("Server error: Socket path too long");
+        std::strcpy(address.sun_path, socketPath.c_str());
+
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+            throw std::runtime_error("Server error: socket failed: " + std::string(std::strerror(errno)));
+        unlink(socketPath.c_str()); // left behind by an earlier server
+        if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0)
+        {
+            int error = errno;
+            close(listener);
+            throw std::runtime_error("Server error: Could not listen on " + socketPath + ": " + std::strerror(error));
+        }
+        std::cerr << "Serving on " << socketPath << std::endl;
+        return listener;
+    }
+
+    int acceptClient(int listener)
+    {
+        while (true)
+        {
+            int client = accept(listener, nullptr, nullptr);
+            if (client >= 0)
+                return client;
+            if (errno != EINTR && errno != ECONNABORTED)
+                throw std::runtime_error("Server error: accept failed: " + std::string(std::strerror(errno)));
+        }
+    }
+
+    // One connection of serveForked, in a process of its own that never runs
+    // bytecode: every job is forked from it, so every job starts from the
+    // state the server prepared
+    void serveForkedConnection(int client, VM &vm, const Program &program, const std::string &programPath)
+    {
+        for (Job job; readJob(client, job); job = Job())
+        {
+            fflush(nullptr); // nothing buffered gets written twice
+            auto forkedAt = std::chrono::steady_clock::now();
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                std::string message = "VM error: Server error: fork failed: " + std::string(std::strerror(errno)) + "\n";
+                writeFrame(client, Frame::STDERR, message.data(), static_cast<uint32_t>(message.size()));
+                if (!writeFrame(client, Frame::EXIT, 1))
+                    break;
+                continue;
+            }
+            if (pid == 0)
+            {
+                JobStreams streams(client, job.input);
+                Outcome outcome;
+                try
+                {
+                    if (!job.program.empty() && job.program != programPath)
+                        throw std::runtime_error("Server error: This server runs " + programPath + " only");
+                    outcome = runOn(vm, program, job, streams, &forkedAt);
+                }
+                catch (const std::exception &ex)
+                {
+                    streams.fail(ex);
+                    outcome.status = 1;
+                }
+                streams.close();
+                if (outcome.returned)
+                    writeFrame(client, Frame::RESULT, outcome.result);
+                // The exit status travels through the process's, like a run of vm
+                _exit(outcome.status);
+            }
+
+            int waitStatus = 0;
+            while (waitpid(pid, &waitStatus, 0) < 0 && errno == EINTR)
+                ;
+            int32_t status = 1;
+            if (WIFEXITED(waitStatus))
+                status = WEXITSTATUS(waitStatus);
+            else if (WIFSIGNALED(waitStatus))
+            {
+                status = 128 + WTERMSIG(waitStatus);
+                std::string message = "VM error: Job killed by signal " + std::to_string(WTERMSIG(waitStatus)) + "\n";
+                writeFrame(client, Frame::STDERR, message.data(), static_cast<uint32_t>(message.size()));
+            }
+            if (!writeFrame(client, Frame::EXIT, status))
+                break;
+        }
+    }
+}
+
+int serve(const std::string &socketPath, const std::vector<std::string> &preload, const VMOptions &options)
+{
+    // Connections already run on every core
+    VMOptions jobOptions = options;
+    if (jobOptions.sortThreads == 0)
+        jobOptions.sortThreads = 1;
+    static ProgramCache *cache = new ProgramCache(options.memory); // outlives detached connections
+    for (const std::string &path : preload)
+        cache->get(path);
+
+    int listener = listenOn(socketPath);
+    while (true)
+    {
+        int client = acceptClient(listener);
+        std::thread(serveConnection, client, std::ref(*cache), jobOptions).detach();
+    }
+}
+
+int serveForked(const std::string &socketPath, const std::string &programPath, const std::string &initMethod,
+                const VMOptions &options)
+{
+    auto program = std::make_shared<const Program>(MappedFile(programPath.c_str()), options.memory);
+    program->classes().resolveAllClasses();
+    VM vm(program, options);
+    if (!initMethod.empty())
+    {
+        size_t dot = initMethod.rfind('.');
+        if (dot == std::string::npos)
+            throw std::runtime_error("Server error: Method must be given as Class.method");
+        vm.invoke(program->findMethod(initMethod.substr(0, dot), initMethod.substr(dot + 1)));
+        DBG("Server ran " << initMethod);
+    }
+
+    int listener = listenOn(socketPath);
+    // Connection processes are reaped by the kernel
+    signal(SIGCHLD, SIG_IGN);
+    while (true)
+    {
+        int client = acceptClient(listener);
+        fflush(nullptr);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(listener);
+            signal(SIGCHLD, SIG_DFL); // this process waits for its jobs
+            serveForkedConnection(client, vm, *program, programPath);
+            _exit(0);
+        }
+        if (pid < 0)
+            std::cerr << "Server error: fork failed: " << std::strerror(errno) << std::endl;
+        close(client);
+    }
+}
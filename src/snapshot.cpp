@@ -0,0 +1,281 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <bytecode.hpp>
+#include <program.hpp>
+#include <VM.hpp>
+#include <snapshot.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+    void putName(std::vector<uint8_t> &out, const std::string &name)
+    {
+        putWord(out, static_cast<uint32_t>(name.size()));
+        out.insert(out.end(), name.begin(), name.end());
+    }
+
+    struct SnapshotReader
+    {
+        const uint8_t *bytes;
+        size_t size;
+        size_t pos;
+
+        uint32_t word()
+        {
+            return readWord(take(4));
+        }
+
+        const uint8_t *take(size_t count)
+        {
+            if (count > size - pos)
+                throw std::runtime_error("Unexpected EOF in snapshot");
+            const uint8_t *start = bytes + pos;
+            pos += count;
+            return start;
+        }
+
+        std::string name()
+        {
+            uint32_t length = word();
+            return std::string(reinterpret_cast<const char *>(take(length)), length);
+        }
+    };
+
+    // Offset of a section of count units of unitSize bytes, checked against the file
+    size_t section(const uint8_t *snapshot, size_t snapshotSize, size_t headerPos, size_t unitSize, uint32_t &count, const char *what)
+    {
+        size_t offset = readWord(snapshot + headerPos);
+        count = readWord(snapshot + headerPos + 4);
+        if (offset > snapshotSize || count > (snapshotSize - offset) / unitSize)
+            throw std::runtime_error(std::string(what) + " section out of snapshot bounds");
+        return offset;
+    }
+}
+
+void Program::saveSnapshot(const std::string &path) const
+{
+    classTable.resolveAllClasses();
+
+    std::vector<uint8_t> out(SNAPSHOT_HEADER_SIZE, 0);
+    std::copy(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 4, out.begin());
+    patchWord(out, 4, SNAPSHOT_VERSION);
+    patchWord(out, 8, entry);
+
+    beginSection(out, 12, codePages.size());
+    out.insert(out.end(), codePages.begin(), codePages.end());
+
+    beginSection(out, 20, numConstants);
+    for (size_t i = 0; i < numConstants; i++)
+        putWord(out, constant(i));
+
+    beginSection(out, 28, stringConstants.size());
+    for (size_t ref = 0; ref < stringConstants.size(); ref++)
+    {
+        const std::string &value = stringConstants[ref];
+        putWord(out, static_cast<uint32_t>(ref));
+        putWord(out, static_cast<uint32_t>(value.size()));
+        out.insert(out.end(), value.begin(), value.end());
+    }
+
+    beginSection(out, 36, initialGlobals.size());
+    for (uint32_t value : initialGlobals)
+        putWord(out, value);
+
+    beginSection(out, 44, classTable.classCount());
+    for (size_t i = 0; i < classTable.classCount(); i++)
+    {
+        const ClassInfo &cls = *classTable.getClassInfo(static_cast<uint16_t>(i));
+        putName(out, cls.name);
+        putWord(out, static_cast<uint32_t>(cls.superClassIndex));
+        putWord(out, static_cast<uint32_t>(cls.objectSize));
+        putWord(out, static_cast<uint32_t>(cls.fields.size()));
+        for (const FieldInfo &field : cls.fields)
+        {
+            putName(out, field.name);
+            putWord(out, static_cast<uint32_t>(field.type));
+        }
+        putWord(out, static_cast<uint32_t>(cls.fieldSlots.size()));
+        for (const FieldSlot &slot : cls.fieldSlots)
+        {
+            putWord(out, slot.offset);
+            putWord(out, static_cast<uint32_t>(slot.type));
+        }
+        putWord(out, static_cast<uint32_t>(cls.methods.size()));
+        for (const MethodInfo &method : cls.methods)
+        {
+            putName(out, method.name);
+            putWord(out, method.bytecodeOffset);
+            putWord(out, method.isVirtual);
+        }
+        std::vector<MethodRef> vtable = classTable.vtableRefs(static_cast<uint16_t>(i));
+        putWord(out, static_cast<uint32_t>(vtable.size()));
+        for (const MethodRef &ref : vtable)
+        {
+            putWord(out, ref.classIndex);
+            putWord(out, ref.methodIndex);
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(out.data()), static_cast<std::streamsize>(out.size()));
+    if (!file)
+        throw std::runtime_error("Cannot write snapshot " + path);
+    DBG("Snapshot of " << out.size() << " bytes written to " << path);
+}
+
+void Program::loadSnapshot(const uint8_t *snapshot, size_t snapshotSize)
+{
+    if (snapshotSize < SNAPSHOT_HEADER_SIZE)
+    {
+        throw std::runtime_error("File too small to be a VM snapshot\n Expected at least " + std::to_string(SNAPSHOT_HEADER_SIZE) + " bytes, got " + std::to_string(snapshotSize));
+    }
+    uint32_t versionWord = readWord(snapshot + 4);
+    if ((versionWord & 0xFFFF) != SNAPSHOT_VERSION)
+    {
+        throw std::runtime_error("Unsupported snapshot version");
+    }
+    if (versionWord >> 16)
+    {
+        throw std::runtime_error("Unsupported snapshot flags " + std::to_string(versionWord >> 16));
+    }
+    uint32_t entryPoint = readWord(snapshot + 8);
+
+    uint32_t codeSize;
+    size_t codeOffset = section(snapshot, snapshotSize, 12, 1, codeSize, "Code");
+    if (snapshot == image.data() && !memory.hugePages && !memory.numaLocal)
+    {
+        // The code was rewritten before it was saved, so no page of it is ever written
+        codePages.borrow(image.data() + codeOffset, codeSize);
+    }
+    else
+    {
+        codePages.assign(snapshot + codeOffset, codeSize, memory, MemoryKind::CODE);
+    }
+    if (entryPoint >= codePages.size())
+    {
+        throw std::runtime_error("Entry point out of code segment bounds");
+    }
+
+    uint32_t numConsts;
+    size_t constOffset = section(snapshot, snapshotSize, 20, 4, numConsts, "Constant pool");
+    if (numConsts > 0x10000)
+    {
+        throw std::runtime_error("Constant pool has more than 65536 entries");
+    }
+    constantPool.clear();
+    mappedConstants = nullptr;
+    if (snapshot == image.data())
+    {
+        mappedConstants = snapshot + constOffset;
+    }
+    else
+    {
+        constantPool.reserve(numConsts);
+        for (size_t i = 0; i < numConsts; i++)
+            constantPool.push_back(readWord(snapshot + constOffset + i * 4));
+    }
+    numConstants = numConsts;
+
+    // String constants are stored in reference order, starting from 0
+    uint32_t stringCount;
+    SnapshotReader reader{snapshot, snapshotSize, section(snapshot, snapshotSize, 28, 8, stringCount, "Strings")};
+    for (uint32_t i = 0; i < stringCount; i++)
+    {
+        uint32_t ref = reader.word();
+        uint32_t length = reader.word();
+        const uint8_t *bytes = reader.take(length);
+        if (ref != i)
+            throw std::runtime_error("Snapshot string " + std::to_string(i) + " does not get reference " + std::to_string(ref));
+        stringConstants.emplace_back(reinterpret_cast<const char *>(bytes), length);
+    }
+
+    uint32_t numGlobals;
+    size_t globalsOffset = section(snapshot, snapshotSize, 36, 4, numGlobals, "Globals");
+    for (size_t i = 0; i < numGlobals; i++)
+        initialGlobals.push_back(readWord(snapshot + globalsOffset + i * 4));
+
+    uint32_t classCount;
+    reader.pos = section(snapshot, snapshotSize, 44, 1, classCount, "Class");
+    std::vector<std::vector<MethodRef>> vtables(classCount);
+    for (uint32_t i = 0; i < classCount; i++)
+    {
+        ClassInfo cls;
+        cls.name = reader.name();
+        cls.superClassIndex = static_cast<int32_t>(reader.word());
+        if (cls.superClassIndex >= static_cast<int32_t>(classCount) || cls.superClassIndex < -1)
+            throw std::runtime_error("Invalid superclass index for class " + cls.name);
+        cls.objectSize = reader.word();
+
+        uint32_t fieldCount = reader.word();
+        for (uint32_t f = 0; f < fieldCount; f++)
+        {
+            FieldInfo field;
+            field.name = reader.name();
+            field.type = static_cast<FieldType>(reader.word());
+            cls.fields.push_back(field);
+        }
+        uint32_t slotCount = reader.word();
+        for (uint32_t f = 0; f < slotCount; f++)
+        {
+            FieldSlot slot;
+            slot.offset = reader.word();
+            slot.type = static_cast<FieldType>(reader.word());
+            if (slot.offset + ObjectFactory::fieldSize(slot.type) > cls.objectSize)
+                throw std::runtime_error("Field " + std::to_string(f) + " of class " + cls.name + " lies outside the object");
+            cls.fieldSlots.push_back(slot);
+        }
+
+        uint32_t methodCount = reader.word();
+        for (uint32_t m = 0; m < methodCount; m++)
+        {
+            MethodInfo method;
+            method.name = reader.name();
+            method.bytecodeOffset = reader.word();
+            method.isVirtual = reader.word() != 0;
+            if (method.bytecodeOffset >= codePages.size())
+                throw std::runtime_error("Method " + cls.name + "." + method.name + " out of code segment bounds");
+            cls.methods.push_back(method);
+        }
+
+        uint32_t vtableSize = reader.word();
+        for (uint32_t v = 0; v < vtableSize; v++)
+        {
+            MethodRef ref;
+            ref.classIndex = reader.word();
+            ref.methodIndex = reader.word();
+            vtables[i].push_back(ref);
+        }
+
+        cls.laidOut = true;
+        DBG("Class: " << cls.name << ", Size: " << cls.objectSize << ", VTable: " << vtableSize);
+        classTable.registerClass(cls);
+    }
+    for (uint32_t i = 0; i < classCount; i++)
+    {
+        classTable.setVTable(static_cast<uint16_t>(i), vtables[i]);
+    }
+
+    // The code holds the unchecked accesses the rewrite produced, which
+    // verifyCode would refuse as reserved opcodes. Verify it with them
+    // turned back, then redo the rewrite: the file may hold exactly the
+    // unchecked accesses the loader writes, and no others.
+    std::vector<uint32_t> entries{entryPoint};
+    for (uint32_t i = 0; i < classCount; i++)
+        for (const MethodInfo &method : classTable.getClassInfo(static_cast<uint16_t>(i))->methods)
+            entries.push_back(method.bytecodeOffset);
+    std::vector<uint8_t> checked = withBoundsChecks(codePages.data(), codePages.size());
+    marks = verifyCode(checked.data(), checked.size(), entries);
+    eliminateBoundsChecks(checked.data(), checked.size(), entries);
+    auto differs = std::mismatch(checked.begin(), checked.end(), codePages.begin());
+    if (differs.first != checked.end())
+    {
+        throw std::runtime_error("Snapshot code at offset " + std::to_string(differs.first - checked.begin()) +
+                                 " differs from what the loader writes");
+    }
+
+    entry = entryPoint;
+    DBG("Snapshot loaded: " << numConstants << " constants, " << stringCount << " strings, " << numGlobals << " globals, " << classCount << " classes");
+}
@@ -0,0 +1,203 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <sort_ops.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#ifdef VM_THREADS
+#include <thread>
+#endif
+
+namespace
+{
+    template <typename T>
+    struct Order
+    {
+        using Less = std::less<T>;
+    };
+    template <>
+    struct Order<float>
+    {
+        using Less = FloatLess;
+    };
+
+    template <typename T>
+    T fromWord(uint32_t raw)
+    {
+        T value;
+        if constexpr (sizeof(T) == sizeof(uint32_t))
+            std::memcpy(&value, &raw, sizeof(T));
+        else
+            value = static_cast<T>(raw);
+        return value;
+    }
+
+    // Calls f with a value of the C++ type that holds elements of `type`
+    template <typename F>
+    auto withElementType(FieldType type, F &&f)
+    {
+        switch (type)
+        {
+        case FieldType::INT:
+            return f(int32_t());
+        case FieldType::FLOAT:
+            return f(float());
+        case FieldType::CHAR:
+            return f(uint8_t());
+        default:
+            throw std::runtime_error("Sorting needs INT, FLOAT or CHAR elements");
+        }
+    }
+
+    unsigned threadCount(unsigned requested, size_t count)
+    {
+        if (count < PARALLEL_SORT_MIN)
+            return 1;
+#ifdef VM_THREADS
+        unsigned threads = requested != 0 ? requested : std::thread::hardware_concurrency();
+        // Keep every part at least half the parallel threshold long
+        size_t maxParts = count / (PARALLEL_SORT_MIN / 2);
+        return static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, maxParts)));
+#else
+        (void)requested;
+        return 1;
+#endif
+    }
+
+    // Sorts equal slices on separate threads, then merges neighbours in
+    // rounds that also run in parallel. std::inplace_merge keeps stability.
+    template <typename It, typename Less>
+    void parallelSort(It first, It last, Less less, bool stable, unsigned threads)
+    {
+        size_t n = static_cast<size_t>(last - first);
+        unsigned parts = threadCount(threads, n);
+        auto sortSlice = [=](It begin, It end)
+        {
+            if (stable)
+                std::stable_sort(begin, end, less);
+            else
+                std::sort(begin, end, less);
+        };
+        if (parts <= 1)
+        {
+            sortSlice(first, last);
+            return;
+        }
+#ifdef VM_THREADS
+        std::vector<size_t> bounds(parts + 1);
+        for (unsigned i = 0; i <= parts; i++)
+            bounds[i] = n * i / parts;
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < parts; i++)
+            workers.emplace_back(sortSlice, first + bounds[i], first + bounds[i + 1]);
+        for (std::thread &worker : workers)
+            worker.join();
+
+        for (unsigned width = 1; width < parts; width *= 2)
+        {
+            workers.clear();
+            for (unsigned i = 0; i + width < parts; i += 2 * width)
+            {
+                It begin = first + bounds[i];
+                It middle = first + bounds[i + width];
+                It end = first + bounds[std::min(i + 2 * width, parts)];
+                workers.emplace_back([=]
+                                     { std::inplace_merge(begin, middle, end, less); });
+            }
+            for (std::thread &worker : workers)
+                worker.join();
+        }
+#endif
+    }
+
+    template <typename E>
+    void permute(void *data, const std::vector<uint32_t> &order)
+    {
+        E *elements = static_cast<E *>(data);
+        std::vector<E> sorted(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+            sorted[i] = elements[order[i]];
+        std::copy(sorted.begin(), sorted.end(), elements);
+    }
+}
+
+void arraySort(void *data, size_t count, FieldType type, unsigned threads)
+{
+    withElementType(type, [&](auto tag)
+                    {
+        using T = decltype(tag);
+        T *elements = static_cast<T *>(data);
+        if constexpr (sizeof(T) == 1)
+        {
+            // Bytes have few distinct values: counting them is linear
+            size_t histogram[256] = {};
+            for (size_t i = 0; i < count; i++)
+                histogram[static_cast<uint8_t>(elements[i])]++;
+            size_t at = 0;
+            for (int value = 0; value < 256; value++)
+            {
+                std::fill_n(elements + at, histogram[value], static_cast<T>(value));
+                at += histogram[value];
+            }
+            return;
+        }
+        parallelSort(elements, elements + count, typename Order<T>::Less(), false, threads); });
+}
+
+void arraySortStable(void *keys, FieldType keyType, void *values, FieldType valueType, size_t count, unsigned threads)
+{
+    withElementType(keyType, [&](auto tag)
+                    {
+        using T = decltype(tag);
+        T *elements = static_cast<T *>(keys);
+        typename Order<T>::Less less;
+        if (values == nullptr)
+        {
+            parallelSort(elements, elements + count, less, true, threads);
+            return;
+        }
+
+        std::vector<uint32_t> order(count);
+        std::iota(order.begin(), order.end(), 0u);
+        parallelSort(order.begin(), order.end(), [=](uint32_t a, uint32_t b)
+                     { return less(elements[a], elements[b]); }, true, threads);
+        permute<T>(keys, order);
+        if (ObjectFactory::fieldSize(valueType) == 1)
+            permute<uint8_t>(values, order);
+        else
+            permute<uint32_t>(values, order); });
+}
+
+int64_t arrayBinarySearch(const void *data, size_t count, FieldType type, uint32_t key)
+{
+    return withElementType(type, [&](auto tag) -> int64_t
+                           {
+        using T = decltype(tag);
+        const T *elements = static_cast<const T *>(data);
+        typename Order<T>::Less less;
+        T value = fromWord<T>(key);
+        const T *at = std::lower_bound(elements, elements + count, value, less);
+        int64_t index = at - elements;
+        if (at != elements + count && !less(value, *at))
+            return index;
+        return -index - 1; });
+}
+
+size_t arrayPartition(void *data, size_t count, FieldType type, uint32_t pivot)
+{
+    return withElementType(type, [&](auto tag) -> size_t
+                           {
+        using T = decltype(tag);
+        T *elements = static_cast<T *>(data);
+        typename Order<T>::Less less;
+        T value = fromWord<T>(pivot);
+        return std::partition(elements, elements + count, [&](const T &x)
+                              { return less(x, value); }) - elements; });
+}
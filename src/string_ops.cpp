@@ -0,0 +1,65 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <string_ops.hpp>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+int stringCompare(const uint8_t *a, size_t aLength, const uint8_t *b, size_t bLength)
+{
+    int result = std::memcmp(a, b, std::min(aLength, bLength));
+    if (result != 0)
+        return (result > 0) - (result < 0);
+    return (aLength > bLength) - (aLength < bLength);
+}
+
+int64_t stringFind(const uint8_t *text, size_t textLength, const uint8_t *needle, size_t needleLength)
+{
+    if (needleLength == 0)
+        return 0;
+    if (needleLength > textLength)
+        return -1;
+    if (needleLength == 1)
+    {
+        const void *at = std::memchr(text, needle[0], textLength);
+        return at == nullptr ? -1 : static_cast<const uint8_t *>(at) - text;
+    }
+
+    // Candidate starts are positions where both the first and the last byte
+    // of the needle match; 16 of them are tested per compare, and only those
+    // go on to a memcmp of the bytes in between
+    size_t last = needleLength - 1;
+    size_t end = textLength - needleLength + 1; // one past the last start
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(static_cast<char>(needle[0]));
+    const __m128i final = _mm_set1_epi8(static_cast<char>(needle[last]));
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i + last));
+        uint32_t bits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, final))));
+        for (; bits != 0; bits &= bits - 1)
+        {
+            size_t at = i + __builtin_ctz(bits);
+            if (std::memcmp(text + at + 1, needle + 1, last - 1) == 0)
+                return static_cast<int64_t>(at);
+        }
+    }
+#endif
+    while (i < end)
+    {
+        const void *hit = std::memchr(text + i, needle[0], end - i);
+        if (hit == nullptr)
+            return -1;
+        size_t at = static_cast<const uint8_t *>(hit) - text;
+        if (text[at + last] == needle[last] && std::memcmp(text + at + 1, needle + 1, last - 1) == 0)
+            return static_cast<int64_t>(at);
+        i = at + 1;
+    }
+    return -1;
+}
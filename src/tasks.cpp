@@ -0,0 +1,168 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <VM.hpp>
+
+uint32_t VM::spawnTask(uint32_t methodOffset, uint8_t argCount)
+{
+    if (tasks.empty())
+    {
+        // The running context becomes task 0
+        tasks.push_back(std::make_unique<Task>());
+        tasks[0]->state = TaskState::RUNNABLE;
+        currentTask = 0;
+    }
+    uint32_t id;
+    if (!freeTaskIds.empty())
+    {
+        id = freeTaskIds.back();
+        freeTaskIds.pop_back();
+    }
+    else
+    {
+        id = static_cast<uint32_t>(tasks.size());
+        tasks.push_back(std::make_unique<Task>());
+    }
+
+    Task &task = *tasks[id];
+    if (!spareStacks.empty())
+    {
+        task.stack.swap(*spareStacks.back());
+        spareStacks.pop_back();
+    }
+    else
+    {
+        GuardedStack fresh(options.taskStackBytes, options.memory);
+        task.stack.swap(fresh);
+    }
+    task.stack.clear();
+
+    // The frame CALL would build, with arguments in the order they were
+    // pushed and a return address that ends the task
+    for (size_t i = argCount; i > 0; i--)
+        task.stack.push(stack[stack.size() - i]);
+    for (uint8_t i = 0; i < argCount; i++)
+        pop();
+    task.stack.push(TASK_EXIT);
+    task.stack.push(0);
+    task.fp = static_cast<uint32_t>(task.stack.size()) - 1;
+    task.ip = methodOffset;
+    task.argsToPop = argCount;
+    task.state = TaskState::RUNNABLE;
+    task.result = 0;
+    task.joiners.clear();
+    runQueue.push_back(id);
+    return id;
+}
+
+void VM::switchTask()
+{
+    if (runQueue.empty())
+    {
+        throw std::runtime_error("Task error: Deadlock, every task is blocked.");
+    }
+    uint32_t next = runQueue.front();
+    runQueue.pop_front();
+
+    Task &from = *tasks[currentTask];
+    from.ip = ip;
+    from.fp = fp;
+    from.argsToPop = args_to_pop;
+    from.stack.swap(stack);
+
+    Task &to = *tasks[next];
+    stack.swap(to.stack);
+    ip = to.ip;
+    fp = to.fp;
+    args_to_pop = to.argsToPop;
+    currentTask = next;
+    quantumLeft = options.taskQuantum;
+
+    // A finished task only needs its result; its stack serves the next SPAWN
+    if (from.state == TaskState::FINISHED)
+    {
+        spareStacks.push_back(std::make_unique<GuardedStack>());
+        spareStacks.back()->swap(from.stack);
+    }
+}
+
+void VM::preempt()
+{
+    quantumLeft = options.taskQuantum;
+    // Arena objects belong to the task that opened the region, so tasks are
+    // not switched inside one
+    if (runQueue.empty() || objectFactory.arenaDepth() > 0)
+        return;
+    runQueue.push_back(currentTask);
+    switchTask();
+}
+
+void VM::blockTask(const char *opName)
+{
+    if (objectFactory.arenaDepth() > 0)
+    {
+        throw std::runtime_error(std::string(opName) + " error: Cannot block inside an arena region.");
+    }
+    if (tasks.empty())
+    {
+        throw std::runtime_error("Task error: Deadlock, every task is blocked.");
+    }
+    // JOIN, SEND and RECV have no operands, and they leave theirs on the
+    // stack when they block
+    ip--;
+    tasks[currentTask]->state = TaskState::BLOCKED;
+    switchTask();
+}
+
+void VM::wakeTask(uint32_t id)
+{
+    Task &task = *tasks[id];
+    if (task.state != TaskState::BLOCKED)
+        return;
+    task.state = TaskState::RUNNABLE;
+    runQueue.push_back(id);
+}
+
+void VM::finishTask()
+{
+    Task &task = *tasks[currentTask];
+    task.result = stack.empty() ? 0 : stack.back();
+    gc.writeBarrier(task.result); // results are scanned once per cycle
+    task.state = TaskState::FINISHED;
+    for (uint32_t joiner : task.joiners)
+        wakeTask(joiner);
+    task.joiners.clear();
+    DBG("Task " << currentTask << " finished with " << task.result);
+    switchTask();
+}
+
+void VM::endTasks()
+{
+    if (tasks.empty())
+        return;
+    if (currentTask != 0)
+    {
+        Task &main = *tasks[0];
+        tasks[currentTask]->stack.swap(stack);
+        stack.swap(main.stack);
+        ip = main.ip;
+        fp = main.fp;
+        args_to_pop = main.argsToPop;
+        currentTask = 0;
+    }
+    tasks.clear();
+    freeTaskIds.clear();
+    runQueue.clear();
+    channelWaiters.clear();
+    quantumLeft = options.taskQuantum;
+}
+
+bool VM::tasksRunning() const
+{
+    for (size_t id = 1; id < tasks.size(); id++)
+    {
+        if (tasks[id]->state != TaskState::FREE)
+            return true;
+    }
+    return false;
+}
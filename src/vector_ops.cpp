@@ -0,0 +1,494 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <vector_ops.hpp>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define VM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Portable kernels. They start at element i so the SIMD kernels can hand
+    // them the tail that does not fill a whole register.
+
+    void mapFloatScalar(VectorOp op, float *dst, const float *a, const float *b, size_t i, size_t n)
+    {
+        switch (op)
+        {
+        case VectorOp::ADD:
+            for (; i < n; i++)
+                dst[i] = a[i] + b[i];
+            break;
+        case VectorOp::SUB:
+            for (; i < n; i++)
+                dst[i] = a[i] - b[i];
+            break;
+        case VectorOp::MUL:
+            for (; i < n; i++)
+                dst[i] = a[i] * b[i];
+            break;
+        case VectorOp::DIV:
+            for (; i < n; i++)
+                dst[i] = a[i] / b[i];
+            break;
+        case VectorOp::FMA:
+            for (; i < n; i++)
+                dst[i] = std::fma(a[i], b[i], dst[i]);
+            break;
+        }
+    }
+
+    void mapIntScalar(VectorOp op, uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t i, size_t n)
+    {
+        switch (op)
+        {
+        case VectorOp::ADD:
+            for (; i < n; i++)
+                dst[i] = a[i] + b[i];
+            break;
+        case VectorOp::SUB:
+            for (; i < n; i++)
+                dst[i] = a[i] - b[i];
+            break;
+        case VectorOp::MUL:
+            for (; i < n; i++)
+                dst[i] = a[i] * b[i];
+            break;
+        case VectorOp::DIV:
+            // A failing VDIV leaves dst as it was, so the divisors are all
+            // checked before the first element is written
+            for (size_t j = i; j < n; j++)
+            {
+                if (b[j] == 0)
+                    throw std::runtime_error("VDIV error: Division by zero");
+            }
+            for (; i < n; i++)
+            {
+                int32_t x = static_cast<int32_t>(a[i]);
+                int32_t y = static_cast<int32_t>(b[i]);
+                dst[i] = (y == -1) ? 0u - a[i] : static_cast<uint32_t>(x / y);
+            }
+            break;
+        case VectorOp::FMA:
+            for (; i < n; i++)
+                dst[i] += a[i] * b[i];
+            break;
+        }
+    }
+
+    float dotFloatScalar(const float *a, const float *b, size_t i, size_t n, float sum)
+    {
+        for (; i < n; i++)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    uint32_t dotIntScalar(const uint32_t *a, const uint32_t *b, size_t i, size_t n, uint32_t sum)
+    {
+        for (; i < n; i++)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    float reduceFloatScalar(VectorReduce op, const float *a, size_t i, size_t n, float acc)
+    {
+        for (; i < n; i++)
+        {
+            if (op == VectorReduce::SUM)
+                acc += a[i];
+            else if (op == VectorReduce::MIN)
+                acc = a[i] < acc ? a[i] : acc;
+            else
+                acc = a[i] > acc ? a[i] : acc;
+        }
+        return acc;
+    }
+
+    uint32_t reduceIntScalar(VectorReduce op, const uint32_t *a, size_t i, size_t n, uint32_t acc)
+    {
+        for (; i < n; i++)
+        {
+            if (op == VectorReduce::SUM)
+                acc += a[i];
+            else if (op == VectorReduce::MIN)
+                acc = static_cast<int32_t>(a[i]) < static_cast<int32_t>(acc) ? a[i] : acc;
+            else
+                acc = static_cast<int32_t>(a[i]) > static_cast<int32_t>(acc) ? a[i] : acc;
+        }
+        return acc;
+    }
+
+    void mapFloatPortable(VectorOp op, float *dst, const float *a, const float *b, size_t n)
+    {
+        mapFloatScalar(op, dst, a, b, 0, n);
+    }
+    void mapIntPortable(VectorOp op, uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n)
+    {
+        mapIntScalar(op, dst, a, b, 0, n);
+    }
+    float dotFloatPortable(const float *a, const float *b, size_t n) { return dotFloatScalar(a, b, 0, n, 0.0f); }
+    uint32_t dotIntPortable(const uint32_t *a, const uint32_t *b, size_t n) { return dotIntScalar(a, b, 0, n, 0); }
+    float reduceFloatPortable(VectorReduce op, const float *a, size_t n) { return reduceFloatScalar(op, a, 1, n, a[0]); }
+    uint32_t reduceIntPortable(VectorReduce op, const uint32_t *a, size_t n) { return reduceIntScalar(op, a, 1, n, a[0]); }
+
+#ifdef VM_X86_KERNELS
+
+    // SSE4.1: 4 lanes. There is no fused multiply-add, so VFMA stays scalar
+    // to round the same way on every CPU.
+
+    __attribute__((target("sse4.1"))) inline __m128i load128(const uint32_t *p)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    }
+
+    __attribute__((target("sse4.1"))) inline void store128(uint32_t *p, __m128i v)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v);
+    }
+
+    __attribute__((target("sse4.1"))) float horizontalSum(__m128 v)
+    {
+        __m128 shuffled = _mm_movehdup_ps(v);
+        __m128 sums = _mm_add_ps(v, shuffled);
+        shuffled = _mm_movehl_ps(shuffled, sums);
+        return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+    }
+
+    __attribute__((target("sse4.1"))) uint32_t horizontalSum(__m128i v)
+    {
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+        return static_cast<uint32_t>(_mm_cvtsi128_si32(v));
+    }
+
+    __attribute__((target("sse4.1"))) void mapFloatSse(VectorOp op, float *dst, const float *a, const float *b, size_t n)
+    {
+        size_t i = 0;
+        switch (op)
+        {
+        case VectorOp::ADD:
+            for (; i + 4 <= n; i += 4)
+                _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+            break;
+        case VectorOp::SUB:
+            for (; i + 4 <= n; i += 4)
+                _mm_storeu_ps(dst + i, _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+            break;
+        case VectorOp::MUL:
+            for (; i + 4 <= n; i += 4)
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+            break;
+        case VectorOp::DIV:
+            for (; i + 4 <= n; i += 4)
+                _mm_storeu_ps(dst + i, _mm_div_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+            break;
+        case VectorOp::FMA:
+            break;
+        }
+        mapFloatScalar(op, dst, a, b, i, n);
+    }
+
+    __attribute__((target("sse4.1"))) void mapIntSse(VectorOp op, uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n)
+    {
+        size_t i = 0;
+        switch (op)
+        {
+        case VectorOp::ADD:
+            for (; i + 4 <= n; i += 4)
+                store128(dst + i, _mm_add_epi32(load128(a + i), load128(b + i)));
+            break;
+        case VectorOp::SUB:
+            for (; i + 4 <= n; i += 4)
+                store128(dst + i, _mm_sub_epi32(load128(a + i), load128(b + i)));
+            break;
+        case VectorOp::MUL:
+            for (; i + 4 <= n; i += 4)
+                store128(dst + i, _mm_mullo_epi32(load128(a + i), load128(b + i)));
+            break;
+        case VectorOp::DIV:
+            break;
+        case VectorOp::FMA:
+            for (; i + 4 <= n; i += 4)
+                store128(dst + i, _mm_add_epi32(load128(dst + i), _mm_mullo_epi32(load128(a + i), load128(b + i))));
+            break;
+        }
+        mapIntScalar(op, dst, a, b, i, n);
+    }
+
+    __attribute__((target("sse4.1"))) float dotFloatSse(const float *a, const float *b, size_t n)
+    {
+        __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        }
+        return dotFloatScalar(a, b, i, n, horizontalSum(_mm_add_ps(sum0, sum1)));
+    }
+
+    __attribute__((target("sse4.1"))) uint32_t dotIntSse(const uint32_t *a, const uint32_t *b, size_t n)
+    {
+        __m128i sum = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            sum = _mm_add_epi32(sum, _mm_mullo_epi32(load128(a + i), load128(b + i)));
+        }
+        return dotIntScalar(a, b, i, n, horizontalSum(sum));
+    }
+
+    __attribute__((target("sse4.1"))) float reduceFloatSse(VectorReduce op, const float *a, size_t n)
+    {
+        if (n < 4)
+            return reduceFloatScalar(op, a, 1, n, a[0]);
+        __m128 acc = op == VectorReduce::SUM ? _mm_setzero_ps() : _mm_loadu_ps(a);
+        size_t i = op == VectorReduce::SUM ? 0 : 4;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 v = _mm_loadu_ps(a + i);
+            acc = op == VectorReduce::SUM ? _mm_add_ps(acc, v) : op == VectorReduce::MIN ? _mm_min_ps(acc, v)
+                                                                                          : _mm_max_ps(acc, v);
+        }
+        if (op == VectorReduce::SUM)
+            return reduceFloatScalar(op, a, i, n, horizontalSum(acc));
+        float lanes[4];
+        _mm_storeu_ps(lanes, acc);
+        return reduceFloatScalar(op, a, i, n, reduceFloatScalar(op, lanes, 1, 4, lanes[0]));
+    }
+
+    __attribute__((target("sse4.1"))) uint32_t reduceIntSse(VectorReduce op, const uint32_t *a, size_t n)
+    {
+        if (n < 4)
+            return reduceIntScalar(op, a, 1, n, a[0]);
+        __m128i acc = op == VectorReduce::SUM ? _mm_setzero_si128() : load128(a);
+        size_t i = op == VectorReduce::SUM ? 0 : 4;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i v = load128(a + i);
+            acc = op == VectorReduce::SUM ? _mm_add_epi32(acc, v) : op == VectorReduce::MIN ? _mm_min_epi32(acc, v)
+                                                                                             : _mm_max_epi32(acc, v);
+        }
+        if (op == VectorReduce::SUM)
+            return reduceIntScalar(op, a, i, n, horizontalSum(acc));
+        uint32_t lanes[4];
+        store128(lanes, acc);
+        return reduceIntScalar(op, a, i, n, reduceIntScalar(op, lanes, 1, 4, lanes[0]));
+    }
+
+    // AVX2 with FMA: 8 lanes
+
+    __attribute__((target("avx2,fma"))) inline __m256i load256(const uint32_t *p)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    }
+
+    __attribute__((target("avx2,fma"))) inline void store256(uint32_t *p, __m256i v)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+    }
+
+    __attribute__((target("avx2,fma"))) float horizontalSum256(__m256 v)
+    {
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+        return _mm_cvtss_f32(sum);
+    }
+
+    __attribute__((target("avx2,fma"))) uint32_t horizontalSum256(__m256i v)
+    {
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        return static_cast<uint32_t>(_mm_cvtsi128_si32(sum));
+    }
+
+    __attribute__((target("avx2,fma"))) void mapFloatAvx2(VectorOp op, float *dst, const float *a, const float *b, size_t n)
+    {
+        size_t i = 0;
+        switch (op)
+        {
+        case VectorOp::ADD:
+            for (; i + 8 <= n; i += 8)
+                _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+            break;
+        case VectorOp::SUB:
+            for (; i + 8 <= n; i += 8)
+                _mm256_storeu_ps(dst + i, _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+            break;
+        case VectorOp::MUL:
+            for (; i + 8 <= n; i += 8)
+                _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+            break;
+        case VectorOp::DIV:
+            for (; i + 8 <= n; i += 8)
+                _mm256_storeu_ps(dst + i, _mm256_div_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+            break;
+        case VectorOp::FMA:
+            for (; i + 8 <= n; i += 8)
+                _mm256_storeu_ps(dst + i, _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), _mm256_loadu_ps(dst + i)));
+            break;
+        }
+        mapFloatScalar(op, dst, a, b, i, n);
+    }
+
+    __attribute__((target("avx2,fma"))) void mapIntAvx2(VectorOp op, uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n)
+    {
+        size_t i = 0;
+        switch (op)
+        {
+        case VectorOp::ADD:
+            for (; i + 8 <= n; i += 8)
+                store256(dst + i, _mm256_add_epi32(load256(a + i), load256(b + i)));
+            break;
+        case VectorOp::SUB:
+            for (; i + 8 <= n; i += 8)
+                store256(dst + i, _mm256_sub_epi32(load256(a + i), load256(b + i)));
+            break;
+        case VectorOp::MUL:
+            for (; i + 8 <= n; i += 8)
+                store256(dst + i, _mm256_mullo_epi32(load256(a + i), load256(b + i)));
+            break;
+        case VectorOp::DIV:
+            break;
+        case VectorOp::FMA:
+            for (; i + 8 <= n; i += 8)
+                store256(dst + i, _mm256_add_epi32(load256(dst + i), _mm256_mullo_epi32(load256(a + i), load256(b + i))));
+            break;
+        }
+        mapIntScalar(op, dst, a, b, i, n);
+    }
+
+    __attribute__((target("avx2,fma"))) float dotFloatAvx2(const float *a, const float *b, size_t n)
+    {
+        __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+            sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+        }
+        return dotFloatScalar(a, b, i, n, horizontalSum256(_mm256_add_ps(sum0, sum1)));
+    }
+
+    __attribute__((target("avx2,fma"))) uint32_t dotIntAvx2(const uint32_t *a, const uint32_t *b, size_t n)
+    {
+        __m256i sum = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(load256(a + i), load256(b + i)));
+        }
+        return dotIntScalar(a, b, i, n, horizontalSum256(sum));
+    }
+
+    __attribute__((target("avx2,fma"))) float reduceFloatAvx2(VectorReduce op, const float *a, size_t n)
+    {
+        if (n < 8)
+            return reduceFloatScalar(op, a, 1, n, a[0]);
+        __m256 acc = op == VectorReduce::SUM ? _mm256_setzero_ps() : _mm256_loadu_ps(a);
+        size_t i = op == VectorReduce::SUM ? 0 : 8;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(a + i);
+            acc = op == VectorReduce::SUM ? _mm256_add_ps(acc, v) : op == VectorReduce::MIN ? _mm256_min_ps(acc, v)
+                                                                                             : _mm256_max_ps(acc, v);
+        }
+        if (op == VectorReduce::SUM)
+            return reduceFloatScalar(op, a, i, n, horizontalSum256(acc));
+        float lanes[8];
+        _mm256_storeu_ps(lanes, acc);
+        return reduceFloatScalar(op, a, i, n, reduceFloatScalar(op, lanes, 1, 8, lanes[0]));
+    }
+
+    __attribute__((target("avx2,fma"))) uint32_t reduceIntAvx2(VectorReduce op, const uint32_t *a, size_t n)
+    {
+        if (n < 8)
+            return reduceIntScalar(op, a, 1, n, a[0]);
+        __m256i acc = op == VectorReduce::SUM ? _mm256_setzero_si256() : load256(a);
+        size_t i = op == VectorReduce::SUM ? 0 : 8;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256i v = load256(a + i);
+            acc = op == VectorReduce::SUM ? _mm256_add_epi32(acc, v) : op == VectorReduce::MIN ? _mm256_min_epi32(acc, v)
+                                                                                                : _mm256_max_epi32(acc, v);
+        }
+        if (op == VectorReduce::SUM)
+            return reduceIntScalar(op, a, i, n, horizontalSum256(acc));
+        uint32_t lanes[8];
+        store256(lanes, acc);
+        return reduceIntScalar(op, a, i, n, reduceIntScalar(op, lanes, 1, 8, lanes[0]));
+    }
+
+#endif // VM_X86_KERNELS
+
+    struct VectorKernels
+    {
+        const char *name;
+        void (*mapFloat)(VectorOp, float *, const float *, const float *, size_t);
+        void (*mapInt)(VectorOp, uint32_t *, const uint32_t *, const uint32_t *, size_t);
+        float (*dotFloat)(const float *, const float *, size_t);
+        uint32_t (*dotInt)(const uint32_t *, const uint32_t *, size_t);
+        float (*reduceFloat)(VectorReduce, const float *, size_t);
+        uint32_t (*reduceInt)(VectorReduce, const uint32_t *, size_t);
+    };
+
+    VectorKernels selectKernels()
+    {
+#ifdef VM_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return VectorKernels{"avx2", mapFloatAvx2, mapIntAvx2, dotFloatAvx2, dotIntAvx2, reduceFloatAvx2, reduceIntAvx2};
+        if (__builtin_cpu_supports("sse4.1"))
+            return VectorKernels{"sse4.1", mapFloatSse, mapIntSse, dotFloatSse, dotIntSse, reduceFloatSse, reduceIntSse};
+#endif
+        return VectorKernels{"scalar", mapFloatPortable, mapIntPortable, dotFloatPortable, dotIntPortable, reduceFloatPortable, reduceIntPortable};
+    }
+
+    const VectorKernels &kernels()
+    {
+        static const VectorKernels selected = selectKernels();
+        return selected;
+    }
+}
+
+void vectorMap(VectorOp op, FieldType type, void *dst, const void *a, const void *b, size_t count)
+{
+    if (type == FieldType::FLOAT)
+        kernels().mapFloat(op, static_cast<float *>(dst), static_cast<const float *>(a), static_cast<const float *>(b), count);
+    else
+        kernels().mapInt(op, static_cast<uint32_t *>(dst), static_cast<const uint32_t *>(a), static_cast<const uint32_t *>(b), count);
+}
+
+uint32_t vectorDot(FieldType type, const void *a, const void *b, size_t count)
+{
+    if (type != FieldType::FLOAT)
+        return kernels().dotInt(static_cast<const uint32_t *>(a), static_cast<const uint32_t *>(b), count);
+    float result = kernels().dotFloat(static_cast<const float *>(a), static_cast<const float *>(b), count);
+    uint32_t raw;
+    std::memcpy(&raw, &result, sizeof(uint32_t));
+    return raw;
+}
+
+uint32_t vectorReduce(VectorReduce op, FieldType type, const void *a, size_t count)
+{
+    if (count == 0)
+        return 0;
+    if (type != FieldType::FLOAT)
+        return kernels().reduceInt(op, static_cast<const uint32_t *>(a), count);
+    float result = kernels().reduceFloat(op, static_cast<const float *>(a), count);
+    uint32_t raw;
+    std::memcpy(&raw, &result, sizeof(uint32_t));
+    return raw;
+}
+
+const char *vectorIsa()
+{
+    return kernels().name;
+}
@@ -0,0 +1,157 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <serve_protocol.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/un.h>
+
+// Client of vm --serve: runs one job and passes its output through
+int main(int argc, char *argv[])
+{
+    const char *socketPath = nullptr;
+    const char *programPath = nullptr;
+    std::string method;
+    std::vector<int32_t> args;
+    unsigned repeat = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--method") == 0 && i + 1 < argc)
+        {
+            method = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            repeat = std::stoul(argv[++i]);
+        }
+        else if (socketPath == nullptr)
+        {
+            socketPath = argv[i];
+        }
+        else if (programPath == nullptr)
+        {
+            programPath = argv[i];
+        }
+        else
+        {
+            args.push_back(std::stoi(argv[i]));
+        }
+    }
+    if (socketPath == nullptr || programPath == nullptr || repeat == 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--method <Class.method>] [--repeat <n>] <socket> <program> [int_args...]" << std::endl;
+        return 1;
+    }
+
+    // A terminal is not a payload
+    std::string input;
+    if (!isatty(STDIN_FILENO))
+        input.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+
+    std::vector<uint8_t> request;
+    putWord(request, 0); // length, patched below
+    putWord(request, static_cast<uint32_t>(std::strlen(programPath)));
+    request.insert(request.end(), programPath, programPath + std::strlen(programPath));
+    putWord(request, static_cast<uint32_t>(method.size()));
+    request.insert(request.end(), method.begin(), method.end());
+    putWord(request, static_cast<uint32_t>(args.size()));
+    for (int32_t arg : args)
+        putWord(request, static_cast<uint32_t>(arg));
+    putWord(request, static_cast<uint32_t>(input.size()));
+    request.insert(request.end(), input.begin(), input.end());
+    uint32_t length = static_cast<uint32_t>(request.size() - 4);
+    for (int i = 0; i < 4; i++)
+        request[i] = static_cast<uint8_t>(length >> (8 * i));
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (std::strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        std::cerr << "Error: Socket path too long" << std::endl;
+        return 1;
+    }
+    std::strcpy(address.sun_path, socketPath);
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || connect(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+    {
+        std::cerr << "Error: Could not connect to " << socketPath << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    // --repeat sends the job again on the same connection and reports the
+    // mean round trip; the output of every run is passed through
+    int status = 1;
+    double startupMicros = 0; // summed STARTUP frames
+    unsigned forked = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned run = 0; run < repeat; run++)
+    {
+        if (!writeFully(server, request.data(), request.size()))
+        {
+            std::cerr << "Error: Server closed the connection" << std::endl;
+            return 1;
+        }
+        for (bool done = false; !done;)
+        {
+            uint8_t head[5];
+            if (!readFully(server, head, 5))
+            {
+                std::cerr << "Error: Server closed the connection" << std::endl;
+                return 1;
+            }
+            std::vector<uint8_t> payload(readWord(head + 1));
+            if (!readFully(server, payload.data(), payload.size()))
+            {
+                std::cerr << "Error: Server closed the connection" << std::endl;
+                return 1;
+            }
+            switch (static_cast<Frame>(head[0]))
+            {
+            case Frame::STDOUT:
+                fwrite(payload.data(), 1, payload.size(), stdout);
+                break;
+            case Frame::STDERR:
+                fflush(stdout);
+                fwrite(payload.data(), 1, payload.size(), stderr);
+                break;
+            case Frame::RESULT:
+                if (payload.size() == 4)
+                    printf("%d\n", static_cast<int32_t>(readWord(payload.data())));
+                break;
+            case Frame::STARTUP:
+                if (payload.size() == 4)
+                {
+                    startupMicros += readWord(payload.data()) / 1000.0;
+                    forked++;
+                }
+                break;
+            case Frame::EXIT:
+                if (payload.size() == 4)
+                    status = static_cast<int32_t>(readWord(payload.data()));
+                done = true;
+                break;
+            default:
+                std::cerr << "Error: Unknown frame type " << static_cast<int>(head[0]) << std::endl;
+                return 1;
+            }
+        }
+    }
+    fflush(stdout);
+    if (repeat > 1)
+    {
+        double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << repeat << " jobs, " << micros / repeat << " us per job";
+        if (forked > 0)
+            std::cerr << ", " << startupMicros / forked << " us from fork to first instruction";
+        std::cerr << std::endl;
+    }
+    close(server);
+    return status;
+}
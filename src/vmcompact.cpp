@@ -0,0 +1,50 @@
+/**
+ * Author: Shivadharshan S
+ */
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <stdexcept>
+#include <compact.hpp>
+
+// Converts a VM binary to the compact version 2 encoding
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <input_binary> <output_binary>" << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "Error: cannot open " << argv[1] << std::endl;
+        return 1;
+    }
+    std::vector<uint8_t> input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    try
+    {
+        CompactStats stats;
+        std::vector<uint8_t> output = compactBinary(input.data(), input.size(), &stats);
+        std::ofstream out(argv[2], std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(output.data()), static_cast<std::streamsize>(output.size()));
+        if (!out)
+        {
+            std::cerr << "Error: cannot write " << argv[2] << std::endl;
+            return 1;
+        }
+        std::cout << "code: " << stats.codeBefore << " -> " << stats.codeAfter << " bytes";
+        if (stats.codeBefore != 0)
+            std::cout << " (" << 100.0 * stats.codeAfter / stats.codeBefore << "%)";
+        std::cout << ", " << stats.shortened << " of " << stats.instructions << " instructions shortened" << std::endl;
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
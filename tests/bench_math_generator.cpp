@@ -0,0 +1,115 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes programs that replace every element of a 1M-element FLOAT array
+ * (1.0, 1.5, 2.0, ...) by its square root or by exp(x / 1e6):
+ *   bench_math_init.vm    - only fills the array; subtract its time
+ *   bench_math_newton.vm  - sqrt by 8 Newton iterations in bytecode
+ *   bench_math_fsqrt.vm   - one FSQRT per element
+ *   bench_math_vsqrt.vm   - one VSQRT over the array
+ *   bench_math_taylor.vm  - exp by a 10-term Taylor polynomial in bytecode
+ *   bench_math_fexp.vm    - one FEXP per element
+ *   bench_math_vexp.vm    - one VEXP over the array
+ * Time them with `time ./vm <file>`.
+ *
+ * Build: g++ -std=c++17 -I../src/include bench_math_generator.cpp
+ */
+#include "program_builder.hpp"
+#include <functional>
+
+static const int32_t N = 1000000;
+
+enum : uint32_t
+{
+    ARRAY = 1,
+    I = 2,
+    X = 4,
+    ARG = 5,
+    GUESS = 6,
+    SCALE = 7,
+};
+
+static void fill(Emitter &e)
+{
+    e.push(N), e.op(Opcode::NEWARRAY), e.u8(T_FLOAT), e.store(ARRAY);
+    e.pushFloat(1.0f), e.store(X);
+    e.push(0), e.store(I);
+    e.label("fill");
+    e.load(I), e.push(N), e.op(Opcode::ICMP_LT), e.jump(Opcode::JZ, "filled");
+    e.load(ARRAY), e.load(I), e.load(X), e.op(Opcode::ASTORE);
+    e.load(X), e.pushFloat(0.5f), e.op(Opcode::FADD), e.store(X);
+    e.load(I), e.push(1), e.op(Opcode::IADD), e.store(I);
+    e.jump(Opcode::JMP, "fill");
+    e.label("filled");
+}
+
+// a[i] = f(a[i]) for every element, with body turning the value on the
+// stack into its result
+static void perElement(Emitter &e, const std::function<void(Emitter &)> &body)
+{
+    e.push(0), e.store(I);
+    e.label("loop");
+    e.load(I), e.push(N), e.op(Opcode::ICMP_LT), e.jump(Opcode::JZ, "done");
+    e.load(ARRAY), e.load(I);
+    e.load(ARRAY), e.load(I), e.op(Opcode::ALOAD);
+    body(e);
+    e.op(Opcode::ASTORE);
+    e.load(I), e.push(1), e.op(Opcode::IADD), e.store(I);
+    e.jump(Opcode::JMP, "loop");
+    e.label("done");
+}
+
+static void write(const char *path, const std::function<void(Emitter &)> &work)
+{
+    Emitter e;
+    e.label("main");
+    fill(e);
+    work(e);
+    e.push(0), e.exit();
+    writeFile(path, binary(e, "main", 8));
+}
+
+int main()
+{
+    write("bench_math_init.vm", [](Emitter &) {});
+    write("bench_math_newton.vm", [](Emitter &e)
+          { perElement(e, [](Emitter &e)
+                       {
+                           // g = x, then g = 0.5 * (g + x / g) eight times
+                           e.store(ARG), e.load(ARG), e.store(GUESS);
+                           for (int k = 0; k < 8; k++)
+                           {
+                               e.load(GUESS), e.load(ARG), e.load(GUESS), e.op(Opcode::FDIV), e.op(Opcode::FADD);
+                               e.pushFloat(0.5f), e.op(Opcode::FMUL), e.store(GUESS);
+                           }
+                           e.load(GUESS);
+                       }); });
+    write("bench_math_fsqrt.vm", [](Emitter &e)
+          { perElement(e, [](Emitter &e)
+                       { e.op(Opcode::FSQRT); }); });
+    write("bench_math_vsqrt.vm", [](Emitter &e)
+          { e.load(ARRAY), e.load(ARRAY), e.push(0), e.push(N), e.op(Opcode::VSQRT); });
+    write("bench_math_taylor.vm", [](Emitter &e)
+          { perElement(e, [](Emitter &e)
+                       {
+                           // Horner form of sum t^k / k! for k <= 10, t = x / 1e6
+                           e.pushFloat(1e-6f), e.op(Opcode::FMUL), e.store(ARG);
+                           e.pushFloat(1.0f);
+                           for (int k = 10; k > 0; k--)
+                           {
+                               e.load(ARG), e.op(Opcode::FMUL), e.pushFloat(1.0f / k), e.op(Opcode::FMUL);
+                               e.pushFloat(1.0f), e.op(Opcode::FADD);
+                           }
+                       }); });
+    write("bench_math_fexp.vm", [](Emitter &e)
+          { perElement(e, [](Emitter &e)
+                       { e.pushFloat(1e-6f), e.op(Opcode::FMUL), e.op(Opcode::FEXP); }); });
+    write("bench_math_vexp.vm", [](Emitter &e)
+          {
+              // exp(x / 1e6), with the arguments scaled by a VMUL first
+              e.push(N), e.op(Opcode::NEWARRAY), e.u8(T_FLOAT), e.store(SCALE);
+              e.load(SCALE), e.push(0), e.push(N), e.pushFloat(1e-6f), e.op(Opcode::ARRAYFILL);
+              e.load(ARRAY), e.load(ARRAY), e.load(SCALE), e.push(0), e.push(N), e.op(Opcode::VMUL);
+              e.load(ARRAY), e.load(ARRAY), e.push(0), e.push(N), e.op(Opcode::VEXP); });
+    return 0;
+}
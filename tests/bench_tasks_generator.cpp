@@ -0,0 +1,64 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes programs that time task switches and task creation:
+ *   bench_tasks_yield.vm - two tasks yield to each other 10M times each
+ *   bench_tasks_spawn.vm - spawns 10000 tasks that yield once, then joins
+ *                          them in order
+ * Both exit with 0. Time them with `time ./vm <file>`.
+ *
+ * Build: g++ -std=c++17 -I../src/include bench_tasks_generator.cpp
+ */
+#include "program_builder.hpp"
+
+static const int32_t YIELDS = 10000000;
+static const int32_t TASKS = 10000;
+
+enum : uint32_t
+{
+    IDS = 0,
+    I = 1,
+    FIRST = 2,
+    SECOND = 3,
+};
+
+int main()
+{
+    {
+        Emitter e;
+        e.label("main");
+        e.push(YIELDS), e.spawn("yielder", 1), e.store(FIRST);
+        e.push(YIELDS), e.spawn("yielder", 1), e.store(SECOND);
+        e.load(FIRST), e.op(Opcode::JOIN), e.op(Opcode::POP);
+        e.load(SECOND), e.op(Opcode::JOIN), e.op(Opcode::POP);
+        e.push(0), e.exit();
+
+        e.label("yielder");
+        e.loadArg(0);
+        e.label("loop");
+        e.op(Opcode::YIELD), e.push(1), e.op(Opcode::ISUB), e.op(Opcode::DUP), e.jump(Opcode::JNZ, "loop");
+        e.op(Opcode::RET);
+        writeFile("bench_tasks_yield.vm", binary(e, "main", 4));
+    }
+    {
+        Emitter e;
+        e.label("main");
+        e.push(TASKS), e.op(Opcode::NEWARRAY), e.u8(T_INT), e.store(IDS);
+        e.push(0), e.store(I);
+        e.label("spawn");
+        e.load(IDS), e.load(I), e.load(I), e.spawn("task", 1), e.op(Opcode::ASTORE);
+        e.load(I), e.push(1), e.op(Opcode::IADD), e.store(I);
+        e.load(I), e.push(TASKS), e.op(Opcode::ICMP_LT), e.jump(Opcode::JNZ, "spawn");
+        e.push(0), e.store(I);
+        e.label("join");
+        e.load(IDS), e.load(I), e.op(Opcode::ALOAD), e.op(Opcode::JOIN), e.op(Opcode::POP);
+        e.load(I), e.push(1), e.op(Opcode::IADD), e.store(I);
+        e.load(I), e.push(TASKS), e.op(Opcode::ICMP_LT), e.jump(Opcode::JNZ, "join");
+        e.push(0), e.exit();
+
+        e.label("task");
+        e.op(Opcode::YIELD), e.loadArg(0), e.op(Opcode::RET);
+        writeFile("bench_tasks_spawn.vm", binary(e, "main", 4));
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes two programs that compute c[i] = a[i] * b[i] over 1M-element FLOAT
+ * arrays, 20 times over:
+ *   bench_vector_loop.vm  - one ALOAD/ALOAD/FMUL/ASTORE round per element
+ *   bench_vector_simd.vm  - one VMUL per pass
+ * Both return c[0] (3.0f). Time them with `time ./vm <file>`.
+ */
+#include <fstream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+static const int32_t N = 1 << 20;
+static const int32_t ROUNDS = 20;
+
+struct Emitter
+{
+    vector<uint8_t> code;
+
+    void op(uint8_t opcode) { code.push_back(opcode); }
+    void u16(uint16_t v)
+    {
+        code.push_back(v & 0xFF);
+        code.push_back(v >> 8);
+    }
+    void u32(uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            code.push_back((v >> (8 * i)) & 0xFF);
+    }
+    void push(int32_t v) { op(0x10), u32(v); }
+    void pushFloat(float f)
+    {
+        uint32_t raw;
+        memcpy(&raw, &f, 4);
+        push(raw);
+    }
+    void load(uint32_t idx) { op(0x20), u32(idx); }
+    void store(uint32_t idx) { op(0x21), u32(idx); }
+    uint16_t here() const { return code.size(); }
+    // Emits a jump and returns the position of its target for patching
+    size_t jump(uint8_t opcode)
+    {
+        op(opcode);
+        u16(0);
+        return code.size() - 2;
+    }
+    void patch(size_t at, uint16_t target)
+    {
+        code[at] = target & 0xFF;
+        code[at + 1] = target >> 8;
+    }
+};
+
+static vector<uint8_t> program(bool simd)
+{
+    enum : uint32_t
+    {
+        A,
+        B,
+        C,
+        I,
+        ROUND
+    };
+    Emitter e;
+    for (uint32_t array : {A, B, C})
+    {
+        e.push(N);
+        e.op(0x70), e.op(0x03); // NEWARRAY FLOAT
+        e.store(array);
+    }
+    // ARRAYFILL a = 1.5, b = 2.0
+    e.load(A), e.push(0), e.push(N), e.pushFloat(1.5f), e.op(0x75);
+    e.load(B), e.push(0), e.push(N), e.pushFloat(2.0f), e.op(0x75);
+
+    e.push(0), e.store(ROUND);
+    uint16_t round = e.here();
+    e.load(ROUND), e.push(ROUNDS), e.op(0x41); // ICMP_LT
+    size_t done = e.jump(0x31);                 // JZ done
+
+    if (simd)
+    {
+        e.load(C), e.load(A), e.load(B), e.push(0), e.push(N), e.op(0x82); // VMUL
+    }
+    else
+    {
+        e.push(0), e.store(I);
+        uint16_t loop = e.here();
+        e.load(I), e.load(C), e.op(0x73), e.op(0x41); // i < c.length
+        size_t exit = e.jump(0x31);
+        e.load(C), e.load(I);
+        e.load(A), e.load(I), e.op(0x71); // ALOAD
+        e.load(B), e.load(I), e.op(0x71);
+        e.op(0x08); // FMUL
+        e.op(0x72); // ASTORE
+        e.load(I), e.push(1), e.op(0x01), e.store(I);
+        e.op(0x30), e.u16(loop);
+        e.patch(exit, e.here());
+    }
+
+    e.load(ROUND), e.push(1), e.op(0x01), e.store(ROUND);
+    e.op(0x30), e.u16(round);
+    e.patch(done, e.here());
+    e.load(C), e.push(0), e.op(0x71), e.op(0x34); // return c[0]
+
+    Emitter file;
+    const uint32_t headerSize = 44;
+    file.code = {0x56, 0x4D, 0x00, 0x01};
+    file.u32(1);                    // version
+    file.u32(0);                    // entry point
+    file.u32(headerSize), file.u32(0); // constant pool
+    file.u32(headerSize), file.u32(e.code.size());
+    file.u32(headerSize + e.code.size()), file.u32(0); // globals
+    file.u32(headerSize + e.code.size()), file.u32(0); // class metadata
+    file.code.insert(file.code.end(), e.code.begin(), e.code.end());
+    return file.code;
+}
+
+int main()
+{
+    vector<uint8_t> loop = program(false);
+    vector<uint8_t> simd = program(true);
+    ofstream("bench_vector_loop.vm", ios::binary).write(reinterpret_cast<const char *>(loop.data()), loop.size());
+    ofstream("bench_vector_simd.vm", ios::binary).write(reinterpret_cast<const char *>(simd.data()), simd.size());
+    return 0;
+}
@@ -0,0 +1,216 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Shared by the test generators: an emitter for code with named labels and a
+ * writer for version 1 binaries with globals and class metadata. Generators
+ * are built with -I../src/include, so they use the VM's own opcode names.
+ */
+#ifndef VM_TESTS_PROGRAM_BUILDER_HPP
+#define VM_TESTS_PROGRAM_BUILDER_HPP
+
+#include <bytecode.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Element and field types, as NEWARRAY, CHANNEW and class metadata encode them
+enum : uint8_t
+{
+    T_INT = 1,
+    T_OBJECT = 2,
+    T_FLOAT = 3,
+    T_CHAR = 4,
+    T_LONG = 5,
+    T_DOUBLE = 6,
+};
+
+// Syscall numbers used by the generated programs
+enum : uint8_t
+{
+    SYS_OPEN = 0x01,
+    SYS_READ = 0x02,
+    SYS_CLOSE = 0x04,
+    SYS_LSEEK = 0x06,
+    SYS_WRITE = 0x07,
+    SYS_EXIT = 0x0A,
+    SYS_READLINE = 0x14,
+    SYS_WRITESTR = 0x15,
+    SYS_CHECKPOINT = 0x16,
+};
+
+struct Emitter
+{
+    std::vector<uint8_t> code;
+
+    void u8(uint8_t v) { code.push_back(v); }
+    void u16(uint16_t v)
+    {
+        code.push_back(v & 0xFF);
+        code.push_back(v >> 8);
+    }
+    void u32(uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            code.push_back((v >> (8 * i)) & 0xFF);
+    }
+
+    void op(Opcode opcode) { code.push_back(static_cast<uint8_t>(opcode)); }
+    void push(int32_t v) { op(Opcode::PUSH), u32(v); }
+    void pushFloat(float f)
+    {
+        uint32_t raw;
+        std::memcpy(&raw, &f, 4);
+        op(Opcode::FPUSH), u32(raw);
+    }
+    void pushLong(int64_t v)
+    {
+        uint64_t raw = static_cast<uint64_t>(v);
+        op(Opcode::LPUSH), u32(static_cast<uint32_t>(raw)), u32(static_cast<uint32_t>(raw >> 32));
+    }
+    void pushDouble(double d)
+    {
+        uint64_t raw;
+        std::memcpy(&raw, &d, 8);
+        op(Opcode::DPUSH), u32(static_cast<uint32_t>(raw)), u32(static_cast<uint32_t>(raw >> 32));
+    }
+    void load(uint32_t idx) { op(Opcode::LOAD), u32(idx); }
+    void store(uint32_t idx) { op(Opcode::STORE), u32(idx); }
+    void loadArg(uint8_t idx) { op(Opcode::LOAD_ARG), u8(idx); }
+    void ldc(uint16_t idx) { op(Opcode::LDC), u16(idx); }
+    void syscall(uint8_t number) { op(Opcode::SYS_CALL), u8(number); }
+    void exit() { syscall(SYS_EXIT); }
+
+    void label(const std::string &name)
+    {
+        if (!labels.emplace(name, static_cast<uint32_t>(code.size())).second)
+            throw std::runtime_error("Label defined twice: " + name);
+    }
+    uint32_t at(const std::string &name) const
+    {
+        auto it = labels.find(name);
+        if (it == labels.end())
+            throw std::runtime_error("Undefined label: " + name);
+        return it->second;
+    }
+
+    // JMP, JZ and JNZ, with their 16-bit target
+    void jump(Opcode opcode, const std::string &target)
+    {
+        op(opcode);
+        fixups.push_back({code.size(), target, 2});
+        u16(0);
+    }
+    // A 32-bit absolute target, as CALL, SPAWN and the switches use
+    void target(const std::string &name)
+    {
+        fixups.push_back({code.size(), name, 4});
+        u32(0);
+    }
+    void call(const std::string &method, uint8_t argCount) { op(Opcode::CALL), target(method), u8(argCount); }
+    void spawn(const std::string &method, uint8_t argCount) { op(Opcode::SPAWN), target(method), u8(argCount); }
+
+    // Fills in every target; fails on a label that was never defined
+    const std::vector<uint8_t> &finish()
+    {
+        for (const Fixup &fixup : fixups)
+        {
+            uint32_t value = at(fixup.label);
+            if (fixup.width == 2 && value > 0xFFFF)
+                throw std::runtime_error("Jump target out of range: " + fixup.label);
+            for (int i = 0; i < fixup.width; i++)
+                code[fixup.at + i] = (value >> (8 * i)) & 0xFF;
+        }
+        fixups.clear();
+        return code;
+    }
+
+private:
+    struct Fixup
+    {
+        size_t at;
+        std::string label;
+        int width;
+    };
+    std::map<std::string, uint32_t> labels;
+    std::vector<Fixup> fixups;
+};
+
+struct ClassDef
+{
+    std::string name;
+    int32_t superClass; // index, -1 for none
+    std::vector<std::pair<std::string, uint8_t>> fields;
+    std::vector<std::pair<std::string, std::string>> methods; // name, label
+};
+
+// A version 1 binary of the emitted code, starting at the entry label, with
+// globals zeroed locals. The constant pool is empty, or typed and holding
+// strings, so that LDC i pushes strings[i] as a CHAR array.
+inline std::vector<uint8_t> binary(Emitter &e, const std::string &entry, uint32_t globals,
+                                   const std::vector<ClassDef> &classes = {},
+                                   const std::vector<std::string> &strings = {})
+{
+    const std::vector<uint8_t> &code = e.finish();
+    Emitter metadata;
+    if (!classes.empty())
+    {
+        metadata.u32(classes.size());
+        for (const ClassDef &cls : classes)
+        {
+            metadata.u8(cls.name.size());
+            metadata.code.insert(metadata.code.end(), cls.name.begin(), cls.name.end());
+            metadata.u32(static_cast<uint32_t>(cls.superClass));
+            metadata.u32(cls.fields.size());
+            for (const auto &field : cls.fields)
+            {
+                metadata.u8(field.first.size());
+                metadata.code.insert(metadata.code.end(), field.first.begin(), field.first.end());
+                metadata.u8(field.second);
+            }
+            metadata.u32(cls.methods.size());
+            for (const auto &method : cls.methods)
+            {
+                metadata.u8(method.first.size());
+                metadata.code.insert(metadata.code.end(), method.first.begin(), method.first.end());
+                metadata.u32(e.at(method.second));
+            }
+        }
+    }
+
+    Emitter pool;
+    for (const std::string &str : strings)
+    {
+        pool.u8(static_cast<uint8_t>(ConstantTag::STRING));
+        pool.u32(str.size());
+        pool.code.insert(pool.code.end(), str.begin(), str.end());
+    }
+
+    const uint32_t headerSize = 44;
+    const uint32_t codeOffset = headerSize + pool.code.size();
+    const uint32_t globalsOffset = codeOffset + code.size();
+    const uint32_t classesOffset = globalsOffset + globals * 4;
+    Emitter file;
+    file.code = {0x56, 0x4D, 0x00, 0x01};
+    file.u32(FORMAT_VERSION | (strings.empty() ? 0u : static_cast<uint32_t>(FORMAT_TYPED_CONSTANTS) << 16));
+    file.u32(e.at(entry));
+    file.u32(headerSize), file.u32(pool.code.size());
+    file.u32(codeOffset), file.u32(code.size());
+    file.u32(globalsOffset), file.u32(globals * 4);
+    file.u32(classesOffset), file.u32(metadata.code.size());
+    file.code.insert(file.code.end(), pool.code.begin(), pool.code.end());
+    file.code.insert(file.code.end(), code.begin(), code.end());
+    file.code.resize(file.code.size() + globals * 4, 0);
+    file.code.insert(file.code.end(), metadata.code.begin(), metadata.code.end());
+    return file.code;
+}
+
+inline void writeFile(const std::string &path, const std::vector<uint8_t> &bytes)
+{
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+}
+
+#endif // VM_TESTS_PROGRAM_BUILDER_HPP
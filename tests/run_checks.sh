@@ -0,0 +1,126 @@
+#!/bin/bash
+# Builds the test generators, writes their programs and checks how the VM
+# runs them. Usage: tests/run_checks.sh <build dir with vm and libvm.a>
+
+BUILD=$(realpath "${1:-build}")
+VM="$BUILD/vm"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$(dirname "$0")"
+TESTS=$(pwd)
+failures=0
+
+fail()
+{
+    echo "FAIL: $*"
+    failures=$((failures + 1))
+}
+
+# generate <generator.cpp>: builds it and runs it in the work directory
+generate()
+{
+    g++ -std=c++17 -O2 -I"$TESTS/../src/include" "$TESTS/$1" -o "$WORK/generator" || { fail "$1 does not build"; return; }
+    (cd "$WORK" && ./generator) || fail "$1 did not run"
+}
+
+# expect_host <program.cpp>: builds a program against libvm and expects it
+# to succeed
+expect_host()
+{
+    g++ -std=c++17 -O2 -I"$TESTS/../src/include" "$TESTS/$1" "$BUILD/libvm.a" -lpthread -o "$WORK/host" || { fail "$1 does not build"; return; }
+    (cd "$WORK" && ./host >/dev/null 2>"$WORK/stderr") || fail "$1 failed: $(head -c 300 "$WORK/stderr")"
+}
+
+# expect_exit <status> <vm arguments...>
+expect_exit()
+{
+    local want=$1
+    shift
+    (cd "$WORK" && "$VM" "$@" >/dev/null 2>"$WORK/stderr")
+    local got=$?
+    [ "$got" == "$want" ] || fail "vm $* exited with $got, expected $want: $(head -c 300 "$WORK/stderr")"
+}
+
+# expect_error <message part> <vm arguments...>
+expect_error()
+{
+    local want=$1
+    shift
+    (cd "$WORK" && "$VM" "$@" >/dev/null 2>"$WORK/stderr")
+    local got=$?
+    [ "$got" != 0 ] && grep -qF -- "$want" "$WORK/stderr" || fail "vm $* exited with $got, expected an error with \"$want\": $(head -c 300 "$WORK/stderr")"
+}
+
+generate test_arena_check_generator.cpp
+expect_exit 99 arena_local_escape.vm
+expect_error "escapes its arena through local 0" --arena-check arena_local_escape.vm
+expect_error "escapes its arena through object" --arena-check arena_field_escape.vm
+expect_exit 99 arena_stale_use.vm
+expect_error "GETFIELD error: Invalid object reference" --arena-check arena_stale_use.vm
+expect_exit 42 arena_clean.vm
+expect_exit 42 --arena-check arena_clean.vm
+
+generate test_verify_generator.cpp
+expect_error "Code does not decode at offset 3" verify_skip_byte.vm
+expect_error "is not the start of an instruction" verify_operand_jump.vm
+expect_error "RET error: Return address" verify_forged_return.vm
+
+generate test_buffer_generator.cpp
+expect_error "SYS_READ error: Size 1000000 out of bounds for a buffer of 4 bytes" buffer_read_overflow.vm
+expect_error "SYS_WRITE error: Size 9 out of bounds for a buffer of 8 bytes" buffer_write_overflow.vm
+expect_error "SYS_WRITE error: Size -1 out of bounds" buffer_write_negative.vm
+expect_exit 42 buffer_write_fit.vm
+
+generate test_array_compare_generator.cpp
+expect_exit 42 arraycmp_nan.vm
+
+generate test_snapshot_generator.cpp
+expect_exit 0 --snapshot snapshot_loop.vms snapshot_loop.vm
+expect_exit 42 snapshot_loop.vms
+expect_exit 0 --snapshot snapshot_oob.vms snapshot_oob.vm
+expect_error "ALOAD error: Index 100000000 out of bounds" snapshot_oob.vms
+# Turns the ALOAD into an unchecked one where the loader would not write it
+offset=$(od -An -tu4 -j12 -N4 "$WORK/snapshot_oob.vms" | tr -d ' ')
+printf '\xf0' | dd of="$WORK/snapshot_oob.vms" bs=1 seek=$((offset + $(cat "$WORK/snapshot_oob.pc"))) conv=notrunc 2>/dev/null
+expect_error "differs from what the loader writes" snapshot_oob.vms
+
+generate test_gc_pause_generator.cpp
+# Fewer than 1 in 100 slices may take 4 times the 500 us target or longer
+(cd "$WORK" && "$VM" --gc-stats --gc-pause-us 500 gc_pause_stack.vm >/dev/null 2>"$WORK/stderr")
+status=$?
+long=$(awk '$1 == "pause" && ($2 == ">=" || $3 > 2048) { n += $5 } END { print n + 0 }' "$WORK/stderr")
+slices=$(awk '/^GC stats/ { print $5 }' "$WORK/stderr")
+[ "$status" == 42 ] && [ -n "$slices" ] && [ $((long * 100)) -lt "$slices" ] ||
+    fail "gc_pause_stack.vm exited with $status, $long of ${slices:-0} slices took 2048 us or more: $(head -c 300 "$WORK/stderr")"
+
+generate test_compact_generator.cpp
+expect_exit 42 compact_mix.vm
+if "$BUILD/vmcompact" "$WORK/compact_mix.vm" "$WORK/compact_mix_v2.vm" >/dev/null 2>"$WORK/stderr"; then
+    expect_exit 42 compact_mix_v2.vm
+    (cd "$WORK" && "$VM" compact_mix.vm >orig.out 2>&1; "$VM" compact_mix_v2.vm >compact.out 2>&1)
+    cmp -s "$WORK/orig.out" "$WORK/compact.out" || fail "compact_mix.vm and its compact form print different output"
+else
+    fail "vmcompact compact_mix.vm failed: $(head -c 300 "$WORK/stderr")"
+fi
+
+generate test_checkpoint_generator.cpp
+expect_exit 42 --gc-trigger-kb 1 checkpoint_roundtrip.vm
+expect_exit 43 --gc-trigger-kb 1 --resume checkpoint_roundtrip.ckpt checkpoint_roundtrip.vm
+
+generate test_tasks_generator.cpp
+expect_exit 42 tasks_channel.vm
+expect_exit 42 tasks_join.vm
+expect_error "Task error: Deadlock, every task is blocked." tasks_deadlock.vm
+expect_exit 42 --gc-trigger-kb 1 tasks_gc.vm
+
+expect_host test_fault_chain.cpp
+expect_host test_math_accuracy.cpp
+expect_host test_class_resolution.cpp
+expect_host test_embed_invoke.cpp
+expect_host test_field_layout.cpp
+
+if [ "$failures" != 0 ]; then
+    echo "$failures checks failed"
+    exit 1
+fi
+echo "All checks passed"
@@ -0,0 +1,130 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes programs for ARENA_BEGIN / ARENA_END under --arena-check:
+ *   arena_local_escape.vm  - keeps an arena object in local 0 past ARENA_END.
+ *                            Fails "through local 0" with the check; without
+ *                            it the stale reference names the next Node and
+ *                            the program exits with 99.
+ *   arena_field_escape.vm  - stores an arena object in a field of a heap
+ *                            object. Fails "through object" with the check.
+ *   arena_stale_use.vm     - hides an arena reference from the check as an
+ *                            offset integer and uses it after ARENA_END. Fails
+ *                            "Invalid object reference" with the check, exits
+ *                            with 99 without it.
+ *   arena_clean.vm         - builds and sums a list in an arena inside a
+ *                            called method. Exits with 42 either way.
+ * run_checks.sh runs them.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_arena_check_generator.cpp
+ */
+#include "program_builder.hpp"
+
+static const std::vector<ClassDef> classes = {
+    {"Node", -1, {{"value", T_INT}, {"next", T_OBJECT}}, {}},
+};
+enum : uint8_t
+{
+    NODE = 0,
+    VALUE = 0,
+    NEXT = 1,
+};
+
+// NEW Node with its value set; leaves the reference on the stack
+static void newNode(Emitter &e, int32_t value)
+{
+    e.op(Opcode::NEW), e.u8(NODE);
+    e.op(Opcode::DUP), e.push(value), e.op(Opcode::PUTFIELD), e.u8(VALUE);
+}
+
+// Locals and stacks are untyped, so the check reports any word that equals
+// a reference of the arena. This takes reference 0 outside of any arena, so
+// that zeroed locals do not look like arena objects.
+static void takeReferenceZero(Emitter &e)
+{
+    e.op(Opcode::NEW), e.u8(NODE), e.store(3);
+}
+
+// Drops the arena, then allocates a Node with value 99 that reuses a slot of
+// the arena when nothing retires it, and reads the value of the reference in
+// local 0
+static void reuseAndRead(Emitter &e)
+{
+    e.op(Opcode::ARENA_END);
+    newNode(e, 99), e.op(Opcode::POP);
+    e.load(0), e.op(Opcode::GETFIELD), e.u8(VALUE);
+    e.exit();
+}
+
+int main()
+{
+    {
+        Emitter e;
+        e.label("main");
+        takeReferenceZero(e);
+        e.op(Opcode::ARENA_BEGIN);
+        newNode(e, 7), e.store(0);
+        reuseAndRead(e);
+        writeFile("arena_local_escape.vm", binary(e, "main", 4, classes));
+    }
+    {
+        Emitter e;
+        e.label("main");
+        newNode(e, 1), e.store(1);
+        e.op(Opcode::ARENA_BEGIN);
+        e.load(1);
+        newNode(e, 7);
+        e.op(Opcode::PUTFIELD), e.u8(NEXT);
+        e.op(Opcode::ARENA_END);
+        e.push(0), e.exit();
+        writeFile("arena_field_escape.vm", binary(e, "main", 4, classes));
+    }
+    {
+        Emitter e;
+        e.label("main");
+        takeReferenceZero(e);
+        e.op(Opcode::ARENA_BEGIN);
+        newNode(e, 7), e.push(1000000), e.op(Opcode::IADD), e.store(0);
+        e.op(Opcode::ARENA_END);
+        e.load(0), e.push(1000000), e.op(Opcode::ISUB), e.store(0);
+        e.op(Opcode::ARENA_BEGIN); // reuseAndRead ends it again
+        reuseAndRead(e);
+        writeFile("arena_stale_use.vm", binary(e, "main", 4, classes));
+    }
+    {
+        // sum: a list of local 2 Nodes valued 1..n built in an arena, summed
+        // and dropped before returning; the caller's frame and the first
+        // sum sit on the stack
+        Emitter e;
+        e.label("main");
+        takeReferenceZero(e);
+        e.push(5), e.store(2), e.call("sum", 0);
+        e.push(6), e.store(2), e.call("sum", 0);
+        e.op(Opcode::IADD), e.push(6), e.op(Opcode::IADD), e.exit();
+
+        e.label("sum");
+        e.op(Opcode::ARENA_BEGIN);
+        e.push(-1), e.store(1); // list head, -1 for none
+        e.label("build");
+        e.load(2), e.jump(Opcode::JZ, "walk");
+        newNode(e, 0);
+        e.op(Opcode::DUP), e.load(2), e.op(Opcode::PUTFIELD), e.u8(VALUE);
+        e.op(Opcode::DUP), e.load(1), e.op(Opcode::PUTFIELD), e.u8(NEXT);
+        e.store(1);
+        e.load(2), e.push(1), e.op(Opcode::ISUB), e.store(2);
+        e.jump(Opcode::JMP, "build");
+        e.label("walk");
+        e.push(0); // running sum, kept on the stack across the walk
+        e.label("next");
+        e.load(1), e.push(-1), e.op(Opcode::ICMP_EQ), e.jump(Opcode::JNZ, "done");
+        e.load(1), e.op(Opcode::GETFIELD), e.u8(VALUE), e.op(Opcode::IADD);
+        e.load(1), e.op(Opcode::GETFIELD), e.u8(NEXT), e.store(1);
+        e.jump(Opcode::JMP, "next");
+        e.label("done");
+        e.push(-1), e.store(2); // locals 1 and 2 no longer name arena objects
+        e.op(Opcode::ARENA_END);
+        e.op(Opcode::RET);
+        writeFile("arena_clean.vm", binary(e, "main", 4, classes));
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes arraycmp_nan.vm, which compares FLOAT arrays holding NaN both ways
+ * round with ARRAYCMP and exits 42 when the order is the one ASORT uses:
+ * [NaN] after [1.0], [NaN] equal to [NaN], and [-0.0] equal to [0.0].
+ *
+ * Build: g++ -std=c++17 -I../src/include test_array_compare_generator.cpp
+ */
+#include "program_builder.hpp"
+#include <cmath>
+
+// Pushes a new one-element FLOAT array holding value
+static void floatArray(Emitter &e, float value)
+{
+    e.push(1), e.op(Opcode::NEWARRAY), e.u8(T_FLOAT), e.op(Opcode::DUP);
+    e.push(0), e.pushFloat(value), e.op(Opcode::ASTORE);
+}
+
+// Fails the program unless ARRAYCMP of [a] and [b] gives expected
+static void expectCompare(Emitter &e, float a, float b, int32_t expected)
+{
+    floatArray(e, a), e.push(0), floatArray(e, b), e.push(0), e.push(1), e.op(Opcode::ARRAYCMP);
+    e.push(expected), e.op(Opcode::ICMP_EQ), e.jump(Opcode::JZ, "wrong");
+}
+
+int main()
+{
+    Emitter e;
+    e.label("main");
+    expectCompare(e, NAN, 1.0f, 1);
+    expectCompare(e, 1.0f, NAN, -1);
+    expectCompare(e, NAN, NAN, 0);
+    expectCompare(e, -0.0f, 0.0f, 0);
+    expectCompare(e, 1.0f, 2.0f, -1);
+    e.push(42), e.exit();
+    e.label("wrong");
+    e.push(1), e.exit();
+    writeFile("arraycmp_nan.vm", binary(e, "main", 0));
+    return 0;
+}
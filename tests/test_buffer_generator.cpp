@@ -0,0 +1,44 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes programs that pass SYS_READ and SYS_WRITE sizes that do not fit
+ * their buffer, each of which must fail instead of reaching past it:
+ *   buffer_read_overflow.vm  - reads 1000000 bytes into a 4-byte CHAR array
+ *   buffer_write_overflow.vm - writes 9 bytes from a 2-element INT array
+ *   buffer_write_negative.vm - writes -1 bytes
+ * and buffer_write_fit.vm, which writes all 8 bytes of that INT array and
+ * exits 42.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_buffer_generator.cpp
+ */
+#include "program_builder.hpp"
+
+static const int32_t STDIN = 0;
+static const int32_t STDOUT = 1;
+
+// SYS_WRITE of size bytes from a new 2-element INT array to stdout
+static std::vector<uint8_t> write(int32_t size)
+{
+    Emitter e;
+    e.label("main");
+    e.push(2), e.op(Opcode::NEWARRAY), e.u8(T_INT);
+    e.push(size), e.push(STDOUT), e.syscall(SYS_WRITE), e.op(Opcode::POP);
+    e.push(42), e.exit();
+    return binary(e, "main", 0);
+}
+
+int main()
+{
+    {
+        Emitter e;
+        e.label("main");
+        e.push(4), e.op(Opcode::NEWARRAY), e.u8(T_CHAR), e.store(0);
+        e.push(0), e.push(1000000), e.push(STDIN), e.syscall(SYS_READ), e.op(Opcode::POP);
+        e.push(42), e.exit();
+        writeFile("buffer_read_overflow.vm", binary(e, "main", 1));
+    }
+    writeFile("buffer_write_overflow.vm", write(9));
+    writeFile("buffer_write_negative.vm", write(-1));
+    writeFile("buffer_write_fit.vm", write(8));
+    return 0;
+}
@@ -0,0 +1,168 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes checkpoint_roundtrip.vm, which builds a linked list of objects, an
+ * INT_INT map, a STRING_REF map, a string with a cached hash, an interned
+ * string, a channel holding values and a file read up to its second line.
+ * It allocates garbage so that collections leave a free list, takes a
+ * checkpoint with SYS_CHECKPOINT, allocates garbage again, which reuses the
+ * free references, and then checks everything it built. A failed check
+ * exits with its number; otherwise the program exits with 42, or 43 when it
+ * was resumed from the checkpoint. run_checks.sh runs it with
+ * --gc-trigger-kb 1 and then resumes it.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_checkpoint_generator.cpp
+ */
+#include "program_builder.hpp"
+
+static const std::vector<std::string> STRINGS = {
+    "checkpoint_data.txt", "checkpoint_roundtrip.ckpt", "line1\nline2\nline3\n", "line2",
+    "hello world", "ab", "cd", "abcd", "list",
+};
+
+enum : uint16_t
+{
+    DATA_PATH,
+    CHECKPOINT_PATH,
+    LINES,
+    SECOND_LINE,
+    HELLO,
+    AB,
+    CD,
+    ABCD,
+    LIST_KEY,
+};
+
+enum : uint32_t
+{
+    RESUMED = 0,
+    LIST = 1,
+    INTS = 2,
+    NAMES = 3,
+    TEXT = 4,
+    TEXT_HASH = 5,
+    WORD = 6,
+    CHANNEL = 7,
+    FILE_HANDLE = 8,
+    I = 9,
+    NODE = 10,
+    SUM = 11,
+};
+
+enum : uint8_t
+{
+    VALUE = 0,
+    NEXT = 1,
+};
+
+// Pushes a new string holding constant idx
+static void string(Emitter &e, uint16_t idx)
+{
+    e.ldc(idx), e.push(0), e.push(STRINGS[idx].size()), e.op(Opcode::NEWSTRING);
+}
+
+// Exits with number unless the value on the stack is non-zero
+static void check(Emitter &e, int number)
+{
+    std::string passed = "check_" + std::to_string(number);
+    e.jump(Opcode::JNZ, passed);
+    e.push(number), e.exit();
+    e.label(passed);
+}
+
+static void garbage(Emitter &e, const std::string &name)
+{
+    e.push(0), e.store(I);
+    e.label(name);
+    e.op(Opcode::NEW), e.u8(0), e.op(Opcode::POP);
+    e.load(I), e.push(1), e.op(Opcode::IADD), e.store(I);
+    e.load(I), e.push(3000), e.op(Opcode::ICMP_LT), e.jump(Opcode::JNZ, name);
+}
+
+int main()
+{
+    Emitter e;
+    e.label("main");
+
+    // A file open for reading, positioned after its first line
+    e.ldc(DATA_PATH), e.push('w'), e.syscall(SYS_OPEN), e.store(FILE_HANDLE);
+    string(e, LINES), e.load(FILE_HANDLE), e.syscall(SYS_WRITESTR), e.op(Opcode::POP);
+    e.load(FILE_HANDLE), e.syscall(SYS_CLOSE);
+    e.ldc(DATA_PATH), e.push('r'), e.syscall(SYS_OPEN), e.store(FILE_HANDLE);
+    e.load(FILE_HANDLE), e.syscall(SYS_READLINE), e.op(Opcode::POP);
+
+    // The list 1 -> 2 -> 3
+    for (int value = 3; value >= 1; value--)
+    {
+        e.op(Opcode::NEW), e.u8(0);
+        e.op(Opcode::DUP), e.push(value), e.op(Opcode::PUTFIELD), e.u8(VALUE);
+        e.op(Opcode::DUP), e.load(LIST), e.op(Opcode::PUTFIELD), e.u8(NEXT);
+        e.store(LIST);
+    }
+
+    // i -> i * i for i < 100
+    e.op(Opcode::MAPNEW), e.u8(1), e.store(INTS);
+    e.push(0), e.store(I);
+    e.label("fill");
+    e.load(INTS), e.load(I), e.load(I), e.load(I), e.op(Opcode::IMUL), e.op(Opcode::MAPPUT);
+    e.load(I), e.push(1), e.op(Opcode::IADD), e.store(I);
+    e.load(I), e.push(100), e.op(Opcode::ICMP_LT), e.jump(Opcode::JNZ, "fill");
+
+    e.op(Opcode::MAPNEW), e.u8(3), e.store(NAMES);
+    e.load(NAMES), e.ldc(LIST_KEY), e.load(LIST), e.op(Opcode::MAPPUT);
+
+    string(e, HELLO), e.store(TEXT);
+    e.load(TEXT), e.op(Opcode::HASH), e.store(TEXT_HASH);
+    string(e, AB), string(e, CD), e.op(Opcode::CONCAT), e.op(Opcode::INTERN), e.store(WORD);
+
+    // Holds 22 and 33, with its head past the first slot
+    e.push(4), e.op(Opcode::CHANNEW), e.u8(T_INT), e.store(CHANNEL);
+    for (int value : {11, 22, 33})
+        e.load(CHANNEL), e.push(value), e.op(Opcode::SEND);
+    e.load(CHANNEL), e.op(Opcode::RECV), e.op(Opcode::POP);
+
+    garbage(e, "before");
+    e.ldc(CHECKPOINT_PATH), e.syscall(SYS_CHECKPOINT), e.store(RESUMED);
+    garbage(e, "after");
+
+    // 1: the list, in order
+    e.push(0), e.store(SUM), e.load(LIST), e.store(NODE);
+    for (int k = 0; k < 3; k++)
+    {
+        e.load(SUM), e.push(10), e.op(Opcode::IMUL), e.load(NODE), e.op(Opcode::GETFIELD), e.u8(VALUE);
+        e.op(Opcode::IADD), e.store(SUM);
+        e.load(NODE), e.op(Opcode::GETFIELD), e.u8(NEXT), e.store(NODE);
+    }
+    e.load(SUM), e.push(123), e.op(Opcode::ICMP_EQ), check(e, 1);
+
+    // 2: every entry of the INT_INT map
+    e.push(0), e.store(SUM), e.push(0), e.store(I);
+    e.label("sum");
+    e.load(SUM), e.load(INTS), e.load(I), e.push(-1), e.op(Opcode::MAPGET), e.op(Opcode::IADD), e.store(SUM);
+    e.load(I), e.push(1), e.op(Opcode::IADD), e.store(I);
+    e.load(I), e.push(100), e.op(Opcode::ICMP_LT), e.jump(Opcode::JNZ, "sum");
+    e.load(SUM), e.push(328350), e.op(Opcode::ICMP_EQ), check(e, 2);
+
+    // 3: the STRING_REF map, looked up by content
+    e.load(NAMES), e.ldc(LIST_KEY), e.push(0), e.op(Opcode::MAPGET), e.load(LIST), e.op(Opcode::ICMP_EQ), check(e, 3);
+
+    // 4: the cached hash, which EQUALS compares before the bytes
+    e.load(TEXT), e.op(Opcode::HASH), e.load(TEXT_HASH), e.op(Opcode::ICMP_EQ), check(e, 4);
+    e.load(TEXT), string(e, HELLO), e.op(Opcode::EQUALS), check(e, 5);
+
+    // 6: the intern table
+    string(e, ABCD), e.op(Opcode::INTERN), e.load(WORD), e.op(Opcode::ICMP_EQ), check(e, 6);
+
+    // 7, 8: the channel
+    e.load(CHANNEL), e.op(Opcode::RECV), e.push(22), e.op(Opcode::ICMP_EQ), check(e, 7);
+    e.load(CHANNEL), e.op(Opcode::RECV), e.push(33), e.op(Opcode::ICMP_EQ), check(e, 8);
+
+    // 9: the file position
+    e.load(FILE_HANDLE), e.syscall(SYS_READLINE), string(e, SECOND_LINE), e.op(Opcode::EQUALS), check(e, 9);
+
+    e.push(42), e.load(RESUMED), e.op(Opcode::IADD), e.exit();
+
+    std::vector<ClassDef> classes = {{"Node", -1, {{"value", T_INT}, {"next", T_OBJECT}}, {}}};
+    writeFile("checkpoint_roundtrip.vm", binary(e, "main", 12, classes, STRINGS));
+    return 0;
+}
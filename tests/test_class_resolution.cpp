@@ -0,0 +1,73 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Resolves classes from several threads at once. The program has a chain of
+ * 200 classes, each adding one INT field to its superclass, and one method
+ * that creates an object of every class and sets and reads back its newest
+ * field. Each round loads a fresh Program, so the 4 batch threads race to
+ * resolve every class, and checks all results. Build it with
+ * -fsanitize=thread (and libvm built the same way) to check the class table
+ * for data races.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_class_resolution.cpp <build>/libvm.a -lpthread
+ */
+#include "program_builder.hpp"
+#include <batch.hpp>
+#include <iostream>
+
+static const int CLASSES = 200;
+static const int ROUNDS = 20;
+static const int INPUTS = 64;
+static const unsigned THREADS = 4;
+
+int main()
+{
+    // all(n) returns n + 0 + 1 + ... + 199
+    Emitter e;
+    e.label("main");
+    e.push(0), e.op(Opcode::RET);
+    e.label("all");
+    e.push(0);
+    for (int i = 0; i < CLASSES; i++)
+    {
+        e.op(Opcode::NEW), e.u8(i), e.op(Opcode::DUP), e.push(i), e.op(Opcode::PUTFIELD), e.u8(i);
+        e.op(Opcode::GETFIELD), e.u8(i), e.op(Opcode::IADD);
+    }
+    e.loadArg(0), e.op(Opcode::IADD), e.op(Opcode::RET);
+
+    std::vector<ClassDef> classes;
+    for (int i = 0; i < CLASSES; i++)
+    {
+        ClassDef c{"C" + std::to_string(i), i - 1, {{"f", T_INT}}, {}};
+        if (i == 0)
+            c.methods.push_back({"all", "all"});
+        classes.push_back(c);
+    }
+    std::vector<uint8_t> binaryFile = binary(e, "main", 0, classes);
+
+    std::vector<std::vector<VMValue>> inputs;
+    for (int i = 0; i < INPUTS; i++)
+        inputs.push_back({VMValue::ofInt(i)});
+    int32_t sum = CLASSES * (CLASSES - 1) / 2;
+
+    int wrong = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        auto program = std::make_shared<const Program>(binaryFile);
+        // Found on C0, which resolves only C0: the batch threads resolve
+        // the other classes as NEW first meets them
+        MethodHandle all = program->findMethod("C0", "all");
+        std::vector<BatchResult> results = runBatch(program, all, inputs, FieldType::INT, THREADS);
+        for (int i = 0; i < INPUTS; i++)
+        {
+            if (!results[i].error.empty() || results[i].value.intValue != sum + i)
+            {
+                if (wrong++ == 0)
+                    std::cerr << "round " << round << ", input " << i << ": got " << results[i].value.intValue
+                              << " " << results[i].error << std::endl;
+            }
+        }
+    }
+    std::cout << (wrong == 0 ? "class resolution ok" : "class resolution broken") << std::endl;
+    return wrong == 0 ? 0 : 1;
+}
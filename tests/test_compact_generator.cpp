@@ -0,0 +1,149 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes compact_mix.vm, a version 1 program for checking vmcompact. It
+ * mixes JMP/JZ, TABLESWITCH, LOOKUPSWITCH, CALL to near and far targets
+ * (the far one past the reach of a 2-byte varint) and INVOKEVIRTUAL with an
+ * override, plus locals and constants of every encoding size. It folds all
+ * their results into a checksum and exits with 42 when that matches the one
+ * computed here, 1 otherwise. run_checks.sh converts it with vmcompact and
+ * expects both binaries to behave alike.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_compact_generator.cpp
+ */
+#include "program_builder.hpp"
+
+static const int32_t ROUNDS = 40;
+static const int32_t TABLE[] = {3, 5, 7, 11, 13}; // TABLESWITCH cases 1 .. 5, default 1
+static const int32_t KEYS[] = {-5, 3, 17, 33, 1000};
+static const int32_t VALUES[] = {100, 200, 300, 400, 500}; // LOOKUPSWITCH, default 7
+
+enum : uint32_t
+{
+    ACC = 0,
+    I = 1,
+    TMP = 2,
+    SHAPE = 3,
+    KEY = 4,
+    SQUARE = 200, // beyond the one-byte local forms
+};
+
+static uint32_t expected()
+{
+    uint32_t acc = 0;
+    auto fold = [&acc](uint32_t v)
+    { acc = acc * 31 + v; };
+    for (int32_t i = 0; i < ROUNDS; i++)
+    {
+        int32_t t = i % 8;
+        fold(t >= 1 && t <= 5 ? TABLE[t - 1] : 1);
+        int32_t looked = 7;
+        for (int k = 0; k < 5; k++)
+            if (KEYS[k] == i - 5)
+                looked = VALUES[k];
+        fold(looked);
+        fold(2 * i + 1);              // far(i)
+        fold(i + 1);                  // near(i)
+        fold(i % 2 ? i * i : i);      // area(i) of a Square or a Shape
+        fold(static_cast<uint32_t>(-70000 + 130 * i));
+    }
+    return acc;
+}
+
+// acc = acc * 31 + the value on the stack
+static void fold(Emitter &e)
+{
+    e.store(TMP);
+    e.load(ACC), e.push(31), e.op(Opcode::IMUL), e.load(TMP), e.op(Opcode::IADD), e.store(ACC);
+}
+
+int main()
+{
+    Emitter e;
+    e.jump(Opcode::JMP, "main");
+
+    e.label("near");
+    e.loadArg(0), e.push(1), e.op(Opcode::IADD), e.op(Opcode::RET);
+    e.label("shape_area");
+    e.loadArg(0), e.op(Opcode::RET);
+    e.label("square_area");
+    e.loadArg(0), e.op(Opcode::DUP), e.op(Opcode::IMUL), e.op(Opcode::RET);
+
+    e.label("main");
+    e.op(Opcode::NEW), e.u8(0), e.store(SHAPE);
+    e.op(Opcode::NEW), e.u8(1), e.store(SQUARE);
+    e.push(0), e.store(ACC);
+    e.push(0), e.store(I);
+
+    e.label("loop");
+    e.load(I), e.push(ROUNDS), e.op(Opcode::ICMP_LT), e.jump(Opcode::JZ, "end");
+
+    e.load(I), e.push(8), e.op(Opcode::IMOD);
+    e.op(Opcode::TABLESWITCH), e.target("t_default"), e.u32(1), e.u32(5);
+    for (int k = 0; k < 5; k++)
+        e.target("t_" + std::to_string(k));
+    for (int k = 0; k < 5; k++)
+    {
+        e.label("t_" + std::to_string(k));
+        e.push(TABLE[k]), e.jump(Opcode::JMP, "t_done");
+    }
+    e.label("t_default");
+    e.push(1);
+    e.label("t_done");
+    fold(e);
+
+    e.load(I), e.push(5), e.op(Opcode::ISUB), e.store(KEY), e.load(KEY);
+    e.op(Opcode::LOOKUPSWITCH), e.target("l_default"), e.u32(5);
+    for (int k = 0; k < 5; k++)
+        e.u32(static_cast<uint32_t>(KEYS[k])), e.target("l_" + std::to_string(k));
+    for (int k = 0; k < 5; k++)
+    {
+        e.label("l_" + std::to_string(k));
+        e.push(VALUES[k]), e.jump(Opcode::JMP, "l_done");
+    }
+    e.label("l_default");
+    e.push(7);
+    e.label("l_done");
+    fold(e);
+
+    e.load(I), e.call("far", 1), fold(e);
+    e.load(I), e.call("near", 1), fold(e);
+
+    // Odd rounds call the Square override, even ones the Shape method
+    e.load(I);
+    e.load(I), e.push(2), e.op(Opcode::IMOD), e.jump(Opcode::JZ, "shape");
+    e.load(SQUARE), e.jump(Opcode::JMP, "invoke");
+    e.label("shape");
+    e.load(SHAPE);
+    e.label("invoke");
+    e.op(Opcode::INVOKEVIRTUAL), e.u32(0), e.u8(1);
+    fold(e);
+
+    e.push(-70000), e.load(I), e.push(130), e.op(Opcode::IMUL), e.op(Opcode::IADD), fold(e);
+
+    e.load(I), e.push(1), e.op(Opcode::IADD), e.store(I);
+    e.jump(Opcode::JMP, "loop");
+
+    e.label("end");
+    e.load(ACC), e.push(static_cast<int32_t>(expected())), e.op(Opcode::ICMP_EQ), e.jump(Opcode::JZ, "wrong");
+    e.push(42), e.exit();
+    e.label("wrong");
+    e.push(1), e.exit();
+
+    // Straight-line code that moves far past the 2-byte varint range, even
+    // after compaction
+    e.label("padding");
+    for (int k = 0; k < 6000; k++)
+        e.push(k), e.op(Opcode::POP);
+    e.op(Opcode::RET);
+
+    e.label("far");
+    e.loadArg(0), e.push(2), e.op(Opcode::IMUL), e.push(1), e.op(Opcode::IADD), e.op(Opcode::RET);
+
+    std::vector<ClassDef> classes = {
+        {"Shape", -1, {}, {{"area", "shape_area"}}},
+        {"Square", 0, {}, {{"area", "square_area"}}},
+    };
+    writeFile("compact_mix.vm", binary(e, "main", 4, classes));
+    return 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Checks that VM::invoke passes arguments and takes results the way a
+ * bytecode CALL does. Each method subtracts its second argument from its
+ * first, so swapped arguments or swapped words of a wide one show up in
+ * the result. Every method is invoked directly and through a method that
+ * CALLs it with the same arguments, and both results must be the expected
+ * one.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_embed_invoke.cpp <build>/libvm.a -lpthread
+ */
+#include "program_builder.hpp"
+#include <VM.hpp>
+#include <iostream>
+
+static const int64_t LONG_VALUE = 0x1111111122222222;
+
+int main()
+{
+    Emitter e;
+    e.label("main");
+    e.push(0), e.op(Opcode::RET);
+
+    // ints(a, b) = a - b
+    e.label("ints");
+    e.loadArg(0), e.loadArg(1), e.op(Opcode::ISUB), e.op(Opcode::RET);
+    e.label("callInts");
+    e.push(8), e.push(50), e.call("ints", 2), e.op(Opcode::RET);
+
+    // floats(a, b) = a - b
+    e.label("floats");
+    e.loadArg(0), e.loadArg(1), e.op(Opcode::FSUB), e.op(Opcode::RET);
+    e.label("callFloats");
+    e.pushFloat(0.25f), e.pushFloat(2.5f), e.call("floats", 2), e.op(Opcode::RET);
+
+    // longs(a, b) = a - b, for a LONG a and an INT b. The high word of a is
+    // LOAD_ARG 0 and its low word LOAD_ARG 1.
+    e.label("longs");
+    e.loadArg(1), e.loadArg(0), e.loadArg(2), e.op(Opcode::I2L), e.op(Opcode::LSUB), e.op(Opcode::WRET);
+    e.label("callLongs");
+    e.push(1), e.pushLong(LONG_VALUE), e.call("longs", 3), e.op(Opcode::WRET);
+
+    // doubles(a, b) = a - b, for a DOUBLE a and an INT b
+    e.label("doubles");
+    e.loadArg(1), e.loadArg(0), e.loadArg(2), e.op(Opcode::I2D), e.op(Opcode::DSUB), e.op(Opcode::WRET);
+    e.label("callDoubles");
+    e.push(1), e.pushDouble(2.5), e.call("doubles", 3), e.op(Opcode::WRET);
+
+    ClassDef calls{"Calls", -1, {}, {}};
+    for (const char *name : {"ints", "callInts", "floats", "callFloats", "longs", "callLongs", "doubles", "callDoubles"})
+        calls.methods.push_back({name, name});
+    VM vm(binary(e, "main", 0, {calls}));
+
+    int wrong = 0;
+    auto check = [&](const char *what, bool ok)
+    {
+        if (!ok)
+        {
+            std::cerr << what << " differs" << std::endl;
+            wrong++;
+        }
+    };
+    auto invoke = [&](const char *name, const std::vector<VMValue> &args, FieldType type)
+    {
+        return vm.invoke(vm.findMethod("Calls", name), args, type);
+    };
+
+    check("ints", invoke("ints", {VMValue::ofInt(50), VMValue::ofInt(8)}, FieldType::INT).intValue == 42);
+    check("callInts", invoke("callInts", {}, FieldType::INT).intValue == 42);
+    check("floats", invoke("floats", {VMValue::ofFloat(2.5f), VMValue::ofFloat(0.25f)}, FieldType::FLOAT).floatValue == 2.25f);
+    check("callFloats", invoke("callFloats", {}, FieldType::FLOAT).floatValue == 2.25f);
+    check("longs", invoke("longs", {VMValue::ofLong(LONG_VALUE), VMValue::ofInt(1)}, FieldType::LONG).longValue == LONG_VALUE - 1);
+    check("callLongs", invoke("callLongs", {}, FieldType::LONG).longValue == LONG_VALUE - 1);
+    check("doubles", invoke("doubles", {VMValue::ofDouble(2.5), VMValue::ofInt(1)}, FieldType::DOUBLE).doubleValue == 1.5);
+    check("callDoubles", invoke("callDoubles", {}, FieldType::DOUBLE).doubleValue == 1.5);
+
+    std::cout << (wrong == 0 ? "invoke ok" : "invoke broken") << std::endl;
+    return wrong == 0 ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Checks that the VM's SIGSEGV handler passes faults outside its guard pages
+ * to the handler the host installed before it, and stays installed when
+ * that handler recovers: a VM stack overflow after a recovered host fault is
+ * still reported as an error.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_fault_chain.cpp <build>/libvm.a -lpthread
+ */
+#include "program_builder.hpp"
+#include <VM.hpp>
+#include <csetjmp>
+#include <csignal>
+#include <iostream>
+#include <sys/mman.h>
+
+static sigjmp_buf hostJump;
+static int hostFaults = 0;
+
+static void hostHandler(int, siginfo_t *, void *)
+{
+    hostFaults++;
+    siglongjmp(hostJump, 1);
+}
+
+// Touches a page the host mapped without access, recovering in hostHandler
+static bool hostFaultRecovered()
+{
+    static volatile char *page = static_cast<char *>(mmap(nullptr, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    int before = hostFaults;
+    if (sigsetjmp(hostJump, 1) == 0)
+        page[0] = 1;
+    return hostFaults == before + 1;
+}
+
+static bool overflowReported(const std::vector<uint8_t> &program)
+{
+    VMOptions options;
+    options.stackBytes = 64 * 1024;
+    VM vm(program, options);
+    try
+    {
+        vm.run();
+    }
+    catch (const std::runtime_error &ex)
+    {
+        return std::string(ex.what()) == "Stack Overflow";
+    }
+    return false;
+}
+
+int main()
+{
+    struct sigaction action{};
+    action.sa_sigaction = hostHandler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, nullptr);
+
+    Emitter e;
+    e.label("main");
+    e.call("main", 0);
+    std::vector<uint8_t> recursion = binary(e, "main", 0);
+
+    bool ok = overflowReported(recursion) && hostFaultRecovered() && hostFaultRecovered() && overflowReported(recursion) && hostFaultRecovered();
+    std::cout << (ok ? "fault chain ok" : "fault chain broken") << std::endl;
+    return ok ? 0 : 1;
+}
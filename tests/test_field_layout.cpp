@@ -0,0 +1,70 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Checks that LONG and DOUBLE fields are 8-byte aligned in memory: heap
+ * blocks are 8-byte aligned and start with the 4-byte header, so every such
+ * field must sit at an offset that is 4 mod 8, through any depth of
+ * inheritance and with or without a 4-byte field to fill the gap in front
+ * of it. Fields must also not overlap and must fit the object. A method then
+ * writes and reads back a LONG field of the deepest class.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_field_layout.cpp <build>/libvm.a -lpthread
+ */
+#include "program_builder.hpp"
+#include <VM.hpp>
+#include <iostream>
+
+static const int64_t LONG_VALUE = 0x1122334455667788;
+
+int main()
+{
+    // roundTrip() = new D().x = LONG_VALUE, read back
+    Emitter e;
+    e.label("main");
+    e.push(0), e.op(Opcode::RET);
+    e.label("roundTrip");
+    e.op(Opcode::NEW), e.u8(3), e.op(Opcode::DUP), e.pushLong(LONG_VALUE), e.op(Opcode::WPUTFIELD), e.u8(4);
+    e.op(Opcode::WGETFIELD), e.u8(4), e.op(Opcode::WRET);
+
+    std::vector<ClassDef> classes = {
+        {"A", -1, {{"i", T_INT}, {"l", T_LONG}}, {{"roundTrip", "roundTrip"}}},
+        {"B", 0, {{"d", T_DOUBLE}, {"c", T_CHAR}}, {}},
+        {"C", -1, {{"c", T_CHAR}, {"d", T_DOUBLE}}, {}},
+        {"D", 1, {{"x", T_LONG}, {"f", T_FLOAT}}, {}},
+    };
+    auto program = std::make_shared<const Program>(binary(e, "main", 0, classes));
+    program->classes().resolveAllClasses();
+
+    int wrong = 0;
+    for (const ClassDef &def : classes)
+    {
+        const ClassInfo &cls = *program->classes().getClassInfo(def.name);
+        std::vector<bool> used(cls.objectSize, false);
+        for (size_t i = 0; i < cls.fieldSlots.size(); i++)
+        {
+            const FieldSlot &slot = cls.fieldSlots[i];
+            size_t size = ObjectFactory::fieldSize(slot.type);
+            bool ok = (sizeof(ObjectHeader) + slot.offset) % size == 0 && slot.offset + size <= cls.objectSize;
+            for (size_t b = slot.offset; ok && b < slot.offset + size; b++)
+            {
+                ok = !used[b];
+                used[b] = true;
+            }
+            if (!ok)
+            {
+                std::cerr << def.name << " field " << i << " at offset " << slot.offset << " of " << cls.objectSize << std::endl;
+                wrong++;
+            }
+        }
+    }
+
+    VM vm(program);
+    if (vm.invoke(vm.findMethod("A", "roundTrip"), {}, FieldType::LONG).longValue != LONG_VALUE)
+    {
+        std::cerr << "roundTrip differs" << std::endl;
+        wrong++;
+    }
+
+    std::cout << (wrong == 0 ? "field layout ok" : "field layout broken") << std::endl;
+    return wrong == 0 ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes gc_pause_stack.vm, which keeps two million live arrays on the
+ * operand stack while it allocates garbage, so that collector cycles run
+ * with a root set far larger than one slice can scan. Each array holds its
+ * index; the program pops them all, sums the indices and exits 42 when the
+ * sum is right. run_checks.sh runs it with --gc-stats and checks that
+ * slices stay near the pause target: scheduling delays can stretch a few,
+ * but a root scan that does not stop at the deadline stretches every one
+ * that meets the stack.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_gc_pause_generator.cpp
+ */
+#include "program_builder.hpp"
+
+static const int32_t COUNT = 2000000;
+
+enum : uint32_t
+{
+    I = 0,
+    SUM = 1,
+};
+
+int main()
+{
+    Emitter e;
+    e.label("main");
+    e.push(0), e.store(I);
+    e.label("fill");
+    e.load(I), e.push(COUNT), e.op(Opcode::ICMP_LT), e.jump(Opcode::JZ, "filled");
+    e.push(1), e.op(Opcode::NEWARRAY), e.u8(T_INT), e.op(Opcode::DUP), e.push(0), e.load(I), e.op(Opcode::ASTORE);
+    e.push(8), e.op(Opcode::NEWARRAY), e.u8(T_INT), e.op(Opcode::POP);
+    e.load(I), e.push(1), e.op(Opcode::IADD), e.store(I), e.jump(Opcode::JMP, "fill");
+    e.label("filled");
+
+    e.push(0), e.store(SUM);
+    e.label("drain");
+    e.load(I), e.jump(Opcode::JZ, "drained");
+    e.push(0), e.op(Opcode::ALOAD), e.load(SUM), e.op(Opcode::IADD), e.store(SUM);
+    e.load(I), e.push(1), e.op(Opcode::ISUB), e.store(I), e.jump(Opcode::JMP, "drain");
+    e.label("drained");
+
+    // The sum wraps like IADD
+    uint32_t sum = 0;
+    for (int32_t i = 0; i < COUNT; i++)
+        sum += static_cast<uint32_t>(i);
+    e.load(SUM), e.push(static_cast<int32_t>(sum)), e.op(Opcode::ICMP_EQ), e.jump(Opcode::JZ, "wrong");
+    e.push(42), e.exit();
+    e.label("wrong");
+    e.push(1), e.exit();
+    writeFile("gc_pause_stack.vm", binary(e, "main", 2));
+    return 0;
+}
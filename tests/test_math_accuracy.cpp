@@ -0,0 +1,130 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Checks the kernels behind VSQRT .. VPOW and the scalar FSQRT .. FPOW
+ * against double precision libm rounded to float, on 1M random arguments
+ * per function and on special values. sqrt must be exact, exp, log and pow
+ * within 1 ulp, sin and cos within 2 ulp; special values must match the
+ * scalar opcodes bit for bit. Prints the largest error seen per function.
+ *
+ * Build: g++ -std=c++17 -O2 -I../src/include test_math_accuracy.cpp <build>/libvm.a -lpthread
+ */
+#include <math_ops.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+static const size_t COUNT = 1 << 20;
+
+static uint32_t bitsOf(float f)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+// Distance in representable floats; both values finite
+static uint64_t ulps(float x, float y)
+{
+    auto ordered = [](float f)
+    {
+        int64_t bits = bitsOf(f);
+        return bits & 0x80000000 ? 0x80000000 - bits : bits + 0x80000000;
+    };
+    int64_t d = ordered(x) - ordered(y);
+    return static_cast<uint64_t>(d < 0 ? -d : d);
+}
+
+static float reference(MathFn fn, float a, float b)
+{
+    double x = a;
+    switch (fn)
+    {
+    case MathFn::SQRT:
+        return static_cast<float>(std::sqrt(x));
+    case MathFn::EXP:
+        return static_cast<float>(std::exp(x));
+    case MathFn::LOG:
+        return static_cast<float>(std::log(x));
+    case MathFn::SIN:
+        return static_cast<float>(std::sin(x));
+    case MathFn::COS:
+        return static_cast<float>(std::cos(x));
+    case MathFn::POW:
+        return static_cast<float>(std::pow(x, static_cast<double>(b)));
+    }
+    return 0;
+}
+
+struct Case
+{
+    const char *name;
+    MathFn fn;
+    float low, high; // range of the random arguments
+    uint64_t allowedUlps;
+};
+
+int main()
+{
+    const Case cases[] = {
+        {"sqrt", MathFn::SQRT, 0.0f, 1e30f, 0},
+        {"exp", MathFn::EXP, -87.0f, 88.0f, 1},
+        {"log", MathFn::LOG, 1e-30f, 1e30f, 1},
+        {"sin", MathFn::SIN, -65536.0f, 65536.0f, 2},
+        {"cos", MathFn::COS, -65536.0f, 65536.0f, 2},
+        {"pow", MathFn::POW, 0.0f, 100.0f, 1},
+    };
+    const float inf = std::numeric_limits<float>::infinity();
+    const float specials[] = {0.0f, -0.0f, 1.0f, -1.0f, inf, -inf, std::numeric_limits<float>::quiet_NaN(),
+                              std::numeric_limits<float>::denorm_min(), std::numeric_limits<float>::min(),
+                              std::numeric_limits<float>::max(), -104.0f, 89.0f, 1e-3f, 1e5f, -1e7f};
+
+    std::mt19937 random(39);
+    bool ok = true;
+    for (const Case &c : cases)
+    {
+        // Uniform in the exponent for wide ranges, so small arguments count
+        bool logScale = c.low > 0 && c.high / c.low > 1e6f;
+        std::uniform_real_distribution<float> linear(c.low, c.high);
+        std::uniform_real_distribution<float> exponent(std::log2(c.low), std::log2(c.high));
+        std::uniform_real_distribution<float> power(-10.0f, 10.0f);
+
+        std::vector<float> a(COUNT), b(COUNT), out(COUNT);
+        for (size_t i = 0; i < COUNT; i++)
+        {
+            a[i] = logScale ? std::exp2(exponent(random)) : linear(random);
+            b[i] = power(random);
+        }
+        for (size_t i = 0; i < sizeof(specials) / sizeof(specials[0]); i++)
+            a[i] = specials[i];
+
+        mathMap(c.fn, out.data(), a.data(), b.data(), COUNT);
+        uint64_t worst = 0, worstScalar = 0;
+        size_t mismatches = 0;
+        for (size_t i = 0; i < COUNT; i++)
+        {
+            float want = reference(c.fn, a[i], b[i]);
+            float scalar = mathScalar(c.fn, a[i], b[i]);
+            if (!std::isfinite(want) || !std::isfinite(out[i]) || std::fpclassify(want) == FP_SUBNORMAL)
+            {
+                // Special values come from libm, like the scalar opcode's
+                bool same = bitsOf(out[i]) == bitsOf(scalar) || (std::isnan(out[i]) && std::isnan(scalar));
+                mismatches += !same;
+                continue;
+            }
+            worst = std::max(worst, ulps(out[i], want));
+            if (std::isfinite(scalar))
+                worstScalar = std::max(worstScalar, ulps(scalar, want));
+        }
+        bool passed = worst <= c.allowedUlps && worstScalar <= c.allowedUlps && mismatches == 0;
+        std::printf("%-4s %s: array %llu ulp, scalar %llu ulp, %zu special mismatches (%s)\n", c.name, mathIsa(),
+                    static_cast<unsigned long long>(worst), static_cast<unsigned long long>(worstScalar), mismatches,
+                    passed ? "ok" : "FAILED");
+        ok = ok && passed;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes programs for checking snapshots of rewritten code:
+ *   snapshot_loop.vm - fills and sums a 100-element array in counted loops
+ *                      whose accesses the loader makes unchecked; exits 42
+ *                      when the sum is right
+ *   snapshot_oob.vm  - an ALOAD at index 100000000, which fails with an
+ *                      index error. Its offset in the code is written to
+ *                      snapshot_oob.pc, so that run_checks.sh can turn it
+ *                      into an unchecked access inside a snapshot, which
+ *                      loading the snapshot must refuse.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_snapshot_generator.cpp
+ */
+#include "program_builder.hpp"
+
+enum : uint32_t
+{
+    ARRAY = 0,
+    I = 1,
+    SUM = 2,
+};
+
+// for (i = 0; i < a.length; i++) body, in the shape the loader rewrites
+static void countedLoop(Emitter &e, const std::string &name, void (*body)(Emitter &))
+{
+    e.push(0), e.store(I);
+    e.label(name);
+    e.load(I), e.load(ARRAY), e.op(Opcode::ARRAYLENGTH), e.op(Opcode::ICMP_LT), e.jump(Opcode::JZ, name + "_end");
+    body(e);
+    e.load(I), e.push(1), e.op(Opcode::IADD), e.store(I), e.jump(Opcode::JMP, name);
+    e.label(name + "_end");
+}
+
+int main()
+{
+    {
+        Emitter e;
+        e.label("main");
+        e.push(100), e.op(Opcode::NEWARRAY), e.u8(T_INT), e.store(ARRAY);
+        countedLoop(e, "fill", [](Emitter &e)
+                    { e.load(ARRAY), e.load(I), e.load(I), e.op(Opcode::ASTORE); });
+        e.push(0), e.store(SUM);
+        countedLoop(e, "sum", [](Emitter &e)
+                    { e.load(SUM), e.load(ARRAY), e.load(I), e.op(Opcode::ALOAD), e.op(Opcode::IADD), e.store(SUM); });
+        e.load(SUM), e.push(4950), e.op(Opcode::ICMP_EQ), e.jump(Opcode::JZ, "wrong");
+        e.push(42), e.exit();
+        e.label("wrong");
+        e.push(1), e.exit();
+        writeFile("snapshot_loop.vm", binary(e, "main", 3));
+    }
+    {
+        Emitter e;
+        e.label("main");
+        e.push(1), e.op(Opcode::NEWARRAY), e.u8(T_INT), e.push(100000000);
+        std::string at = std::to_string(e.code.size()) + "\n";
+        e.op(Opcode::ALOAD), e.exit();
+        writeFile("snapshot_oob.vm", binary(e, "main", 1));
+        writeFile("snapshot_oob.pc", std::vector<uint8_t>(at.begin(), at.end()));
+    }
+    return 0;
+}
@@ -0,0 +1,174 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes programs for SPAWN, YIELD, JOIN and channels:
+ *   tasks_channel.vm  - a producer sends 1 .. 1000 and a 0 through a channel
+ *                       of capacity 4 to a consumer that sums them
+ *   tasks_join.vm     - JOIN of a finished and of a running task, and a
+ *                       SPAWN after a JOIN that gets the joined id back
+ *   tasks_deadlock.vm - main joins a task that waits on an empty channel
+ *   tasks_gc.vm       - a producer sends fresh arrays through an OBJECT
+ *                       channel; run with --gc-trigger-kb 1, collections
+ *                       happen while the arrays are held only by buffered
+ *                       channel slots and by the stack of a blocked task
+ * All but tasks_deadlock.vm exit with 42 when their checks pass and with the
+ * number of the failed check otherwise.
+ *
+ * Build: g++ -std=c++17 -I../src/include test_tasks_generator.cpp
+ */
+#include "program_builder.hpp"
+
+enum : uint32_t
+{
+    CHANNEL = 0,
+    FIRST = 1,
+    SECOND = 2,
+    THIRD = 3,
+    PRODUCED = 4, // producer's counter
+    RECEIVED = 5, // consumer's current array
+};
+
+static void check(Emitter &e, int number)
+{
+    std::string passed = "check_" + std::to_string(number);
+    e.jump(Opcode::JNZ, passed);
+    e.push(number), e.exit();
+    e.label(passed);
+}
+
+static void write(const char *path, Emitter &e)
+{
+    writeFile(path, binary(e, "main", 8));
+}
+
+static void channel()
+{
+    Emitter e;
+    e.label("main");
+    e.push(4), e.op(Opcode::CHANNEW), e.u8(T_INT), e.store(CHANNEL);
+    // The consumer starts first and waits on the empty channel
+    e.load(CHANNEL), e.spawn("consumer", 1), e.store(FIRST);
+    e.load(CHANNEL), e.spawn("producer", 1), e.store(SECOND);
+    e.load(FIRST), e.op(Opcode::JOIN), e.push(500500), e.op(Opcode::ICMP_EQ), check(e, 1);
+    e.load(SECOND), e.op(Opcode::JOIN), e.push(7), e.op(Opcode::ICMP_EQ), check(e, 2);
+    e.push(42), e.exit();
+
+    // producer(channel): sends 1000 .. 1, then 0; returns 7
+    e.label("producer");
+    e.push(1000), e.store(PRODUCED);
+    e.label("produce");
+    e.load(PRODUCED), e.jump(Opcode::JZ, "produced");
+    e.loadArg(0), e.load(PRODUCED), e.op(Opcode::SEND);
+    e.load(PRODUCED), e.push(1), e.op(Opcode::ISUB), e.store(PRODUCED);
+    e.jump(Opcode::JMP, "produce");
+    e.label("produced");
+    e.loadArg(0), e.push(0), e.op(Opcode::SEND);
+    e.push(7), e.op(Opcode::RET);
+
+    // consumer(channel): sum of what it receives before a 0
+    e.label("consumer");
+    e.push(0);
+    e.label("consume");
+    e.loadArg(0), e.op(Opcode::RECV), e.op(Opcode::DUP), e.jump(Opcode::JZ, "consumed");
+    e.op(Opcode::IADD), e.jump(Opcode::JMP, "consume");
+    e.label("consumed");
+    e.op(Opcode::POP), e.op(Opcode::RET);
+    write("tasks_channel.vm", e);
+}
+
+static void join()
+{
+    Emitter e;
+    e.label("main");
+    // Finished: quick has run to its end by the time main yields back
+    e.push(5), e.spawn("quick", 1), e.store(FIRST);
+    e.op(Opcode::YIELD), e.op(Opcode::YIELD);
+    e.load(FIRST), e.op(Opcode::JOIN), e.push(5), e.op(Opcode::ICMP_EQ), check(e, 1);
+    // Running: slow yields 100 times before it returns
+    e.push(6), e.spawn("slow", 1), e.store(SECOND);
+    e.load(SECOND), e.op(Opcode::JOIN), e.push(6), e.op(Opcode::ICMP_EQ), check(e, 2);
+    // Both ids are free again; the next SPAWN reuses one, with a fresh task
+    e.push(8), e.spawn("slow", 1), e.store(THIRD);
+    e.load(THIRD), e.load(FIRST), e.op(Opcode::ICMP_EQ), e.load(THIRD), e.load(SECOND), e.op(Opcode::ICMP_EQ);
+    e.op(Opcode::IADD), check(e, 3);
+    e.load(THIRD), e.op(Opcode::JOIN), e.push(8), e.op(Opcode::ICMP_EQ), check(e, 4);
+    e.push(42), e.exit();
+
+    e.label("quick");
+    e.loadArg(0), e.op(Opcode::RET);
+
+    e.label("slow");
+    e.push(100);
+    e.label("slow_loop");
+    e.op(Opcode::YIELD), e.push(1), e.op(Opcode::ISUB), e.op(Opcode::DUP), e.jump(Opcode::JNZ, "slow_loop");
+    e.op(Opcode::POP), e.loadArg(0), e.op(Opcode::RET);
+    write("tasks_join.vm", e);
+}
+
+static void deadlock()
+{
+    Emitter e;
+    e.label("main");
+    e.push(1), e.op(Opcode::CHANNEW), e.u8(T_INT), e.store(CHANNEL);
+    e.load(CHANNEL), e.spawn("waiter", 1), e.op(Opcode::JOIN);
+    e.push(0), e.exit();
+
+    e.label("waiter");
+    e.loadArg(0), e.op(Opcode::RECV), e.op(Opcode::RET);
+    write("tasks_deadlock.vm", e);
+}
+
+static void collection()
+{
+    const int32_t count = 20000;
+    Emitter e;
+    e.label("main");
+    // Created first, so no array gets reference 0, which ends the stream
+    e.push(8), e.op(Opcode::CHANNEW), e.u8(T_OBJECT), e.store(CHANNEL);
+    e.load(CHANNEL), e.spawn("consumer", 1), e.store(FIRST);
+    e.load(CHANNEL), e.spawn("producer", 1), e.store(SECOND);
+    e.load(FIRST), e.op(Opcode::JOIN), e.push(count * (count + 1)), e.op(Opcode::ICMP_EQ), check(e, 1);
+    e.load(SECOND), e.op(Opcode::JOIN), e.op(Opcode::POP);
+    e.push(42), e.exit();
+
+    // producer(channel): sends arrays of 64 INTs with k in the first and
+    // last element, for k = count .. 1, then 0. A SEND that waits keeps its
+    // array on this task's stack only.
+    e.label("producer");
+    e.push(count), e.store(PRODUCED);
+    e.label("produce");
+    e.load(PRODUCED), e.jump(Opcode::JZ, "produced");
+    e.loadArg(0), e.push(64), e.op(Opcode::NEWARRAY), e.u8(T_INT);
+    e.op(Opcode::DUP), e.push(0), e.load(PRODUCED), e.op(Opcode::ASTORE);
+    e.op(Opcode::DUP), e.push(63), e.load(PRODUCED), e.op(Opcode::ASTORE);
+    e.op(Opcode::SEND);
+    e.load(PRODUCED), e.push(1), e.op(Opcode::ISUB), e.store(PRODUCED);
+    e.jump(Opcode::JMP, "produce");
+    e.label("produced");
+    e.loadArg(0), e.push(0), e.op(Opcode::SEND);
+    e.push(0), e.op(Opcode::RET);
+
+    // consumer(channel): sum of the first and last elements it receives
+    e.label("consumer");
+    e.push(0);
+    e.label("consume");
+    e.loadArg(0), e.op(Opcode::RECV), e.op(Opcode::DUP), e.jump(Opcode::JZ, "consumed");
+    e.store(RECEIVED);
+    // Garbage, so that collector slices run while the producer is parked
+    e.push(64), e.op(Opcode::NEWARRAY), e.u8(T_INT), e.op(Opcode::POP);
+    e.load(RECEIVED), e.push(0), e.op(Opcode::ALOAD), e.op(Opcode::IADD);
+    e.load(RECEIVED), e.push(63), e.op(Opcode::ALOAD), e.op(Opcode::IADD);
+    e.jump(Opcode::JMP, "consume");
+    e.label("consumed");
+    e.op(Opcode::POP), e.op(Opcode::RET);
+    write("tasks_gc.vm", e);
+}
+
+int main()
+{
+    channel();
+    join();
+    deadlock();
+    collection();
+    return 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * Author: Shivadharshan S
+ *
+ * Writes programs that try to reach an unchecked ALOAD with an index far
+ * outside its array. Each must be refused with an error instead of reading
+ * out of bounds:
+ *   verify_skip_byte.vm     - jumps over a byte that does not decode to an
+ *                             ALOAD_UNCHECKED written in the file
+ *   verify_operand_jump.vm  - jumps into the operand of PUSH 0x000A60F0,
+ *                             whose bytes are ALOAD_UNCHECKED, SYS_CALL EXIT
+ *   verify_forged_return.vm - a method replaces its return address with the
+ *                             offset of that operand and returns
+ *
+ * Build: g++ -std=c++17 -I../src/include test_verify_generator.cpp
+ */
+#include "program_builder.hpp"
+
+static const int32_t FAR_INDEX = 100000000;
+
+// Pushes the hidden code and drops it again; returns the offset of the
+// hidden ALOAD_UNCHECKED
+static uint16_t hiddenCode(Emitter &e)
+{
+    uint16_t at = static_cast<uint16_t>(e.code.size() + 1);
+    e.push(0x000A60F0), e.op(Opcode::POP);
+    return at;
+}
+
+int main()
+{
+    {
+        Emitter e;
+        e.label("main");
+        e.jump(Opcode::JMP, "after");
+        e.u8(0xFF);
+        e.label("after");
+        e.push(1), e.op(Opcode::NEWARRAY), e.u8(T_INT), e.push(FAR_INDEX);
+        e.op(Opcode::ALOAD_UNCHECKED), e.exit();
+        writeFile("verify_skip_byte.vm", binary(e, "main", 1));
+    }
+    {
+        Emitter e;
+        e.label("main");
+        e.push(1), e.op(Opcode::NEWARRAY), e.u8(T_INT), e.push(FAR_INDEX);
+        uint16_t hidden = hiddenCode(e);
+        e.op(Opcode::JMP), e.u16(hidden);
+        writeFile("verify_operand_jump.vm", binary(e, "main", 1));
+    }
+    {
+        Emitter e;
+        e.label("main");
+        e.push(1), e.op(Opcode::NEWARRAY), e.u8(T_INT);
+        uint16_t hidden = hiddenCode(e);
+        e.call("forge", 0);
+        e.push(0), e.exit();
+
+        // Drops the saved fp and return address, puts its own in their
+        // place and returns the index
+        e.label("forge");
+        e.op(Opcode::POP), e.op(Opcode::POP);
+        e.push(hidden), e.push(0), e.push(FAR_INDEX), e.op(Opcode::RET);
+        writeFile("verify_forged_return.vm", binary(e, "main", 1));
+    }
+    return 0;
+}